@@ -25,10 +25,14 @@ int blockConstruct_constructP(const void *o1, const void *o2) {
 
 Block *block_construct(int64_t length, Flower *flower) {
     assert(flower != NULL);
+    return block_construct3(cactusDisk_getUniqueIDInterval(flower_getCactusDisk(flower), 3), length, flower);
+}
 
-    Name name = cactusDisk_getUniqueIDInterval(flower_getCactusDisk(flower), 3);
+Block *block_construct3(Name name, int64_t length, Flower *flower) {
+    assert(flower != NULL);
+    assert(name != NULL_NAME);
 
-	Block *block = st_calloc(1, 6*sizeof(Block) + sizeof(BlockEndContents));
+	Block *block = slabArena_calloc(flower_getSlabArena(flower), 6*sizeof(Block) + sizeof(BlockEndContents));
     // Bits: (0) orientation / (1) part_of_block / (2) is_block / (3) left / (4) is_attached / (5) side
     (block+0)->bits = 0x2B; // binary: 101011
     (block+1)->bits = 0xA; // binary: 001010
@@ -27,6 +27,12 @@ struct _block_instanceIterator {
  */
 Block *block_construct2(Name name, int64_t length, End *leftEnd, End *rightEnd, Flower *flower);
 
+/*
+ * Constructs the block and its two ends using the given name, which is the name of the 5 end,
+ * the block is name+1 and the 3 end is name+2.
+ */
+Block *block_construct3(Name name, int64_t length, Flower *flower);
+
 /*
  * Destructs the block and all segments it contains.
  */
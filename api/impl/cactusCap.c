@@ -123,7 +123,7 @@ static Cap *cap_construct5(Name instance, Event *event, End *end, bool setFlower
     assert(!end_partOfBlock(end));
 
     // Create the combined forward and reverse caps
-    Cap *cap = st_calloc(1, 2*sizeof(Cap) + sizeof(CapContents));
+    Cap *cap = slabArena_calloc(flower_getSlabArena(end_getFlower(end)), 2*sizeof(Cap) + sizeof(CapContents));
 
     // see above comment to decode what is set
     // Bits: strand / forward / part_of_segment / is_segment / left / event_not_sequence
@@ -264,7 +264,7 @@ void cap_destruct(Cap *cap) {
 
     // Free only if not part of a segment
     if(!cap_partOfSegment(cap)) {
-        free(cap_forward(cap) ? cap : cap_getReverse(cap));
+        slabArena_free(cap_forward(cap) ? cap : cap_getReverse(cap), 2*sizeof(Cap) + sizeof(CapContents));
     }
 }
 
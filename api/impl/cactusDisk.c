@@ -9,6 +9,8 @@
 #include <unistd.h>
 #include <math.h>
 #include <time.h>
+#include <fcntl.h>
+#include <sys/mman.h>
 
 // OpenMP
 #if defined(_OPENMP)
@@ -16,48 +18,252 @@
 #endif
 
 /*
- * Functions on meta sequences.
+ * Sharding of the flower and sequence maps.
  */
 
-void cactusDisk_addSequence(CactusDisk *cactusDisk, Sequence *sequence) {
+static CactusDiskShard *cactusDisk_getShard(CactusDisk *cactusDisk, Name name) {
+    // Names are issued in contiguous blocks, so mix the bits (Fibonacci hashing) to spread neighbouring names over the shards
+    uint64_t i = ((uint64_t)name * 0x9E3779B97F4A7C15ULL) >> 58;
+    assert(i < CACTUS_DISK_SHARD_NUMBER);
+    return &(cactusDisk->shards[i]);
+}
+
+static void cactusDisk_lockShard(CactusDiskShard *shard) {
 #if defined(_OPENMP)
-    omp_set_lock(&(cactusDisk->writelock));
+    omp_set_lock(&(shard->lock));
 #endif
-    assert(stSortedSet_search(cactusDisk->sequences, sequence) == NULL);
-    stSortedSet_insert(cactusDisk->sequences, sequence);
+}
+
+static void cactusDisk_unlockShard(CactusDiskShard *shard) {
 #if defined(_OPENMP)
-    omp_unset_lock(&(cactusDisk->writelock));
+    omp_unset_lock(&(shard->lock));
 #endif
 }
 
+static int cactusDisk_constructFlowersP(const void *o1, const void *o2) {
+    return cactusMisc_nameCompare(flower_getName((Flower *) o1), flower_getName((Flower *) o2));
+}
+
+static int cactusDisk_constructSequencesP(const void *o1, const void *o2) {
+    return cactusMisc_nameCompare(sequence_getName((Sequence *) o1), sequence_getName((Sequence *) o2));
+}
+
+static int cactusDisk_nameCmpP(const void *o1, const void *o2) {
+    return cactusMisc_nameCompare((Name) o1, (Name) o2); // Cheeky pointer to 64bit int conversion
+}
+
+/*
+ * Gets the objects in the given map of each shard, sorted with the given function.
+ */
+static stList *cactusDisk_getAll(CactusDisk *cactusDisk, bool flowers, int (*cmpFn)(const void *, const void *)) {
+    stList *objects = stList_construct();
+    for (int64_t i = 0; i < CACTUS_DISK_SHARD_NUMBER; i++) {
+        CactusDiskShard *shard = &(cactusDisk->shards[i]);
+        cactusDisk_lockShard(shard);
+        stList *values = stHash_getValues(flowers ? shard->flowers : shard->sequences);
+        cactusDisk_unlockShard(shard);
+        stList_appendAll(objects, values);
+        stList_destruct(values);
+    }
+    stList_sort(objects, cmpFn);
+    return objects;
+}
+
+/*
+ * Functions on meta sequences.
+ */
+
+void cactusDisk_addSequence(CactusDisk *cactusDisk, Sequence *sequence) {
+    CactusDiskShard *shard = cactusDisk_getShard(cactusDisk, sequence_getName(sequence));
+    cactusDisk_lockShard(shard);
+    assert(stHash_search(shard->sequences, (void *)sequence_getName(sequence)) == NULL);
+    stHash_insert(shard->sequences, (void *)sequence_getName(sequence), sequence); // Cheeky 64bit to pointer conversion
+    cactusDisk_unlockShard(shard);
+}
+
 void cactusDisk_removeSequence(CactusDisk *cactusDisk, Sequence *sequence) {
+    CactusDiskShard *shard = cactusDisk_getShard(cactusDisk, sequence_getName(sequence));
+    cactusDisk_lockShard(shard);
+    assert(stHash_search(shard->sequences, (void *)sequence_getName(sequence)) != NULL);
+    stHash_remove(shard->sequences, (void *)sequence_getName(sequence));
+    cactusDisk_unlockShard(shard);
+}
+
+stList *cactusDisk_getSequences(CactusDisk *cactusDisk) {
+    return cactusDisk_getAll(cactusDisk, 0, cactusDisk_constructSequencesP);
+}
+
+/*
+ * Functions for strings
+ */
+
+static CactusDiskStringTable *stringTable_construct(int64_t size, CactusDiskStringTable *previous) {
+    CactusDiskStringTable *table = st_malloc(sizeof(CactusDiskStringTable));
+    table->size = size;
+    table->entryNumber = 0;
+    table->names = st_malloc(size * sizeof(Name));
+    for (int64_t i = 0; i < size; i++) {
+        table->names[i] = NULL_NAME;
+    }
+    table->strings = st_calloc(size, sizeof(PackedString *));
+    table->previous = previous;
+    return table;
+}
+
+static void stringTable_destruct(CactusDiskStringTable *table) {
+    // The strings are shared with the previous tables, so are only freed from the current table
+    for (int64_t i = 0; i < table->size; i++) {
+        if (table->names[i] != NULL_NAME) {
+            packedString_destruct(table->strings[i]);
+        }
+    }
+    while (table != NULL) {
+        CactusDiskStringTable *previous = table->previous;
+        free(table->names);
+        free(table->strings);
+        free(table);
+        table = previous;
+    }
+}
+
+static int64_t stringTable_getSlot(CactusDiskStringTable *table, Name name) {
+    return (((uint64_t)name * 0x9E3779B97F4A7C15ULL) >> 17) & (table->size - 1);
+}
+
+/*
+ * Adds an entry to the table, must be called holding the write lock and with space in the table.
+ */
+static void stringTable_insert(CactusDiskStringTable *table, Name name, PackedString *string) {
+    assert(name != NULL_NAME);
+    assert(2 * (table->entryNumber + 1) <= table->size);
+    int64_t i = stringTable_getSlot(table, name);
+    while (table->names[i] != NULL_NAME) {
+        if (table->names[i] == name) {
+            st_errAbort("Attempt to add a string with the name %" PRIi64 " twice to the cactus disk", name);
+        }
+        i = (i + 1) & (table->size - 1);
+    }
+    // The string must be visible before the name, which publishes the entry to readers
+    table->strings[i] = string;
+    __atomic_store_n(&(table->names[i]), name, __ATOMIC_RELEASE);
+    table->entryNumber++;
+}
+
+void cactusDisk_addStringWithName(CactusDisk *cactusDisk, Name name, PackedString *string) {
 #if defined(_OPENMP)
     omp_set_lock(&(cactusDisk->writelock));
 #endif
-    assert(stSortedSet_search(cactusDisk->sequences, sequence) != NULL);
-    stSortedSet_remove(cactusDisk->sequences, sequence);
+    CactusDiskStringTable *table = cactusDisk->strings;
+    if (2 * (table->entryNumber + 1) > table->size) {
+        // Copy the table to one twice the size, then publish it. Readers holding the old table can
+        // still use it, as entries are never removed.
+        CactusDiskStringTable *table2 = stringTable_construct(2 * table->size, table);
+        for (int64_t i = 0; i < table->size; i++) {
+            if (table->names[i] != NULL_NAME) {
+                stringTable_insert(table2, table->names[i], table->strings[i]);
+            }
+        }
+        __atomic_store_n(&(cactusDisk->strings), table2, __ATOMIC_RELEASE);
+        table = table2;
+    }
+    stringTable_insert(table, name, string);
 #if defined(_OPENMP)
     omp_unset_lock(&(cactusDisk->writelock));
 #endif
 }
 
-/*
- * Functions for strings
- */
-
 Name cactusDisk_addString(CactusDisk *cactusDisk, const char *string) {
     /*
      * Adds a string to the database.
      */
+    return cactusDisk_addPackedString(cactusDisk, packedString_construct(string));
+}
+
+Name cactusDisk_addPackedString(CactusDisk *cactusDisk, PackedString *packedString) {
     Name name = cactusDisk_getUniqueID(cactusDisk);
+    cactusDisk_addStringWithName(cactusDisk, name, packedString);
+    return name;
+}
+
+Name cactusDisk_addMappedString(CactusDisk *cactusDisk, const char *bases, int64_t length, int64_t lineBases,
+                                int64_t lineBytes) {
+    return cactusDisk_addPackedString(cactusDisk, packedString_constructMapped(bases, length, lineBases, lineBytes));
+}
+
+/*
+ * A file mapped into memory.
+ */
+typedef struct _cactusDiskMappedFile {
+    void *mapping;
+    size_t length;
+} CactusDiskMappedFile;
+
+static void cactusDiskMappedFile_destruct(CactusDiskMappedFile *mappedFile) {
+    munmap(mappedFile->mapping, mappedFile->length);
+    free(mappedFile);
+}
+
+const char *cactusDisk_mapFile(CactusDisk *cactusDisk, const char *fileName, int64_t *fileLength) {
+    int fd = open(fileName, O_RDONLY);
+    if (fd == -1) {
+        st_errAbort("Could not open the file %s to map it", fileName);
+    }
+    struct stat fileStat;
+    if (fstat(fd, &fileStat) != 0) {
+        st_errAbort("Could not stat the file %s to map it", fileName);
+    }
+    *fileLength = fileStat.st_size;
+    if (fileStat.st_size == 0) {
+        close(fd);
+        return NULL;
+    }
+    void *mapping = mmap(NULL, fileStat.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd); // The mapping keeps the file open
+    if (mapping == MAP_FAILED) {
+        st_errAbort("Could not map the file %s", fileName);
+    }
+    CactusDiskMappedFile *mappedFile = st_malloc(sizeof(CactusDiskMappedFile));
+    mappedFile->mapping = mapping;
+    mappedFile->length = fileStat.st_size;
 #if defined(_OPENMP)
     omp_set_lock(&(cactusDisk->writelock));
 #endif
-    stHash_insert(cactusDisk->allStrings, (void *)name, stString_copy(string)); // Cheeky 64bit to pointer conversion
+    stList_append(cactusDisk->mappedFiles, mappedFile);
 #if defined(_OPENMP)
     omp_unset_lock(&(cactusDisk->writelock));
 #endif
-    return name;
+    return mapping;
+}
+
+PackedString *cactusDisk_getPackedString(CactusDisk *cactusDisk, Name name) {
+    CactusDiskStringTable *table = __atomic_load_n(&(cactusDisk->strings), __ATOMIC_ACQUIRE);
+    int64_t i = stringTable_getSlot(table, name);
+    Name name2;
+    while ((name2 = __atomic_load_n(&(table->names[i]), __ATOMIC_ACQUIRE)) != NULL_NAME) {
+        if (name2 == name) {
+            return table->strings[i];
+        }
+        i = (i + 1) & (table->size - 1);
+    }
+    return NULL;
+}
+
+stList *cactusDisk_getStringNames(CactusDisk *cactusDisk) {
+#if defined(_OPENMP)
+    omp_set_lock(&(cactusDisk->writelock));
+#endif
+    CactusDiskStringTable *table = cactusDisk->strings;
+    stList *names = stList_construct();
+    for (int64_t i = 0; i < table->size; i++) {
+        if (table->names[i] != NULL_NAME) {
+            stList_append(names, (void *)table->names[i]); // Cheeky 64bit to pointer conversion
+        }
+    }
+#if defined(_OPENMP)
+    omp_unset_lock(&(cactusDisk->writelock));
+#endif
+    stList_sort(names, cactusDisk_nameCmpP);
+    return names;
 }
 
 char *cactusDisk_getString(CactusDisk *cactusDisk, Name name, int64_t start, int64_t length, int64_t strand,
@@ -71,22 +277,15 @@ char *cactusDisk_getString(CactusDisk *cactusDisk, Name name, int64_t start, int
         return stString_copy("");
     }
 
-#if defined(_OPENMP)
-    omp_set_lock(&(cactusDisk->writelock));
-#endif
-    char *string = stHash_search(cactusDisk->allStrings, (void *)name); // Cheeky 64bit int to pointer conversion
-#if defined(_OPENMP)
-    omp_unset_lock(&(cactusDisk->writelock));
-#endif
-
+    PackedString *string = cactusDisk_getPackedString(cactusDisk, name);
     assert(string != NULL);
-    string = stString_getSubString(string, start, length);
+    char *subString = packedString_getSubString(string, start, length);
     if(!strand) {
-        char *reverseComplement = stString_reverseComplementString(string);
-        free(string);
+        char *reverseComplement = stString_reverseComplementString(subString);
+        free(subString);
         return reverseComplement;
     }
-    return string;
+    return subString;
 }
 
 ////////////////////////////////////////////////
@@ -97,25 +296,26 @@ char *cactusDisk_getString(CactusDisk *cactusDisk, Name name, int64_t start, int
 ////////////////////////////////////////////////
 ////////////////////////////////////////////////
 
-static int cactusDisk_constructFlowersP(const void *o1, const void *o2) {
-    return cactusMisc_nameCompare(flower_getName((Flower *) o1), flower_getName((Flower *) o2));
-}
-
-static int cactusDisk_constructSequencesP(const void *o1, const void *o2) {
-    return cactusMisc_nameCompare(sequence_getName((Sequence *) o1), sequence_getName((Sequence *) o2));
-}
-
 /*
- * The following two functions compress and decompress the data in the cactus disk..
+ * Each disk gets a serial number, so that blocks of names taken by a thread for one disk are
+ * never used for another disk allocated at the same address.
  */
+static int64_t cactusDisk_serialCounter = 0;
 
 CactusDisk *cactusDisk_construct() {
     CactusDisk *cactusDisk = st_calloc(1, sizeof(CactusDisk));
-    cactusDisk->sequences = stSortedSet_construct3(cactusDisk_constructSequencesP, NULL);
-    cactusDisk->flowers = stSortedSet_construct3(cactusDisk_constructFlowersP, NULL);
+    for (int64_t i = 0; i < CACTUS_DISK_SHARD_NUMBER; i++) {
+        cactusDisk->shards[i].sequences = stHash_construct();
+        cactusDisk->shards[i].flowers = stHash_construct();
+#if defined(_OPENMP)
+        omp_init_lock(&(cactusDisk->shards[i].lock));
+#endif
+    }
     cactusDisk->eventTree = NULL;
-    cactusDisk->allStrings = stHash_construct2(NULL, free);
+    cactusDisk->strings = stringTable_construct(1024, NULL);
+    cactusDisk->mappedFiles = stList_construct3(0, (void (*)(void *))cactusDiskMappedFile_destruct);
     cactusDisk->currentName = 1; // Start the naming of objects from 1
+    cactusDisk->serial = __atomic_add_fetch(&cactusDisk_serialCounter, 1, __ATOMIC_RELAXED);
 #if defined(_OPENMP)
         omp_init_lock(&(cactusDisk->writelock));
 #endif
@@ -123,18 +323,29 @@ CactusDisk *cactusDisk_construct() {
 }
 
 void cactusDisk_destruct(CactusDisk *cactusDisk) {
-    Flower *flower;
-    while ((flower = stSortedSet_getFirst(cactusDisk->flowers)) != NULL) {
-        flower_destruct(flower, FALSE, FALSE);
+    stList *flowers = cactusDisk_getFlowers(cactusDisk);
+    for (int64_t i = 0; i < stList_length(flowers); i++) {
+        flower_destruct(stList_get(flowers, i), FALSE, FALSE);
+    }
+    stList_destruct(flowers);
+
+    stList *sequences = cactusDisk_getSequences(cactusDisk);
+    for (int64_t i = 0; i < stList_length(sequences); i++) {
+        sequence_destruct(stList_get(sequences, i));
     }
-    stSortedSet_destruct(cactusDisk->flowers);
+    stList_destruct(sequences);
 
-    Sequence *sequence;
-    while ((sequence = stSortedSet_getFirst(cactusDisk->sequences)) != NULL) {
-        sequence_destruct(sequence);
+    for (int64_t i = 0; i < CACTUS_DISK_SHARD_NUMBER; i++) {
+        assert(stHash_size(cactusDisk->shards[i].flowers) == 0);
+        assert(stHash_size(cactusDisk->shards[i].sequences) == 0);
+        stHash_destruct(cactusDisk->shards[i].flowers);
+        stHash_destruct(cactusDisk->shards[i].sequences);
+#if defined(_OPENMP)
+        omp_destroy_lock(&(cactusDisk->shards[i].lock));
+#endif
     }
-    stSortedSet_destruct(cactusDisk->sequences);
-    stHash_destruct(cactusDisk->allStrings); // cleanup the library of strings we hold in memory
+    stringTable_destruct(cactusDisk->strings); // cleanup the library of strings we hold in memory
+    stList_destruct(cactusDisk->mappedFiles); // after the strings, which may refer to the mappings
 
     if(cactusDisk->eventTree != NULL) {
         eventTree_destruct(cactusDisk->eventTree);
@@ -148,29 +359,19 @@ void cactusDisk_destruct(CactusDisk *cactusDisk) {
 }
 
 Flower *cactusDisk_getFlower(CactusDisk *cactusDisk, Name flowerName) {
-    Flower flower;
-    flower.name = flowerName;
-#if defined(_OPENMP)
-        omp_set_lock(&(cactusDisk->writelock));
-#endif
-        Flower *flower2 = stSortedSet_search(cactusDisk->flowers, &flower);
-#if defined(_OPENMP)
-        omp_unset_lock(&(cactusDisk->writelock));
-#endif
-    return flower2;
+    CactusDiskShard *shard = cactusDisk_getShard(cactusDisk, flowerName);
+    cactusDisk_lockShard(shard);
+    Flower *flower = stHash_search(shard->flowers, (void *)flowerName); // Cheeky 64bit to pointer conversion
+    cactusDisk_unlockShard(shard);
+    return flower;
 }
 
 Sequence *cactusDisk_getSequence(CactusDisk *cactusDisk, Name sequenceName) {
-    Sequence sequence;
-    sequence.name = sequenceName;
-#if defined(_OPENMP)
-    omp_set_lock(&(cactusDisk->writelock));
-#endif
-    Sequence *sequence2 = stSortedSet_search(cactusDisk->sequences, &sequence);
-#if defined(_OPENMP)
-    omp_unset_lock(&(cactusDisk->writelock));
-#endif
-    return sequence2;
+    CactusDiskShard *shard = cactusDisk_getShard(cactusDisk, sequenceName);
+    cactusDisk_lockShard(shard);
+    Sequence *sequence = stHash_search(shard->sequences, (void *)sequenceName); // Cheeky 64bit to pointer conversion
+    cactusDisk_unlockShard(shard);
+    return sequence;
 }
 
 /*
@@ -178,25 +379,23 @@ Sequence *cactusDisk_getSequence(CactusDisk *cactusDisk, Name sequenceName) {
  */
 
 void cactusDisk_addFlower(CactusDisk *cactusDisk, Flower *flower) {
-#if defined(_OPENMP)
-        omp_set_lock(&(cactusDisk->writelock));
-#endif
-        assert(stSortedSet_search(cactusDisk->flowers, flower) == NULL);
-        stSortedSet_insert(cactusDisk->flowers, flower);
-#if defined(_OPENMP)
-        omp_unset_lock(&(cactusDisk->writelock));
-#endif
+    CactusDiskShard *shard = cactusDisk_getShard(cactusDisk, flower_getName(flower));
+    cactusDisk_lockShard(shard);
+    assert(stHash_search(shard->flowers, (void *)flower_getName(flower)) == NULL);
+    stHash_insert(shard->flowers, (void *)flower_getName(flower), flower); // Cheeky 64bit to pointer conversion
+    cactusDisk_unlockShard(shard);
 }
 
 void cactusDisk_removeFlower(CactusDisk *cactusDisk, Flower *flower) {
-#if defined(_OPENMP)
-        omp_set_lock(&(cactusDisk->writelock));
-#endif
-        assert(stSortedSet_search(cactusDisk->flowers, flower) != NULL);
-        stSortedSet_remove(cactusDisk->flowers, flower);
-#if defined(_OPENMP)
-        omp_unset_lock(&(cactusDisk->writelock));
-#endif
+    CactusDiskShard *shard = cactusDisk_getShard(cactusDisk, flower_getName(flower));
+    cactusDisk_lockShard(shard);
+    assert(stHash_search(shard->flowers, (void *)flower_getName(flower)) != NULL);
+    stHash_remove(shard->flowers, (void *)flower_getName(flower));
+    cactusDisk_unlockShard(shard);
+}
+
+stList *cactusDisk_getFlowers(CactusDisk *cactusDisk) {
+    return cactusDisk_getAll(cactusDisk, 1, cactusDisk_constructFlowersP);
 }
 
 void cactusDisk_setEventTree(CactusDisk *cactusDisk, EventTree *eventTree) {
@@ -208,18 +407,36 @@ void cactusDisk_setEventTree(CactusDisk *cactusDisk, EventTree *eventTree) {
  */
 
 int64_t cactusDisk_getUniqueIDInterval(CactusDisk *cactusDisk, int64_t intervalSize) {
+    return __atomic_fetch_add(&(cactusDisk->currentName), intervalSize, __ATOMIC_RELAXED);
+}
+
+/*
+ * The block of names each thread takes names from within parallel regions, to avoid every
+ * thread contending on the counter of the disk.
+ */
+typedef struct _nameBlock {
+    int64_t serial; // The serial number of the disk the block belongs to
+    Name next;
+    Name end;
+} NameBlock;
+
+static NameBlock nameBlock = { 0, 0, 0 };
 #if defined(_OPENMP)
-    omp_set_lock(&(cactusDisk->writelock));
-#endif
-    Name n = cactusDisk->currentName;
-    cactusDisk->currentName += intervalSize;
-#if defined(_OPENMP)
-    omp_unset_lock(&(cactusDisk->writelock));
+#pragma omp threadprivate(nameBlock)
 #endif
-    return n;
-}
 
 int64_t cactusDisk_getUniqueID(CactusDisk *cactusDisk) {
+#if defined(_OPENMP)
+    if (omp_in_parallel()) {
+        if (nameBlock.serial != cactusDisk->serial || nameBlock.next == nameBlock.end) {
+            nameBlock.serial = cactusDisk->serial;
+            nameBlock.next = cactusDisk_getUniqueIDInterval(cactusDisk, CACTUS_DISK_NAME_BLOCK_SIZE);
+            nameBlock.end = nameBlock.next + CACTUS_DISK_NAME_BLOCK_SIZE;
+        }
+        return nameBlock.next++;
+    }
+#endif
+    // Outside of parallel regions names are issued in order, as they always have been
     return cactusDisk_getUniqueIDInterval(cactusDisk, 1);
 }
 
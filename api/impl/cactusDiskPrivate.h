@@ -12,15 +12,50 @@
 #include <omp.h>
 #endif
 
+/*
+ * The number of shards the flower and sequence maps are split into. Each shard has its own lock, so
+ * that threads looking up different flowers or sequences rarely contend.
+ */
+#define CACTUS_DISK_SHARD_NUMBER 64
+
+/*
+ * The number of names a thread takes at a time when calling cactusDisk_getUniqueID within a parallel region.
+ */
+#define CACTUS_DISK_NAME_BLOCK_SIZE 1024
+
+typedef struct _cactusDiskShard {
+    stHash *sequences; // Map of sequence names to sequences
+    stHash *flowers; // Map of flower names to flowers
+#if defined(_OPENMP)
+    omp_lock_t lock; // Gates access to the maps of the shard
+#endif
+} CactusDiskShard;
+
+/*
+ * An open addressing table of the strings, which are held packed, which is only ever added to. Lookups are lock free: entries are
+ * published by atomically setting their name after their string, and when the table grows the larger copy
+ * is published atomically, the old table being kept (it may still be read) until the disk is destructed.
+ */
+typedef struct _cactusDiskStringTable CactusDiskStringTable;
+
+struct _cactusDiskStringTable {
+    int64_t size; // A power of two
+    int64_t entryNumber;
+    Name *names; // NULL_NAME for empty slots
+    PackedString **strings;
+    CactusDiskStringTable *previous; // The table this table replaced, or NULL
+};
+
 struct _cactusDisk {
-    stSortedSet *sequences;
-    stSortedSet *flowers;
+    CactusDiskShard shards[CACTUS_DISK_SHARD_NUMBER];
     EventTree *eventTree;
 #if defined(_OPENMP)
-    omp_lock_t writelock; // This lock used to gate access to concurrently accessed variables
+    omp_lock_t writelock; // This lock used to gate additions to the string table
 #endif
-    stHash *allStrings; // If the strings are being all stored in memory, a map of names to strings
-    Name currentName; // Used as a counter for issuing names
+    CactusDiskStringTable *strings; // The strings, a map of names to strings
+    stList *mappedFiles; // Files mapped with cactusDisk_mapFile, unmapped when the disk is destructed
+    Name currentName; // Used as a counter for issuing names, updated atomically
+    int64_t serial; // Identifies the disk to the per-thread blocks of names
 };
 
 ////////////////////////////////////////////////
@@ -41,6 +76,11 @@ void cactusDisk_addFlower(CactusDisk *cactusDisk, Flower *flower);
  */
 void cactusDisk_removeFlower(CactusDisk *cactusDisk, Flower *flower);
 
+/*
+ * Gets a list of the flowers in the cactusDisk, sorted by name.
+ */
+stList *cactusDisk_getFlowers(CactusDisk *cactusDisk);
+
 /*
  * Functions on meta sequences.
  */
@@ -57,6 +97,11 @@ void cactusDisk_addSequence(CactusDisk *cactusDisk,
 void cactusDisk_removeSequence(CactusDisk *cactusDisk,
         Sequence *sequence);
 
+/*
+ * Gets a list of the sequences in the cactusDisk, sorted by name.
+ */
+stList *cactusDisk_getSequences(CactusDisk *cactusDisk);
+
 /*
  * Functions on strings stored by the cactus disk.
  */
@@ -72,6 +117,21 @@ Name cactusDisk_addString(CactusDisk *cactusDisk, const char *string);
 char *cactusDisk_getString(CactusDisk *cactusDisk, Name name,
         int64_t start, int64_t length, int64_t strand, int64_t totalSequenceLength);
 
+/*
+ * Adds a packed string to the database with the given name, taking ownership of the packed string.
+ */
+void cactusDisk_addStringWithName(CactusDisk *cactusDisk, Name name, PackedString *string);
+
+/*
+ * Gets a list of the names of the strings in the database, sorted by name.
+ */
+stList *cactusDisk_getStringNames(CactusDisk *cactusDisk);
+
+/*
+ * Gets the packed string with the given name, or NULL if it is not in the database. Lock free.
+ */
+PackedString *cactusDisk_getPackedString(CactusDisk *cactusDisk, Name name);
+
 /*
  * Set the event tree for this disk. (Hopefully this only happens once.)
  */
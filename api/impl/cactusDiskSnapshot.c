@@ -0,0 +1,466 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include "cactusGlobalsPrivate.h"
+
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+//Binary snapshots of a cactus disk.
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+
+/*
+ * The snapshot is a flat stream of little records, written in an order such
+ * that everything an object refers to is loaded before the object:
+ * strings, event tree, sequences, then the flowers. Within a flower the ends
+ * (with their caps) and blocks (with their segments) come first, then
+ * adjacencies, groups and chains. Objects are referred to by name.
+ */
+
+#define CACTUS_DISK_SNAPSHOT_MAGIC 0x4b53494443545343 // "CSTCDISK"
+#define CACTUS_DISK_SNAPSHOT_VERSION 1
+
+static void writeInt(FILE *fileHandle, int64_t i) {
+    if (fwrite(&i, sizeof(int64_t), 1, fileHandle) != 1) {
+        st_errAbort("Failed to write to cactus disk snapshot");
+    }
+}
+
+static int64_t readInt(FILE *fileHandle) {
+    int64_t i;
+    if (fread(&i, sizeof(int64_t), 1, fileHandle) != 1) {
+        st_errAbort("Unexpected end of cactus disk snapshot");
+    }
+    return i;
+}
+
+static void writeFloat(FILE *fileHandle, float f) {
+    if (fwrite(&f, sizeof(float), 1, fileHandle) != 1) {
+        st_errAbort("Failed to write to cactus disk snapshot");
+    }
+}
+
+static float readFloat(FILE *fileHandle) {
+    float f;
+    if (fread(&f, sizeof(float), 1, fileHandle) != 1) {
+        st_errAbort("Unexpected end of cactus disk snapshot");
+    }
+    return f;
+}
+
+static void writeString(FILE *fileHandle, const char *string) {
+    int64_t length = strlen(string);
+    writeInt(fileHandle, length);
+    if (length > 0 && fwrite(string, sizeof(char), length, fileHandle) != length) {
+        st_errAbort("Failed to write to cactus disk snapshot");
+    }
+}
+
+static char *readString(FILE *fileHandle) {
+    int64_t length = readInt(fileHandle);
+    char *string = st_malloc(sizeof(char) * (length + 1));
+    if (length > 0 && fread(string, sizeof(char), length, fileHandle) != length) {
+        st_errAbort("Unexpected end of cactus disk snapshot");
+    }
+    string[length] = '\0';
+    return string;
+}
+
+/*
+ * Writing
+ */
+
+static void writeEvents(FILE *fileHandle, Event *event) {
+    for (int64_t i = 0; i < event_getChildNumber(event); i++) {
+        Event *child = event_getChild(event, i);
+        writeInt(fileHandle, event_getName(child));
+        writeInt(fileHandle, event_getName(event));
+        writeString(fileHandle, event_getHeader(child));
+        writeFloat(fileHandle, event_getBranchLength(child));
+        writeInt(fileHandle, event_isOutgroup(child));
+        writeEvents(fileHandle, child);
+    }
+}
+
+static void writeEventTree(FILE *fileHandle, EventTree *eventTree) {
+    writeInt(fileHandle, eventTree != NULL);
+    if (eventTree != NULL) {
+        Event *rootEvent = eventTree_getRootEvent(eventTree);
+        writeInt(fileHandle, event_getName(rootEvent));
+        writeString(fileHandle, event_getHeader(rootEvent));
+        writeFloat(fileHandle, event_getBranchLength(rootEvent));
+        writeInt(fileHandle, event_isOutgroup(rootEvent));
+        writeInt(fileHandle, eventTree_getEventNumber(eventTree) - 1);
+        writeEvents(fileHandle, rootEvent);
+    }
+}
+
+static void writeSequence(FILE *fileHandle, Sequence *sequence) {
+    writeInt(fileHandle, sequence->name);
+    writeInt(fileHandle, sequence->stringName);
+    writeInt(fileHandle, sequence->start);
+    writeInt(fileHandle, sequence->length);
+    writeInt(fileHandle, sequence->event != NULL ? event_getName(sequence->event) : NULL_NAME);
+    writeString(fileHandle, sequence->header);
+    writeInt(fileHandle, sequence->isTrivialSequence);
+}
+
+/*
+ * Writes the name, coordinates and sequence (or event, if there is no sequence) of a cap.
+ */
+static void writeCap(FILE *fileHandle, Cap *cap) {
+    writeInt(fileHandle, cap_getName(cap));
+    writeInt(fileHandle, cap_getCoordinate(cap));
+    writeInt(fileHandle, cap_getStrand(cap));
+    Sequence *sequence = cap_getSequence(cap);
+    writeInt(fileHandle, sequence != NULL);
+    writeInt(fileHandle, sequence != NULL ? sequence_getName(sequence) : event_getName(cap_getEvent(cap)));
+}
+
+static void writeFlower(FILE *fileHandle, Flower *flower) {
+    assert(flower->caps2 == NULL && flower->ends2 == NULL);
+    writeInt(fileHandle, flower->name);
+    writeInt(fileHandle, flower->parentFlowerName);
+    writeInt(fileHandle, flower->builtBlocks);
+
+    // Sequences
+    writeInt(fileHandle, stList_length(flower->sequences));
+    for (int64_t i = 0; i < stList_length(flower->sequences); i++) {
+        writeInt(fileHandle, sequence_getName(stList_get(flower->sequences, i)));
+    }
+
+    // Ends, in name order, writing a block when we see its 5 end, so that construction
+    // appends ends in sorted order
+    writeInt(fileHandle, stList_length(flower->ends) - flower_getBlockNumber(flower));
+    for (int64_t i = 0; i < stList_length(flower->ends); i++) {
+        End *end = stList_get(flower->ends, i);
+        if (end_isBlockEnd(end)) {
+            if (end_left(end)) {
+                Block *block = end_getBlock(end);
+                writeInt(fileHandle, 1);
+                writeInt(fileHandle, end_getName(end));
+                writeInt(fileHandle, block_getLength(block));
+                writeInt(fileHandle, block_getInstanceNumber(block));
+                Block_InstanceIterator *segmentIt = block_getInstanceIterator(block);
+                Segment *segment;
+                while ((segment = block_getNext(segmentIt)) != NULL) {
+                    writeCap(fileHandle, segment_get5Cap(segment));
+                }
+                block_destructInstanceIterator(segmentIt);
+            }
+        } else {
+            writeInt(fileHandle, 0);
+            writeInt(fileHandle, end_getName(end));
+            writeInt(fileHandle, end_isAttached(end));
+            writeInt(fileHandle, end_getSide(end));
+            writeInt(fileHandle, end_getInstanceNumber(end));
+            End_InstanceIterator *capIt = end_getInstanceIterator(end);
+            Cap *cap;
+            while ((cap = end_getNext(capIt)) != NULL) {
+                writeCap(fileHandle, cap);
+            }
+            end_destructInstanceIterator(capIt);
+        }
+    }
+
+    // Adjacencies, each written once
+    int64_t adjacencyNumber = 0;
+    for (int64_t i = 0; i < stList_length(flower->caps); i++) {
+        Cap *cap = stList_get(flower->caps, i), *adjacentCap = cap_getAdjacency(cap);
+        if (adjacentCap != NULL && cap_getName(cap) < cap_getName(adjacentCap)) {
+            adjacencyNumber++;
+        }
+    }
+    writeInt(fileHandle, adjacencyNumber);
+    for (int64_t i = 0; i < stList_length(flower->caps); i++) {
+        Cap *cap = stList_get(flower->caps, i), *adjacentCap = cap_getAdjacency(cap);
+        if (adjacentCap != NULL && cap_getName(cap) < cap_getName(adjacentCap)) {
+            writeInt(fileHandle, cap_getName(cap));
+            writeInt(fileHandle, cap_getName(adjacentCap));
+        }
+    }
+
+    // Groups, with their ends in iteration order
+    writeInt(fileHandle, stList_length(flower->groups));
+    for (int64_t i = 0; i < stList_length(flower->groups); i++) {
+        Group *group = stList_get(flower->groups, i);
+        writeInt(fileHandle, group_getName(group));
+        writeInt(fileHandle, group_isLeaf(group));
+        writeInt(fileHandle, group_getEndNumber(group));
+        Group_EndIterator *endIt = group_getEndIterator(group);
+        End *end;
+        while ((end = group_getNextEnd(endIt)) != NULL) {
+            writeInt(fileHandle, end_getName(end));
+        }
+        group_destructEndIterator(endIt);
+    }
+
+    // Chains, with their links in order
+    writeInt(fileHandle, stList_length(flower->chains));
+    for (int64_t i = 0; i < stList_length(flower->chains); i++) {
+        Chain *chain = stList_get(flower->chains, i);
+        writeInt(fileHandle, chain_getName(chain));
+        int64_t linkNumber = 0;
+        for (Link *link = chain_getFirst(chain); link != NULL; link = link_getNextLink(link)) {
+            linkNumber++;
+        }
+        writeInt(fileHandle, linkNumber);
+        for (Link *link = chain_getFirst(chain); link != NULL; link = link_getNextLink(link)) {
+            writeInt(fileHandle, end_getName(link_get3End(link)));
+            writeInt(fileHandle, end_getName(link_get5End(link)));
+        }
+    }
+}
+
+void cactusDisk_write(CactusDisk *cactusDisk, FILE *fileHandle) {
+    writeInt(fileHandle, CACTUS_DISK_SNAPSHOT_MAGIC);
+    writeInt(fileHandle, CACTUS_DISK_SNAPSHOT_VERSION);
+    writeInt(fileHandle, cactusDisk->currentName);
+
+    // Strings
+    stList *stringNames = cactusDisk_getStringNames(cactusDisk);
+    writeInt(fileHandle, stList_length(stringNames));
+    for (int64_t i = 0; i < stList_length(stringNames); i++) {
+        Name name = (Name)stList_get(stringNames, i); // Cheeky pointer to 64bit int conversion
+        writeInt(fileHandle, name);
+        PackedString *packedString = cactusDisk_getPackedString(cactusDisk, name);
+        char *string = packedString_getSubString(packedString, 0, packedString_getLength(packedString));
+        writeString(fileHandle, string);
+        free(string);
+    }
+    stList_destruct(stringNames);
+
+    writeEventTree(fileHandle, cactusDisk->eventTree);
+
+    // Sequences
+    stList *sequences = cactusDisk_getSequences(cactusDisk);
+    writeInt(fileHandle, stList_length(sequences));
+    for (int64_t i = 0; i < stList_length(sequences); i++) {
+        writeSequence(fileHandle, stList_get(sequences, i));
+    }
+    stList_destruct(sequences);
+
+    // Flowers
+    stList *flowers = cactusDisk_getFlowers(cactusDisk);
+    writeInt(fileHandle, stList_length(flowers));
+    for (int64_t i = 0; i < stList_length(flowers); i++) {
+        writeFlower(fileHandle, stList_get(flowers, i));
+    }
+    stList_destruct(flowers);
+}
+
+/*
+ * Reading
+ */
+
+static void readEventTree(FILE *fileHandle, CactusDisk *cactusDisk) {
+    if (!readInt(fileHandle)) {
+        return;
+    }
+    Name rootName = readInt(fileHandle);
+    EventTree *eventTree = eventTree_construct(cactusDisk, rootName);
+    Event *rootEvent = eventTree_getRootEvent(eventTree);
+    free(rootEvent->header);
+    rootEvent->header = readString(fileHandle);
+    rootEvent->branchLength = readFloat(fileHandle);
+    rootEvent->isOutgroup = readInt(fileHandle);
+
+    // The events were written in pre-order, so parents always precede their children
+    int64_t eventNumber = readInt(fileHandle);
+    for (int64_t i = 0; i < eventNumber; i++) {
+        Name name = readInt(fileHandle);
+        Event *parentEvent = eventTree_getEvent(eventTree, readInt(fileHandle));
+        assert(parentEvent != NULL);
+        char *header = readString(fileHandle);
+        float branchLength = readFloat(fileHandle);
+        Event *event = event_construct(name, header, branchLength, parentEvent, eventTree);
+        event_setOutgroupStatus(event, readInt(fileHandle));
+        free(header);
+    }
+}
+
+static void readSequence(FILE *fileHandle, CactusDisk *cactusDisk) {
+    Name name = readInt(fileHandle);
+    Name stringName = readInt(fileHandle);
+    int64_t start = readInt(fileHandle);
+    int64_t length = readInt(fileHandle);
+    Name eventName = readInt(fileHandle);
+    Event *event = eventName == NULL_NAME ? NULL : eventTree_getEvent(cactusDisk->eventTree, eventName);
+    assert(eventName == NULL_NAME || event != NULL);
+    char *header = readString(fileHandle);
+    bool isTrivialSequence = readInt(fileHandle);
+    sequence_construct2(name, start, length, stringName, header, event, isTrivialSequence, cactusDisk);
+    free(header);
+}
+
+typedef struct _capRecord {
+    Name name;
+    int64_t coordinate;
+    bool strand;
+    bool hasSequence;
+    Name sequenceOrEventName;
+} CapRecord;
+
+static CapRecord *readCaps(FILE *fileHandle, int64_t capNumber) {
+    CapRecord *caps = st_malloc(sizeof(CapRecord) * (capNumber > 0 ? capNumber : 1));
+    for (int64_t i = 0; i < capNumber; i++) {
+        caps[i].name = readInt(fileHandle);
+        caps[i].coordinate = readInt(fileHandle);
+        caps[i].strand = readInt(fileHandle);
+        caps[i].hasSequence = readInt(fileHandle);
+        caps[i].sequenceOrEventName = readInt(fileHandle);
+    }
+    return caps;
+}
+
+static Sequence *capRecord_getSequence(CapRecord *capRecord, CactusDisk *cactusDisk) {
+    if (!capRecord->hasSequence) {
+        return NULL;
+    }
+    Sequence *sequence = cactusDisk_getSequence(cactusDisk, capRecord->sequenceOrEventName);
+    assert(sequence != NULL);
+    return sequence;
+}
+
+static Event *capRecord_getEvent(CapRecord *capRecord, CactusDisk *cactusDisk) {
+    if (capRecord->hasSequence) {
+        return sequence_getEvent(capRecord_getSequence(capRecord, cactusDisk));
+    }
+    Event *event = eventTree_getEvent(cactusDisk->eventTree, capRecord->sequenceOrEventName);
+    assert(event != NULL);
+    return event;
+}
+
+static void readFlower(FILE *fileHandle, CactusDisk *cactusDisk) {
+    Flower *flower = flower_construct2(readInt(fileHandle), cactusDisk);
+    flower->parentFlowerName = readInt(fileHandle);
+    flower->builtBlocks = readInt(fileHandle);
+
+    // Sequences
+    int64_t sequenceNumber = readInt(fileHandle);
+    for (int64_t i = 0; i < sequenceNumber; i++) {
+        Sequence *sequence = cactusDisk_getSequence(cactusDisk, readInt(fileHandle));
+        assert(sequence != NULL);
+        flower_addSequence(flower, sequence);
+    }
+
+    // Ends and blocks. Caps and segments are prepended to their end/block, so they
+    // are constructed in reverse to recreate the original iteration order.
+    flower_setFastCapsAndEnds(flower, 1);
+    int64_t endNumber = readInt(fileHandle);
+    for (int64_t i = 0; i < endNumber; i++) {
+        if (readInt(fileHandle)) {
+            Name name = readInt(fileHandle);
+            int64_t length = readInt(fileHandle);
+            Block *block = block_construct3(name, length, flower);
+            int64_t segmentNumber = readInt(fileHandle);
+            CapRecord *caps = readCaps(fileHandle, segmentNumber);
+            for (int64_t j = segmentNumber - 1; j >= 0; j--) {
+                Segment *segment = segment_construct4(caps[j].name, block, capRecord_getEvent(&caps[j], cactusDisk));
+                cap_setCoordinates(segment_get5Cap(segment), caps[j].coordinate, caps[j].strand,
+                                   capRecord_getSequence(&caps[j], cactusDisk));
+            }
+            free(caps);
+        } else {
+            Name name = readInt(fileHandle);
+            int64_t isAttached = readInt(fileHandle);
+            int64_t side = readInt(fileHandle);
+            End *end = end_construct3(name, isAttached, side, flower);
+            int64_t capNumber = readInt(fileHandle);
+            CapRecord *caps = readCaps(fileHandle, capNumber);
+            for (int64_t j = capNumber - 1; j >= 0; j--) {
+                Cap *cap = cap_construct3(caps[j].name, capRecord_getEvent(&caps[j], cactusDisk), end);
+                cap_setCoordinates(cap, caps[j].coordinate, caps[j].strand,
+                                   capRecord_getSequence(&caps[j], cactusDisk));
+            }
+            free(caps);
+        }
+    }
+    flower_setFastCapsAndEnds(flower, 0);
+
+    // Adjacencies
+    int64_t adjacencyNumber = readInt(fileHandle);
+    for (int64_t i = 0; i < adjacencyNumber; i++) {
+        Cap *cap = flower_getCap(flower, readInt(fileHandle));
+        Cap *adjacentCap = flower_getCap(flower, readInt(fileHandle));
+        assert(cap != NULL && adjacentCap != NULL);
+        cap_makeAdjacent(cap, adjacentCap);
+    }
+
+    // Groups, ends are prepended to a group so again add them in reverse
+    int64_t groupNumber = readInt(fileHandle);
+    for (int64_t i = 0; i < groupNumber; i++) {
+        Name name = readInt(fileHandle);
+        bool isLeaf = readInt(fileHandle);
+        Group *group = group_construct4(flower, name, isLeaf);
+        int64_t groupEndNumber = readInt(fileHandle);
+        Name *endNames = st_malloc(sizeof(Name) * (groupEndNumber > 0 ? groupEndNumber : 1));
+        for (int64_t j = 0; j < groupEndNumber; j++) {
+            endNames[j] = readInt(fileHandle);
+        }
+        for (int64_t j = groupEndNumber - 1; j >= 0; j--) {
+            End *end = flower_getEnd(flower, endNames[j]);
+            assert(end != NULL);
+            end_setGroup(end, group);
+        }
+        free(endNames);
+    }
+
+    // Chains, link_construct keeps the order of the other ends in the group
+    int64_t chainNumber = readInt(fileHandle);
+    for (int64_t i = 0; i < chainNumber; i++) {
+        Chain *chain = chain_construct2(readInt(fileHandle), flower);
+        int64_t linkNumber = readInt(fileHandle);
+        for (int64_t j = 0; j < linkNumber; j++) {
+            End *_3End = flower_getEnd(flower, readInt(fileHandle));
+            End *_5End = flower_getEnd(flower, readInt(fileHandle));
+            assert(_3End != NULL && _5End != NULL);
+            assert(end_getGroup(_3End) != NULL && end_getGroup(_3End) == end_getGroup(_5End));
+            link_construct(_3End, _5End, end_getGroup(_3End), chain);
+        }
+    }
+}
+
+CactusDisk *cactusDisk_read(FILE *fileHandle) {
+    if (readInt(fileHandle) != CACTUS_DISK_SNAPSHOT_MAGIC) {
+        st_errAbort("File is not a cactus disk snapshot");
+    }
+    int64_t version = readInt(fileHandle);
+    if (version != CACTUS_DISK_SNAPSHOT_VERSION) {
+        st_errAbort("Unsupported cactus disk snapshot version: %" PRIi64 "", version);
+    }
+    CactusDisk *cactusDisk = cactusDisk_construct();
+    Name currentName = readInt(fileHandle);
+
+    // Strings
+    int64_t stringNumber = readInt(fileHandle);
+    for (int64_t i = 0; i < stringNumber; i++) {
+        Name name = readInt(fileHandle);
+        char *string = readString(fileHandle);
+        cactusDisk_addStringWithName(cactusDisk, name, packedString_construct(string));
+        free(string);
+    }
+
+    readEventTree(fileHandle, cactusDisk);
+
+    // Sequences
+    int64_t sequenceNumber = readInt(fileHandle);
+    for (int64_t i = 0; i < sequenceNumber; i++) {
+        readSequence(fileHandle, cactusDisk);
+    }
+
+    // Flowers
+    int64_t flowerNumber = readInt(fileHandle);
+    for (int64_t i = 0; i < flowerNumber; i++) {
+        readFlower(fileHandle, cactusDisk);
+    }
+
+    // Everything was built with the original names, so continue issuing names where we left off
+    assert(cactusDisk->currentName <= currentName);
+    cactusDisk->currentName = currentName;
+
+    return cactusDisk;
+}
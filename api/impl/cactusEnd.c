@@ -137,7 +137,7 @@ End *end_construct2(bool side, bool isAttached, Flower *flower) {
 
 static End *end_construct4(Name name, int64_t isAttached,
         int64_t side, Flower *flower, bool addToFlower) {
-    End *end = st_calloc(1, 2*sizeof(End) + sizeof(EndContents));
+    End *end = slabArena_calloc(flower_getSlabArena(flower), 2*sizeof(End) + sizeof(EndContents));
     // see above comment to decode what is set
     // Bits: (0) orientation / (1) part_of_block / (2) is_block / (3) left / (4) is_attached / (5) side
     end->bits = 1; // binary 000001
@@ -255,7 +255,7 @@ void end_destruct(End *end) {
             cap_destruct(cap);
         }
 
-        free(end_getOrientation(end) ? end : end_getReverse(end));
+        slabArena_free(end_getOrientation(end) ? end : end_getReverse(end), 2*sizeof(End) + sizeof(EndContents));
     }
     else if(end_left(end)) { // is the left end of a block
         Block *block = end_getBlock(end);
@@ -266,7 +266,7 @@ void end_destruct(End *end) {
             segment_destruct(segment);
         }
 
-        free(block_getOrientation(block) ? block-2 : block-3);
+        slabArena_free(block_getOrientation(block) ? block-2 : block-3, 6*sizeof(Block) + sizeof(BlockEndContents));
     }
 }
 
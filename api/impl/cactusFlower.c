@@ -48,6 +48,7 @@ static Flower *flower_construct3(Name name, CactusDisk *cactusDisk) {
     flower->parentFlowerName = NULL_NAME;
     flower->cactusDisk = cactusDisk;
     flower->builtBlocks = 0;
+    flower->slabArena = slabArena_construct();
     cactusDisk_addFlower(flower->cactusDisk, flower);
 
     return flower;
@@ -119,6 +120,7 @@ void flower_destruct(Flower *flower, int64_t recursive, bool removeFromParentGro
         stSortedSet_destruct(flower->ends2);
     }
     stList_destruct(flower->ends);
+    slabArena_destruct(flower->slabArena);
 
     free(flower);
 }
@@ -127,6 +129,10 @@ Name flower_getName(Flower *flower) {
     return flower->name;
 }
 
+SlabArena *flower_getSlabArena(Flower *flower) {
+    return flower->slabArena;
+}
+
 CactusDisk *flower_getCactusDisk(Flower *flower) {
     return flower->cactusDisk;
 }
@@ -0,0 +1,373 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include <math.h>
+#include "cactusGlobalsPrivate.h"
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+//Basic flower cost model functions.
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+
+typedef struct _flowerCostWeights {
+    char *stageName;
+    double weights[FLOWER_COST_FEATURE_NUMBER];
+} FlowerCostWeights;
+
+struct _flowerCostModel {
+    stList *stageWeights; // The weights of each stage given weights
+    double defaultWeights[FLOWER_COST_FEATURE_NUMBER]; // The weights of any other stage
+};
+
+static void flowerCostWeights_destruct(FlowerCostWeights *stageWeights) {
+    free(stageWeights->stageName);
+    free(stageWeights);
+}
+
+void flowerCost_getFeatures(Flower *flower, double *features, bool adjacencyCells) {
+    features[0] = 1.0;
+    features[1] = flower_getCapNumber(flower);
+    features[2] = flower_getEndNumber(flower);
+    features[3] = flower_getTotalBaseLength(flower);
+    features[4] = 0.0;
+    if (!adjacencyCells) { // The other features are constant time, this needs a walk over the caps
+        return;
+    }
+    Flower_EndIterator *endIterator = flower_getEndIterator(flower);
+    End *end;
+    while ((end = flower_getNextEnd(endIterator)) != NULL) {
+        int64_t maxLength = 0;
+        End_InstanceIterator *instanceIterator = end_getInstanceIterator(end);
+        Cap *cap;
+        while ((cap = end_getNext(instanceIterator)) != NULL) {
+            Cap *cap2 = cap_getAdjacency(cap);
+            if (cap2 != NULL && cap_getSequence(cap) != NULL) {
+                int64_t length = llabs(cap_getCoordinate(cap) - cap_getCoordinate(cap2)) - 1;
+                maxLength = length > maxLength ? length : maxLength;
+            }
+        }
+        end_destructInstanceIterator(instanceIterator);
+        maxLength = maxLength < FLOWER_COST_MAX_ADJACENCY_LENGTH ? maxLength : FLOWER_COST_MAX_ADJACENCY_LENGTH;
+        features[4] += (double)end_getInstanceNumber(end) * maxLength * maxLength;
+    }
+    flower_destructEndIterator(endIterator);
+}
+
+FlowerCostModel *flowerCostModel_construct(void) {
+    FlowerCostModel *model = st_calloc(1, sizeof(FlowerCostModel));
+    model->stageWeights = stList_construct3(0, (void (*)(void *))flowerCostWeights_destruct);
+    model->defaultWeights[1] = 1.0; // Caps
+    double barWeights[FLOWER_COST_FEATURE_NUMBER] = { 0.0, 0.0, 0.0, 1.0, 0.0 }; // Bases
+    flowerCostModel_setWeights(model, "bar", barWeights);
+    return model;
+}
+
+void flowerCostModel_destruct(FlowerCostModel *model) {
+    stList_destruct(model->stageWeights);
+    free(model);
+}
+
+static double *getWeights(FlowerCostModel *model, const char *stageName) {
+    for (int64_t i = 0; i < stList_length(model->stageWeights); i++) {
+        FlowerCostWeights *stageWeights = stList_get(model->stageWeights, i);
+        if (strcmp(stageWeights->stageName, stageName) == 0) {
+            return stageWeights->weights;
+        }
+    }
+    return model->defaultWeights;
+}
+
+void flowerCostModel_setWeights(FlowerCostModel *model, const char *stageName, const double *weights) {
+    double *w = getWeights(model, stageName);
+    if (w == model->defaultWeights) {
+        FlowerCostWeights *stageWeights = st_malloc(sizeof(FlowerCostWeights));
+        stageWeights->stageName = stString_copy(stageName);
+        stList_append(model->stageWeights, stageWeights);
+        w = stageWeights->weights;
+    }
+    memcpy(w, weights, FLOWER_COST_FEATURE_NUMBER * sizeof(double));
+}
+
+double flowerCostModel_getCost(FlowerCostModel *model, const char *stageName, Flower *flower) {
+    double *weights = getWeights(model, stageName);
+    double features[FLOWER_COST_FEATURE_NUMBER];
+    flowerCost_getFeatures(flower, features, weights[4] != 0.0);
+    double cost = 0.0;
+    for (int64_t i = 0; i < FLOWER_COST_FEATURE_NUMBER; i++) {
+        cost += weights[i] * features[i];
+    }
+    return cost;
+}
+
+typedef struct _flowerAndCost {
+    Flower *flower;
+    double cost;
+    int64_t index;
+} FlowerAndCost;
+
+static int flowerAndCost_cmp(const void *a, const void *b) {
+    const FlowerAndCost *i = a, *j = b;
+    if (i->cost != j->cost) {
+        return i->cost > j->cost ? -1 : 1; // Sort in descending order
+    }
+    return i->index < j->index ? -1 : (i->index > j->index ? 1 : 0);
+}
+
+void flowerCostModel_sortFlowers(FlowerCostModel *model, const char *stageName, stList *flowers) {
+    int64_t flowerNumber = stList_length(flowers);
+    FlowerAndCost *flowerCosts = st_malloc(flowerNumber * sizeof(FlowerAndCost));
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic) if(flowerNumber > 1000 && !omp_in_parallel())
+#endif
+    for (int64_t i = 0; i < flowerNumber; i++) {
+        flowerCosts[i].flower = stList_get(flowers, i);
+        flowerCosts[i].cost = flowerCostModel_getCost(model, stageName, flowerCosts[i].flower);
+        flowerCosts[i].index = i;
+    }
+    qsort(flowerCosts, flowerNumber, sizeof(FlowerAndCost), flowerAndCost_cmp);
+    for (int64_t i = 0; i < flowerNumber; i++) {
+        stList_set(flowers, i, flowerCosts[i].flower);
+    }
+    free(flowerCosts);
+}
+
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+//Fitting the model to flower timings
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+
+/*
+ * Solves the n by n system a x = b by Gaussian elimination with partial pivoting, overwriting a and b. Returns zero
+ * if the system is singular.
+ */
+static bool solve(double *a, double *b, double *x, int64_t n) {
+    for (int64_t k = 0; k < n; k++) {
+        int64_t pivot = k;
+        for (int64_t i = k + 1; i < n; i++) {
+            if (fabs(a[i * n + k]) > fabs(a[pivot * n + k])) {
+                pivot = i;
+            }
+        }
+        if (fabs(a[pivot * n + k]) < 1e-12) {
+            return 0;
+        }
+        for (int64_t j = 0; j < n; j++) {
+            double t = a[k * n + j];
+            a[k * n + j] = a[pivot * n + j];
+            a[pivot * n + j] = t;
+        }
+        double t = b[k];
+        b[k] = b[pivot];
+        b[pivot] = t;
+        for (int64_t i = k + 1; i < n; i++) {
+            double f = a[i * n + k] / a[k * n + k];
+            for (int64_t j = k; j < n; j++) {
+                a[i * n + j] -= f * a[k * n + j];
+            }
+            b[i] -= f * b[k];
+        }
+    }
+    for (int64_t k = n - 1; k >= 0; k--) {
+        x[k] = b[k];
+        for (int64_t j = k + 1; j < n; j++) {
+            x[k] -= a[k * n + j] * x[j];
+        }
+        x[k] /= a[k * n + k];
+    }
+    return 1;
+}
+
+/*
+ * Solves the least squares problem restricted to the passive features, given the normal equations g x = c of all
+ * n features, setting the weights of the other features to zero. Returns zero if the system is singular.
+ */
+static bool solvePassive(double *g, double *c, bool *passive, double *x, int64_t n) {
+    int64_t m = 0, index[FLOWER_COST_FEATURE_NUMBER];
+    for (int64_t i = 0; i < n; i++) {
+        if (passive[i]) {
+            index[m++] = i;
+        }
+        x[i] = 0.0;
+    }
+    double a[FLOWER_COST_FEATURE_NUMBER * FLOWER_COST_FEATURE_NUMBER], b[FLOWER_COST_FEATURE_NUMBER];
+    double y[FLOWER_COST_FEATURE_NUMBER];
+    for (int64_t i = 0; i < m; i++) {
+        for (int64_t j = 0; j < m; j++) {
+            a[i * m + j] = g[index[i] * n + index[j]];
+        }
+        b[i] = c[index[i]];
+    }
+    if (!solve(a, b, y, m)) {
+        return 0;
+    }
+    for (int64_t i = 0; i < m; i++) {
+        x[index[i]] = y[i];
+    }
+    return 1;
+}
+
+bool flowerCostModel_fit(FlowerCostModel *model, const char *stageName, stList *samples) {
+    int64_t n = FLOWER_COST_FEATURE_NUMBER;
+    if (stList_length(samples) < 2 * n) {
+        return 0;
+    }
+    // The features are scaled by their largest values, as they differ by many orders of magnitude
+    double scales[FLOWER_COST_FEATURE_NUMBER] = { 0.0 };
+    for (int64_t s = 0; s < stList_length(samples); s++) {
+        double *sample = stList_get(samples, s);
+        for (int64_t i = 0; i < n; i++) {
+            scales[i] = fabs(sample[i]) > scales[i] ? fabs(sample[i]) : scales[i];
+        }
+    }
+
+    // The normal equations of the scaled features, with a little ridge regularisation so that correlated features
+    // are not singular. Features that are always zero get no weight.
+    double g[FLOWER_COST_FEATURE_NUMBER * FLOWER_COST_FEATURE_NUMBER] = { 0.0 }, c[FLOWER_COST_FEATURE_NUMBER] = { 0.0 };
+    double cMax = 0.0;
+    for (int64_t s = 0; s < stList_length(samples); s++) {
+        double *sample = stList_get(samples, s);
+        for (int64_t i = 0; i < n; i++) {
+            if (scales[i] > 0.0) {
+                double fi = sample[i] / scales[i];
+                for (int64_t j = 0; j < n; j++) {
+                    if (scales[j] > 0.0) {
+                        g[i * n + j] += fi * sample[j] / scales[j];
+                    }
+                }
+                c[i] += fi * sample[n];
+            }
+        }
+    }
+    for (int64_t i = 0; i < n; i++) {
+        g[i * n + i] += 1e-9 * stList_length(samples);
+        cMax = fabs(c[i]) > cMax ? fabs(c[i]) : cMax;
+    }
+
+    // Lawson and Hanson's non-negative least squares. Features are moved into the passive set, whose weights are
+    // free, in order of the gradient of the residual, and moved back out whenever their weights would go negative.
+    bool passive[FLOWER_COST_FEATURE_NUMBER] = { 0 };
+    double x[FLOWER_COST_FEATURE_NUMBER] = { 0.0 }, z[FLOWER_COST_FEATURE_NUMBER];
+    double tolerance = 1e-10 * cMax;
+    for (int64_t iteration = 0; iteration < 3 * n; iteration++) { // Bounds the iterations should rounding cycle
+        int64_t k = -1;
+        double maxGradient = tolerance;
+        for (int64_t i = 0; i < n; i++) {
+            if (!passive[i] && scales[i] > 0.0) {
+                double gradient = c[i];
+                for (int64_t j = 0; j < n; j++) {
+                    gradient -= g[i * n + j] * x[j];
+                }
+                if (gradient > maxGradient) {
+                    maxGradient = gradient;
+                    k = i;
+                }
+            }
+        }
+        if (k == -1) { // No weight can be increased to reduce the residual, so the weights are optimal
+            break;
+        }
+        passive[k] = 1;
+        while (1) {
+            if (!solvePassive(g, c, passive, z, n)) {
+                return 0;
+            }
+            // Step from x towards z as far as the weights stay non-negative
+            double alpha = 1.0;
+            for (int64_t i = 0; i < n; i++) {
+                if (passive[i] && z[i] < 0.0) {
+                    double step = x[i] / (x[i] - z[i]);
+                    alpha = step < alpha ? step : alpha;
+                }
+            }
+            for (int64_t i = 0; i < n; i++) {
+                x[i] += alpha * (z[i] - x[i]);
+            }
+            if (alpha == 1.0) {
+                break;
+            }
+            for (int64_t i = 0; i < n; i++) {
+                if (passive[i] && x[i] <= 0.0) {
+                    passive[i] = 0;
+                    x[i] = 0.0;
+                }
+            }
+            if (alpha == 0.0) { // The feature just added cannot take a positive weight
+                break;
+            }
+        }
+    }
+    bool fitted = 0;
+    double weights[FLOWER_COST_FEATURE_NUMBER];
+    for (int64_t i = 0; i < n; i++) {
+        weights[i] = passive[i] ? x[i] / scales[i] : 0.0;
+        fitted = fitted || passive[i];
+    }
+    if (!fitted) {
+        return 0;
+    }
+    flowerCostModel_setWeights(model, stageName, weights);
+    st_logInfo("Fitted the flower cost model for %s to %" PRIi64 " flowers by non-negative least squares: %g + %g * "
+               "caps + %g * ends + %g * bases + %g * adjacency cells\n", stageName, stList_length(samples), weights[0],
+               weights[1], weights[2], weights[3], weights[4]);
+    return 1;
+}
+
+void flowerCostModel_fitFromFile(FlowerCostModel *model, const char *flowerTimingsFile) {
+    FILE *fileHandle = fopen(flowerTimingsFile, "r");
+    if (fileHandle == NULL) {
+        st_errAbort("Could not open the flower timings file: %s", flowerTimingsFile);
+    }
+    stHash *stagesToSamples = stHash_construct3(stHash_stringKey, stHash_stringEqualKey, free,
+                                                (void (*)(void *))stList_destruct);
+    char *line;
+    while ((line = stFile_getLineFromFile(fileHandle)) != NULL) {
+        if (line[0] == '#' || line[0] == '\0') { // Skip the header and empty lines
+            free(line);
+            continue;
+        }
+        char stageName[1024];
+        Name flowerName;
+        int64_t caps, ends, bases;
+        double adjacencyCells, seconds;
+        if (sscanf(line, "%1023s %" SCNi64 " %" SCNi64 " %" SCNi64 " %" SCNi64 " %lf %lf", stageName, &flowerName,
+                   &caps, &ends, &bases, &adjacencyCells, &seconds) != 7) {
+            st_errAbort("Could not parse the flower timing: %s", line);
+        }
+        stList *samples = stHash_search(stagesToSamples, stageName);
+        if (samples == NULL) {
+            samples = stList_construct3(0, free);
+            stHash_insert(stagesToSamples, stString_copy(stageName), samples);
+        }
+        double *sample = st_malloc((FLOWER_COST_FEATURE_NUMBER + 1) * sizeof(double));
+        sample[0] = 1.0;
+        sample[1] = caps;
+        sample[2] = ends;
+        sample[3] = bases;
+        sample[4] = adjacencyCells;
+        sample[5] = seconds;
+        stList_append(samples, sample);
+        free(line);
+    }
+    fclose(fileHandle);
+
+    stHashIterator *it = stHash_getIterator(stagesToSamples);
+    char *stageName;
+    while ((stageName = stHash_getNext(it)) != NULL) {
+        if (!flowerCostModel_fit(model, stageName, stHash_search(stagesToSamples, stageName))) {
+            st_logInfo("Could not fit the flower cost model for %s to its flower timings\n", stageName);
+        }
+    }
+    stHash_destructIterator(it);
+    stHash_destruct(stagesToSamples);
+}
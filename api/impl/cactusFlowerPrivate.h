@@ -21,6 +21,7 @@ struct _flower {
     Name parentFlowerName;
     CactusDisk *cactusDisk;
     bool builtBlocks;
+    SlabArena *slabArena; // Holds the caps, ends, segments and blocks of the flower
 };
 
 ////////////////////////////////////////////////
@@ -44,6 +45,11 @@ void flower_setEventTree(Flower *flower, EventTree *eventTree);
  */
 void flower_removeEventTree(Flower *flower, EventTree *eventTree);
 
+/*
+ * Gets the arena from which the caps, ends, segments and blocks of the flower are allocated.
+ */
+SlabArena *flower_getSlabArena(Flower *flower);
+
 /*
  * Adds the cap to the flower.
  */
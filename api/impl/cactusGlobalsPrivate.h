@@ -48,9 +48,13 @@
 #include "cactusSequencePrivate.h"
 #include "cactusFlower.h"
 #include "cactusDisk.h"
+#include "cactusPackedString.h"
 #include "cactusDiskPrivate.h"
 #include "cactusMisc.h"
+#include "cactusSlabArenaPrivate.h"
 #include "cactusFlowerPrivate.h"
 #include "cactusTestCommon.h"
+#include "cactusPerfReport.h"
+#include "cactusFlowerCost.h"
 
 #endif
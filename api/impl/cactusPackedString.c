@@ -0,0 +1,257 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include <ctype.h>
+#include "cactusGlobalsPrivate.h"
+
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+//Packed string functions.
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+
+#define BASES_PER_WORD 32
+
+/*
+ * A run of identical characters that are not A, C, G or T (in either case), stored as they appear in the string.
+ */
+typedef struct _packedStringRun {
+    int64_t start;
+    int64_t length;
+    char character;
+} PackedStringRun;
+
+/*
+ * An interval of lower case characters.
+ */
+typedef struct _packedStringInterval {
+    int64_t start;
+    int64_t length;
+} PackedStringInterval;
+
+struct _packedString {
+    int64_t length;
+    uint64_t *bases; // Two bits per base, the bases of the runs being set to zero
+    int64_t runNumber;
+    PackedStringRun *runs;
+    int64_t intervalNumber;
+    PackedStringInterval *intervals;
+    const char *mappedBases; // If not NULL the string is held in a mapped file, split into lines, and is not packed
+    int64_t lineBases;
+    int64_t lineBytes;
+};
+
+static const char packedString_bases[] = { 'A', 'C', 'G', 'T' };
+
+static int64_t packedString_getCode(char c) {
+    switch (c) {
+        case 'A':
+        case 'a':
+            return 0;
+        case 'C':
+        case 'c':
+            return 1;
+        case 'G':
+        case 'g':
+            return 2;
+        case 'T':
+        case 't':
+            return 3;
+        default:
+            return -1;
+    }
+}
+
+PackedString *packedString_construct(const char *string) {
+    PackedString *packedString = st_malloc(sizeof(PackedString));
+    int64_t length = strlen(string);
+    packedString->length = length;
+    packedString->mappedBases = NULL;
+    packedString->bases = st_calloc((length + BASES_PER_WORD - 1) / BASES_PER_WORD, sizeof(uint64_t));
+
+    // Pack the bases, counting the runs and intervals in the same pass
+    int64_t runNumber = 0, intervalNumber = 0;
+    for (int64_t i = 0; i < length; i++) {
+        int64_t code = packedString_getCode(string[i]);
+        if (code == -1) {
+            if (i == 0 || string[i - 1] != string[i]) {
+                runNumber++;
+            }
+        } else {
+            packedString->bases[i / BASES_PER_WORD] |= ((uint64_t) code) << (2 * (i % BASES_PER_WORD));
+        }
+        if (islower((unsigned char) string[i]) && (i == 0 || !islower((unsigned char) string[i - 1]))) {
+            intervalNumber++;
+        }
+    }
+
+    // Now fill in the side tables
+    packedString->runNumber = runNumber;
+    packedString->runs = st_malloc(runNumber * sizeof(PackedStringRun));
+    packedString->intervalNumber = intervalNumber;
+    packedString->intervals = st_malloc(intervalNumber * sizeof(PackedStringInterval));
+    runNumber = 0;
+    intervalNumber = 0;
+    for (int64_t i = 0; i < length; i++) {
+        if (packedString_getCode(string[i]) == -1) {
+            if (i == 0 || string[i - 1] != string[i]) {
+                PackedStringRun *run = &(packedString->runs[runNumber++]);
+                run->start = i;
+                run->length = 0;
+                run->character = string[i];
+            }
+            packedString->runs[runNumber - 1].length++;
+        }
+        if (islower((unsigned char) string[i])) {
+            if (i == 0 || !islower((unsigned char) string[i - 1])) {
+                PackedStringInterval *interval = &(packedString->intervals[intervalNumber++]);
+                interval->start = i;
+                interval->length = 0;
+            }
+            packedString->intervals[intervalNumber - 1].length++;
+        }
+    }
+    assert(runNumber == packedString->runNumber);
+    assert(intervalNumber == packedString->intervalNumber);
+
+    return packedString;
+}
+
+PackedString *packedString_constructMapped(const char *bases, int64_t length, int64_t lineBases, int64_t lineBytes) {
+    assert(length == 0 || (lineBases > 0 && lineBytes >= lineBases));
+    PackedString *packedString = st_calloc(1, sizeof(PackedString));
+    packedString->length = length;
+    packedString->mappedBases = bases;
+    packedString->lineBases = lineBases;
+    packedString->lineBytes = lineBytes;
+    return packedString;
+}
+
+void packedString_destruct(PackedString *packedString) {
+    free(packedString->bases);
+    free(packedString->runs);
+    free(packedString->intervals);
+    free(packedString);
+}
+
+int64_t packedString_getLength(PackedString *packedString) {
+    return packedString->length;
+}
+
+/*
+ * Gets the index of the first of the sorted, non-overlapping intervals that ends after position i, or intervalNumber if none does.
+ * The intervals are given by an array of structs of size structSize, each starting with the start and length of the interval.
+ */
+static int64_t packedString_getFirstIntervalEndingAfter(const void *intervals, int64_t intervalNumber, size_t structSize, int64_t i) {
+    int64_t min = 0, max = intervalNumber;
+    while (min < max) {
+        int64_t mid = min + (max - min) / 2;
+        const int64_t *interval = (const int64_t *) ((const char *) intervals + mid * structSize);
+        if (interval[0] + interval[1] <= i) {
+            min = mid + 1;
+        } else {
+            max = mid;
+        }
+    }
+    return min;
+}
+
+void packedString_unpack(PackedString *packedString, int64_t start, int64_t length, char *buffer) {
+    assert(start >= 0);
+    assert(length >= 0);
+    assert(start + length <= packedString->length);
+    int64_t end = start + length;
+
+    if (packedString->mappedBases != NULL) {
+        // Copy the characters line by line, skipping the line terminators
+        for (int64_t i = start; i < end;) {
+            int64_t j = i % packedString->lineBases;
+            int64_t k = packedString->lineBases - j < end - i ? packedString->lineBases - j : end - i;
+            memcpy(buffer + (i - start), packedString->mappedBases + (i / packedString->lineBases) * packedString->lineBytes + j, k);
+            i += k;
+        }
+        return;
+    }
+
+    // The bases
+    for (int64_t i = start; i < end; i++) {
+        buffer[i - start] = packedString_bases[(packedString->bases[i / BASES_PER_WORD] >> (2 * (i % BASES_PER_WORD))) & 3];
+    }
+
+    // The soft masked intervals
+    for (int64_t j = packedString_getFirstIntervalEndingAfter(packedString->intervals, packedString->intervalNumber,
+                                                              sizeof(PackedStringInterval), start);
+         j < packedString->intervalNumber && packedString->intervals[j].start < end; j++) {
+        PackedStringInterval *interval = &(packedString->intervals[j]);
+        int64_t i = interval->start > start ? interval->start : start;
+        int64_t k = interval->start + interval->length < end ? interval->start + interval->length : end;
+        for (; i < k; i++) {
+            buffer[i - start] = tolower(buffer[i - start]);
+        }
+    }
+
+    // The runs of other characters, which are stored with their case
+    for (int64_t j = packedString_getFirstIntervalEndingAfter(packedString->runs, packedString->runNumber,
+                                                              sizeof(PackedStringRun), start);
+         j < packedString->runNumber && packedString->runs[j].start < end; j++) {
+        PackedStringRun *run = &(packedString->runs[j]);
+        int64_t i = run->start > start ? run->start : start;
+        int64_t k = run->start + run->length < end ? run->start + run->length : end;
+        memset(buffer + (i - start), run->character, k - i);
+    }
+}
+
+char packedString_getBase(PackedString *packedString, int64_t i) {
+    assert(i >= 0 && i < packedString->length);
+    if (packedString->mappedBases != NULL) {
+        return packedString->mappedBases[(i / packedString->lineBases) * packedString->lineBytes + i % packedString->lineBases];
+    }
+    int64_t j = packedString_getFirstIntervalEndingAfter(packedString->runs, packedString->runNumber, sizeof(PackedStringRun), i);
+    if (j < packedString->runNumber && packedString->runs[j].start <= i) {
+        return packedString->runs[j].character;
+    }
+    char c = packedString_bases[(packedString->bases[i / BASES_PER_WORD] >> (2 * (i % BASES_PER_WORD))) & 3];
+    j = packedString_getFirstIntervalEndingAfter(packedString->intervals, packedString->intervalNumber, sizeof(PackedStringInterval), i);
+    return j < packedString->intervalNumber && packedString->intervals[j].start <= i ? tolower(c) : c;
+}
+
+char packedString_complement(char c) {
+    switch (c) {
+        case 'A':
+            return 'T';
+        case 'C':
+            return 'G';
+        case 'G':
+            return 'C';
+        case 'T':
+            return 'A';
+        case 'a':
+            return 't';
+        case 'c':
+            return 'g';
+        case 'g':
+            return 'c';
+        case 't':
+            return 'a';
+        default:
+            return c;
+    }
+}
+
+char *packedString_getSubString(PackedString *packedString, int64_t start, int64_t length) {
+    char *string = st_malloc((length + 1) * sizeof(char));
+    packedString_unpack(packedString, start, length, string);
+    string[length] = '\0';
+    return string;
+}
+
+int64_t packedString_getSizeInBytes(PackedString *packedString) {
+    if (packedString->mappedBases != NULL) {
+        return sizeof(PackedString);
+    }
+    return sizeof(PackedString) + ((packedString->length + BASES_PER_WORD - 1) / BASES_PER_WORD) * sizeof(uint64_t)
+           + packedString->runNumber * sizeof(PackedStringRun) + packedString->intervalNumber * sizeof(PackedStringInterval);
+}
@@ -0,0 +1,341 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include <time.h>
+#include <sys/time.h>
+#include <sys/resource.h>
+#include "cactusGlobalsPrivate.h"
+
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+//Basic performance report functions.
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+
+/*
+ * Upper bounds, in seconds, of the bins of the per-flower time histograms. The last bin is unbounded.
+ */
+static const double histogramBins[] = { 0.001, 0.01, 0.1, 1.0, 10.0, 100.0, 1000.0 };
+#define HISTOGRAM_BIN_NUMBER 8
+
+typedef struct _perfStage {
+    char *name;
+    int64_t parent; // Index of the enclosing stage, or -1
+    double wallStart;
+    double cpuStart;
+    double wallTime;
+    double cpuTime;
+    int64_t peakRss; // In kilobytes
+    int64_t taskNumber; // For a stage made of task times (see perfReport_addTaskTime) the number of tasks, else 0
+} PerfStage;
+
+typedef struct _perfFlowerRecord {
+    Name flowerName;
+    int64_t capNumber;
+    int64_t endNumber;
+    int64_t totalBaseLength;
+    double adjacencyCells;
+    double time;
+} PerfFlowerRecord;
+
+typedef struct _perfFlowerStage {
+    char *name;
+    stList *records;
+} PerfFlowerStage;
+
+struct _perfReport {
+    int64_t topFlowerNumber;
+    double wallStart;
+    double cpuStart;
+    stList *stages; // Stages in the order they were started
+    int64_t currentStage; // Index of the innermost open stage, or -1
+    stList *flowerStages;
+    bool recordAdjacencyCells;
+#if defined(_OPENMP)
+    omp_lock_t flowerLock; // Gates access to flowerStages and to the stages added to by perfReport_addTaskTime
+#endif
+};
+
+static PerfReport *globalPerfReport = NULL;
+
+double perfReport_getWallTime(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_MONOTONIC, &t);
+    return t.tv_sec + t.tv_nsec / 1.0e9;
+}
+
+static double getCpuTime(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_utime.tv_sec + usage.ru_utime.tv_usec / 1.0e6 + usage.ru_stime.tv_sec + usage.ru_stime.tv_usec / 1.0e6;
+}
+
+double perfReport_getThreadCpuTime(void) {
+    struct timespec t;
+    clock_gettime(CLOCK_THREAD_CPUTIME_ID, &t);
+    return t.tv_sec + t.tv_nsec / 1.0e9;
+}
+
+static int64_t getPeakRss(void) {
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return usage.ru_maxrss;
+}
+
+static void perfStage_destruct(PerfStage *stage) {
+    free(stage->name);
+    free(stage);
+}
+
+static void perfFlowerStage_destruct(PerfFlowerStage *flowerStage) {
+    free(flowerStage->name);
+    stList_destruct(flowerStage->records);
+    free(flowerStage);
+}
+
+PerfReport *perfReport_construct(int64_t topFlowerNumber) {
+    PerfReport *perfReport = st_malloc(sizeof(PerfReport));
+    perfReport->topFlowerNumber = topFlowerNumber;
+    perfReport->wallStart = perfReport_getWallTime();
+    perfReport->cpuStart = getCpuTime();
+    perfReport->stages = stList_construct3(0, (void (*)(void *))perfStage_destruct);
+    perfReport->currentStage = -1;
+    perfReport->flowerStages = stList_construct3(0, (void (*)(void *))perfFlowerStage_destruct);
+    perfReport->recordAdjacencyCells = 1;
+#if defined(_OPENMP)
+    omp_init_lock(&(perfReport->flowerLock));
+#endif
+    return perfReport;
+}
+
+void perfReport_destruct(PerfReport *perfReport) {
+    if (globalPerfReport == perfReport) {
+        globalPerfReport = NULL;
+    }
+    stList_destruct(perfReport->stages);
+    stList_destruct(perfReport->flowerStages);
+#if defined(_OPENMP)
+    omp_destroy_lock(&(perfReport->flowerLock));
+#endif
+    free(perfReport);
+}
+
+void perfReport_setGlobal(PerfReport *perfReport) {
+    globalPerfReport = perfReport;
+}
+
+void perfReport_setRecordAdjacencyCells(PerfReport *perfReport, bool recordAdjacencyCells) {
+    perfReport->recordAdjacencyCells = recordAdjacencyCells;
+}
+
+PerfReport *perfReport_getGlobal(void) {
+    return globalPerfReport;
+}
+
+void perfReport_startStage(PerfReport *perfReport, const char *stageName) {
+    if (perfReport == NULL) {
+        return;
+    }
+    PerfStage *stage = st_calloc(1, sizeof(PerfStage));
+    stage->name = stString_copy(stageName);
+    stage->parent = perfReport->currentStage;
+    stage->wallStart = perfReport_getWallTime();
+    stage->cpuStart = getCpuTime();
+    perfReport->currentStage = stList_length(perfReport->stages);
+    stList_append(perfReport->stages, stage);
+}
+
+void perfReport_endStage(PerfReport *perfReport) {
+    if (perfReport == NULL) {
+        return;
+    }
+    if (perfReport->currentStage == -1) {
+        st_errAbort("Attempt to end a performance report stage when no stage has been started");
+    }
+    PerfStage *stage = stList_get(perfReport->stages, perfReport->currentStage);
+    stage->wallTime = perfReport_getWallTime() - stage->wallStart;
+    stage->cpuTime = getCpuTime() - stage->cpuStart;
+    stage->peakRss = getPeakRss();
+    perfReport->currentStage = stage->parent;
+    st_logInfo("Ran %s in %f seconds (%f cpu seconds, peak rss %" PRIi64 " kb), %f seconds have elapsed\n", stage->name,
+               stage->wallTime, stage->cpuTime, stage->peakRss, perfReport_getWallTime() - perfReport->wallStart);
+}
+
+void perfReport_addTaskTime(PerfReport *perfReport, const char *stageName, double wallTime, double cpuTime) {
+    if (perfReport == NULL) {
+        return;
+    }
+#if defined(_OPENMP)
+    omp_set_lock(&(perfReport->flowerLock));
+#endif
+    PerfStage *stage = NULL;
+    for (int64_t i = perfReport->currentStage + 1; i < stList_length(perfReport->stages); i++) {
+        PerfStage *stage2 = stList_get(perfReport->stages, i);
+        if (stage2->parent == perfReport->currentStage && stage2->taskNumber > 0 && strcmp(stage2->name, stageName) == 0) {
+            stage = stage2;
+            break;
+        }
+    }
+    if (stage == NULL) {
+        stage = st_calloc(1, sizeof(PerfStage));
+        stage->name = stString_copy(stageName);
+        stage->parent = perfReport->currentStage;
+        stList_append(perfReport->stages, stage);
+    }
+    stage->wallTime += wallTime;
+    stage->cpuTime += cpuTime;
+    stage->peakRss = getPeakRss();
+    stage->taskNumber++;
+#if defined(_OPENMP)
+    omp_unset_lock(&(perfReport->flowerLock));
+#endif
+}
+
+void perfReport_startFlower(PerfReport *perfReport, Flower *flower, PerfFlowerTimer *timer) {
+    if (perfReport == NULL) {
+        return;
+    }
+    double features[FLOWER_COST_FEATURE_NUMBER];
+    flowerCost_getFeatures(flower, features, perfReport->recordAdjacencyCells);
+    timer->flowerName = flower_getName(flower);
+    timer->capNumber = features[1];
+    timer->endNumber = features[2];
+    timer->totalBaseLength = features[3];
+    timer->adjacencyCells = features[4];
+    timer->startTime = perfReport_getWallTime();
+}
+
+static PerfFlowerStage *getFlowerStage(PerfReport *perfReport, const char *stageName) {
+    for (int64_t i = 0; i < stList_length(perfReport->flowerStages); i++) {
+        PerfFlowerStage *flowerStage = stList_get(perfReport->flowerStages, i);
+        if (strcmp(flowerStage->name, stageName) == 0) {
+            return flowerStage;
+        }
+    }
+    PerfFlowerStage *flowerStage = st_malloc(sizeof(PerfFlowerStage));
+    flowerStage->name = stString_copy(stageName);
+    flowerStage->records = stList_construct3(0, free);
+    stList_append(perfReport->flowerStages, flowerStage);
+    return flowerStage;
+}
+
+void perfReport_endFlower(PerfReport *perfReport, const char *stageName, PerfFlowerTimer *timer) {
+    if (perfReport == NULL) {
+        return;
+    }
+    PerfFlowerRecord *record = st_malloc(sizeof(PerfFlowerRecord));
+    record->flowerName = timer->flowerName;
+    record->capNumber = timer->capNumber;
+    record->endNumber = timer->endNumber;
+    record->totalBaseLength = timer->totalBaseLength;
+    record->adjacencyCells = timer->adjacencyCells;
+    record->time = perfReport_getWallTime() - timer->startTime;
+#if defined(_OPENMP)
+    omp_set_lock(&(perfReport->flowerLock));
+#endif
+    stList_append(getFlowerStage(perfReport, stageName)->records, record);
+#if defined(_OPENMP)
+    omp_unset_lock(&(perfReport->flowerLock));
+#endif
+}
+
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+//Writing the report
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+
+static int perfFlowerRecord_cmpByTime(const void *a, const void *b) {
+    double i = ((PerfFlowerRecord *)a)->time, j = ((PerfFlowerRecord *)b)->time;
+    return i < j ? 1 : (i > j ? -1 : 0); // Sort in descending order
+}
+
+static void writeFlowerStage(PerfReport *perfReport, PerfFlowerStage *flowerStage, FILE *fileHandle) {
+    int64_t histogram[HISTOGRAM_BIN_NUMBER] = { 0 };
+    double totalTime = 0.0;
+    for (int64_t i = 0; i < stList_length(flowerStage->records); i++) {
+        PerfFlowerRecord *record = stList_get(flowerStage->records, i);
+        int64_t j = 0;
+        while (j < HISTOGRAM_BIN_NUMBER - 1 && record->time >= histogramBins[j]) {
+            j++;
+        }
+        histogram[j]++;
+        totalTime += record->time;
+    }
+
+    fprintf(fileHandle, "    {\"name\": \"%s\", \"flowers\": %" PRIi64 ", \"totalSeconds\": %f,\n", flowerStage->name,
+            stList_length(flowerStage->records), totalTime);
+    fprintf(fileHandle, "     \"histogram\": [");
+    for (int64_t j = 0; j < HISTOGRAM_BIN_NUMBER; j++) {
+        if (j < HISTOGRAM_BIN_NUMBER - 1) {
+            fprintf(fileHandle, "{\"maxSeconds\": %g, \"flowers\": %" PRIi64 "}, ", histogramBins[j], histogram[j]);
+        } else {
+            fprintf(fileHandle, "{\"maxSeconds\": null, \"flowers\": %" PRIi64 "}],\n", histogram[j]);
+        }
+    }
+
+    stList_sort(flowerStage->records, perfFlowerRecord_cmpByTime);
+    fprintf(fileHandle, "     \"slowestFlowers\": [");
+    int64_t n = stList_length(flowerStage->records) < perfReport->topFlowerNumber ? stList_length(flowerStage->records)
+                                                                                   : perfReport->topFlowerNumber;
+    for (int64_t i = 0; i < n; i++) {
+        PerfFlowerRecord *record = stList_get(flowerStage->records, i);
+        fprintf(fileHandle, "%s\n       {\"name\": %" PRIi64 ", \"seconds\": %f, \"caps\": %" PRIi64 ", \"ends\": %" PRIi64
+                ", \"bases\": %" PRIi64 "}", i == 0 ? "" : ",", record->flowerName, record->time, record->capNumber,
+                record->endNumber, record->totalBaseLength);
+    }
+    fprintf(fileHandle, "]}");
+}
+
+void perfReport_writeJson(PerfReport *perfReport, FILE *fileHandle) {
+    int64_t threads = 1;
+#if defined(_OPENMP)
+    threads = omp_get_max_threads();
+#endif
+    fprintf(fileHandle, "{\n  \"threads\": %" PRIi64 ",\n  \"wallSeconds\": %f,\n  \"cpuSeconds\": %f,\n  \"peakRssKb\": %" PRIi64 ",\n",
+            threads, perfReport_getWallTime() - perfReport->wallStart, getCpuTime() - perfReport->cpuStart, getPeakRss());
+
+    fprintf(fileHandle, "  \"stages\": [");
+    for (int64_t i = 0; i < stList_length(perfReport->stages); i++) {
+        PerfStage *stage = stList_get(perfReport->stages, i);
+        fprintf(fileHandle, "%s\n    {\"name\": \"%s\", ", i == 0 ? "" : ",", stage->name);
+        if (stage->parent != -1) {
+            fprintf(fileHandle, "\"parent\": \"%s\", ", ((PerfStage *)stList_get(perfReport->stages, stage->parent))->name);
+        }
+        if (stage->taskNumber > 0) {
+            fprintf(fileHandle, "\"tasks\": %" PRIi64 ", ", stage->taskNumber);
+        }
+        fprintf(fileHandle, "\"wallSeconds\": %f, \"cpuSeconds\": %f, \"peakRssKb\": %" PRIi64 "}",
+                stage->wallTime, stage->cpuTime, stage->peakRss);
+    }
+    fprintf(fileHandle, "],\n");
+
+    fprintf(fileHandle, "  \"flowerStages\": [");
+    for (int64_t i = 0; i < stList_length(perfReport->flowerStages); i++) {
+        fprintf(fileHandle, "%s\n", i == 0 ? "" : ",");
+        writeFlowerStage(perfReport, stList_get(perfReport->flowerStages, i), fileHandle);
+    }
+    fprintf(fileHandle, "]\n}\n");
+}
+
+void perfReport_writeFlowerTimings(PerfReport *perfReport, FILE *fileHandle) {
+    fprintf(fileHandle, "#stage\tflower\tcaps\tends\tbases\tadjacencyCells\tseconds\n");
+    for (int64_t i = 0; i < stList_length(perfReport->flowerStages); i++) {
+        PerfFlowerStage *flowerStage = stList_get(perfReport->flowerStages, i);
+        for (int64_t j = 0; j < stList_length(flowerStage->records); j++) {
+            PerfFlowerRecord *record = stList_get(flowerStage->records, j);
+            fprintf(fileHandle, "%s\t%" PRIi64 "\t%" PRIi64 "\t%" PRIi64 "\t%" PRIi64 "\t%.0f\t%f\n", flowerStage->name,
+                    record->flowerName, record->capNumber, record->endNumber, record->totalBaseLength,
+                    record->adjacencyCells, record->time);
+        }
+    }
+}
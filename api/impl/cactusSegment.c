@@ -20,14 +20,17 @@ SegmentCapContents *segment_getContents(Segment *segment) {
 }
 
 Segment *segment_construct(Block *block, Event *event) {
-    assert(event != NULL);
     assert(block != NULL);
+    return segment_construct4(cactusDisk_getUniqueIDInterval(flower_getCactusDisk(block_getFlower(block)), 3), block, event);
+}
 
-    Name instance = cactusDisk_getUniqueIDInterval(flower_getCactusDisk(block_getFlower(block)), 3);
+Segment *segment_construct4(Name instance, Block *block, Event *event) {
+    assert(event != NULL);
+    assert(block != NULL);
     assert(instance != NULL_NAME);
 
     // Create the combined forward and reverse caps
-    Cap *cap = st_calloc(1, 6*sizeof(Cap) + sizeof(SegmentCapContents));
+    Cap *cap = slabArena_calloc(flower_getSlabArena(block_getFlower(block)), 6*sizeof(Cap) + sizeof(SegmentCapContents));
 
     // see above comment to decode what is set
     // Bits: strand / forward / part_of_segment / is_segment / left / event_not_sequence
@@ -120,7 +123,7 @@ Segment *segment_construct2(Block *block, int64_t startCoordinate, bool strand,
 void segment_destruct(Segment *segment) {
     block_removeInstance(segment_getBlock(segment), segment);
     assert(cap_isSegment(segment));
-    free(cap_forward(segment) ? segment - 2 : segment - 3);
+    slabArena_free(cap_forward(segment) ? segment - 2 : segment - 3, 6*sizeof(Cap) + sizeof(SegmentCapContents));
 }
 
 Block *segment_getBlock(Segment *segment) {
@@ -179,6 +182,16 @@ char *segment_getString(Segment *segment) {
             segment_getStrand(segment));
 }
 
+SequenceView segment_getView(Segment *segment) {
+    assert(cap_isSegment(segment));
+    Sequence *sequence = segment_getSequence(segment);
+    assert(sequence != NULL);
+    return sequence_getView(sequence,
+            segment_getStart(segment_getStrand(segment) ? segment
+                    : segment_getReverse(segment)), segment_getLength(segment),
+            segment_getStrand(segment));
+}
+
 Cap *segment_get5Cap(Segment *segment) {
     assert(cap_isSegment(segment));
     return cap_forward(segment) ? segment-2 : segment+2;
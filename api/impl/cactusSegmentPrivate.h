@@ -23,6 +23,12 @@
 Segment *segment_construct3(Name name, Block *block,
 		Cap *_5Cap, Cap *_3Cap);
 
+/*
+ * Constructs the segment and its two caps using the given instance name, which is the name of the 5 cap,
+ * the segment is instance+1 and the 3 cap is instance+2.
+ */
+Segment *segment_construct4(Name instance, Block *block, Event *event);
+
 /*
  * Destruct the segment, does not destruct ends.
  */
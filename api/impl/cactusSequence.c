@@ -44,6 +44,12 @@ Sequence *sequence_construct3(int64_t start, int64_t length,
             name, header, event, isTrivialSequence, cactusDisk);
 }
 
+Sequence *sequence_construct4(int64_t start, int64_t length, Name stringName,
+        const char *header, Event *event, CactusDisk *cactusDisk) {
+    return sequence_construct2(cactusDisk_getUniqueID(cactusDisk), start, length,
+            stringName, header, event, 0, cactusDisk);
+}
+
 Sequence *sequence_construct(int64_t start, int64_t length,
 		const char *string, const char *header, Event *event, CactusDisk *cactusDisk) {
 	return sequence_construct3(start, length, string, header, event, 0, cactusDisk);
@@ -92,3 +98,77 @@ void sequence_setHeader(Sequence *sequence,
 	free(sequence->header);
 	sequence->header = newHeader;
 }
+
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+//Sequence view functions.
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+
+SequenceView sequence_getView(Sequence *sequence, int64_t start, int64_t length, int64_t strand) {
+	assert(start >= sequence_getStart(sequence));
+	assert(length >= 0);
+	assert(start + length <= sequence_getStart(sequence) + sequence_getLength(sequence));
+	SequenceView view;
+	view.string = length > 0 ? cactusDisk_getPackedString(sequence->cactusDisk, sequence->stringName) : NULL;
+	assert(length == 0 || view.string != NULL);
+	view.start = start - sequence_getStart(sequence);
+	view.length = length;
+	view.strand = strand;
+	return view;
+}
+
+int64_t sequenceView_getLength(SequenceView *view) {
+	return view->length;
+}
+
+char sequenceView_getBase(SequenceView *view, int64_t i) {
+	assert(i >= 0 && i < view->length);
+	if (view->strand) {
+		return packedString_getBase(view->string, view->start + i);
+	}
+	return packedString_complement(packedString_getBase(view->string, view->start + view->length - 1 - i));
+}
+
+void sequenceView_copy(SequenceView *view, int64_t start, int64_t length, char *buffer) {
+	assert(start >= 0 && length >= 0 && start + length <= view->length);
+	if (view->strand) {
+		packedString_unpack(view->string, view->start + start, length, buffer);
+	} else {
+		packedString_unpack(view->string, view->start + view->length - start - length, length, buffer);
+		for (int64_t i = 0, j = length - 1; i <= j; i++, j--) {
+			char c = buffer[i];
+			buffer[i] = packedString_complement(buffer[j]);
+			buffer[j] = packedString_complement(c);
+		}
+	}
+}
+
+char *sequenceView_getString(SequenceView *view, int64_t start, int64_t length) {
+	char *string = st_malloc((length + 1) * sizeof(char));
+	sequenceView_copy(view, start, length, string);
+	string[length] = '\0';
+	return string;
+}
+
+void sequenceView_getIt(SequenceView *view, SequenceViewIt *it) {
+	it->view = *view;
+	it->i = 0;
+	it->bufferStart = 0;
+	it->bufferEnd = 0;
+}
+
+char sequenceViewIt_getNext(SequenceViewIt *it) {
+	if (it->i == it->bufferEnd) {
+		if (it->i == it->view.length) {
+			return '\0';
+		}
+		int64_t length = it->view.length - it->i < SEQUENCE_VIEW_IT_BUFFER_SIZE ? it->view.length - it->i : SEQUENCE_VIEW_IT_BUFFER_SIZE;
+		sequenceView_copy(&(it->view), it->i, length, it->buffer);
+		it->bufferStart = it->i;
+		it->bufferEnd = it->i + length;
+	}
+	return it->buffer[it->i++ - it->bufferStart];
+}
@@ -0,0 +1,179 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include "cactusGlobalsPrivate.h"
+
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+//Basic slab arena functions.
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+
+/*
+ * Each object is preceded by a header pointing to its slab, which points to its arena, so that it can be freed
+ * without knowing which flower it was allocated for.
+ */
+#define SLAB_HEADER_SIZE sizeof(Slab *)
+#define SLAB_MIN_OBJECTS 16
+#define SLAB_MAX_OBJECTS 4096
+#define SLAB_MAX_SIZE_CLASSES 4 // One for each of caps, ends, segments and blocks
+
+typedef struct _slab Slab;
+
+typedef struct _slabSizeClass {
+    size_t size; // Size of the objects, zero if the class is unused
+    size_t chunkSize; // Size of the objects with their header, rounded to the alignment of a pointer
+    int64_t slabObjects; // Number of objects in the next slab
+    Slab *availableSlabs; // The slabs with room for another object, most recently freed into or created first
+} SlabSizeClass;
+
+/*
+ * A slab is a single allocation holding this struct followed by its objects. It is freed as soon as none of its
+ * objects are live, so the memory of a flower shrinks as its objects are destroyed.
+ */
+struct _slab {
+    SlabArena *arena;
+    SlabSizeClass *sizeClass;
+    int64_t objects; // Number of objects the slab holds
+    int64_t liveObjects;
+    char *next, *end; // The unallocated part of the slab
+    void *freeList; // Freed objects, linked through their first word
+    Slab *previousAvailable, *nextAvailable; // Links in availableSlabs, if the slab is in it
+};
+
+/*
+ * The arena of a flower is only used by the task that is processing the flower, as with the other modifications
+ * of a flower, so neither the arena nor its slabs are locked.
+ */
+struct _slabArena {
+    SlabSizeClass sizeClasses[SLAB_MAX_SIZE_CLASSES];
+    int64_t slabNumber;
+    int64_t liveObjects;
+    bool released; // If slabArena_destruct has been called
+};
+
+SlabArena *slabArena_construct(void) {
+    return st_calloc(1, sizeof(SlabArena));
+}
+
+void slabArena_destruct(SlabArena *arena) {
+    arena->released = 1;
+    if (arena->liveObjects == 0) {
+        assert(arena->slabNumber == 0); // Every slab has been freed with its last object
+        free(arena);
+    }
+}
+
+int64_t slabArena_getSlabNumber(SlabArena *arena) {
+    return arena->slabNumber;
+}
+
+static SlabSizeClass *getSizeClass(SlabArena *arena, size_t size) {
+    for (int64_t i = 0; i < SLAB_MAX_SIZE_CLASSES; i++) {
+        SlabSizeClass *sizeClass = &(arena->sizeClasses[i]);
+        if (sizeClass->size == size) {
+            return sizeClass;
+        }
+        if (sizeClass->size == 0) {
+            sizeClass->size = size;
+            sizeClass->chunkSize = SLAB_HEADER_SIZE + ((size + sizeof(void *) - 1) / sizeof(void *)) * sizeof(void *);
+            sizeClass->slabObjects = SLAB_MIN_OBJECTS;
+            return sizeClass;
+        }
+    }
+    st_errAbort("Too many object sizes allocated from a slab arena");
+    return NULL;
+}
+
+static void slab_addToAvailable(Slab *slab) {
+    SlabSizeClass *sizeClass = slab->sizeClass;
+    slab->previousAvailable = NULL;
+    slab->nextAvailable = sizeClass->availableSlabs;
+    if (sizeClass->availableSlabs != NULL) {
+        sizeClass->availableSlabs->previousAvailable = slab;
+    }
+    sizeClass->availableSlabs = slab;
+}
+
+static void slab_removeFromAvailable(Slab *slab) {
+    if (slab->previousAvailable != NULL) {
+        slab->previousAvailable->nextAvailable = slab->nextAvailable;
+    } else {
+        assert(slab->sizeClass->availableSlabs == slab);
+        slab->sizeClass->availableSlabs = slab->nextAvailable;
+    }
+    if (slab->nextAvailable != NULL) {
+        slab->nextAvailable->previousAvailable = slab->previousAvailable;
+    }
+}
+
+static Slab *slab_construct(SlabArena *arena, SlabSizeClass *sizeClass) {
+    size_t slabSize = sizeof(Slab) + sizeClass->slabObjects * sizeClass->chunkSize;
+    Slab *slab = st_malloc(slabSize);
+    slab->arena = arena;
+    slab->sizeClass = sizeClass;
+    slab->objects = sizeClass->slabObjects;
+    slab->liveObjects = 0;
+    slab->next = (char *)slab + sizeof(Slab);
+    slab->end = (char *)slab + slabSize;
+    slab->freeList = NULL;
+    slab_addToAvailable(slab);
+    arena->slabNumber++;
+    if (sizeClass->slabObjects < SLAB_MAX_OBJECTS) {
+        sizeClass->slabObjects *= 2;
+    }
+    return slab;
+}
+
+void *slabArena_calloc(SlabArena *arena, size_t size) {
+    assert(!arena->released);
+    assert(size >= sizeof(void *));
+    SlabSizeClass *sizeClass = getSizeClass(arena, size);
+    Slab *slab = sizeClass->availableSlabs;
+    if (slab == NULL) {
+        slab = slab_construct(arena, sizeClass);
+    }
+    char *chunk;
+    if (slab->freeList != NULL) {
+        chunk = (char *)slab->freeList - SLAB_HEADER_SIZE;
+        slab->freeList = *(void **)slab->freeList;
+    } else {
+        assert(slab->next < slab->end);
+        chunk = slab->next;
+        slab->next += sizeClass->chunkSize;
+    }
+    if (++slab->liveObjects == slab->objects) {
+        slab_removeFromAvailable(slab);
+    }
+    *(Slab **)chunk = slab;
+    arena->liveObjects++;
+    void *object = chunk + SLAB_HEADER_SIZE;
+    memset(object, 0, size);
+    return object;
+}
+
+void slabArena_free(void *object, size_t size) {
+    Slab *slab = *(Slab **)((char *)object - SLAB_HEADER_SIZE);
+    SlabArena *arena = slab->arena;
+    assert(slab->sizeClass->size == size);
+    assert(slab->liveObjects > 0 && arena->liveObjects > 0);
+    arena->liveObjects--;
+    if (slab->liveObjects-- == slab->objects) { // The slab was full, so has room again
+        slab_addToAvailable(slab);
+    }
+    if (slab->liveObjects == 0) { // Return the slab to the allocator
+        slab_removeFromAvailable(slab);
+        free(slab);
+        arena->slabNumber--;
+        if (arena->liveObjects == 0 && arena->released) {
+            assert(arena->slabNumber == 0);
+            free(arena);
+        }
+    } else {
+        *(void **)object = slab->freeList;
+        slab->freeList = object;
+    }
+}
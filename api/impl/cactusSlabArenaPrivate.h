@@ -0,0 +1,50 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#ifndef CACTUS_SLAB_ARENA_PRIVATE_H_
+#define CACTUS_SLAB_ARENA_PRIVATE_H_
+
+#include "cactusGlobals.h"
+
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+//Slab arena, from which the caps, ends, segments and blocks
+//of a flower are allocated.
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+
+typedef struct _slabArena SlabArena;
+
+/*
+ * Constructs an empty arena.
+ */
+SlabArena *slabArena_construct(void);
+
+/*
+ * Releases the arena. The arena is freed once every object allocated from it has been freed, which is
+ * immediately if the objects have all already been freed.
+ */
+void slabArena_destruct(SlabArena *arena);
+
+/*
+ * Gets a zeroed object of the given size from the arena. Objects of each size are bump allocated from slabs that
+ * grow geometrically, so small flowers use little memory, reusing freed objects of the same size first.
+ * Not thread safe, as with the other modifications of a flower.
+ */
+void *slabArena_calloc(SlabArena *arena, size_t size);
+
+/*
+ * Returns an object of the given size to the arena it was allocated from. The slab holding the object is freed
+ * if none of its objects are left.
+ */
+void slabArena_free(void *object, size_t size);
+
+/*
+ * Gets the number of slabs the arena holds.
+ */
+int64_t slabArena_getSlabNumber(SlabArena *arena);
+
+#endif
@@ -20,8 +20,11 @@
 #include "cactusSequence.h"
 #include "cactusFlower.h"
 #include "cactusDisk.h"
+#include "cactusPackedString.h"
 #include "cactusMisc.h"
 #include "cactusTestCommon.h"
+#include "cactusPerfReport.h"
+#include "cactusFlowerCost.h"
 #include "cactus_params_parser.h"
 
 #endif
@@ -32,17 +32,19 @@ CactusDisk *cactusDisk_construct();
 void cactusDisk_destruct(CactusDisk *cactusDisk);
 
 /*
- * Retrieves the next unique ID.
+ * Retrieves the next unique ID. Within a parallel region each thread takes IDs from its own block,
+ * taken with cactusDisk_getUniqueIDInterval, so IDs are unique but not issued in order across threads.
  */
 int64_t cactusDisk_getUniqueID(CactusDisk *cactusDisk);
 
 /*
  * Retrieves a contiguous interval of unique ids starting from the return value to return value + intervalSize (exclusive).
+ * Lock free.
  */
 int64_t cactusDisk_getUniqueIDInterval(CactusDisk *cactusDisk, int64_t intervalSize);
 
 /*
- * Gets a flower the cactusDisk contains. If the flower is not in memory it will be loaded. If not in memory or on disk, returns NULL.
+ * Gets a flower the cactusDisk contains. Flowers and sequences are held in sharded maps, so concurrent lookups rarely contend. If the flower is not in memory it will be loaded. If not in memory or on disk, returns NULL.
  */
 Flower *cactusDisk_getFlower(CactusDisk *cactusDisk, Name flowerName);
 
@@ -56,4 +58,38 @@ Sequence *cactusDisk_getSequence(CactusDisk *cactusDisk, Name sequenceName);
  */
 EventTree *cactusDisk_getEventTree(CactusDisk *cactusDisk);
 
+/*
+ * Adds a packed string to the database, taking ownership of it. Returns the name of the string, as with
+ * cactusDisk_addString. Allows strings to be packed in parallel before they are added.
+ */
+Name cactusDisk_addPackedString(CactusDisk *cactusDisk, PackedString *packedString);
+
+/*
+ * Memory maps the given file read only for the lifetime of the cactus disk, returning the mapping and setting
+ * fileLength to the length of the file. Pages of the file are only read when they are accessed.
+ * Returns NULL if the file is empty. The file must not be modified while the cactus disk exists.
+ */
+const char *cactusDisk_mapFile(CactusDisk *cactusDisk, const char *fileName, int64_t *fileLength);
+
+/*
+ * Adds a string held in a file mapped with cactusDisk_mapFile to the database, without reading it.
+ * The string has the given length and, as in a faidx index, is split into lines of lineBases characters,
+ * each lineBytes bytes long including the line terminator, the first starting at bases.
+ * Returns the name of the string, as with cactusDisk_addString.
+ */
+Name cactusDisk_addMappedString(CactusDisk *cactusDisk, const char *bases, int64_t length, int64_t lineBases,
+                                int64_t lineBytes);
+
+/*
+ * Writes a binary snapshot of the cactus disk, including its strings, event tree,
+ * sequences and all the flowers it contains, to the given file handle.
+ */
+void cactusDisk_write(CactusDisk *cactusDisk, FILE *fileHandle);
+
+/*
+ * Constructs a cactus disk from a snapshot written by cactusDisk_write. The names of all the objects
+ * are preserved, as is the order in which the ends/caps/segments are iterated.
+ */
+CactusDisk *cactusDisk_read(FILE *fileHandle);
+
 #endif
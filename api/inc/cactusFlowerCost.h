@@ -0,0 +1,74 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#ifndef CACTUS_FLOWER_COST_H_
+#define CACTUS_FLOWER_COST_H_
+
+#include "cactusGlobals.h"
+
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+//Flower cost model, estimates the time a stage takes on a
+//flower, used to process the most expensive flowers first.
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+
+/*
+ * The features of a flower a cost is estimated from: a constant, the numbers of caps and ends, the total base length
+ * and the adjacency cells, the sum over the ends of the number of adjacencies of the end times the square of the
+ * length of the longest, each length capped at FLOWER_COST_MAX_ADJACENCY_LENGTH. The last approximates the
+ * dynamic programming done to align the ends, e.g. the rows times the square of the window of a poa alignment.
+ */
+#define FLOWER_COST_FEATURE_NUMBER 5
+#define FLOWER_COST_MAX_ADJACENCY_LENGTH 10000
+
+typedef struct _flowerCostModel FlowerCostModel;
+
+/*
+ * Gets the features of the flower. The adjacency cells take a walk over every cap of the flower, the other features
+ * are constant time, so if adjacencyCells is zero they are not computed and are left zero.
+ */
+void flowerCost_getFeatures(Flower *flower, double *features, bool adjacencyCells);
+
+/*
+ * Constructs a cost model in which the cost of a flower for bar is its total base length and for any other stage is
+ * its number of caps.
+ */
+FlowerCostModel *flowerCostModel_construct(void);
+
+void flowerCostModel_destruct(FlowerCostModel *model);
+
+/*
+ * Sets the weights of the features for the named stage, e.g. "bar".
+ */
+void flowerCostModel_setWeights(FlowerCostModel *model, const char *stageName, const double *weights);
+
+/*
+ * Fits the weights of the named stage to the given samples, each an array of the features of a flower followed by
+ * the seconds the stage took on it, by non-negative least squares (Lawson and Hanson). Returns non-zero
+ * if the weights were fitted, zero if there were too few samples or no weight could be made positive, in which case
+ * the weights are unchanged.
+ */
+bool flowerCostModel_fit(FlowerCostModel *model, const char *stageName, stList *samples);
+
+/*
+ * Fits the weights of each stage to the flower timings in the given file, as written by perfReport_writeFlowerTimings.
+ */
+void flowerCostModel_fitFromFile(FlowerCostModel *model, const char *flowerTimingsFile);
+
+/*
+ * Gets the estimated cost of the flower for the named stage. The adjacency cells of the flower are only computed if
+ * the stage weights them.
+ */
+double flowerCostModel_getCost(FlowerCostModel *model, const char *stageName, Flower *flower);
+
+/*
+ * Sorts the flowers in descending order of their estimated cost for the named stage, ties keeping their order.
+ * The costs of many flowers are computed in parallel, unless already in a parallel region.
+ */
+void flowerCostModel_sortFlowers(FlowerCostModel *model, const char *stageName, stList *flowers);
+
+#endif
@@ -0,0 +1,71 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#ifndef CACTUS_PACKED_STRING_H_
+#define CACTUS_PACKED_STRING_H_
+
+#include "cactusGlobals.h"
+
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+//Packed string functions, used by the cactus disk to hold
+//sequence strings in memory.
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+
+/*
+ * A string packed with two bits per A, C, G or T. Any other characters (Ns, IUPAC codes, etc.) are
+ * held as runs of identical characters and lower case (soft masked) bases as intervals, both in side tables
+ * sorted by position. Unpacking gives back exactly the string that was packed. Alternatively the string may be
+ * left in a memory mapped file, to be read only when it is unpacked.
+ */
+/*
+ * Packs the given string.
+ */
+PackedString *packedString_construct(const char *string);
+
+/*
+ * Constructs a packed string that is not packed but is read, when unpacked, from a string of the given length held in
+ * a memory mapped file, split into lines as described for cactusDisk_addMappedString. The mapping must outlive
+ * the packed string.
+ */
+PackedString *packedString_constructMapped(const char *bases, int64_t length, int64_t lineBases, int64_t lineBytes);
+
+void packedString_destruct(PackedString *packedString);
+
+/*
+ * Gets the length of the string.
+ */
+int64_t packedString_getLength(PackedString *packedString);
+
+/*
+ * Unpacks the length characters of the string starting from start into the given buffer, which
+ * must have space for them. Does not null terminate the buffer.
+ */
+void packedString_unpack(PackedString *packedString, int64_t start, int64_t length, char *buffer);
+
+/*
+ * Gets the character at position i of the string.
+ */
+char packedString_getBase(PackedString *packedString, int64_t i);
+
+/*
+ * Gets the complement of the character, as used by stString_reverseComplementString. Characters other than
+ * A, C, G and T (in either case) are their own complement.
+ */
+char packedString_complement(char c);
+
+/*
+ * Gets a copy of the substring of the given length starting from start, as in stString_getSubString.
+ */
+char *packedString_getSubString(PackedString *packedString, int64_t start, int64_t length);
+
+/*
+ * Gets the number of bytes used by the packed string.
+ */
+int64_t packedString_getSizeInBytes(PackedString *packedString);
+
+#endif
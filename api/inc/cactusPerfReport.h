@@ -0,0 +1,116 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#ifndef CACTUS_PERF_REPORT_H_
+#define CACTUS_PERF_REPORT_H_
+
+#include "cactusGlobals.h"
+
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+//Performance report, records the cost of the stages of an
+//alignment and of the individual flowers processed within them.
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+
+typedef struct _perfReport PerfReport;
+
+/*
+ * Holds the state of a flower while it is being timed. The counts are taken
+ * when the timer is started, as the flower is modified by the stages that are timed.
+ */
+typedef struct _perfFlowerTimer {
+    Name flowerName;
+    int64_t capNumber;
+    int64_t endNumber;
+    int64_t totalBaseLength;
+    double adjacencyCells; // See flowerCost_getFeatures
+    double startTime;
+} PerfFlowerTimer;
+
+/*
+ * Constructs an empty report. For each stage in which flowers are timed the
+ * report keeps the topFlowerNumber slowest flowers.
+ */
+PerfReport *perfReport_construct(int64_t topFlowerNumber);
+
+/*
+ * Destructs the report.
+ */
+void perfReport_destruct(PerfReport *perfReport);
+
+/*
+ * Sets the report that library code (caf, bar, reference) records into, may be NULL, in which
+ * case nothing is recorded.
+ */
+void perfReport_setGlobal(PerfReport *perfReport);
+
+/*
+ * Sets if the adjacency cells of the timed flowers are recorded, by default they are. They are only written to the
+ * flower timings, and take a walk over every cap of the flower to compute, so can be skipped if the timings are not
+ * written; they are then recorded as zero.
+ */
+void perfReport_setRecordAdjacencyCells(PerfReport *perfReport, bool recordAdjacencyCells);
+
+/*
+ * Gets the report set with perfReport_setGlobal, or NULL if none is set.
+ */
+PerfReport *perfReport_getGlobal(void);
+
+/*
+ * Starts a stage. Stages started before the current stage is ended are nested within it.
+ * Stages must be started and ended by a single (the master) thread. Does nothing if perfReport is NULL.
+ */
+void perfReport_startStage(PerfReport *perfReport, const char *stageName);
+
+/*
+ * Ends the most recently started stage, recording its wall time, CPU time (summed over
+ * all threads) and the peak resident set size of the process at its end. Logs the times at info level.
+ */
+void perfReport_endStage(PerfReport *perfReport);
+
+/*
+ * Adds the wall and CPU time of a task to the named sub-stage of the current stage, creating the sub-stage for
+ * the first task. This reports the phases of a stage whose work is interleaved as tasks, e.g. bar and reference
+ * construction in scheduleBarAndReference. As the times of concurrent tasks are summed, the times of the sub-stages
+ * can exceed the wall time of the enclosing stage. Thread safe. Does nothing if perfReport is NULL.
+ */
+void perfReport_addTaskTime(PerfReport *perfReport, const char *stageName, double wallTime, double cpuTime);
+
+/*
+ * Starts timing the given flower, recording its cap, end and base counts and, unless disabled with
+ * perfReport_setRecordAdjacencyCells, its adjacency cells. Thread safe.
+ */
+void perfReport_startFlower(PerfReport *perfReport, Flower *flower, PerfFlowerTimer *timer);
+
+/*
+ * Stops timing a flower and records its time against the named flower stage, e.g. "bar". Thread safe.
+ */
+void perfReport_endFlower(PerfReport *perfReport, const char *stageName, PerfFlowerTimer *timer);
+
+/*
+ * Writes the report as a JSON object.
+ */
+void perfReport_writeJson(PerfReport *perfReport, FILE *fileHandle);
+
+/*
+ * Writes the time of every flower timed, one tab separated line per flower giving the stage, the flower name, the
+ * cap, end and base counts, the adjacency cells and the seconds, after a header line starting with '#'. This is the
+ * input flowerCostModel_fitFromFile fits a cost model to.
+ */
+void perfReport_writeFlowerTimings(PerfReport *perfReport, FILE *fileHandle);
+
+/*
+ * Gets the monotonic wall clock time in seconds.
+ */
+double perfReport_getWallTime(void);
+
+/*
+ * Gets the CPU time in seconds used by the calling thread.
+ */
+double perfReport_getThreadCpuTime(void);
+
+#endif
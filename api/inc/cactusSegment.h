@@ -8,6 +8,7 @@
 #define CACTUS_ATOM_INSTANCE_H_
 
 #include "cactusGlobals.h"
+#include "cactusSequence.h"
 
 ////////////////////////////////////////////////
 ////////////////////////////////////////////////
@@ -90,6 +91,11 @@ Sequence *segment_getSequence(Segment *segment);
  */
 char *segment_getString(Segment *segment);
 
+/*
+ * Gets a view of the string of the segment (see sequence_getView). The segment must have a sequence.
+ */
+SequenceView segment_getView(Segment *segment);
+
 /*
  * Gets the left cap of the segment.
  */
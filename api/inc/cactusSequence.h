@@ -31,6 +31,12 @@ Sequence *sequence_construct(int64_t start, int64_t length, const char *string,
 Sequence *sequence_construct3(int64_t start, int64_t length, const char *string, const char *header, Event *event,
         bool isTrivialSequence, CactusDisk *cactusDisk);
 
+/*
+ * Constructs a sequence whose string has already been added to the cactus disk, e.g. with cactusDisk_addMappedString.
+ */
+Sequence *sequence_construct4(int64_t start, int64_t length, Name stringName, const char *header, Event *event,
+        CactusDisk *cactusDisk);
+
 /*
  * Gets the name of the sequence.
  */
@@ -71,4 +77,73 @@ bool sequence_isTrivialSequence(Sequence *sequence);
  */
 void sequence_setHeader(Sequence *sequence, char *newHeader);
 
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+//Sequence views, which give access to substrings of
+//a sequence without allocating copies of them.
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+////////////////////////////////////////////////
+
+/*
+ * A read only view of a substring of a sequence, on either strand. Views are held by value and need no destruction.
+ */
+typedef struct _sequenceView {
+    PackedString *string; // The stored string of the sequence
+    int64_t start; // Offset in the stored (positive strand) string of the first position covered by the view
+    int64_t length;
+    bool strand; // If zero the view is of the reverse complement of the substring
+} SequenceView;
+
+#define SEQUENCE_VIEW_IT_BUFFER_SIZE 1024
+
+/*
+ * Iterates over the characters of a view, unpacking them a block at a time into a buffer.
+ */
+typedef struct _sequenceViewIt {
+    SequenceView view;
+    int64_t i; // The position in the view of the next character
+    int64_t bufferStart; // The position in the view of the first character in the buffer
+    int64_t bufferEnd; // The position in the view after the last character in the buffer
+    char buffer[SEQUENCE_VIEW_IT_BUFFER_SIZE];
+} SequenceViewIt;
+
+/*
+ * Gets a view of the substring of the sequence, with the same coordinates as sequence_getString.
+ */
+SequenceView sequence_getView(Sequence *sequence, int64_t start, int64_t length, int64_t strand);
+
+/*
+ * Gets the length of the view.
+ */
+int64_t sequenceView_getLength(SequenceView *view);
+
+/*
+ * Gets the character at position i of the view, reverse complemented if the view is of the negative strand.
+ * For scanning a view sequenceViewIt_getNext or sequenceView_copy are faster.
+ */
+char sequenceView_getBase(SequenceView *view, int64_t i);
+
+/*
+ * Copies the length characters of the view starting at position start into the buffer, as sequenceView_getBase
+ * would return them. The buffer is not null terminated.
+ */
+void sequenceView_copy(SequenceView *view, int64_t start, int64_t length, char *buffer);
+
+/*
+ * Gets a copy of the length characters of the view starting at position start, as a null terminated string.
+ */
+char *sequenceView_getString(SequenceView *view, int64_t start, int64_t length);
+
+/*
+ * Starts an iteration over the characters of the view.
+ */
+void sequenceView_getIt(SequenceView *view, SequenceViewIt *it);
+
+/*
+ * Gets the next character of the view, or '\0' once all the characters have been returned.
+ */
+char sequenceViewIt_getNext(SequenceViewIt *it);
+
 #endif
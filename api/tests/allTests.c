@@ -20,6 +20,10 @@ CuSuite *cactusDiskTestSuite();
 CuSuite *cactusMiscTestSuite();
 CuSuite *cactusFlowerTestSuite();
 CuSuite *cactusParamsTestSuite(void);
+CuSuite *cactusPerfReportTestSuite(void);
+CuSuite *cactusFlowerCostTestSuite(void);
+CuSuite *cactusPackedStringTestSuite(void);
+CuSuite *cactusSlabArenaTestSuite(void);
 
 int cactusAPIRunAllTests(void) {
 	CuString *output = CuStringNew();
@@ -38,6 +42,10 @@ int cactusAPIRunAllTests(void) {
 	CuSuiteAddSuite(suite, cactusMiscTestSuite());
 	CuSuiteAddSuite(suite, cactusFlowerTestSuite());
     CuSuiteAddSuite(suite, cactusParamsTestSuite());
+    CuSuiteAddSuite(suite, cactusPerfReportTestSuite());
+    CuSuiteAddSuite(suite, cactusFlowerCostTestSuite());
+    CuSuiteAddSuite(suite, cactusPackedStringTestSuite());
+    CuSuiteAddSuite(suite, cactusSlabArenaTestSuite());
 	CuSuiteRun(suite);
 	CuSuiteSummary(suite, output);
 	CuSuiteDetails(suite, output);
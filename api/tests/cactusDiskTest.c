@@ -85,6 +85,140 @@ void testCactusDisk_getUniqueID_UniqueIntervals(CuTest* testCase) {
     cactusDisk_destruct(cactusDisk);
 }
 
+void testCactusDisk_getUniqueID_UniqueParallel(CuTest* testCase) {
+    CactusDisk *cactusDisk = cactusDisk_construct();
+    int64_t nameNumber = 100000;
+    Name *names = st_malloc(nameNumber * sizeof(Name));
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(static, 1)
+#endif
+    for (int64_t i = 0; i < nameNumber; i++) {
+        names[i] = cactusDisk_getUniqueID(cactusDisk);
+    }
+    stSortedSet *uniqueNames = stSortedSet_construct3(testCactusDisk_getUniqueID_UniqueP, free);
+    for (int64_t i = 0; i < nameNumber; i++) {
+        CuAssertTrue(testCase, names[i] > 0);
+        CuAssertTrue(testCase, names[i] != NULL_NAME);
+        char *cA = cactusMisc_nameToString(names[i]);
+        CuAssertTrue(testCase, stSortedSet_search(uniqueNames, cA) == NULL);
+        stSortedSet_insert(uniqueNames, cA);
+    }
+    // Names issued outside of a parallel region do not collide with those issued within one
+    Name name = cactusDisk_getUniqueID(cactusDisk);
+    char *cA = cactusMisc_nameToString(name);
+    CuAssertTrue(testCase, stSortedSet_search(uniqueNames, cA) == NULL);
+    free(cA);
+    stSortedSet_destruct(uniqueNames);
+    free(names);
+    cactusDisk_destruct(cactusDisk);
+}
+
+void testCactusDisk_getString(CuTest* testCase) {
+    CactusDisk *cactusDisk = cactusDisk_construct();
+    // Enough strings for the string table to grow a few times
+    int64_t stringNumber = 10000;
+    Name *names = st_malloc(stringNumber * sizeof(Name));
+    for (int64_t i = 0; i < stringNumber; i++) {
+        char *string = stString_print("ACGT%" PRIi64 "", i);
+        names[i] = cactusDisk_addString(cactusDisk, string);
+        free(string);
+    }
+    for (int64_t i = 0; i < stringNumber; i++) {
+        char *string = stString_print("ACGT%" PRIi64 "", i);
+        char *string2 = cactusDisk_getString(cactusDisk, names[i], 0, strlen(string), 1, strlen(string));
+        CuAssertStrEquals(testCase, string, string2);
+        free(string2);
+        string2 = cactusDisk_getString(cactusDisk, names[i], 1, 3, 1, strlen(string));
+        CuAssertStrEquals(testCase, "CGT", string2);
+        free(string2);
+        string2 = cactusDisk_getString(cactusDisk, names[i], 0, 2, 0, strlen(string));
+        CuAssertStrEquals(testCase, "GT", string2);
+        free(string2);
+        free(string);
+    }
+    CuAssertTrue(testCase, cactusDisk_getPackedString(cactusDisk, cactusDisk_getUniqueID(cactusDisk)) == NULL);
+    stList *stringNames = cactusDisk_getStringNames(cactusDisk);
+    CuAssertIntEquals(testCase, stringNumber, stList_length(stringNames));
+    stList_destruct(stringNames);
+    free(names);
+    cactusDisk_destruct(cactusDisk);
+}
+
+void testCactusDisk_writeAndRead(CuTest* testCase) {
+    CactusDisk *cactusDisk = cactusDisk_construct();
+    EventTree *eventTree = eventTree_construct2(cactusDisk);
+    Event *event = event_construct3("ONE", 0.5, eventTree_getRootEvent(eventTree), eventTree);
+    Sequence *sequence = sequence_construct(1, 10, "ACTGACTGAG", "FOO", event, cactusDisk);
+    Flower *flower = flower_construct(cactusDisk);
+    flower_addSequence(flower, sequence);
+    End *end1 = end_construct2(0, 1, flower);
+    End *end2 = end_construct2(1, 1, flower);
+    Block *block = block_construct(3, flower);
+    Cap *cap1 = cap_construct2(end1, 0, 1, sequence);
+    Cap *cap2 = cap_construct2(end2, 11, 1, sequence);
+    Segment *segment = segment_construct2(block, 4, 1, sequence);
+    cap_makeAdjacent(cap1, segment_get5Cap(segment));
+    cap_makeAdjacent(segment_get3Cap(segment), cap2);
+    Group *group1 = group_construct2(flower);
+    Group *group2 = group_construct2(flower);
+    end_setGroup(end1, group1);
+    end_setGroup(block_get5End(block), group1);
+    end_setGroup(block_get3End(block), group2);
+    end_setGroup(end2, group2);
+    Chain *chain = chain_construct(flower);
+    link_construct(end1, block_get5End(block), group1, chain);
+    link_construct(block_get3End(block), end2, group2, chain);
+    flower_setBuiltBlocks(flower, 1);
+
+    FILE *fileHandle = tmpfile();
+    cactusDisk_write(cactusDisk, fileHandle);
+    rewind(fileHandle);
+    CactusDisk *cactusDisk2 = cactusDisk_read(fileHandle);
+    fclose(fileHandle);
+
+    // Check the event tree and sequences
+    EventTree *eventTree2 = cactusDisk_getEventTree(cactusDisk2);
+    CuAssertIntEquals(testCase, 2, eventTree_getEventNumber(eventTree2));
+    Event *event2 = eventTree_getEvent(eventTree2, event_getName(event));
+    CuAssertStrEquals(testCase, "ONE", event_getHeader(event2));
+    CuAssertTrue(testCase, event_getParent(event2) == eventTree_getRootEvent(eventTree2));
+    Sequence *sequence2 = cactusDisk_getSequence(cactusDisk2, sequence_getName(sequence));
+    CuAssertTrue(testCase, sequence2 != NULL);
+    CuAssertStrEquals(testCase, "FOO", sequence_getHeader(sequence2));
+    char *string = sequence_getString(sequence2, 2, 6, 1);
+    CuAssertStrEquals(testCase, "CTGACT", string);
+    free(string);
+
+    // Check the flower
+    Flower *flower2 = cactusDisk_getFlower(cactusDisk2, flower_getName(flower));
+    CuAssertTrue(testCase, flower2 != NULL);
+    CuAssertTrue(testCase, flower_builtBlocks(flower2));
+    CuAssertIntEquals(testCase, flower_getEndNumber(flower), flower_getEndNumber(flower2));
+    CuAssertIntEquals(testCase, flower_getCapNumber(flower), flower_getCapNumber(flower2));
+    CuAssertIntEquals(testCase, 1, flower_getBlockNumber(flower2));
+    CuAssertIntEquals(testCase, flower_getTotalBaseLength(flower), flower_getTotalBaseLength(flower2));
+    Block *block2 = flower_getBlock(flower2, block_getName(block));
+    CuAssertIntEquals(testCase, 3, block_getLength(block2));
+    Segment *segment2 = block_getFirst(block2);
+    CuAssertIntEquals(testCase, segment_getName(segment), segment_getName(segment2));
+    CuAssertIntEquals(testCase, 4, segment_getStart(segment2));
+    CuAssertTrue(testCase, segment_getSequence(segment2) == sequence2);
+    Cap *cap3 = flower_getCap(flower2, cap_getName(cap1));
+    CuAssertTrue(testCase, cap_getAdjacency(cap3) == segment_get5Cap(segment2));
+    CuAssertIntEquals(testCase, 0, cap_getCoordinate(cap3));
+    CuAssertTrue(testCase, end_getGroup(cap_getEnd(cap3)) == flower_getGroup(flower2, group_getName(group1)));
+    Chain *chain2 = flower_getChain(flower2, chain_getName(chain));
+    CuAssertTrue(testCase, chain2 != NULL);
+    CuAssertIntEquals(testCase, end_getName(end1), end_getName(link_get3End(chain_getFirst(chain2))));
+    CuAssertIntEquals(testCase, end_getName(end2), end_getName(link_get5End(chain_getLast(chain2))));
+
+    // New names must not collide with the loaded ones
+    CuAssertTrue(testCase, cactusDisk_getUniqueID(cactusDisk2) == cactusDisk_getUniqueID(cactusDisk));
+
+    cactusDisk_destruct(cactusDisk);
+    cactusDisk_destruct(cactusDisk2);
+}
+
 CuSuite* cactusDiskTestSuite(void) {
     CuSuite* suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, testCactusDisk_getFlower);
@@ -92,6 +226,9 @@ CuSuite* cactusDiskTestSuite(void) {
     SUITE_ADD_TEST(suite, testCactusDisk_getUniqueID);
     SUITE_ADD_TEST(suite, testCactusDisk_getUniqueID_Unique);
     SUITE_ADD_TEST(suite, testCactusDisk_getUniqueID_UniqueIntervals);
+    SUITE_ADD_TEST(suite, testCactusDisk_getUniqueID_UniqueParallel);
+    SUITE_ADD_TEST(suite, testCactusDisk_getString);
+    SUITE_ADD_TEST(suite, testCactusDisk_writeAndRead);
     SUITE_ADD_TEST(suite, testCactusDisk_constructAndDestruct);
     return suite;
 }
@@ -0,0 +1,116 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include "cactusGlobalsPrivate.h"
+
+void testFlowerCostModel_fit(CuTest* testCase) {
+    // Samples of a known model, with features of very different magnitudes
+    double weights[FLOWER_COST_FEATURE_NUMBER] = { 0.5, 0.0, 0.01, 1e-6, 2e-9 };
+    stList *samples = stList_construct3(0, free);
+    for (int64_t i = 0; i < 100; i++) {
+        double *sample = st_malloc((FLOWER_COST_FEATURE_NUMBER + 1) * sizeof(double));
+        sample[0] = 1.0;
+        sample[1] = st_randomInt(0, 1000);
+        sample[2] = st_randomInt(0, 500);
+        sample[3] = st_randomInt(0, 10000000);
+        sample[4] = st_randomInt(0, 1000000) * 1000.0;
+        sample[FLOWER_COST_FEATURE_NUMBER] = 0.0;
+        for (int64_t j = 0; j < FLOWER_COST_FEATURE_NUMBER; j++) {
+            sample[FLOWER_COST_FEATURE_NUMBER] += weights[j] * sample[j];
+        }
+        stList_append(samples, sample);
+    }
+
+    FlowerCostModel *model = flowerCostModel_construct();
+    CactusDisk *cactusDisk = cactusDisk_construct();
+    Flower *flower = flower_construct(cactusDisk);
+    double features[FLOWER_COST_FEATURE_NUMBER];
+    flowerCost_getFeatures(flower, features, 1);
+    CuAssertDblEquals(testCase, 1.0, features[0], 0.0);
+    for (int64_t j = 1; j < FLOWER_COST_FEATURE_NUMBER; j++) {
+        CuAssertDblEquals(testCase, 0.0, features[j], 0.0);
+    }
+
+    // The cost of an empty flower is the fitted constant
+    CuAssertTrue(testCase, flowerCostModel_fit(model, "bar", samples));
+    CuAssertDblEquals(testCase, weights[0], flowerCostModel_getCost(model, "bar", flower), 1e-3);
+
+    // Too few samples leave the weights unchanged
+    stList *fewSamples = stList_construct();
+    stList_append(fewSamples, stList_get(samples, 0));
+    CuAssertTrue(testCase, !flowerCostModel_fit(model, "bar", fewSamples));
+    CuAssertDblEquals(testCase, weights[0], flowerCostModel_getCost(model, "bar", flower), 1e-3);
+    stList_destruct(fewSamples);
+
+    stList_destruct(samples);
+    flowerCostModel_destruct(model);
+    cactusDisk_destruct(cactusDisk);
+}
+
+void testFlowerCostModel_fitNonNegative(CuTest* testCase) {
+    // The time grows with the ends but would be fitted with a negative constant, which is instead kept at zero
+    stList *samples = stList_construct3(0, free);
+    for (int64_t i = 0; i < 100; i++) {
+        double *sample = st_calloc(FLOWER_COST_FEATURE_NUMBER + 1, sizeof(double));
+        sample[0] = 1.0;
+        sample[2] = st_randomInt(100, 500);
+        sample[FLOWER_COST_FEATURE_NUMBER] = 0.01 * sample[2] - 1.0;
+        stList_append(samples, sample);
+    }
+
+    FlowerCostModel *model = flowerCostModel_construct();
+    CactusDisk *cactusDisk = cactusDisk_construct();
+    Flower *flower = flower_construct(cactusDisk);
+    CuAssertTrue(testCase, flowerCostModel_fit(model, "bar", samples));
+    CuAssertDblEquals(testCase, 0.0, flowerCostModel_getCost(model, "bar", flower), 0.0);
+    end_construct2(0, 0, flower);
+    CuAssertTrue(testCase, flowerCostModel_getCost(model, "bar", flower) > 0.0);
+
+    // No time can be fitted with a positive weight
+    for (int64_t i = 0; i < stList_length(samples); i++) {
+        double *sample = stList_get(samples, i);
+        sample[FLOWER_COST_FEATURE_NUMBER] = -1.0;
+    }
+    CuAssertTrue(testCase, !flowerCostModel_fit(model, "reference", samples));
+
+    stList_destruct(samples);
+    flowerCostModel_destruct(model);
+    cactusDisk_destruct(cactusDisk);
+}
+
+void testFlowerCostModel_sortFlowers(CuTest* testCase) {
+    CactusDisk *cactusDisk = cactusDisk_construct();
+    Flower *flower = flower_construct(cactusDisk);
+    Flower *flower2 = flower_construct(cactusDisk);
+    Flower *flower3 = flower_construct(cactusDisk);
+    end_construct2(0, 0, flower2);
+    end_construct2(0, 0, flower2);
+    end_construct2(0, 0, flower3);
+
+    FlowerCostModel *model = flowerCostModel_construct();
+    double weights[FLOWER_COST_FEATURE_NUMBER] = { 0.0, 0.0, 1.0, 0.0, 0.0 };
+    flowerCostModel_setWeights(model, "reference", weights);
+    CuAssertDblEquals(testCase, 2.0, flowerCostModel_getCost(model, "reference", flower2), 0.0);
+
+    stList *flowers = stList_construct();
+    stList_append(flowers, flower);
+    stList_append(flowers, flower3);
+    stList_append(flowers, flower2);
+    flowerCostModel_sortFlowers(model, "reference", flowers);
+    CuAssertPtrEquals(testCase, flower2, stList_get(flowers, 0));
+    CuAssertPtrEquals(testCase, flower3, stList_get(flowers, 1));
+    CuAssertPtrEquals(testCase, flower, stList_get(flowers, 2));
+
+    stList_destruct(flowers);
+    flowerCostModel_destruct(model);
+    cactusDisk_destruct(cactusDisk);
+}
+
+CuSuite* cactusFlowerCostTestSuite(void) {
+    CuSuite* suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, testFlowerCostModel_fit);
+    SUITE_ADD_TEST(suite, testFlowerCostModel_fitNonNegative);
+    SUITE_ADD_TEST(suite, testFlowerCostModel_sortFlowers);
+    return suite;
+}
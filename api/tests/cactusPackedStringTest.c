@@ -0,0 +1,73 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include <ctype.h>
+#include "cactusGlobalsPrivate.h"
+
+/*
+ * Makes a random string with runs of Ns, soft masked intervals and the odd IUPAC code.
+ */
+static char *getRandomString(int64_t length) {
+    char *string = st_malloc((length + 1) * sizeof(char));
+    const char *alphabet = "ACGTACGTACGTACGTNRY-";
+    bool lowerCase = 0;
+    for (int64_t i = 0; i < length;) {
+        if (st_random() < 0.05) {
+            lowerCase = !lowerCase;
+        }
+        char c = alphabet[st_randomInt(0, strlen(alphabet))];
+        int64_t runLength = c == 'N' ? st_randomInt(1, 50) : 1;
+        for (int64_t j = 0; j < runLength && i < length; j++) {
+            string[i++] = lowerCase ? tolower(c) : c;
+        }
+    }
+    string[length] = '\0';
+    return string;
+}
+
+void testPackedString_getSubString(CuTest* testCase) {
+    for (int64_t test = 0; test < 100; test++) {
+        int64_t length = st_randomInt(0, 500);
+        char *string = getRandomString(length);
+        PackedString *packedString = packedString_construct(string);
+        CuAssertIntEquals(testCase, length, packedString_getLength(packedString));
+        char *string2 = packedString_getSubString(packedString, 0, length);
+        CuAssertStrEquals(testCase, string, string2);
+        free(string2);
+        for (int64_t i = 0; i < 100 && length > 0; i++) {
+            int64_t start = st_randomInt(0, length);
+            int64_t subLength = st_randomInt(0, length - start + 1);
+            char *subString = stString_getSubString(string, start, subLength);
+            string2 = packedString_getSubString(packedString, start, subLength);
+            CuAssertStrEquals(testCase, subString, string2);
+            free(subString);
+            free(string2);
+        }
+        packedString_destruct(packedString);
+        free(string);
+    }
+}
+
+void testPackedString_getSizeInBytes(CuTest* testCase) {
+    // A long, mostly ACGT string should be packed into roughly a quarter of the space
+    char *string = st_malloc(100001 * sizeof(char));
+    for (int64_t i = 0; i < 100000; i++) {
+        string[i] = i < 50000 ? "ACGT"[st_randomInt(0, 4)] : (i < 60000 ? 'N' : "acgt"[st_randomInt(0, 4)]);
+    }
+    string[100000] = '\0';
+    PackedString *packedString = packedString_construct(string);
+    CuAssertTrue(testCase, packedString_getSizeInBytes(packedString) < 100000 / 4 + 1000);
+    char *string2 = packedString_getSubString(packedString, 0, 100000);
+    CuAssertStrEquals(testCase, string, string2);
+    free(string2);
+    packedString_destruct(packedString);
+    free(string);
+}
+
+CuSuite* cactusPackedStringTestSuite(void) {
+    CuSuite* suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, testPackedString_getSubString);
+    SUITE_ADD_TEST(suite, testPackedString_getSizeInBytes);
+    return suite;
+}
@@ -0,0 +1,144 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include "cactusGlobalsPrivate.h"
+
+static char *writeReport(PerfReport *perfReport) {
+    FILE *fileHandle = tmpfile();
+    perfReport_writeJson(perfReport, fileHandle);
+    int64_t length = ftell(fileHandle);
+    rewind(fileHandle);
+    char *report = st_calloc(length + 1, sizeof(char));
+    size_t i = fread(report, sizeof(char), length, fileHandle);
+    assert(i == length);
+    fclose(fileHandle);
+    return report;
+}
+
+void testPerfReport_stages(CuTest* testCase) {
+    PerfReport *perfReport = perfReport_construct(1);
+    perfReport_startStage(perfReport, "caf");
+    perfReport_startStage(perfReport, "caf_annealing_round_0");
+    perfReport_endStage(perfReport);
+    perfReport_endStage(perfReport);
+    perfReport_startStage(perfReport, "bar");
+    perfReport_endStage(perfReport);
+
+    char *report = writeReport(perfReport);
+    CuAssertTrue(testCase, strstr(report, "{\"name\": \"caf\", \"wallSeconds\"") != NULL);
+    CuAssertTrue(testCase, strstr(report, "{\"name\": \"caf_annealing_round_0\", \"parent\": \"caf\"") != NULL);
+    CuAssertTrue(testCase, strstr(report, "{\"name\": \"bar\", \"wallSeconds\"") != NULL);
+    CuAssertTrue(testCase, strstr(report, "\"flowerStages\": []") != NULL);
+    free(report);
+    perfReport_destruct(perfReport);
+}
+
+void testPerfReport_taskTimes(CuTest* testCase) {
+    PerfReport *perfReport = perfReport_construct(1);
+    perfReport_startStage(perfReport, "bar_and_reference");
+#if defined(_OPENMP)
+#pragma omp parallel for
+#endif
+    for (int64_t i = 0; i < 10; i++) {
+        perfReport_addTaskTime(perfReport, i % 2 == 0 ? "bar" : "reference_top_down", 1.0, 0.5);
+    }
+    perfReport_endStage(perfReport);
+    perfReport_addTaskTime(perfReport, "hal", 2.0, 2.0);
+    CuAssertTrue(testCase, perfReport_getThreadCpuTime() >= 0.0);
+
+    char *report = writeReport(perfReport);
+    CuAssertTrue(testCase, strstr(report, "{\"name\": \"bar\", \"parent\": \"bar_and_reference\", \"tasks\": 5, "
+                                          "\"wallSeconds\": 5.000000, \"cpuSeconds\": 2.500000") != NULL);
+    CuAssertTrue(testCase, strstr(report, "{\"name\": \"reference_top_down\", \"parent\": \"bar_and_reference\", "
+                                          "\"tasks\": 5, \"wallSeconds\": 5.000000") != NULL);
+    // Task times added outside of any stage are top level stages
+    CuAssertTrue(testCase, strstr(report, "{\"name\": \"hal\", \"tasks\": 1, \"wallSeconds\": 2.000000") != NULL);
+    free(report);
+    perfReport_destruct(perfReport);
+}
+
+void testPerfReport_flowers(CuTest* testCase) {
+    CactusDisk *cactusDisk = cactusDisk_construct();
+    Flower *flower = flower_construct(cactusDisk);
+    Flower *flower2 = flower_construct(cactusDisk);
+    end_construct2(0, 0, flower);
+    PerfReport *perfReport = perfReport_construct(1);
+
+    perfReport_setGlobal(perfReport);
+    CuAssertPtrEquals(testCase, perfReport, perfReport_getGlobal());
+
+    PerfFlowerTimer timer, timer2;
+    perfReport_startFlower(perfReport, flower, &timer);
+    perfReport_startFlower(perfReport, flower2, &timer2);
+    CuAssertIntEquals(testCase, 1, timer.endNumber);
+    CuAssertIntEquals(testCase, 0, timer2.endNumber);
+    perfReport_endFlower(perfReport, "bar", &timer2);
+    // Make sure the first flower is the slowest
+    timer.startTime -= 20.0;
+    perfReport_endFlower(perfReport, "bar", &timer);
+
+    char *report = writeReport(perfReport);
+    CuAssertTrue(testCase, strstr(report, "{\"name\": \"bar\", \"flowers\": 2") != NULL);
+    char *slowest = stString_print("{\"name\": %" PRIi64 ", \"seconds\": 20", flower_getName(flower));
+    CuAssertTrue(testCase, strstr(report, slowest) != NULL);
+    free(slowest);
+    // Only one flower is listed
+    slowest = stString_print("{\"name\": %" PRIi64 ",", flower_getName(flower2));
+    CuAssertTrue(testCase, strstr(report, slowest) == NULL);
+    free(slowest);
+    CuAssertTrue(testCase, strstr(report, "{\"maxSeconds\": 100, \"flowers\": 1}") != NULL);
+    free(report);
+
+    perfReport_destruct(perfReport);
+    CuAssertPtrEquals(testCase, NULL, perfReport_getGlobal());
+    cactusDisk_destruct(cactusDisk);
+}
+
+void testPerfReport_flowerTimingsRoundTrip(CuTest* testCase) {
+    // Flowers with 1 to 20 ends, each timed as taking 0.5 + 0.1 * ends seconds
+    CactusDisk *cactusDisk = cactusDisk_construct();
+    PerfReport *perfReport = perfReport_construct(1);
+    stList *flowers = stList_construct();
+    for (int64_t i = 1; i <= 20; i++) {
+        Flower *flower = flower_construct(cactusDisk);
+        for (int64_t j = 0; j < i; j++) {
+            end_construct2(0, 0, flower);
+        }
+        stList_append(flowers, flower);
+        PerfFlowerTimer timer;
+        perfReport_startFlower(perfReport, flower, &timer);
+        timer.startTime -= 0.5 + 0.1 * i;
+        perfReport_endFlower(perfReport, "bar", &timer);
+    }
+
+    char *flowerTimingsFile = getTempFile();
+    FILE *fileHandle = fopen(flowerTimingsFile, "w");
+    perfReport_writeFlowerTimings(perfReport, fileHandle);
+    fclose(fileHandle);
+
+    // The fitted model predicts the times, replacing the default model of bar, and leaves other stages unchanged
+    FlowerCostModel *model = flowerCostModel_construct();
+    flowerCostModel_fitFromFile(model, flowerTimingsFile);
+    for (int64_t i = 1; i <= 20; i++) {
+        Flower *flower = stList_get(flowers, i - 1);
+        CuAssertDblEquals(testCase, 0.5 + 0.1 * i, flowerCostModel_getCost(model, "bar", flower), 0.01);
+        CuAssertDblEquals(testCase, 0.0, flowerCostModel_getCost(model, "reference", flower), 0.0);
+    }
+
+    remove(flowerTimingsFile);
+    free(flowerTimingsFile);
+    flowerCostModel_destruct(model);
+    stList_destruct(flowers);
+    perfReport_destruct(perfReport);
+    cactusDisk_destruct(cactusDisk);
+}
+
+CuSuite* cactusPerfReportTestSuite(void) {
+    CuSuite* suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, testPerfReport_stages);
+    SUITE_ADD_TEST(suite, testPerfReport_taskTimes);
+    SUITE_ADD_TEST(suite, testPerfReport_flowers);
+    SUITE_ADD_TEST(suite, testPerfReport_flowerTimingsRoundTrip);
+    return suite;
+}
@@ -69,6 +69,55 @@ void testSequence_getString(CuTest* testCase) {
     }
 }
 
+void testSequence_getView(CuTest* testCase) {
+    cactusSequenceTestSetup(testCase);
+    //String is ACTGGCACTG
+    SequenceView view = sequence_getView(sequence, 3, 4, 1);
+    CuAssertIntEquals(testCase, 4, sequenceView_getLength(&view));
+    CuAssertTrue(testCase, sequenceView_getBase(&view, 0) == 'T');
+    CuAssertTrue(testCase, sequenceView_getBase(&view, 3) == 'C');
+    char *string = sequenceView_getString(&view, 1, 2);
+    CuAssertStrEquals(testCase, "GG", string);
+    free(string);
+    view = sequence_getView(sequence, 3, 4, 0); //reverse complement
+    CuAssertTrue(testCase, sequenceView_getBase(&view, 0) == 'G');
+    CuAssertTrue(testCase, sequenceView_getBase(&view, 3) == 'A');
+    string = sequenceView_getString(&view, 0, 4);
+    CuAssertStrEquals(testCase, "GCCA", string);
+    free(string);
+    view = sequence_getView(sequence, 3, 0, 0); //zero length view
+    CuAssertIntEquals(testCase, 0, sequenceView_getLength(&view));
+    cactusSequenceTestTeardown(testCase);
+
+    // Views of a long, soft masked sequence agree with sequence_getString, whether read by position, copied or iterated
+    CactusDisk *cactusDisk2 = cactusDisk_construct();
+    int64_t length = 5000;
+    char *string2 = st_malloc((length + 1) * sizeof(char));
+    for (int64_t i = 0; i < length; i++) {
+        string2[i] = "ACGTNacgtn"[st_randomInt(0, 10)];
+    }
+    string2[length] = '\0';
+    Sequence *sequence2 = sequence_construct(5, length, string2, headerString, event, cactusDisk2);
+    for (int64_t test = 0; test < 100; test++) {
+        int64_t start = st_randomInt(5, 5 + length), subLength = st_randomInt(0, 5 + length - start + 1), strand = st_randomInt(0, 2);
+        char *expected = sequence_getString(sequence2, start, subLength, strand);
+        view = sequence_getView(sequence2, start, subLength, strand);
+        SequenceViewIt it;
+        sequenceView_getIt(&view, &it);
+        for (int64_t i = 0; i < subLength; i++) {
+            CuAssertTrue(testCase, sequenceView_getBase(&view, i) == expected[i]);
+            CuAssertTrue(testCase, sequenceViewIt_getNext(&it) == expected[i]);
+        }
+        CuAssertTrue(testCase, sequenceViewIt_getNext(&it) == '\0');
+        string = sequenceView_getString(&view, 0, subLength);
+        CuAssertStrEquals(testCase, expected, string);
+        free(string);
+        free(expected);
+    }
+    free(string2);
+    cactusDisk_destruct(cactusDisk2);
+}
+
 void testSequence_getHeader(CuTest* testCase) {
     cactusSequenceTestSetup(testCase);
     CuAssertStrEquals(testCase, headerString, sequence_getHeader(sequence));
@@ -92,6 +141,7 @@ CuSuite* cactusSequenceTestSuite(void) {
     SUITE_ADD_TEST(suite, testSequence_getLength);
     SUITE_ADD_TEST(suite, testSequence_getEvent);
     SUITE_ADD_TEST(suite, testSequence_getString);
+    SUITE_ADD_TEST(suite, testSequence_getView);
     SUITE_ADD_TEST(suite, testSequence_isTrivialSequence);
     SUITE_ADD_TEST(suite, testSequence_getHeader);
     return suite;
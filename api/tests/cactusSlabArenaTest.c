@@ -0,0 +1,94 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include "cactusGlobalsPrivate.h"
+
+static void testSlabArena_callocAndFree(CuTest *testCase) {
+    SlabArena *arena = slabArena_construct();
+    stList *objects = stList_construct();
+    for (int64_t i = 0; i < 10000; i++) {
+        size_t size = i % 2 == 0 ? 20 : 52;
+        char *object = slabArena_calloc(arena, size);
+        for (size_t j = 0; j < size; j++) {
+            CuAssertIntEquals(testCase, 0, object[j]);
+        }
+        memset(object, i % 2 == 0 ? 'a' : 'b', size);
+        stList_append(objects, object);
+    }
+    // Objects do not overlap
+    for (int64_t i = 0; i < stList_length(objects); i++) {
+        char *object = stList_get(objects, i);
+        for (size_t j = 0; j < (i % 2 == 0 ? 20 : 52); j++) {
+            CuAssertIntEquals(testCase, i % 2 == 0 ? 'a' : 'b', object[j]);
+        }
+    }
+    // Freed objects are reused, and zeroed again
+    char *object = stList_get(objects, 2);
+    slabArena_free(object, 20);
+    char *object2 = slabArena_calloc(arena, 20);
+    CuAssertPtrEquals(testCase, object, object2);
+    CuAssertIntEquals(testCase, 0, object2[0]);
+    // The slabs are freed once the remaining objects are freed
+    slabArena_destruct(arena);
+    for (int64_t i = 0; i < stList_length(objects); i++) {
+        slabArena_free(stList_get(objects, i), i % 2 == 0 ? 20 : 52);
+    }
+    stList_destruct(objects);
+}
+
+static void testSlabArena_freeSlabs(CuTest *testCase) {
+    SlabArena *arena = slabArena_construct();
+    stList *objects = stList_construct();
+    for (int64_t i = 0; i < 10000; i++) {
+        stList_append(objects, slabArena_calloc(arena, 20));
+    }
+    int64_t slabNumber = slabArena_getSlabNumber(arena);
+    CuAssertTrue(testCase, slabNumber > 1);
+    // Freeing every other object frees no slab
+    for (int64_t i = 0; i < stList_length(objects); i += 2) {
+        slabArena_free(stList_get(objects, i), 20);
+    }
+    CuAssertIntEquals(testCase, slabNumber, slabArena_getSlabNumber(arena));
+    // Freeing the rest frees every slab while the arena is still in use
+    for (int64_t i = 1; i < stList_length(objects); i += 2) {
+        slabArena_free(stList_get(objects, i), 20);
+    }
+    CuAssertIntEquals(testCase, 0, slabArena_getSlabNumber(arena));
+    char *object = slabArena_calloc(arena, 20);
+    CuAssertIntEquals(testCase, 1, slabArena_getSlabNumber(arena));
+    CuAssertIntEquals(testCase, 0, object[0]);
+    slabArena_free(object, 20);
+    CuAssertIntEquals(testCase, 0, slabArena_getSlabNumber(arena));
+    slabArena_destruct(arena);
+    stList_destruct(objects);
+}
+
+static void testSlabArena_flower(CuTest *testCase) {
+    CactusDisk *cactusDisk = cactusDisk_construct();
+    Flower *flower = flower_construct(cactusDisk);
+    Flower *flower2 = flower_construct(cactusDisk);
+    EventTree *eventTree = eventTree_construct2(cactusDisk);
+    Event *event = event_construct3("ONE", 0.5, eventTree_getRootEvent(eventTree), eventTree);
+    // Objects of the two flowers are interleaved
+    for (int64_t i = 0; i < 1000; i++) {
+        End *end = end_construct(0, i % 2 == 0 ? flower : flower2);
+        cap_construct(end, event);
+        Block *block = block_construct(i + 1, i % 2 == 0 ? flower : flower2);
+        segment_construct(block, event);
+    }
+    CuAssertIntEquals(testCase, 1500, flower_getEndNumber(flower));
+    CuAssertIntEquals(testCase, 1500, flower_getEndNumber(flower2));
+    flower_destruct(flower, 0, 0);
+    CuAssertIntEquals(testCase, 1500, flower_getEndNumber(flower2));
+    CuAssertIntEquals(testCase, 1500, flower_getCapNumber(flower2));
+    cactusDisk_destruct(cactusDisk);
+}
+
+CuSuite* cactusSlabArenaTestSuite(void) {
+    CuSuite* suite = CuSuiteNew();
+    SUITE_ADD_TEST(suite, testSlabArena_callocAndFree);
+    SUITE_ADD_TEST(suite, testSlabArena_freeSlabs);
+    SUITE_ADD_TEST(suite, testSlabArena_flower);
+    return suite;
+}
@@ -34,137 +34,239 @@ PairwiseAlignmentParameters *pairwiseAlignmentParameters_constructFromCactusPara
     return p;
 }
 
-stPinch *getNextAlignedPairAlignment(stSortedSetIterator *it, stPinch *pinchToFillOut) {
-    AlignedPair *alignedPair = stSortedSet_getNext(it);
-    if (alignedPair == NULL) {
-        return NULL;
-    }
-    stPinch_fillOut(pinchToFillOut, alignedPair->subsequenceIdentifier, alignedPair->reverse->subsequenceIdentifier, alignedPair->position,
-                    alignedPair->reverse->position, 1, alignedPair->strand == alignedPair->reverse->strand);
-    return pinchToFillOut;
-}
-
 bool blockFilterFn(stPinchBlock *pinchBlock, void *extraArg) {
     FilterArgs *f = extraArg;
     return !stCaf_containsRequiredSpecies(pinchBlock, f->flower, f->minimumIngroupDegree, f->minimumOutgroupDegree, f->minimumDegree, f->minimumNumberOfSpecies);
 }
 
-void bar(stList *flowers, CactusParams *params, CactusDisk *cactusDisk, stList *listOfEndAlignmentFiles) {
+/*
+ * The parameters for bar, parsed once from the cactus params.
+ */
+struct _barParameters {
+    int64_t maximumLength;
+    int64_t usePoa;
+
+    // Pecan prams
+    int64_t spanningTrees;
+    bool useProgressiveMerging;
+    float matchGamma;
+    PairwiseAlignmentParameters *pairwiseAlignmentParameters;
+    StateMachine *sM;
+    bool pruneOutStubAlignments;
+    int64_t largeEndSize;
+
+    // Poa params
+    int64_t poaWindow;
+    int64_t maskFilter;
+    int64_t poaMaxProgRows;
+    double poaMaxLenDiff;
+    int64_t poaMaxClusterRows;
+    int64_t poaAnchoredWindowsMin;
+    abpoa_para_t *poaParameters;
+
+    // Scheduling params
+    int64_t memoryBudget;
+
+    // Filter params
+    int64_t minimumIngroupDegree;
+    int64_t minimumOutgroupDegree;
+    int64_t minimumDegree;
+    int64_t minimumNumberOfSpecies;
+};
+
+BarParameters *barParameters_construct(CactusParams *params) {
     //////////////////////////////////////////////
     //Parse the many, many necessary parameters from the params file
     //////////////////////////////////////////////
 
-    int64_t maximumLength = cactusParams_get_int(params, 2, "bar", "bandingLimit");
-    int64_t usePoa = cactusParams_get_int(params, 2, "bar", "partialOrderAlignment");
+    BarParameters *barParameters = st_calloc(1, sizeof(BarParameters));
+    barParameters->maximumLength = cactusParams_get_int(params, 2, "bar", "bandingLimit");
+    barParameters->usePoa = cactusParams_get_int(params, 2, "bar", "partialOrderAlignment");
 
     // Pecan prams
-    int64_t spanningTrees = cactusParams_get_int(params, 3, "bar", "pecan", "spanningTrees");
-    bool useProgressiveMerging = cactusParams_get_int(params, 3, "bar", "pecan", "useProgressiveMerging");
-    float matchGamma = cactusParams_get_float(params, 3, "bar", "pecan", "matchGamma");
-    PairwiseAlignmentParameters *pairwiseAlignmentParameters = pairwiseAlignmentParameters_constructFromCactusParams(params);
-    StateMachine *sM = stateMachine5_construct(fiveState);
-    bool pruneOutStubAlignments = cactusParams_get_int(params, 3, "bar", "pecan", "pruneOutStubAlignments");
+    barParameters->spanningTrees = cactusParams_get_int(params, 3, "bar", "pecan", "spanningTrees");
+    barParameters->useProgressiveMerging = cactusParams_get_int(params, 3, "bar", "pecan", "useProgressiveMerging");
+    barParameters->matchGamma = cactusParams_get_float(params, 3, "bar", "pecan", "matchGamma");
+    barParameters->pairwiseAlignmentParameters = pairwiseAlignmentParameters_constructFromCactusParams(params);
+    barParameters->sM = stateMachine5_construct(fiveState);
+    barParameters->pruneOutStubAlignments = cactusParams_get_int(params, 3, "bar", "pecan", "pruneOutStubAlignments");
+    // Ends of a flower with at least this many bases are aligned in parallel with one another
+    barParameters->largeEndSize = cactusParams_get_int(params, 2, "bar", "largeEndSize");
 
     // Poa params
     // toggle from pecan to abpoa for multiple alignment, by setting to non-zero
     // Note that poa uses about N^2 memory, so maximum value is generally in 10s of kb
-    int64_t poaWindow = cactusParams_get_int(params, 3, "bar", "poa", "partialOrderAlignmentWindow");
-    int64_t maskFilter = cactusParams_get_int(params, 3, "bar", "poa", "partialOrderAlignmentMaskFilter");
-    int64_t poaMaxProgRows = cactusParams_get_int(params, 3, "bar", "poa", "partialOrderAlignmentProgressiveMaxRows");
-    double poaMaxLenDiff = cactusParams_get_float(params, 3, "bar", "poa", "partialOrderAlignmentProgressiveMaxLengthDiff");
-    abpoa_para_t *poaParameters = usePoa ? abpoaParamaters_constructFromCactusParams(params) : NULL;
+    barParameters->poaWindow = cactusParams_get_int(params, 3, "bar", "poa", "partialOrderAlignmentWindow");
+    barParameters->maskFilter = cactusParams_get_int(params, 3, "bar", "poa", "partialOrderAlignmentMaskFilter");
+    barParameters->poaMaxProgRows = cactusParams_get_int(params, 3, "bar", "poa", "partialOrderAlignmentProgressiveMaxRows");
+    barParameters->poaMaxLenDiff = cactusParams_get_float(params, 3, "bar", "poa", "partialOrderAlignmentProgressiveMaxLengthDiff");
+    barParameters->poaMaxClusterRows = cactusParams_get_int(params, 3, "bar", "poa", "partialOrderAlignmentClusterMaxRows");
+    barParameters->poaAnchoredWindowsMin = cactusParams_get_int(params, 3, "bar", "poa", "partialOrderAlignmentAnchoredWindowsMin");
+    barParameters->poaParameters = barParameters->usePoa ? abpoaParamaters_constructFromCactusParams(params) : NULL;
 
-    //////////////////////////////////////////////
-    //Run the bar algorithm
-    //////////////////////////////////////////////
+    // The memory the flowers aligned at once are estimated to use is kept below this, if positive
+    barParameters->memoryBudget = cactusParams_get_int(params, 2, "bar", "memoryBudget");
+
+    // These are all variables used by the filter fns
+    barParameters->minimumIngroupDegree = cactusParams_get_int(params, 2, "bar", "minimumIngroupDegree");
+    barParameters->minimumOutgroupDegree = cactusParams_get_int(params, 2, "bar", "minimumOutgroupDegree");
+    barParameters->minimumDegree = cactusParams_get_int(params, 2, "bar", "minimumBlockDegree");
+    barParameters->minimumNumberOfSpecies = cactusParams_get_int(params, 2, "bar", "minimumNumberOfSpecies");
 
-    if (listOfEndAlignmentFiles != NULL && stList_length(flowers) != 1) {
-        st_errAbort("We have precomputed alignments but %" PRIi64 " flowers to align.\n", stList_length(flowers));
+    return barParameters;
+}
+
+void barParameters_destruct(BarParameters *barParameters) {
+    pairwiseAlignmentBandingParameters_destruct(barParameters->pairwiseAlignmentParameters);
+    stateMachine_destruct(barParameters->sM);
+    if (barParameters->poaParameters) {
+        abpoa_free_para(barParameters->poaParameters);
     }
+    free(barParameters);
+}
 
-#if defined(_OPENMP)
-#pragma omp parallel for schedule(dynamic, 1)
-#endif
-    for (int64_t j = 0; j<stList_length(flowers); j++) {
-        Flower *flower = stList_get(flowers, j);
-
-        // These are all variables used by the filter fns
-        FilterArgs *fa = st_calloc(1, sizeof(FilterArgs));
-        fa->minimumIngroupDegree = cactusParams_get_int(params, 2, "bar", "minimumIngroupDegree");
-        fa->minimumOutgroupDegree = cactusParams_get_int(params, 2, "bar", "minimumOutgroupDegree");
-        fa->minimumDegree = cactusParams_get_int(params, 2, "bar", "minimumBlockDegree");
-        fa->minimumNumberOfSpecies = cactusParams_get_int(params, 2, "bar", "minimumNumberOfSpecies");
-        fa->flower = flower;
-
-        void *alignments;
-        if (usePoa) {
-            /*
-             * This makes a consistent set of alignments using abPoa.
-             *
-             * It does not use any precomputed alignments, if they are provided they will be ignored
-             */
-            alignments = make_flower_alignment_poa(flower, maximumLength, poaWindow, maskFilter,
-                                                   poaMaxProgRows, poaMaxLenDiff, poaParameters);
-            st_logDebug("Created the poa alignments: %" PRIi64 " poa alignment blocks for flower\n", stList_length(alignments));
-        } else {
-            alignments = makeFlowerAlignment3(sM, flower, listOfEndAlignmentFiles, spanningTrees, maximumLength,
-                                              useProgressiveMerging, matchGamma, pairwiseAlignmentParameters,
-                                              pruneOutStubAlignments);
-            st_logDebug("Created the alignment: %" PRIi64 " pairs for flower\n", stSortedSet_size(alignments));
-        }
+void bar_alignFlower(Flower *flower, BarParameters *barParameters, stList *listOfEndAlignmentFiles,
+                     bool alignEndsInParallel) {
+    PerfReport *perfReport = perfReport_getGlobal();
+    PerfFlowerTimer flowerTimer;
+    perfReport_startFlower(perfReport, flower, &flowerTimer);
 
-        stPinchIterator *pinchIterator = NULL;
-        if(usePoa) {
-            pinchIterator = stPinchIterator_constructFromAlignedBlocks(alignments);
-        }
-        else {
-            pinchIterator = stPinchIterator_constructFromAlignedPairs(alignments, getNextAlignedPairAlignment);
-        }
+    // These are all variables used by the filter fns
+    FilterArgs *fa = st_calloc(1, sizeof(FilterArgs));
+    fa->minimumIngroupDegree = barParameters->minimumIngroupDegree;
+    fa->minimumOutgroupDegree = barParameters->minimumOutgroupDegree;
+    fa->minimumDegree = barParameters->minimumDegree;
+    fa->minimumNumberOfSpecies = barParameters->minimumNumberOfSpecies;
+    fa->flower = flower;
+
+    void *alignments;
+    if (barParameters->usePoa) {
         /*
-         * Run the cactus caf functions to build cactus.
+         * This makes a consistent set of alignments using abPoa.
+         *
+         * It does not use any precomputed alignments, if they are provided they will be ignored
          */
+        alignments = make_flower_alignment_poa(flower, barParameters->maximumLength, barParameters->poaWindow,
+                                               barParameters->maskFilter, barParameters->poaMaxProgRows,
+                                               barParameters->poaMaxLenDiff, barParameters->poaMaxClusterRows,
+                                               barParameters->poaAnchoredWindowsMin, barParameters->poaParameters,
+                                               alignEndsInParallel);
+        st_logDebug("Created the poa alignments: %" PRIi64 " poa alignment blocks for flower\n",
+                    ((AlignmentBlocks *)alignments)->block_no);
+    } else {
+        alignments = makeFlowerAlignment3(barParameters->sM, flower, listOfEndAlignmentFiles, barParameters->spanningTrees,
+                                          barParameters->maximumLength, barParameters->useProgressiveMerging,
+                                          barParameters->matchGamma, barParameters->pairwiseAlignmentParameters,
+                                          barParameters->pruneOutStubAlignments,
+                                          alignEndsInParallel ? 0 : barParameters->largeEndSize);
+        st_logDebug("Created the alignment: %" PRIi64 " pairs for flower\n", ((AlignedPairs *)alignments)->length);
+    }
 
-        stPinchThreadSet *threadSet = stCaf_setup(flower);
+    stPinchIterator *pinchIterator = NULL;
+    if(barParameters->usePoa) {
+        pinchIterator = stPinchIterator_constructFromAlignedBlocks(alignments);
+    }
+    else {
+        pinchIterator = stPinchIterator_constructFromAlignedPairArray(alignments);
+    }
+    /*
+     * Run the cactus caf functions to build cactus.
+     */
 
-        stCaf_anneal(threadSet, pinchIterator, NULL, flower);
+    stPinchThreadSet *threadSet = stCaf_setup(flower);
 
-        if (fa->minimumDegree < 2) {
-            stCaf_makeDegreeOneBlocks(threadSet);
-        }
+    stCaf_anneal(threadSet, pinchIterator, NULL, flower);
 
-        if (fa->minimumIngroupDegree > 0 || fa->minimumOutgroupDegree > 0 || fa->minimumDegree > 1) {
-            stCaf_melt(flower, threadSet, blockFilterFn, fa, 0, 0, 0, INT64_MAX);
-        }
+    if (fa->minimumDegree < 2) {
+        stCaf_makeDegreeOneBlocks(threadSet);
+    }
 
-        stCaf_finish(flower, threadSet, INT64_MAX, INT64_MAX); //Flower now destroyed.
+    if (fa->minimumIngroupDegree > 0 || fa->minimumOutgroupDegree > 0 || fa->minimumDegree > 1) {
+        stCaf_melt(flower, threadSet, blockFilterFn, fa, 0, 0, 0, INT64_MAX);
+    }
 
-        stPinchThreadSet_destruct(threadSet);
-        st_logDebug("Ran the cactus core script.\n");
+    stCaf_finish(flower, threadSet, INT64_MAX, INT64_MAX); //Flower now destroyed.
 
-        /*
-         * Cleanup
-         */
-        //Clean up the sorted set after cleaning up the iterator
-        stPinchIterator_destruct(pinchIterator);
-        if(usePoa) {
-            stList_destruct(alignments);
-        }
-        else {
-            stSortedSet_destruct(alignments);
-        }
-        free(fa);
+    stPinchThreadSet_destruct(threadSet);
+    st_logDebug("Ran the cactus core script.\n");
 
-        st_logDebug("Finished filling in the alignments for the flower\n");
+    /*
+     * Cleanup
+     */
+    //Clean up the alignments after cleaning up the iterator
+    stPinchIterator_destruct(pinchIterator);
+    if(barParameters->usePoa) {
+        alignmentBlocks_destruct(alignments);
     }
+    else {
+        alignedPairs_destruct(alignments);
+    }
+    free(fa);
 
-    //////////////////////////////////////////////
-    //Clean up
-    //////////////////////////////////////////////
+    perfReport_endFlower(perfReport, "bar", &flowerTimer);
+    st_logDebug("Finished filling in the alignments for the flower\n");
+}
+
+/*
+ * Bytes per cell of the abpoa dynamic programming matrices, which holds three to five 32 bit scores per cell
+ * depending on the gap model.
+ */
+#define POA_BYTES_PER_CELL 20
+
+/*
+ * Bytes per cell of the pecan dynamic programming matrices, a double for each of the five states for both the
+ * forward and backward matrices.
+ */
+#define PECAN_BYTES_PER_CELL 80
 
-    pairwiseAlignmentBandingParameters_destruct(pairwiseAlignmentParameters);
-    stateMachine_destruct(sM);
+int64_t bar_estimateFlowerMemory(Flower *flower, BarParameters *barParameters, bool alignEndsInParallel) {
+    int64_t totalLength = 0, maxEndMemory = 0, largeEndNumber = 0;
+    End *end;
+    Flower_EndIterator *endIterator = flower_getEndIterator(flower);
+    while ((end = flower_getNextEnd(endIterator)) != NULL) {
+        int64_t maxLength = 0;
+        Cap *cap;
+        End_InstanceIterator *capIterator = end_getInstanceIterator(end);
+        while ((cap = end_getNext(capIterator)) != NULL) {
+            int length;
+            get_adjacency_string(cap_getSide(cap) ? cap_getReverse(cap) : cap, &length, 0);
+            length = length < barParameters->maximumLength ? length : barParameters->maximumLength;
+            totalLength += length;
+            maxLength = length > maxLength ? length : maxLength;
+        }
+        end_destructInstanceIterator(capIterator);
 
-    if (poaParameters) {
-        abpoa_free_para(poaParameters);
+        // The largest matrix made for the end, the poa of a window or a pecan pairwise alignment, which pecan splits
+        int64_t endMemory;
+        if (barParameters->usePoa) {
+            int64_t window = maxLength < barParameters->poaWindow ? maxLength : barParameters->poaWindow;
+            endMemory = window * window * POA_BYTES_PER_CELL + end_getInstanceNumber(end) * window;
+        } else {
+            int64_t area = maxLength * maxLength;
+            area = area < barParameters->pairwiseAlignmentParameters->splitMatrixBiggerThanThis ? area :
+                   barParameters->pairwiseAlignmentParameters->splitMatrixBiggerThanThis;
+            endMemory = area * PECAN_BYTES_PER_CELL;
+            largeEndNumber += getTotalAdjacencyLength(end) >= barParameters->largeEndSize ? 1 : 0;
+        }
+        maxEndMemory = endMemory > maxEndMemory ? endMemory : maxEndMemory;
     }
+    // Pecan aligns the large ends in parallel even when the ends are not otherwise aligned in parallel
+    int64_t parallelEnds = alignEndsInParallel ? flower_getEndNumber(flower) : (largeEndNumber > 1 ? largeEndNumber : 1);
+    if (parallelEnds > 1) {
+        int64_t threads = 1;
+#if defined(_OPENMP)
+        threads = omp_get_max_threads();
+#endif
+        maxEndMemory *= parallelEnds < threads ? parallelEnds : threads;
+    }
+    flower_destructEndIterator(endIterator);
+
+    // The strings, their alignment (an msa row or the aligned pairs of the spanning trees for each base),
+    // and the pinch graph built from it
+    int64_t bytesPerBase = barParameters->usePoa ? 64 : 64 + barParameters->spanningTrees * 2 * sizeof(AlignedPair);
+    return totalLength * bytesPerBase + maxEndMemory;
+}
+
+int64_t barParameters_getMemoryBudget(BarParameters *barParameters) {
+    return barParameters->memoryBudget;
 }
@@ -0,0 +1,39 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include "barTasks.h"
+
+// OpenMP
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+void bar_runTasks(void (*spawnTasksFn)(void *extraArg), void *extraArg) {
+#if defined(_OPENMP)
+    if (!omp_in_parallel()) {
+#pragma omp parallel
+#pragma omp single
+        spawnTasksFn(extraArg);
+        return;
+    }
+#endif
+    // Within a parallel region, e.g. the tasks aligning flowers or ends, the tasks go to the enclosing team, whose
+    // threads that are not otherwise busy help with them
+    spawnTasksFn(extraArg);
+}
+
+static int lengthCmp(const void *a, const void *b, void *lengths) {
+    // The items are held as their indexes
+    int64_t i = ((int64_t *)lengths)[(int64_t)a], j = ((int64_t *)lengths)[(int64_t)b];
+    return i < j ? 1 : (i > j ? -1 : 0); // Sort in descending order
+}
+
+stList *bar_getIndexesByDescendingLength(int64_t *lengths, int64_t indexNumber) {
+    stList *indexes = stList_construct();
+    for (int64_t i = 0; i < indexNumber; i++) {
+        stList_append(indexes, (void *)i);
+    }
+    stList_sort2(indexes, lengthCmp, lengths);
+    return indexes;
+}
@@ -9,50 +9,135 @@
 #include "adjacencySequences.h"
 #include "pairwiseAligner.h"
 
-AlignedPair *alignedPair_construct(int64_t subsequenceIdentifier1, int64_t position1, bool strand1,
-        int64_t subsequenceIdentifier2, int64_t position2, bool strand2, int64_t score, int64_t rScore) {
-    AlignedPair *alignedPair = st_malloc(sizeof(AlignedPair));
-    alignedPair->subsequenceIdentifier = subsequenceIdentifier1;
-    alignedPair->position = position1;
-    alignedPair->strand = strand1;
-
-    alignedPair->reverse = st_malloc(sizeof(AlignedPair));
-    alignedPair->reverse->reverse = alignedPair;
-
-    alignedPair->reverse->subsequenceIdentifier = subsequenceIdentifier2;
-    alignedPair->reverse->position = position2;
-    alignedPair->reverse->strand = strand2;
-
-    alignedPair->score = score;
-    alignedPair->reverse->score = rScore;
+AlignedPairs *alignedPairs_construct(void) {
+    AlignedPairs *alignedPairs = st_malloc(sizeof(AlignedPairs));
+    alignedPairs->length = 0;
+    alignedPairs->maxLength = 16;
+    alignedPairs->pairs = st_malloc(alignedPairs->maxLength * sizeof(AlignedPair));
+    return alignedPairs;
+}
 
-    return alignedPair;
+void alignedPairs_destruct(AlignedPairs *alignedPairs) {
+    free(alignedPairs->pairs);
+    free(alignedPairs);
 }
 
-void alignedPair_destruct(AlignedPair *alignedPair) {
-    free(alignedPair); //We assume the reverse will be free independently.
+void alignedPairs_add(AlignedPairs *alignedPairs, int64_t subsequenceIdentifier1, int64_t position1, bool strand1,
+        int64_t subsequenceIdentifier2, int64_t position2, bool strand2, int64_t score1, int64_t score2) {
+    if (alignedPairs->length == alignedPairs->maxLength) {
+        alignedPairs->maxLength *= 2;
+        alignedPairs->pairs = st_realloc(alignedPairs->pairs, alignedPairs->maxLength * sizeof(AlignedPair));
+    }
+    AlignedPair *alignedPair = &alignedPairs->pairs[alignedPairs->length++];
+    alignedPair->subsequenceIdentifier1 = subsequenceIdentifier1;
+    alignedPair->position1 = position1;
+    alignedPair->strand1 = strand1;
+    alignedPair->score1 = score1;
+    alignedPair->subsequenceIdentifier2 = subsequenceIdentifier2;
+    alignedPair->position2 = position2;
+    alignedPair->strand2 = strand2;
+    alignedPair->score2 = score2;
+    alignedPair->deleted = 0;
 }
 
-static int alignedPair_cmpFnP(const AlignedPair *alignedPair1, const AlignedPair *alignedPair2) {
-    int i = cactusMisc_nameCompare(alignedPair1->subsequenceIdentifier, alignedPair2->subsequenceIdentifier);
+static inline int comparePositions(int64_t subsequenceIdentifier1, int64_t position1, bool strand1,
+        int64_t subsequenceIdentifier2, int64_t position2, bool strand2) {
+    int i = cactusMisc_nameCompare(subsequenceIdentifier1, subsequenceIdentifier2);
     if(i == 0) {
-        i = alignedPair1->position > alignedPair2->position ? 1 : (alignedPair1->position < alignedPair2->position ? -1 : 0);
+        i = position1 > position2 ? 1 : (position1 < position2 ? -1 : 0);
         if(i == 0) {
-            i = alignedPair1->strand == alignedPair2->strand ? 0 : (alignedPair1->strand ? 1 : -1);
+            i = strand1 == strand2 ? 0 : (strand1 ? 1 : -1);
         }
     }
     return i;
 }
 
 int alignedPair_cmpFn(const AlignedPair *alignedPair1, const AlignedPair *alignedPair2) {
-    int i = alignedPair_cmpFnP(alignedPair1, alignedPair2);
+    int i = comparePositions(alignedPair1->subsequenceIdentifier1, alignedPair1->position1, alignedPair1->strand1,
+            alignedPair2->subsequenceIdentifier1, alignedPair2->position1, alignedPair2->strand1);
     if(i == 0) {
-        i = alignedPair_cmpFnP(alignedPair1->reverse, alignedPair2->reverse);
+        i = comparePositions(alignedPair1->subsequenceIdentifier2, alignedPair1->position2, alignedPair1->strand2,
+                alignedPair2->subsequenceIdentifier2, alignedPair2->position2, alignedPair2->strand2);
     }
     return i;
 }
 
-stSortedSet *makeEndAlignment(StateMachine *sM, End *end, int64_t spanningTrees, int64_t maxSequenceLength,
+void alignedPairs_sort(AlignedPairs *alignedPairs) {
+    qsort(alignedPairs->pairs, alignedPairs->length, sizeof(AlignedPair),
+            (int (*)(const void *, const void *))alignedPair_cmpFn);
+}
+
+int64_t alignedPairs_getFirstIndex(AlignedPairs *alignedPairs, int64_t subsequenceIdentifier, int64_t position,
+        bool strand) {
+    int64_t i = 0, j = alignedPairs->length; // The index is in [i, j]
+    while (i < j) {
+        int64_t k = i + (j - i) / 2;
+        AlignedPair *alignedPair = &alignedPairs->pairs[k];
+        if (comparePositions(alignedPair->subsequenceIdentifier1, alignedPair->position1, alignedPair->strand1,
+                subsequenceIdentifier, position, strand) < 0) {
+            i = k + 1;
+        } else {
+            j = k;
+        }
+    }
+    return i;
+}
+
+AlignedPair *alignedPairs_getReverse(AlignedPairs *alignedPairs, AlignedPair *alignedPair) {
+    AlignedPair reverse = *alignedPair;
+    reverse.subsequenceIdentifier1 = alignedPair->subsequenceIdentifier2;
+    reverse.position1 = alignedPair->position2;
+    reverse.strand1 = alignedPair->strand2;
+    reverse.subsequenceIdentifier2 = alignedPair->subsequenceIdentifier1;
+    reverse.position2 = alignedPair->position1;
+    reverse.strand2 = alignedPair->strand1;
+    return bsearch(&reverse, alignedPairs->pairs, alignedPairs->length, sizeof(AlignedPair),
+            (int (*)(const void *, const void *))alignedPair_cmpFn);
+}
+
+/*
+ * Iterates over an array of aligned pairs, for a pinch iterator.
+ */
+typedef struct _alignedPairIterator {
+    AlignedPairs *alignedPairs;
+    int64_t i;
+} AlignedPairIterator;
+
+static AlignedPairIterator *alignedPairIterator_construct(AlignedPairs *alignedPairs) {
+    AlignedPairIterator *it = st_calloc(1, sizeof(AlignedPairIterator));
+    it->alignedPairs = alignedPairs;
+    return it;
+}
+
+static void alignedPairIterator_destruct(AlignedPairIterator *it) {
+    free(it);
+}
+
+static AlignedPairIterator *alignedPairIterator_start(AlignedPairIterator *it) {
+    it->i = 0;
+    return it;
+}
+
+static stPinch *alignedPairIterator_getNext(AlignedPairIterator *it, stPinch *pinchToFillOut) {
+    if (it->i == it->alignedPairs->length) {
+        return NULL;
+    }
+    AlignedPair *alignedPair = &it->alignedPairs->pairs[it->i++];
+    stPinch_fillOut(pinchToFillOut, alignedPair->subsequenceIdentifier1, alignedPair->subsequenceIdentifier2,
+                    alignedPair->position1, alignedPair->position2, 1, alignedPair->strand1 == alignedPair->strand2);
+    return pinchToFillOut;
+}
+
+stPinchIterator *stPinchIterator_constructFromAlignedPairArray(AlignedPairs *alignedPairs) {
+    stPinchIterator *pinchIterator = st_calloc(1, sizeof(stPinchIterator));
+    pinchIterator->alignmentArg = alignedPairIterator_construct(alignedPairs);
+    pinchIterator->getNextAlignment = (stPinch *(*)(void *, stPinch *)) alignedPairIterator_getNext;
+    pinchIterator->destructAlignmentArg = (void(*)(void *)) alignedPairIterator_destruct;
+    pinchIterator->startAlignmentStack = (void *(*)(void *)) alignedPairIterator_start;
+    return pinchIterator;
+}
+
+AlignedPairs *makeEndAlignment(StateMachine *sM, End *end, int64_t spanningTrees, int64_t maxSequenceLength,
         bool useProgressiveMerging, float gapGamma,
         PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters) {
     //Make an alignment of the sequences in the ends
@@ -140,10 +225,8 @@ stSortedSet *makeEndAlignment(StateMachine *sM, End *end, int64_t spanningTrees,
         }
     }
 
-    //Convert the alignment pairs to an alignment of the caps..
-    stSortedSet *sortedAlignment =
-                stSortedSet_construct3((int (*)(const void *, const void *))alignedPair_cmpFn,
-                (void (*)(void *))alignedPair_destruct);
+    //Convert the alignment pairs to an alignment of the caps, adding each pair and its reverse.
+    AlignedPairs *endAlignment = alignedPairs_construct();
     while(stList_length(mA->alignedPairs) > 0) {
         stIntTuple *alignedPair = stList_pop(mA->alignedPairs);
         assert(stIntTuple_length(alignedPair) == 5);
@@ -165,16 +248,21 @@ stSortedSet *makeEndAlignment(StateMachine *sM, End *end, int64_t spanningTrees,
         double *scoreAdjustments = seqFrag1->rightEndId == seqFrag2->rightEndId ? scoreAdjustmentsCommonEnds : scoreAdjustmentsNonCommonEnds;
         assert(scoreAdjustments[seqIndex1] != INT64_MIN);
         assert(scoreAdjustments[seqIndex2] != INT64_MIN);
-        AlignedPair *alignedPair2 = alignedPair_construct(
-                i->subsequenceIdentifier, i->start + (i->strand ? offset1 : -offset1), i->strand,
-                j->subsequenceIdentifier, j->start + (j->strand ? offset2 : -offset2), j->strand,
-                score*scoreAdjustments[seqIndex1], score*scoreAdjustments[seqIndex2]); //Do the reweighting here.
-        assert(stSortedSet_search(sortedAlignment, alignedPair2) == NULL);
-        assert(stSortedSet_search(sortedAlignment, alignedPair2->reverse) == NULL);
-        stSortedSet_insert(sortedAlignment, alignedPair2);
-        stSortedSet_insert(sortedAlignment, alignedPair2->reverse);
+        int64_t position1 = i->start + (i->strand ? offset1 : -offset1);
+        int64_t position2 = j->start + (j->strand ? offset2 : -offset2);
+        int64_t score1 = score*scoreAdjustments[seqIndex1], score2 = score*scoreAdjustments[seqIndex2]; //Do the reweighting here.
+        alignedPairs_add(endAlignment, i->subsequenceIdentifier, position1, i->strand,
+                j->subsequenceIdentifier, position2, j->strand, score1, score2);
+        alignedPairs_add(endAlignment, j->subsequenceIdentifier, position2, j->strand,
+                i->subsequenceIdentifier, position1, i->strand, score2, score1);
         stIntTuple_destruct(alignedPair);
     }
+    alignedPairs_sort(endAlignment);
+#ifndef NDEBUG
+    for(int64_t k=1; k<endAlignment->length; k++) { //Each pair is distinct
+        assert(alignedPair_cmpFn(&endAlignment->pairs[k-1], &endAlignment->pairs[k]) < 0);
+    }
+#endif
     //Cleanup
     stList_destruct(seqFrags);
     stList_destruct(sequences);
@@ -185,56 +273,160 @@ stSortedSet *makeEndAlignment(StateMachine *sM, End *end, int64_t spanningTrees,
     multipleAlignment_destruct(mA);
     stHash_destruct(endInstanceNumbers);
 
-    return sortedAlignment;
+    return endAlignment;
+}
+
+/*
+ * End alignments are written as a binary stream of records, one for each end alignment. A record is a header
+ * of four 64 bit integers, the magic number, the name of the end, the number of pairs and the number of bytes of
+ * the pairs, then the pairs in sorted order. Each field of a pair is written as a varint of the zigzag encoding of
+ * its difference from the field of the previous pair, which is small as the pairs are sorted, with the strands in
+ * the bottom bits of the first position. The byte count lets the pairs be read in one go and decoded in memory.
+ */
+
+#define END_ALIGNMENT_MAGIC 0x4e47494c41444e45 // "ENDALIGN"
+
+typedef struct _byteBuffer {
+    uint8_t *bytes;
+    int64_t length;
+    int64_t maxLength;
+} ByteBuffer;
+
+/*
+ * Returns the zigzag encoding of i - j, so that small differences of either sign are small. The difference wraps
+ * around, as names can be anywhere in the range of 64 bit integers, and addDifference undoes it.
+ */
+static inline uint64_t getDifference(int64_t i, int64_t j) {
+    int64_t d = (int64_t)((uint64_t)i - (uint64_t)j);
+    return ((uint64_t)d << 1) ^ (uint64_t)(d >> 63);
+}
+
+static inline int64_t addDifference(int64_t j, uint64_t difference) {
+    return (int64_t)((uint64_t)j + ((difference >> 1) ^ -(difference & 1)));
+}
+
+static void writeVarint(ByteBuffer *buffer, uint64_t i) {
+    if (buffer->length + 10 > buffer->maxLength) { // A varint is at most 10 bytes
+        buffer->maxLength = 2 * buffer->maxLength + 10;
+        buffer->bytes = st_realloc(buffer->bytes, buffer->maxLength);
+    }
+    while (i >= 0x80) {
+        buffer->bytes[buffer->length++] = (uint8_t)(i | 0x80);
+        i >>= 7;
+    }
+    buffer->bytes[buffer->length++] = (uint8_t)i;
+}
+
+static uint64_t readVarint(uint8_t **bytes, uint8_t *bytesEnd) {
+    uint64_t i = 0;
+    for (int64_t shift = 0; shift < 64; shift += 7) {
+        if (*bytes == bytesEnd) {
+            break;
+        }
+        uint8_t byte = *(*bytes)++;
+        i |= (uint64_t)(byte & 0x7F) << shift;
+        if (byte < 0x80) {
+            return i;
+        }
+    }
+    st_errAbort("We encountered a mis-specified pair in loading an end alignment from the disk\n");
+    return 0;
+}
+
+static void writeInt(FILE *fileHandle, int64_t i) {
+    if (fwrite(&i, sizeof(int64_t), 1, fileHandle) != 1) {
+        st_errAbort("Failed to write an end alignment to the disk\n");
+    }
 }
 
-void writeEndAlignmentToDisk(End *end, stSortedSet *endAlignment, FILE *fileHandle) {
-    fprintf(fileHandle, "%" PRIi64 " %" PRIi64 "\n", end_getName(end), stSortedSet_size(endAlignment));
-    stSortedSetIterator *it = stSortedSet_getIterator(endAlignment);
-    AlignedPair *aP;
-    while((aP = stSortedSet_getNext(it)) != NULL) {
-        fprintf(fileHandle, "%" PRIi64 " %" PRIi64 " %i %" PRIi64 " ", aP->subsequenceIdentifier, aP->position, aP->strand, aP->score);
-        aP = aP->reverse;
-        fprintf(fileHandle, "%" PRIi64 " %" PRIi64 " %i %" PRIi64 "\n", aP->subsequenceIdentifier, aP->position, aP->strand, aP->score);
+static int64_t readInt(FILE *fileHandle) {
+    int64_t i;
+    if (fread(&i, sizeof(int64_t), 1, fileHandle) != 1) {
+        st_errAbort("Unexpected end of file when loading an end alignment from the disk\n");
+    }
+    return i;
+}
+
+void writeEndAlignmentToDisk(End *end, AlignedPairs *endAlignment, FILE *fileHandle) {
+    ByteBuffer buffer = { NULL, 0, 0 };
+    AlignedPair p = { 0, 0, 0, 0, 0, 0, 0, 0, 0 }; // The previous pair
+    int64_t pairNumber = 0;
+    for(int64_t i=0; i<endAlignment->length; i++) {
+        AlignedPair *aP = &endAlignment->pairs[i];
+        if(!aP->deleted) {
+            uint64_t position1 = getDifference(aP->position1, p.position1);
+            if(position1 >> 62 != 0) { // No room for the strands, which positions of sequences are far from needing
+                st_errAbort("The position %" PRIi64 " is too large to write in an end alignment\n", aP->position1);
+            }
+            writeVarint(&buffer, getDifference(aP->subsequenceIdentifier1, p.subsequenceIdentifier1));
+            writeVarint(&buffer, (position1 << 2) | (aP->strand1 << 1) | aP->strand2);
+            writeVarint(&buffer, getDifference(aP->subsequenceIdentifier2, p.subsequenceIdentifier2));
+            writeVarint(&buffer, getDifference(aP->position2, p.position2));
+            writeVarint(&buffer, getDifference(aP->score1, p.score1));
+            writeVarint(&buffer, getDifference(aP->score2, p.score2));
+            p = *aP;
+            pairNumber++;
+        }
+    }
+    writeInt(fileHandle, END_ALIGNMENT_MAGIC);
+    writeInt(fileHandle, end_getName(end));
+    writeInt(fileHandle, pairNumber);
+    writeInt(fileHandle, buffer.length);
+    if(buffer.length > 0 && fwrite(buffer.bytes, 1, buffer.length, fileHandle) != buffer.length) {
+        st_errAbort("Failed to write an end alignment to the disk\n");
     }
-    stSortedSet_destructIterator(it);
+    free(buffer.bytes);
 }
 
-stSortedSet *loadEndAlignmentFromDisk(Flower *flower, FILE *fileHandle, End **end) {
-    stSortedSet *endAlignment =
-                stSortedSet_construct3((int (*)(const void *, const void *))alignedPair_cmpFn,
-                (void (*)(void *))alignedPair_destruct);
-    char *line = stFile_getLineFromFile(fileHandle);
-    if(line == NULL) {
+AlignedPairs *loadEndAlignmentFromDisk(Flower *flower, FILE *fileHandle, End **end) {
+    int64_t magic;
+    if(fread(&magic, sizeof(int64_t), 1, fileHandle) != 1) {
+        if(!feof(fileHandle)) {
+            st_errAbort("Failed to read an end alignment from the disk\n");
+        }
         *end = NULL;
         return NULL;
     }
-    Name flowerName;
-    int64_t lineNumber;
-    int64_t i = sscanf(line, "%" PRIi64 " %" PRIi64 "", &flowerName, &lineNumber);
-    if(i != 2 || lineNumber < 0) {
-        st_errAbort("We encountered a mis-specified name in loading the first line of an end alignment from the disk: '%s'\n", line);
+    if(magic != END_ALIGNMENT_MAGIC) {
+        st_errAbort("We encountered a record that is not an end alignment in loading an end alignment from the disk\n");
+    }
+    Name endName = readInt(fileHandle);
+    int64_t pairNumber = readInt(fileHandle);
+    int64_t byteNumber = readInt(fileHandle);
+    if(pairNumber < 0 || byteNumber < 0) {
+        st_errAbort("We encountered a mis-specified header in loading an end alignment from the disk\n");
     }
-    *end = flower_getEnd(flower, flowerName);
+    *end = flower_getEnd(flower, endName);
     if(*end == NULL) {
-        st_errAbort("We encountered an end name that is not in the database: '%s'\n", line);
+        st_errAbort("We encountered an end name that is not in the database: %" PRIi64 "\n", endName);
     }
-    free(line);    
-    for(int64_t i=0; i<lineNumber; i++) {
-        line = stFile_getLineFromFile(fileHandle);
-        if(line == NULL) {
-            st_errAbort("Got a null line when parsing an end alignment\n");
-        }
-        int64_t sI1, sI2;
-        int64_t p1, st1, p2, st2, score1, score2;
-        int64_t i = sscanf(line, "%" PRIi64 " %" PRIi64 " %" PRIi64 " %" PRIi64 " %" PRIi64 " %" PRIi64 " %" PRIi64 " %" PRIi64 "", &sI1, &p1, &st1, &score1, &sI2, &p2, &st2, &score2);
-        (void)i;
-        if(i != 8) {
-            st_errAbort("We encountered a mis-specified name in loading an end alignment from the disk: '%s'\n", line);
-        }
-        stSortedSet_insert(endAlignment, alignedPair_construct(sI1, p1, st1, sI2, p2, st2, score1, score2));
-        free(line);
+    uint8_t *bytes = st_malloc(byteNumber + 1);
+    if(byteNumber > 0 && fread(bytes, 1, byteNumber, fileHandle) != byteNumber) {
+        st_errAbort("Unexpected end of file when loading an end alignment from the disk\n");
     }
+
+    // Decode the pairs, which are already sorted, straight into the array
+    AlignedPairs *endAlignment = alignedPairs_construct();
+    endAlignment->maxLength = pairNumber > 0 ? pairNumber : 1;
+    endAlignment->pairs = st_realloc(endAlignment->pairs, endAlignment->maxLength * sizeof(AlignedPair));
+    AlignedPair p = { 0, 0, 0, 0, 0, 0, 0, 0, 0 }; // The previous pair
+    uint8_t *b = bytes, *bytesEnd = bytes + byteNumber;
+    for(int64_t i=0; i<pairNumber; i++) {
+        p.subsequenceIdentifier1 = addDifference(p.subsequenceIdentifier1, readVarint(&b, bytesEnd));
+        uint64_t position1 = readVarint(&b, bytesEnd);
+        p.strand1 = (position1 >> 1) & 1;
+        p.strand2 = position1 & 1;
+        p.position1 = addDifference(p.position1, position1 >> 2);
+        p.subsequenceIdentifier2 = addDifference(p.subsequenceIdentifier2, readVarint(&b, bytesEnd));
+        p.position2 = addDifference(p.position2, readVarint(&b, bytesEnd));
+        p.score1 = addDifference(p.score1, readVarint(&b, bytesEnd));
+        p.score2 = addDifference(p.score2, readVarint(&b, bytesEnd));
+        endAlignment->pairs[endAlignment->length++] = p;
+        assert(i == 0 || alignedPair_cmpFn(&endAlignment->pairs[i-1], &endAlignment->pairs[i]) < 0);
+    }
+    if(b != bytesEnd) {
+        st_errAbort("We encountered a mis-specified pair in loading an end alignment from the disk\n");
+    }
+    free(bytes);
     return endAlignment;
 }
-
@@ -5,64 +5,42 @@
  */
 
 #include "endAligner.h"
+#include "flowerAligner.h"
 #include "cactus.h"
 #include "sonLib.h"
 #include "adjacencySequences.h"
 #include "pairwiseAligner.h"
+#include "barTasks.h"
 
-stList *getInducedAlignment(stSortedSet *endAlignment, AdjacencySequence *adjacencySequence) {
+stList *getInducedAlignment(AlignedPairs *endAlignment, AdjacencySequence *adjacencySequence) {
     /*
-     * Gets an ordered list of pairs from the end alignment for the given adjacency sequence.
+     * Gets an ordered list of the pairs, that have not been pruned, from the end alignment for the given adjacency sequence.
      */
     stList *inducedAlignment = stList_construct();
     if (adjacencySequence->strand) {
-        AlignedPair *alignedPair = alignedPair_construct(adjacencySequence->subsequenceIdentifier,
-                adjacencySequence->start - 1, adjacencySequence->strand, 0, 0, 0, 0, 0);
-        AlignedPair *alignedPair2 = stSortedSet_searchGreaterThan(endAlignment, alignedPair);
-        if (alignedPair2 != NULL) {
-            stSortedSetIterator *it = stSortedSet_getIteratorFrom(endAlignment, alignedPair2);
-            while ((alignedPair2 = stSortedSet_getNext(it)) != NULL) {
-                if (alignedPair2->subsequenceIdentifier == adjacencySequence->subsequenceIdentifier) {
-                    if (alignedPair2->position >= adjacencySequence->start + adjacencySequence->length) {
-                        break;
-                    }
-                    assert(alignedPair2->position >= adjacencySequence->start);
-                    if (alignedPair2->strand == adjacencySequence->strand) {
-                        stList_append(inducedAlignment, alignedPair2);
-                    }
-                } else {
-                    break;
-                }
+        for (int64_t i = alignedPairs_getFirstIndex(endAlignment, adjacencySequence->subsequenceIdentifier,
+                adjacencySequence->start, 0); i < endAlignment->length; i++) {
+            AlignedPair *alignedPair = &endAlignment->pairs[i];
+            if (alignedPair->subsequenceIdentifier1 != adjacencySequence->subsequenceIdentifier ||
+                alignedPair->position1 >= adjacencySequence->start + adjacencySequence->length) {
+                break;
+            }
+            if (alignedPair->strand1 == adjacencySequence->strand && !alignedPair->deleted) {
+                stList_append(inducedAlignment, alignedPair);
             }
-            stSortedSet_destructIterator(it);
         }
-        alignedPair_destruct(alignedPair->reverse);
-        alignedPair_destruct(alignedPair);
     } else {
-        AlignedPair *alignedPair = alignedPair_construct(adjacencySequence->subsequenceIdentifier,
-                adjacencySequence->start + 1, adjacencySequence->strand, 0, 0, 0, 0, 0);
-        AlignedPair *alignedPair2 = stSortedSet_searchLessThan(endAlignment, alignedPair);
-        if (alignedPair2 != NULL) {
-            stSortedSetIterator *it = stSortedSet_getIteratorFrom(endAlignment, alignedPair2);
-            stSortedSet_getNext(it);
-            stSortedSet_getNext(it); //shift it up..
-            while ((alignedPair2 = stSortedSet_getPrevious(it)) != NULL) {
-                if (alignedPair2->subsequenceIdentifier == adjacencySequence->subsequenceIdentifier) {
-                    if (alignedPair2->position <= adjacencySequence->start - adjacencySequence->length) {
-                        break;
-                    }
-                    assert(alignedPair2->position <= adjacencySequence->start);
-                    if (alignedPair2->strand == adjacencySequence->strand) {
-                        stList_append(inducedAlignment, alignedPair2);
-                    }
-                } else {
-                    break;
-                }
+        for (int64_t i = alignedPairs_getFirstIndex(endAlignment, adjacencySequence->subsequenceIdentifier,
+                adjacencySequence->start + 1, 0) - 1; i >= 0; i--) {
+            AlignedPair *alignedPair = &endAlignment->pairs[i];
+            if (alignedPair->subsequenceIdentifier1 != adjacencySequence->subsequenceIdentifier ||
+                alignedPair->position1 <= adjacencySequence->start - adjacencySequence->length) {
+                break;
+            }
+            if (alignedPair->strand1 == adjacencySequence->strand && !alignedPair->deleted) {
+                stList_append(inducedAlignment, alignedPair);
             }
-            stSortedSet_destructIterator(it);
         }
-        alignedPair_destruct(alignedPair->reverse);
-        alignedPair_destruct(alignedPair);
     }
     /*
      * Check the induced alignment
@@ -70,14 +48,14 @@ stList *getInducedAlignment(stSortedSet *endAlignment, AdjacencySequence *adjace
     for (int64_t i = 0; i < stList_length(inducedAlignment); i++) {
         AlignedPair *alignedPair = stList_get(inducedAlignment, i);
         (void) alignedPair;
-        assert(alignedPair->subsequenceIdentifier == adjacencySequence->subsequenceIdentifier);
-        assert(alignedPair->strand == adjacencySequence->strand);
+        assert(alignedPair->subsequenceIdentifier1 == adjacencySequence->subsequenceIdentifier);
+        assert(alignedPair->strand1 == adjacencySequence->strand);
         if (adjacencySequence->strand) {
-            assert(alignedPair->position >= adjacencySequence->start);
-            assert(alignedPair->position < adjacencySequence->start + adjacencySequence->length);
+            assert(alignedPair->position1 >= adjacencySequence->start);
+            assert(alignedPair->position1 < adjacencySequence->start + adjacencySequence->length);
         } else {
-            assert(alignedPair->position <= adjacencySequence->start);
-            assert(alignedPair->position > adjacencySequence->start - adjacencySequence->length);
+            assert(alignedPair->position1 <= adjacencySequence->start);
+            assert(alignedPair->position1 > adjacencySequence->start - adjacencySequence->length);
         }
     }
     return inducedAlignment;
@@ -91,7 +69,7 @@ static int64_t *cumulateScoreForward(stList *inducedAlignment1) {
     int64_t totalScore = 0;
     for (int64_t i = 0; i < stList_length(inducedAlignment1); i++) {
         AlignedPair *alignedPair = stList_get(inducedAlignment1, i);
-        totalScore += alignedPair->score;
+        totalScore += alignedPair->score1;
         iA[i] = totalScore;
     }
     return iA;
@@ -105,7 +83,7 @@ static int64_t *cumulateScoreBackward(stList *inducedAlignment1) {
     int64_t totalScore = 0;
     for (int64_t i = stList_length(inducedAlignment1) - 1; i >= 0; i--) {
         AlignedPair *alignedPair = stList_get(inducedAlignment1, i);
-        totalScore += alignedPair->score;
+        totalScore += alignedPair->score1;
         iA[i] = totalScore;
     }
     return iA;
@@ -137,16 +115,16 @@ static int64_t getCutOff(stList *inducedAlignment1, stList *inducedAlignment2, i
     int64_t pPos1 = INT64_MIN, pPos2 = INT64_MIN;
     for (int64_t i = 0; i < stList_length(inducedAlignment1); i++) {
         AlignedPair *alignedPair1 = stList_get(inducedAlignment1, i);
-        assert(alignedPair1->strand);
-        assert(pPos1 <= alignedPair1->position);
-        pPos1 = alignedPair1->position;
+        assert(alignedPair1->strand1);
+        assert(pPos1 <= alignedPair1->position1);
+        pPos1 = alignedPair1->position1;
         if (j < stList_length(inducedAlignment2)) {
             do {
                 AlignedPair *alignedPair2 = stList_get(inducedAlignment2, j);
-                assert(!alignedPair2->strand);
-                assert(pPos2 <= alignedPair2->position);
-                pPos2 = alignedPair2->position;
-                if (alignedPair1->position < alignedPair2->position) {
+                assert(!alignedPair2->strand1);
+                assert(pPos2 <= alignedPair2->position1);
+                pPos2 = alignedPair2->position1;
+                if (alignedPair1->position1 < alignedPair2->position1) {
                     if (cScore1[i] + cScore2[j] >= maxScore) {
                         maxScore = cScore1[i] + cScore2[j];
                         *cutOff1 = i + 1;
@@ -190,44 +168,36 @@ void updateDeletedPairs(int64_t subsequenceIdentifier, stHash *deletedAlignedPai
     (*j)++;
 }
 
-static void pruneAlignmentsP(stList *inducedAlignment, stSortedSet *endAlignment, int64_t start, int64_t end,
-        stSortedSet *pairsToDelete, stHash *deletedAlignedPairCounts) {
+static void pruneAlignmentsP(stList *inducedAlignment, AlignedPairs *endAlignment, int64_t start, int64_t end,
+        stHash *deletedAlignedPairCounts) {
     for (int64_t i = start; i < end; i++) {
         AlignedPair *alignedPair = stList_get(inducedAlignment, i);
-        if (stSortedSet_search(endAlignment, alignedPair) != NULL) { //can be missing if we are pruning the reverse strand alignment at the same time
-            assert(stSortedSet_search(endAlignment, alignedPair->reverse) != NULL);
-            updateDeletedPairs(alignedPair->subsequenceIdentifier, deletedAlignedPairCounts);
-            updateDeletedPairs(alignedPair->reverse->subsequenceIdentifier, deletedAlignedPairCounts);
-            stSortedSet_remove(endAlignment, alignedPair);
-            stSortedSet_remove(endAlignment, alignedPair->reverse);
-            if (stSortedSet_search(pairsToDelete, alignedPair) == NULL) { // &&
-                assert(stSortedSet_search(pairsToDelete, alignedPair->reverse) == NULL);
-                stSortedSet_insert(pairsToDelete, alignedPair);
-                stSortedSet_insert(pairsToDelete, alignedPair->reverse);
-            } else {
-                assert(stSortedSet_search(pairsToDelete, alignedPair->reverse) != NULL);
-            }
+        if (!alignedPair->deleted) { //can be deleted already if we are pruning the reverse strand alignment at the same time
+            AlignedPair *reverse = alignedPairs_getReverse(endAlignment, alignedPair);
+            assert(reverse != NULL && !reverse->deleted);
+            updateDeletedPairs(alignedPair->subsequenceIdentifier1, deletedAlignedPairCounts);
+            updateDeletedPairs(alignedPair->subsequenceIdentifier2, deletedAlignedPairCounts);
+            alignedPair->deleted = 1;
+            reverse->deleted = 1;
         }
     }
 }
 
-static void pruneAlignments(Cap *cap, stList *inducedAlignment1, stList *inducedAlignment2, stSortedSet *endAlignment1,
-        stSortedSet *endAlignment2, void *deletedAlignedPairCounts) {
+static void pruneAlignments(Cap *cap, stList *inducedAlignment1, stList *inducedAlignment2, AlignedPairs *endAlignment1,
+        AlignedPairs *endAlignment2, void *deletedAlignedPairCounts) {
     /*
      * Chooses a point along the adjacency sequence at which to filter the two alignments,
      * then filters the aligned pairs by this point.
      */
     int64_t cutOff1 = 0, cutOff2 = 0;
     getCutOff(inducedAlignment1, inducedAlignment2, &cutOff1, &cutOff2);
-    stSortedSet *pairsToDelete = stSortedSet_construct2((void(*)(void *)) alignedPair_destruct);
     //Now do the actual filtering of the alignments.
-    pruneAlignmentsP(inducedAlignment1, endAlignment1, cutOff1, stList_length(inducedAlignment1), pairsToDelete, deletedAlignedPairCounts);
-    pruneAlignmentsP(inducedAlignment2, endAlignment2, 0, cutOff2, pairsToDelete, deletedAlignedPairCounts);
-    stSortedSet_destruct(pairsToDelete);
+    pruneAlignmentsP(inducedAlignment1, endAlignment1, cutOff1, stList_length(inducedAlignment1), deletedAlignedPairCounts);
+    pruneAlignmentsP(inducedAlignment2, endAlignment2, 0, cutOff2, deletedAlignedPairCounts);
 }
 
-void getScore(Cap *cap, stList *inducedAlignment1, stList *inducedAlignment2, stSortedSet *endAlignment1,
-        stSortedSet *endAlignment2, void *capScoresFnHash) {
+void getScore(Cap *cap, stList *inducedAlignment1, stList *inducedAlignment2, AlignedPairs *endAlignment1,
+        AlignedPairs *endAlignment2, void *capScoresFnHash) {
 
     int64_t i, j;
     int64_t *maxScore = st_malloc(sizeof(int64_t));
@@ -245,13 +215,17 @@ static int sortCapsFn(const void *cap1, const void *cap2, void *capScoresFnHash)
     return (i > 0) ? 1 : ((i < 0) ? -1 : 0); 
 }
 
-bool isAlignedToStubSequence(AlignedPair *alignedPair, Flower *flower) {
-	Cap *cap = flower_getCap(flower, alignedPair->reverse->subsequenceIdentifier);
+static bool isStubSequence(int64_t subsequenceIdentifier, Flower *flower) {
+    Cap *cap = flower_getCap(flower, subsequenceIdentifier);
     assert(cap != NULL);
     End *end1 = cap_getEnd(cap), *end2 = cap_getEnd(cap_getAdjacency(cap));
     assert(end1 != NULL && end2 != NULL);
     return (end_isStubEnd(end1) && end_isFree(end1)) || (end_isStubEnd(end2) && end_isFree(end2));
-} 
+}
+
+bool isAlignedToStubSequence(AlignedPair *alignedPair, Flower *flower) {
+    return isStubSequence(alignedPair->subsequenceIdentifier2, flower);
+}
 
 static int64_t findFirstNonStubAlignment(Flower *flower, stList *inducedAlignment, bool reverse) {
     AlignedPair *pAlignedPair = NULL;
@@ -259,9 +233,9 @@ static int64_t findFirstNonStubAlignment(Flower *flower, stList *inducedAlignmen
     for (int64_t i = reverse ? stList_length(inducedAlignment) - 1 : 0; i < stList_length(inducedAlignment) && i >= 0; i
             += reverse ? -1 : 1) {
         AlignedPair *alignedPair = stList_get(inducedAlignment, i);
-        assert(isAlignedToStubSequence(alignedPair->reverse, flower));
-        assert(pAlignedPair == NULL || pAlignedPair->subsequenceIdentifier == alignedPair->subsequenceIdentifier);
-        if (pAlignedPair == NULL || pAlignedPair->position != alignedPair->position) {
+        assert(isStubSequence(alignedPair->subsequenceIdentifier1, flower));
+        assert(pAlignedPair == NULL || pAlignedPair->subsequenceIdentifier1 == alignedPair->subsequenceIdentifier1);
+        if (pAlignedPair == NULL || pAlignedPair->position1 != alignedPair->position1) {
             pAlignedPair = alignedPair;
             j = i;
         }
@@ -274,7 +248,7 @@ static int64_t findFirstNonStubAlignment(Flower *flower, stList *inducedAlignmen
 }
 
 static void pruneStubAlignments(Cap *cap, stList *inducedAlignment1, stList *inducedAlignment2,
-        stSortedSet *endAlignment1, stSortedSet *endAlignment2, void *deletedAlignedPairCounts) {
+        AlignedPairs *endAlignment1, AlignedPairs *endAlignment2, void *deletedAlignedPairCounts) {
     assert(cap != NULL);
     End *end = cap_getEnd(cap);
     assert(cap_getAdjacency(cap) != NULL);
@@ -293,11 +267,9 @@ static void pruneStubAlignments(Cap *cap, stList *inducedAlignment1, stList *ind
         cutOff1 = -1;
         cutOff2 = findFirstNonStubAlignment(end_getFlower(end), inducedAlignment2, 0);
     }
-    stSortedSet *pairsToDelete = stSortedSet_construct2((void(*)(void *)) alignedPair_destruct);
     //Now do the actual filtering of the alignments.
-    pruneAlignmentsP(inducedAlignment1, endAlignment1, cutOff1 + 1, stList_length(inducedAlignment1), pairsToDelete, deletedAlignedPairCounts);
-    pruneAlignmentsP(inducedAlignment2, endAlignment2, 0, cutOff2, pairsToDelete, deletedAlignedPairCounts);
-    stSortedSet_destruct(pairsToDelete);
+    pruneAlignmentsP(inducedAlignment1, endAlignment1, cutOff1 + 1, stList_length(inducedAlignment1), deletedAlignedPairCounts);
+    pruneAlignmentsP(inducedAlignment2, endAlignment2, 0, cutOff2, deletedAlignedPairCounts);
 }
 
 /*
@@ -305,8 +277,8 @@ static void pruneStubAlignments(Cap *cap, stList *inducedAlignment1, stList *ind
  */
 
 static int makeFlowerAlignmentP(Cap *cap, stHash *endAlignments,
-        void(*fn)(Cap *, stList *, stList *, stSortedSet *, stSortedSet *, void *), void *extraArg) {
-    stSortedSet *endAlignment1 = stHash_search(endAlignments, end_getPositiveOrientation(cap_getEnd(cap)));
+        void(*fn)(Cap *, stList *, stList *, AlignedPairs *, AlignedPairs *, void *), void *extraArg) {
+    AlignedPairs *endAlignment1 = stHash_search(endAlignments, end_getPositiveOrientation(cap_getEnd(cap)));
     assert(endAlignment1 != NULL);
 
     Cap *adjacentCap = cap_getAdjacency(cap);
@@ -314,7 +286,7 @@ static int makeFlowerAlignmentP(Cap *cap, stHash *endAlignments,
     assert(cap_getSide(adjacentCap));
     assert(cap_getStrand(adjacentCap));
     adjacentCap = cap_getReverse(adjacentCap);
-    stSortedSet *endAlignment2 = stHash_search(endAlignments, end_getPositiveOrientation(cap_getEnd(adjacentCap)));
+    AlignedPairs *endAlignment2 = stHash_search(endAlignments, end_getPositiveOrientation(cap_getEnd(adjacentCap)));
     assert(endAlignment2 != NULL);
 
     AdjacencySequence *adjacencySequence1 = adjacencySequence_construct(cap, INT64_MAX);
@@ -338,7 +310,19 @@ static int makeFlowerAlignmentP(Cap *cap, stHash *endAlignments,
     return 1;
 }
 
-static stSortedSet *makeFlowerAlignment2(Flower *flower, stHash *endAlignments, bool pruneOutStubAlignments) {
+static bool precedesReverse(AlignedPair *alignedPair) {
+    /*
+     * Returns non-zero if the pair sorts before its reverse, so that one of the two is picked.
+     */
+    int i = cactusMisc_nameCompare(alignedPair->subsequenceIdentifier1, alignedPair->subsequenceIdentifier2);
+    if (i == 0) {
+        i = alignedPair->position1 < alignedPair->position2 ? -1 : (alignedPair->position1 > alignedPair->position2 ? 1 :
+            (int)alignedPair->strand1 - (int)alignedPair->strand2);
+    }
+    return i < 0;
+}
+
+static AlignedPairs *makeFlowerAlignment2(Flower *flower, stHash *endAlignments, bool pruneOutStubAlignments) {
     /*
      * Makes the alignments of the ends, in "endAlignments", consistent with one another using the bar algorithm.
      */
@@ -413,28 +397,33 @@ static stSortedSet *makeFlowerAlignment2(Flower *flower, stHash *endAlignments,
     }
     stList_destruct(freeStubCaps);
 
-    //Now convert to set of final aligned pairs to return.
-    stSortedSet *sortedAlignment = stSortedSet_construct3((int(*)(const void *, const void *)) alignedPair_cmpFn,
-            (void(*)(void *)) alignedPair_destruct);
+    //Now convert to the final aligned pairs to return, holding each remaining pair once.
+    int64_t pairNumber = 0;
     stList *endAlignmentsList = stHash_getValues(endAlignments);
-    while (stList_length(endAlignmentsList) > 0) {
-        stSortedSet *endAlignment = stList_pop(endAlignmentsList);
-        while (stSortedSet_size(endAlignment) > 0) {
-            AlignedPair *alignedPair = stSortedSet_getFirst(endAlignment);
-            stSortedSet_remove(endAlignment, alignedPair);
-            assert(stSortedSet_search(endAlignment, alignedPair->reverse) != NULL);
-            stSortedSet_remove(endAlignment, alignedPair->reverse);
-            assert(stSortedSet_search(sortedAlignment, alignedPair) == NULL);
-            assert(stSortedSet_search(sortedAlignment, alignedPair->reverse) == NULL);
-            stSortedSet_insert(sortedAlignment, alignedPair);
-            stSortedSet_insert(sortedAlignment, alignedPair->reverse);
+    for (int64_t i = 0; i < stList_length(endAlignmentsList); i++) {
+        pairNumber += ((AlignedPairs *)stList_get(endAlignmentsList, i))->length;
+    }
+    AlignedPairs *alignment = alignedPairs_construct();
+    alignment->maxLength = pairNumber / 2 + 1;
+    alignment->pairs = st_realloc(alignment->pairs, alignment->maxLength * sizeof(AlignedPair));
+    for (int64_t i = 0; i < stList_length(endAlignmentsList); i++) {
+        AlignedPairs *endAlignment = stList_get(endAlignmentsList, i);
+        for (int64_t j = 0; j < endAlignment->length; j++) {
+            AlignedPair *alignedPair = &endAlignment->pairs[j];
+            if (!alignedPair->deleted && precedesReverse(alignedPair)) {
+                assert(alignedPairs_getReverse(endAlignment, alignedPair) != NULL);
+                assert(!alignedPairs_getReverse(endAlignment, alignedPair)->deleted);
+                assert(alignment->length < alignment->maxLength);
+                alignment->pairs[alignment->length++] = *alignedPair;
+            }
         }
     }
+    alignedPairs_sort(alignment);
     stList_destruct(endAlignmentsList);
     stHash_destruct(endAlignments);
     stHash_destruct(deletedAlignedPairCounts);
 
-    return sortedAlignment;
+    return alignment;
 }
 
 /*
@@ -523,16 +512,102 @@ static stSortedSet *getEndsToAlign(Flower *flower, int64_t maxSequenceLength) {
  * then call the makeFlowerAlignment2 consistency generating function.
  */
 
+/*
+ * The ends to align as tasks, see makeEndAlignmentsAsTasks.
+ */
+typedef struct _EndAlignmentTasks {
+    StateMachine *sM;
+    End **ends;
+    int64_t *totalLengths; // The total adjacency length of each end
+    int64_t endNumber;
+    AlignedPairs **alignments; // The alignment of each end
+    int64_t spanningTrees;
+    int64_t maxSequenceLength;
+    bool useProgressiveMerging;
+    float gapGamma;
+    PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters;
+} EndAlignmentTasks;
+
+static void makeEndAlignmentsAsTasks(void *extraArg) {
+    /*
+     * Makes the alignment of each end as a task, putting it in the corresponding entry of "alignments", and
+     * waits for them. The longest ends are started first so that the longest alignment does not start last.
+     * Each task only reads the flower and writes its own entry, so the tasks need no synchronisation.
+     */
+    EndAlignmentTasks *t = extraArg;
+    stList *order = bar_getIndexesByDescendingLength(t->totalLengths, t->endNumber);
+    for (int64_t k = 0; k < t->endNumber; k++) {
+        int64_t i = (int64_t)stList_get(order, k);
+#if defined(_OPENMP)
+#pragma omp task firstprivate(i)
+#endif
+        t->alignments[i] = makeEndAlignment(t->sM, t->ends[i], t->spanningTrees, t->maxSequenceLength,
+                t->useProgressiveMerging, t->gapGamma, t->pairwiseAlignmentBandingParameters);
+    }
+#if defined(_OPENMP)
+#pragma omp taskwait
+#endif
+    stList_destruct(order);
+}
+
+static int64_t getLargeEnds(stSortedSet *endsToAlign, int64_t largeEndSize, End **largeEnds,
+        int64_t *largeEndLengths) {
+    /*
+     * Puts the ends of "endsToAlign" with at least "largeEndSize" bases in "largeEnds", and their total
+     * adjacency lengths in "largeEndLengths", returning their number, or 0 if there are fewer than 2 of them.
+     */
+    int64_t largeEndNumber = 0;
+    End *end;
+    stSortedSetIterator *it = stSortedSet_getIterator(endsToAlign);
+    while ((end = stSortedSet_getNext(it)) != NULL) {
+        int64_t length = getTotalAdjacencyLength(end);
+        if (length >= largeEndSize) {
+            largeEnds[largeEndNumber] = end;
+            largeEndLengths[largeEndNumber++] = length;
+        }
+    }
+    stSortedSet_destructIterator(it);
+    return largeEndNumber > 1 ? largeEndNumber : 0;
+}
+
 static void computeMissingEndAlignments(StateMachine *sM, Flower *flower, stHash *endAlignments, int64_t spanningTrees,
         int64_t maxSequenceLength, bool useProgressiveMerging, float gapGamma,
-        PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters) {
+        PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters, int64_t largeEndSize) {
     /*
      * Creates end alignments for the ends that
      * do not have an alignment in the "endAlignments" hash, only creating
      * non-trivial end alignments for those specified by "getEndsToAlign".
+     * The ends picked by "getLargeEnds" for "largeEndSize", as for "getEndsToAlignSeparately", are aligned
+     * in parallel first, as OpenMP tasks.
      */
-    //Make the end alignments, representing each as an adjacency alignment.
     stSortedSet *endsToAlign = getEndsToAlign(flower, maxSequenceLength);
+
+    //Align the large ends that have no alignment in parallel, then add them to the hash.
+    End **largeEnds = st_malloc(sizeof(End *) * (stSortedSet_size(endsToAlign) + 1));
+    int64_t *largeEndLengths = st_malloc(sizeof(int64_t) * (stSortedSet_size(endsToAlign) + 1));
+    int64_t largeEndNumber = getLargeEnds(endsToAlign, largeEndSize, largeEnds, largeEndLengths);
+    int64_t j = 0;
+    for (int64_t i = 0; i < largeEndNumber; i++) {
+        if (stHash_search(endAlignments, largeEnds[i]) == NULL) {
+            largeEnds[j] = largeEnds[i];
+            largeEndLengths[j++] = largeEndLengths[i];
+        }
+    }
+    largeEndNumber = j;
+    if (largeEndNumber > 0) {
+        AlignedPairs **largeEndAlignments = st_malloc(sizeof(AlignedPairs *) * largeEndNumber);
+        EndAlignmentTasks endAlignmentTasks = { sM, largeEnds, largeEndLengths, largeEndNumber, largeEndAlignments,
+                spanningTrees, maxSequenceLength, useProgressiveMerging, gapGamma, pairwiseAlignmentBandingParameters };
+        bar_runTasks(makeEndAlignmentsAsTasks, &endAlignmentTasks);
+        for (int64_t i = 0; i < largeEndNumber; i++) {
+            stHash_insert(endAlignments, largeEnds[i], largeEndAlignments[i]);
+        }
+        free(largeEndAlignments);
+    }
+    free(largeEnds);
+    free(largeEndLengths);
+
+    //Make the remaining end alignments, representing each as an adjacency alignment.
     End *end;
     Flower_EndIterator *endIterator = flower_getEndIterator(flower);
     while ((end = flower_getNextEnd(endIterator)) != NULL) {
@@ -545,7 +620,7 @@ static void computeMissingEndAlignments(StateMachine *sM, Flower *flower, stHash
                                 useProgressiveMerging, gapGamma,
                                 pairwiseAlignmentBandingParameters));
             } else {
-                stHash_insert(endAlignments, end, stSortedSet_construct());
+                stHash_insert(endAlignments, end, alignedPairs_construct());
             }
         }
     }
@@ -553,12 +628,12 @@ static void computeMissingEndAlignments(StateMachine *sM, Flower *flower, stHash
     stSortedSet_destruct(endsToAlign);
 }
 
-stSortedSet *makeFlowerAlignment(StateMachine *sM, Flower *flower, int64_t spanningTrees, int64_t maxSequenceLength,
+AlignedPairs *makeFlowerAlignment(StateMachine *sM, Flower *flower, int64_t spanningTrees, int64_t maxSequenceLength,
         bool useProgressiveMerging, float gapGamma,
-        PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters, bool pruneOutStubAlignments, int64_t poaWindow) {
-    stHash *endAlignments = stHash_construct2(NULL, (void(*)(void *)) stSortedSet_destruct);
+        PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters, bool pruneOutStubAlignments) {
+    stHash *endAlignments = stHash_construct2(NULL, (void(*)(void *)) alignedPairs_destruct);
     computeMissingEndAlignments(sM, flower, endAlignments, spanningTrees, maxSequenceLength,
-            useProgressiveMerging, gapGamma, pairwiseAlignmentBandingParameters);
+            useProgressiveMerging, gapGamma, pairwiseAlignmentBandingParameters, INT64_MAX);
     return makeFlowerAlignment2(flower, endAlignments, pruneOutStubAlignments);
 }
 
@@ -568,8 +643,8 @@ static void loadEndAlignments(Flower *flower, stHash *endAlignments, stList *lis
      */
     for (int64_t i = 0; i < stList_length(listOfEndAlignments); i++) {
         End *end;
-        FILE *fileHandle = fopen(stList_get(listOfEndAlignments, i), "r");
-        stSortedSet *alignment;
+        FILE *fileHandle = fopen(stList_get(listOfEndAlignments, i), "rb");
+        AlignedPairs *alignment;
         while((alignment = loadEndAlignmentFromDisk(flower, fileHandle, &end)) != NULL) {
             assert(stHash_search(endAlignments, end) == NULL);
             stHash_insert(endAlignments, end, alignment);
@@ -578,15 +653,16 @@ static void loadEndAlignments(Flower *flower, stHash *endAlignments, stList *lis
     }
 }
 
-stSortedSet *makeFlowerAlignment3(StateMachine *sM, Flower *flower, stList *listOfEndAlignmentFiles, int64_t spanningTrees,
+AlignedPairs *makeFlowerAlignment3(StateMachine *sM, Flower *flower, stList *listOfEndAlignmentFiles, int64_t spanningTrees,
         int64_t maxSequenceLength, bool useProgressiveMerging, float gapGamma,
-        PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters, bool pruneOutStubAlignments) {
-    stHash *endAlignments = stHash_construct2(NULL, (void(*)(void *)) stSortedSet_destruct);
+        PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters, bool pruneOutStubAlignments,
+        int64_t largeEndSize) {
+    stHash *endAlignments = stHash_construct2(NULL, (void(*)(void *)) alignedPairs_destruct);
     if(listOfEndAlignmentFiles != NULL) {
         loadEndAlignments(flower, endAlignments, listOfEndAlignmentFiles);
     }
     computeMissingEndAlignments(sM, flower, endAlignments, spanningTrees, maxSequenceLength,
-            useProgressiveMerging, gapGamma, pairwiseAlignmentBandingParameters);
+            useProgressiveMerging, gapGamma, pairwiseAlignmentBandingParameters, largeEndSize);
     return makeFlowerAlignment2(flower, endAlignments, pruneOutStubAlignments);
 }
 
@@ -617,18 +693,15 @@ stSortedSet *getEndsToAlignSeparately(Flower *flower, int64_t maxSequenceLength,
      * than 2 of them, returns them in a set.
      */
     stSortedSet *endsToAlign = getEndsToAlign(flower, maxSequenceLength);
-    stSortedSetIterator *it = stSortedSet_getIterator(endsToAlign);
-    End *end;
+    End **largeEnds = st_malloc(sizeof(End *) * (stSortedSet_size(endsToAlign) + 1));
+    int64_t *largeEndLengths = st_malloc(sizeof(int64_t) * (stSortedSet_size(endsToAlign) + 1));
+    int64_t largeEndNumber = getLargeEnds(endsToAlign, largeEndSize, largeEnds, largeEndLengths);
     stSortedSet *largeEndsToAlign = stSortedSet_construct();
-    while ((end = stSortedSet_getNext(it)) != NULL) {
-        if (getTotalAdjacencyLength(end) >= largeEndSize) {
-            stSortedSet_insert(largeEndsToAlign, end);
-        }
+    for (int64_t i = 0; i < largeEndNumber; i++) {
+        stSortedSet_insert(largeEndsToAlign, largeEnds[i]);
     }
     stSortedSet_destruct(endsToAlign);
-    if (stSortedSet_size(largeEndsToAlign) <= 1) {
-        stSortedSet_destruct(largeEndsToAlign);
-        return stSortedSet_construct();
-    }
+    free(largeEnds);
+    free(largeEndLengths);
     return largeEndsToAlign;
 }
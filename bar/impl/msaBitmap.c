@@ -0,0 +1,180 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include "msaBitmap.h"
+
+#include <string.h>
+
+#if defined(__AVX2__) || defined(__SSE2__)
+#if defined(USE_SIMDE)
+#include "simde/x86/avx2.h"
+#else
+#include <immintrin.h>
+#endif
+#endif
+
+// The values msa_to_base() maps to a gap
+#define MSA_GAP 5
+#define MSA_GAP2 27
+
+static inline bool is_gap(uint8_t n) {
+    return n == MSA_GAP || n == MSA_GAP2;
+}
+
+/*
+ * Returns the mask of the first length (at most 64) values of the row that are not gaps, bit i set if value i is not.
+ */
+static inline uint64_t get_row_base_mask(uint8_t *row, int64_t length) {
+    assert(length <= 64);
+    uint64_t mask = 0;
+    int64_t i = 0;
+#if defined(__AVX2__)
+    __m256i gap = _mm256_set1_epi8(MSA_GAP), gap2 = _mm256_set1_epi8(MSA_GAP2);
+    for (; i + 32 <= length; i += 32) {
+        __m256i v = _mm256_loadu_si256((__m256i *)(row + i));
+        __m256i gaps = _mm256_or_si256(_mm256_cmpeq_epi8(v, gap), _mm256_cmpeq_epi8(v, gap2));
+        mask |= (uint64_t)(~(uint32_t)_mm256_movemask_epi8(gaps)) << i;
+    }
+#endif
+#if defined(__AVX2__) || defined(__SSE2__)
+    __m128i gap_128 = _mm_set1_epi8(MSA_GAP), gap2_128 = _mm_set1_epi8(MSA_GAP2);
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128((__m128i *)(row + i));
+        __m128i gaps = _mm_or_si128(_mm_cmpeq_epi8(v, gap_128), _mm_cmpeq_epi8(v, gap2_128));
+        mask |= (uint64_t)(~(uint32_t)_mm_movemask_epi8(gaps) & 0xFFFF) << i;
+    }
+#endif
+    for (; i < length; i++) {
+        mask |= (uint64_t)!is_gap(row[i]) << i;
+    }
+    return mask;
+}
+
+/*
+ * Transposes the 64x64 bit matrix in place, so that afterwards bit j of word i is bit i of word j before.
+ */
+static void transpose_bits(uint64_t *a) {
+    uint64_t m = 0x00000000FFFFFFFFULL;
+    for (int64_t j = 32; j != 0; j >>= 1, m ^= m << j) {
+        for (int64_t k = 0; k < 64; k = ((k | j) + 1) & ~j) {
+            uint64_t t = ((a[k] >> j) ^ a[k | j]) & m;
+            a[k] ^= t << j;
+            a[k | j] ^= t;
+        }
+    }
+}
+
+MsaBitmap *msa_bitmap_construct(Msa *msa) {
+    MsaBitmap *bitmap = st_malloc(sizeof(MsaBitmap));
+    bitmap->row_no = msa->seq_no;
+    bitmap->column_no = msa->column_no;
+    bitmap->words_per_column = (msa->seq_no + 63) / 64;
+    // One word more, so the allocation is never empty
+    bitmap->bits = st_calloc(bitmap->column_no * bitmap->words_per_column + 1, sizeof(uint64_t));
+
+    // Take the row masks of each 64x64 tile of the msa and transpose them into the column words
+    uint64_t tile[64];
+    for (int64_t w = 0; w < bitmap->words_per_column; w++) {
+        int64_t rows = msa->seq_no - w * 64 < 64 ? msa->seq_no - w * 64 : 64;
+        for (int64_t j = 0; j < msa->column_no; j += 64) {
+            int64_t columns = msa->column_no - j < 64 ? msa->column_no - j : 64;
+            for (int64_t i = 0; i < 64; i++) {
+                tile[i] = i < rows ? get_row_base_mask(msa->msa_seq[w * 64 + i] + j, columns) : 0;
+            }
+            transpose_bits(tile);
+            for (int64_t k = 0; k < columns; k++) {
+                bitmap->bits[(j + k) * bitmap->words_per_column + w] = tile[k];
+            }
+        }
+    }
+    return bitmap;
+}
+
+void msa_bitmap_destruct(MsaBitmap *bitmap) {
+    free(bitmap->bits);
+    free(bitmap);
+}
+
+int64_t msa_bitmap_column_bases(MsaBitmap *bitmap, int64_t column) {
+    uint64_t *words = bitmap->bits + column * bitmap->words_per_column;
+    int64_t bases = 0;
+    for (int64_t w = 0; w < bitmap->words_per_column; w++) {
+        bases += __builtin_popcountll(words[w]);
+    }
+    return bases;
+}
+
+void msa_bitmap_column_scores(MsaBitmap *bitmap, float *column_scores) {
+    for (int64_t j = 0; j < bitmap->column_no; j++) {
+        int64_t bases = msa_bitmap_column_bases(bitmap, j);
+        column_scores[j] = bases > 1 ? bases - 1 : 0;
+    }
+}
+
+int64_t msa_bitmap_next_different_column(MsaBitmap *bitmap, int64_t start) {
+    assert(start < bitmap->column_no);
+    size_t column_size = bitmap->words_per_column * sizeof(uint64_t);
+    uint64_t *start_words = bitmap->bits + start * bitmap->words_per_column;
+    int64_t end = start;
+    while (++end < bitmap->column_no) {
+        if (memcmp(start_words, bitmap->bits + end * bitmap->words_per_column, column_size) != 0) {
+            return end;
+        }
+    }
+    return end;
+}
+
+#if defined(__AVX2__)
+static inline __m256i select_256(__m256i mask, __m256i a, __m256i b) {
+    return _mm256_or_si256(_mm256_and_si256(mask, a), _mm256_andnot_si256(mask, b));
+}
+#endif
+#if defined(__AVX2__) || defined(__SSE2__)
+static inline __m128i select_128(__m128i mask, __m128i a, __m128i b) {
+    return _mm_or_si128(_mm_and_si128(mask, a), _mm_andnot_si128(mask, b));
+}
+#endif
+
+void msa_canonicalise_row(uint8_t *row, int64_t length) {
+    // msa_to_base() maps 0-3 to themselves, upper and lower case ASCII ACGT (and U) to 0-3, the two gap
+    // values to the gap and anything else to N, so lower case bits are cleared by or-ing with 0x20
+    int64_t i = 0;
+#if defined(__AVX2__)
+    __m256i lower_case = _mm256_set1_epi8(0x20), three = _mm256_set1_epi8(3);
+    for (; i + 32 <= length; i += 32) {
+        __m256i v = _mm256_loadu_si256((__m256i *)(row + i));
+        __m256i c = _mm256_or_si256(v, lower_case);
+        __m256i r = _mm256_set1_epi8(4);
+        r = select_256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('a')), _mm256_set1_epi8(0), r);
+        r = select_256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('c')), _mm256_set1_epi8(1), r);
+        r = select_256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('g')), _mm256_set1_epi8(2), r);
+        r = select_256(_mm256_or_si256(_mm256_cmpeq_epi8(c, _mm256_set1_epi8('t')),
+                                       _mm256_cmpeq_epi8(c, _mm256_set1_epi8('u'))), three, r);
+        r = select_256(_mm256_or_si256(_mm256_cmpeq_epi8(v, _mm256_set1_epi8(MSA_GAP)),
+                                       _mm256_cmpeq_epi8(v, _mm256_set1_epi8(MSA_GAP2))), _mm256_set1_epi8(MSA_GAP), r);
+        r = select_256(_mm256_cmpeq_epi8(_mm256_min_epu8(v, three), v), v, r);
+        _mm256_storeu_si256((__m256i *)(row + i), r);
+    }
+#endif
+#if defined(__AVX2__) || defined(__SSE2__)
+    __m128i lower_case_128 = _mm_set1_epi8(0x20), three_128 = _mm_set1_epi8(3);
+    for (; i + 16 <= length; i += 16) {
+        __m128i v = _mm_loadu_si128((__m128i *)(row + i));
+        __m128i c = _mm_or_si128(v, lower_case_128);
+        __m128i r = _mm_set1_epi8(4);
+        r = select_128(_mm_cmpeq_epi8(c, _mm_set1_epi8('a')), _mm_set1_epi8(0), r);
+        r = select_128(_mm_cmpeq_epi8(c, _mm_set1_epi8('c')), _mm_set1_epi8(1), r);
+        r = select_128(_mm_cmpeq_epi8(c, _mm_set1_epi8('g')), _mm_set1_epi8(2), r);
+        r = select_128(_mm_or_si128(_mm_cmpeq_epi8(c, _mm_set1_epi8('t')),
+                                    _mm_cmpeq_epi8(c, _mm_set1_epi8('u'))), three_128, r);
+        r = select_128(_mm_or_si128(_mm_cmpeq_epi8(v, _mm_set1_epi8(MSA_GAP)),
+                                    _mm_cmpeq_epi8(v, _mm_set1_epi8(MSA_GAP2))), _mm_set1_epi8(MSA_GAP), r);
+        r = select_128(_mm_cmpeq_epi8(_mm_min_epu8(v, three_128), v), v, r);
+        _mm_storeu_si128((__m128i *)(row + i), r);
+    }
+#endif
+    for (; i < length; i++) {
+        row[i] = msa_to_byte(msa_to_base(row[i]));
+    }
+}
@@ -6,10 +6,13 @@
 
 #include "abpoa.h"
 #include "poaBarAligner.h"
+#include "barTasks.h"
 #include "flowerAligner.h"
+#include "msaBitmap.h"
 
 #include <stdio.h>
 #include <ctype.h>
+#include <strings.h>
 
 // FOR DEBUGGING ONLY: Specify directory where abpoa inputs get dumped
 //#define CACTUS_ABPOA_MSA_DUMP_DIR "/home/hickey/dev/cactus/dump"
@@ -17,9 +20,9 @@
 //#define CACTUS_ABPOA_FROM_COMMAND_LINE
 
 // OpenMP
-//#if defined(_OPENMP)
-//#include <omp.h>
-//#endif
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
 
 abpoa_para_t *abpoaParamaters_constructFromCactusParams(CactusParams *params) {
     abpoa_para_t *abpt = abpoa_init_para();
@@ -111,6 +114,99 @@ static abpoa_para_t *copy_abpoa_params(abpoa_para_t *abpt) {
     return abpt_cpy;
 }
 
+/*
+ * Returns non-zero if abpoa parameters made with copy_abpoa_params from the two parameter objects would be the same.
+ */
+static bool abpoa_params_equal(abpoa_para_t *abpt, abpoa_para_t *abpt2) {
+    if (abpt->align_mode != abpt2->align_mode || abpt->wb != abpt2->wb || abpt->wf != abpt2->wf ||
+        abpt->match != abpt2->match || abpt->mismatch != abpt2->mismatch || abpt->gap_mode != abpt2->gap_mode ||
+        abpt->gap_open1 != abpt2->gap_open1 || abpt->gap_ext1 != abpt2->gap_ext1 ||
+        abpt->gap_open2 != abpt2->gap_open2 || abpt->gap_ext2 != abpt2->gap_ext2 ||
+        abpt->disable_seeding != abpt2->disable_seeding || abpt->k != abpt2->k || abpt->w != abpt2->w ||
+        abpt->min_w != abpt2->min_w || abpt->progressive_poa != abpt2->progressive_poa ||
+        abpt->use_score_matrix != abpt2->use_score_matrix || abpt->max_mat != abpt2->max_mat ||
+        abpt->min_mis != abpt2->min_mis) {
+        return 0;
+    }
+    return abpt->use_score_matrix != 1 || memcmp(abpt->mat, abpt2->mat, abpt->m * abpt->m * sizeof(int)) == 0;
+}
+
+/*
+ * An abpoa aligner together with the post-processed parameters it is run with. Each thread keeps one, which is
+ * reused for every window it aligns rather than being rebuilt for each, so the dynamic programming matrices and
+ * the scoring matrix are allocated once. The engine lives as long as the thread, being rebuilt only if it is
+ * asked to align with different parameters.
+ */
+typedef struct _poaEngine {
+    abpoa_t *ab;
+    abpoa_para_t *abpt; // The parameters used for alignment, which abpoa may modify
+    abpoa_para_t *source; // An unmodified copy of the parameters the engine was built from
+} PoaEngine;
+
+static PoaEngine poaEngine = { NULL, NULL, NULL };
+#if defined(_OPENMP)
+#pragma omp threadprivate(poaEngine)
+#endif
+
+/*
+ * Gets the engine of the thread, ready to align with the given parameters.
+ */
+static PoaEngine *get_poa_engine(abpoa_para_t *poa_parameters) {
+    if (poaEngine.ab == NULL) {
+        poaEngine.ab = abpoa_init();
+    }
+    if (poaEngine.source == NULL || !abpoa_params_equal(poaEngine.source, poa_parameters)) {
+        if (poaEngine.source != NULL) {
+            abpoa_free_para(poaEngine.source);
+            abpoa_free_para(poaEngine.abpt);
+        }
+        poaEngine.source = copy_abpoa_params(poa_parameters);
+        poaEngine.abpt = copy_abpoa_params(poa_parameters);
+    } else {
+        // Restore the settings that are changed between windows, or that abpoa may change, none of which
+        // affect the post-processed parameters
+        poaEngine.abpt->out_msa = 1;
+        poaEngine.abpt->out_cons = 0;
+        poaEngine.abpt->align_mode = poaEngine.source->align_mode;
+        poaEngine.abpt->wb = poaEngine.source->wb;
+        poaEngine.abpt->wf = poaEngine.source->wf;
+        poaEngine.abpt->disable_seeding = poaEngine.source->disable_seeding;
+        poaEngine.abpt->k = poaEngine.source->k;
+        poaEngine.abpt->w = poaEngine.source->w;
+        poaEngine.abpt->min_w = poaEngine.source->min_w;
+        poaEngine.abpt->progressive_poa = poaEngine.source->progressive_poa;
+    }
+    return &poaEngine;
+}
+
+/*
+ * Frees the engine of the calling thread, if it has one.
+ */
+static void free_thread_poa_engine(void) {
+    if (poaEngine.ab != NULL) {
+        abpoa_free(poaEngine.ab);
+    }
+    if (poaEngine.source != NULL) {
+        abpoa_free_para(poaEngine.source);
+        abpoa_free_para(poaEngine.abpt);
+    }
+    poaEngine.ab = NULL;
+    poaEngine.abpt = NULL;
+    poaEngine.source = NULL;
+}
+
+void poa_engine_destruct(void) {
+#if defined(_OPENMP)
+    if (!omp_in_parallel()) {
+        // The threads of a parallel region are those of the previous ones, so each frees the engine it kept
+#pragma omp parallel
+        free_thread_poa_engine();
+        return;
+    }
+#endif
+    free_thread_poa_engine();
+}
+
 // char <--> uint8_t conversion copied over from abPOA example
 // AaCcGgTtNn ==> 0,1,2,3,4
 static unsigned char nst_nt4_table[256] = {
@@ -160,12 +256,6 @@ uint8_t msa_to_byte(char c) {
     return nst_nt4_table[(int)c];
 }
 
-static uint8_t rc_table[6] = { 3, 2, 1, 0, 4, 5 };
-
-static inline uint8_t msa_to_rc(uint8_t n) {
-    return rc_table[n];
-}
-
 #ifdef CACTUS_ABPOA_MSA_DUMP_DIR
 // dump the abpoa input to files, and return a command line for running abpoa on them
 char* dump_abpoa_input(Msa* msa, abpoa_para_t* abpt, uint8_t **bseqs, char* abpoa_input_path, char* abpoa_matrix_path,
@@ -296,85 +386,73 @@ void msa_print(Msa *msa, FILE *f) {
     fprintf(f, "\n");
 }
 
-/**
- * flip msa to its reverse complement (for trimming purposees)
- */
-static void flip_msa_seq(Msa* msa) {
-    if (msa != NULL) {
-        int64_t middle = msa->column_no / 2;
-        bool odd = msa->column_no % 2 == 1;
-        for (int64_t i = 0; i < msa->seq_no; ++i) {
-            for (int64_t j = 0; j < middle; ++j) {
-                uint8_t buf = msa->msa_seq[i][j];
-                msa->msa_seq[i][j] = msa_to_rc(msa->msa_seq[i][msa->column_no - 1 - j]);
-                msa->msa_seq[i][msa->column_no - 1 - j] = msa_to_rc(buf);
-            }
-            if (odd) {
-                msa->msa_seq[i][middle] = msa_to_rc(msa->msa_seq[i][middle]);
-            }
-        }
-    }
-}
-
 /**
  * Returns an array of floats, one for each corresponding column in the MSA. Each float
  * is the score of the column in the alignment.
  */
 static float *make_column_scores(Msa *msa) {
     float *column_scores = st_calloc(msa->column_no, sizeof(float));
-    for(int64_t i=0; i<msa->column_no; i++) {
-        // Score is simply max(number of aligned bases in the column - 1, 0)
-        for(int64_t j=0; j<msa->seq_no; j++) {
-            if(msa_to_base(msa->msa_seq[j][i]) != '-') {
-                column_scores[i]++;
-            }
-        }
-        if(column_scores[i] >= 1.0) {
-            column_scores[i]--;
-        }
-        assert(column_scores[i] >= 0.0);
-    }
+    // Score is simply max(number of aligned bases in the column - 1, 0), counted a word of rows at a time
+    MsaBitmap *bitmap = msa_bitmap_construct(msa);
+    msa_bitmap_column_scores(bitmap, column_scores);
+    msa_bitmap_destruct(bitmap);
     return column_scores;
 }
 
 /**
- * Fills in cu_column_scores with the cumulative sum of column scores, from left-to-right, of columns
- * containing a non-gap character in the given "row".
+ * Gets the index of the ith column of the MSA read left-to-right, or right-to-left if reversed.
+ */
+static inline int64_t get_column(Msa *msa, bool reversed, int64_t i) {
+    return reversed ? msa->column_no - 1 - i : i;
+}
+
+/**
+ * Fills in cu_column_scores with the cumulative sum of column scores, in the reading direction of the row,
+ * of the columns containing the last "overlap" bases of the given "row". Only the end of the row is scanned.
  */
-static void sum_column_scores(int64_t row, Msa *msa, float *column_scores, float *cu_column_scores) {
-    float cu_score = 0.0; // The cumulative sum of column scores containing bases for the given row
-    int64_t j=0; // The index in the DNA string for the given row
-    for(int64_t i=0; i<msa->column_no; i++) {
-        if(msa_to_base(msa->msa_seq[row][i]) != '-') {
-            cu_score += column_scores[i];
-            cu_column_scores[j++] = cu_score;
+static void sum_column_scores(int64_t row, Msa *msa, bool reversed, float *column_scores, int64_t overlap,
+                              float *cu_column_scores) {
+    int64_t j = overlap; // The index in the overlap of the next base, walking back from the end of the row
+    for(int64_t i=msa->column_no-1; j>0; i--) {
+        assert(i >= 0); // We should find all the bases of the overlap
+        int64_t column = get_column(msa, reversed, i);
+        if(msa_to_base(msa->msa_seq[row][column]) != '-') {
+            cu_column_scores[--j] = column_scores[column];
         }
     }
-    assert(msa->seq_lens[row] == j); // We should cover all the bases in the DNA sequence
+    for(j=1; j<overlap; j++) {
+        cu_column_scores[j] += cu_column_scores[j-1];
+    }
 }
 
 /**
- * Removes the suffix of the given row from the MSA and updates the column scores. suffix_start is the beginning
- * suffix to remove.
+ * Removes the suffix of the given row, read left-to-right or right-to-left if reversed, from the MSA and updates
+ * the column scores and the length of the row. suffix_start is the beginning suffix to remove. Only the suffix
+ * is scanned.
  */
-static void trim_msa_suffix(Msa *msa, float *column_scores, int64_t row, int64_t suffix_start) {
-    int64_t seq_index = 0;
-    for(int64_t i=0; i<msa->column_no; i++) {
-        if(msa_to_base(msa->msa_seq[row][i]) != '-') {
-            if(seq_index++ >= suffix_start) {
-                msa->msa_seq[row][i] = msa_to_byte('-');
-                column_scores[i] = column_scores[i] > 1 ? column_scores[i]-1 : 0;
-                assert(column_scores[i] >= 0.0);
-            }
+static void trim_msa_suffix(Msa *msa, float *column_scores, int64_t row, bool reversed, int64_t suffix_start) {
+    int64_t suffix_length = msa->seq_lens[row] - suffix_start; // The bases left to remove
+    for(int64_t i=msa->column_no-1; suffix_length>0; i--) {
+        assert(i >= 0);
+        int64_t column = get_column(msa, reversed, i);
+        if(msa_to_base(msa->msa_seq[row][column]) != '-') {
+            msa->msa_seq[row][column] = msa_to_byte('-');
+            column_scores[column] = column_scores[column] > 1 ? column_scores[column]-1 : 0;
+            assert(column_scores[column] >= 0.0);
+            suffix_length--;
         }
     }
+    if(suffix_start < msa->seq_lens[row]) {
+        msa->seq_lens[row] = suffix_start;
+    }
 }
 
 /**
- * Used to make two MSAs consistent with each other for a shared sequence
+ * Used to make two MSAs consistent with each other for a shared sequence. The shared sequence is at the end of
+ * the rows of both, read right-to-left in msa1 if reversed1 and in msa2 if reversed2, and left-to-right otherwise.
  */
-static void trim(int64_t row1, Msa *msa1, float *column_scores1,
-                 int64_t row2, Msa *msa2, float *column_scores2, int64_t overlap) {
+static void trim(int64_t row1, Msa *msa1, float *column_scores1, bool reversed1,
+                 int64_t row2, Msa *msa2, float *column_scores2, bool reversed2, int64_t overlap) {
     if(overlap == 0) { // There is no overlap, so no need to trim either MSA
         return;
     }
@@ -386,26 +464,21 @@ static void trim(int64_t row1, Msa *msa1, float *column_scores1,
     assert(overlap <= seq_len1); // The overlap must be less than the length of the prefixes
     assert(overlap <= seq_len2);
 
-    // Get the cumulative cut scores for the columns containing the shared sequence
-    float *cu_column_scores1 = st_malloc(msa1->column_no * sizeof(float));
-    float *cu_column_scores2 = st_malloc(msa2->column_no * sizeof(float));
-    sum_column_scores(row1, msa1, column_scores1, cu_column_scores1);
-    sum_column_scores(row2, msa2, column_scores2, cu_column_scores2);
+    // Get the cumulative cut scores for the columns containing the shared sequence. The columns before the
+    // overlap are kept whatever the cut point, so are left out of all the sums.
+    float *cu_column_scores1 = st_malloc(overlap * sizeof(float));
+    float *cu_column_scores2 = st_malloc(overlap * sizeof(float));
+    sum_column_scores(row1, msa1, reversed1, column_scores1, overlap, cu_column_scores1);
+    sum_column_scores(row2, msa2, reversed2, column_scores2, overlap, cu_column_scores2);
 
     // The score if we cut all of the overlap in msa1 and keep all of the overlap in msa2
-    assert(seq_len2 <= msa2->column_no);
-    float max_cut_score = cu_column_scores2[seq_len2-1];
-    if(overlap < seq_len1) { // The overlap is less than the length of the first sequence
-        assert(seq_len1-overlap-1 >= 0);
-        max_cut_score += cu_column_scores1[seq_len1-overlap-1]; // We will keep everything before the overlap
-    }
+    float max_cut_score = cu_column_scores2[overlap-1];
     int64_t max_overlap_cut_point = 0; // the length of the prefix of the overlap of msa1 to keep
 
     // Now walk through each possible cut point within the overlap
     for(int64_t i=0; i<overlap-1; i++) {
-        assert(seq_len2-i-2 >= 0); // Sanity check
-        float cut_score = cu_column_scores1[seq_len1-overlap+i] + cu_column_scores2[seq_len2-i-2]; // The score if we keep prefix up to
-        // and including column i of MSA1's overlap, and the prefix of msa2 up to and including column seq_len-i-2
+        float cut_score = cu_column_scores1[i] + cu_column_scores2[overlap-i-2]; // The score if we keep prefix up to
+        // and including column i of MSA1's overlap, and the prefix of msa2's overlap up to and including column overlap-i-2
         if(cut_score > max_cut_score) {
             max_overlap_cut_point = i + 1;
             max_cut_score = cut_score;
@@ -413,12 +486,7 @@ static void trim(int64_t row1, Msa *msa1, float *column_scores1,
     }
 
     // The score if we cut all of msa2's overlap and keep all of msa1's
-    float f = cu_column_scores1[seq_len1-1];
-    if(overlap < seq_len2) {
-        assert(seq_len2-overlap-1 >= 0);
-        f += cu_column_scores2[seq_len2-overlap-1];
-    }
-
+    float f = cu_column_scores1[overlap-1];
     if(f > max_cut_score) {
         max_cut_score = f;
         max_overlap_cut_point = overlap;
@@ -426,42 +494,447 @@ static void trim(int64_t row1, Msa *msa1, float *column_scores1,
 
     // Now trim back the two MSAs
     assert(max_overlap_cut_point <= overlap);
-    trim_msa_suffix(msa1, column_scores1, row1, seq_len1 - overlap + max_overlap_cut_point);
-    trim_msa_suffix(msa2, column_scores2, row2, seq_len2 - max_overlap_cut_point);
+    trim_msa_suffix(msa1, column_scores1, row1, reversed1, seq_len1 - overlap + max_overlap_cut_point);
+    trim_msa_suffix(msa2, column_scores2, row2, reversed2, seq_len2 - max_overlap_cut_point);
 
     free(cu_column_scores1);
     free(cu_column_scores2);
 }
 
 /**
- * recompute the seq_lens of a trimmed msa and clip off empty suffix columns
- * (todo: can this be built into trimming code?)
+ * Returns the number of columns at the end of the msa, or at its start if reversed, without a base in any row.
  */
-static void msa_fix_trimmed(Msa* msa) {
+static int64_t get_empty_end_columns(Msa *msa, bool reversed) {
+    int64_t empty_columns = msa->column_no;
+    for (int64_t i = 0; i < msa->seq_no && empty_columns > 0; ++i) {
+        for (int64_t j = 0; j < empty_columns; ++j) {
+            if (msa_to_base(msa->msa_seq[i][get_column(msa, !reversed, j)]) != '-') {
+                empty_columns = j;
+            }
+        }
+    }
+    return empty_columns;
+}
+
+/*
+ * Aligns one window of the sequences, row i being the bases [starts[i], ends[i]) of seqs[i]. Rows with no bases
+ * are aligned as a single N that is then removed, as poa can not handle empty sequences. The seq_lens of the
+ * returned msa are the number of bases of each row in the window.
+ */
+static Msa *msa_align_window(char **seqs, int64_t seq_no, int64_t *starts, int64_t *ends,
+                             int64_t max_prog_rows, double max_prog_length_diff, abpoa_para_t *poa_parameters) {
+    // Make Msa object
+    Msa *msa = st_malloc(sizeof(Msa));
+    msa->seq_no = seq_no;
+    msa->seqs = NULL;
+    msa->seq_lens = st_malloc(sizeof(int) * msa->seq_no);
+    bool *empty_seqs = (bool*)st_calloc(seq_no, sizeof(bool));
+
+    // load the window of each sequence into the input matrix for poa
+    uint8_t **bseqs = (uint8_t**)st_malloc(sizeof(uint8_t*) * seq_no);
     for (int64_t i = 0; i < msa->seq_no; ++i) {
-        // recompute the seq_len
+        assert(ends[i] >= starts[i]);
+        bseqs[i] = (uint8_t*)st_malloc(sizeof(uint8_t) * (ends[i] > starts[i] ? ends[i] - starts[i] : 1));
         msa->seq_lens[i] = 0;
-        for (int64_t j = 0; j < msa->column_no; ++j) {
-            if (msa_to_base(msa->msa_seq[i][j]) != '-') {
-                ++msa->seq_lens[i];
+        for (int64_t j = starts[i]; j < ends[i]; ++j, ++msa->seq_lens[i]) {
+            // todo: support iupac characters?
+            bseqs[i][msa->seq_lens[i]] = msa_to_byte(seqs[i][j]);
+        }
+    }
+
+    // poa can't handle empty sequences.  this is a hack to get around that
+    int emptyCount = 0;
+    for (int64_t i = 0; i < msa->seq_no; ++i) {
+        if (msa->seq_lens[i] == 0) {
+            empty_seqs[i] = true;
+            msa->seq_lens[i] = 1;
+            bseqs[i][0] = msa_to_byte('N');
+            ++emptyCount;
+        } else {
+            empty_seqs[i] = false;
+        }
+    }
+
+    // get the abpoa engine of the thread, which abpoa_msa resets for the window
+    PoaEngine *engine = get_poa_engine(poa_parameters);
+    abpoa_t *ab = engine->ab;
+    abpoa_para_t *abpt = engine->abpt;
+    if (msa->seq_no > max_prog_rows ||
+        // note: these are sorted by length excep in unit tests
+        (1. - (double)msa->seq_lens[msa->seq_no-1] / (double)msa->seq_lens[0] > max_prog_length_diff)) {
+        abpt->progressive_poa = 0;
+    }
+
+#ifdef CACTUS_ABPOA_MSA_DUMP_DIR
+    // dump the input to file
+    char abpoa_input_path[1024], abpoa_matrix_path[1024], abpoa_command_path[1024], abpoa_output_path[1024];
+    sprintf(abpoa_input_path, "%s/ap_in_%ld.fa", CACTUS_ABPOA_MSA_DUMP_DIR, (int64_t)msa);
+    sprintf(abpoa_matrix_path, "%s.mat", abpoa_input_path);
+    sprintf(abpoa_command_path, "%s.cmd", abpoa_input_path);
+    sprintf(abpoa_output_path, "%s.out", abpoa_input_path);
+    char* abpoa_command_line = dump_abpoa_input(msa, abpt, bseqs,
+                                                abpoa_input_path, abpoa_matrix_path, abpoa_command_path, abpoa_output_path);
+#endif
+
+#ifdef CACTUS_ABPOA_FROM_COMMAND_LINE
+    // run abpoa from the command line
+    abpoa_msa_from_command_line(abpoa_command_line, abpoa_output_path, &(msa->msa_seq), &(msa->column_no));
+
+    int test_cols = 0;
+    uint8_t** test_msa = NULL;
+    abpoa_msa(ab, abpt, msa->seq_no, NULL, msa->seq_lens, bseqs, NULL, NULL);
+    // abpoa's interface has changed a bit -- instead of passing in pointers to the results, they
+    // end up in the ab->abc struct -- we extract them here
+    test_msa = ab->abc->msa_base;
+    ab->abc->msa_base = NULL;
+    test_cols = ab->abc->msa_len;
+
+    // sanity check to make sure we get the same output
+    assert(msa->column_no == test_cols);
+    for (int i = 0; i < msa->seq_no; ++i) {
+      for (int j = 0; j < test_cols; ++j) {
+          //todo: not sure why this doesn't work anymore !!!!
+          //assert(test_msa[i][j] == msa->msa_seq[i][j]);
+      }
+      free(test_msa[i]);
+    }
+    free(test_msa);
+#else
+    // perform abpoa-msa
+    abpoa_msa(ab, abpt, msa->seq_no, NULL, msa->seq_lens, bseqs, NULL, NULL);
+    // abpoa's interface has changed a bit -- instead of passing in pointers to the results, they
+    // end up in the ab->abc struct -- we extract them here
+    msa->msa_seq = ab->abc->msa_base;
+    ab->abc->msa_base = NULL;
+    msa->column_no = ab->abc->msa_len;
+#endif
+
+#ifdef CACTUS_ABPOA_MSA_DUMP_DIR
+    // we got this far without crashing, so delete the dumped file (they can really pile up otherwise)
+    remove(abpoa_input_path);
+    remove(abpoa_matrix_path);
+    remove(abpoa_command_path);
+    remove(abpoa_output_path);
+    free(abpoa_command_line);
+#endif
+
+    // mask out empty sequences that were phonied in as Ns above
+    for (int64_t i = 0; i < msa->seq_no && emptyCount > 0; ++i) {
+        if (empty_seqs[i] == true) {
+            for (int j = 0; j < msa->column_no; ++j) {
+                if (msa_to_base(msa->msa_seq[i][j]) != '-') {
+                    assert(msa_to_base(msa->msa_seq[i][j]) == 'N');
+                    msa->msa_seq[i][j] = msa_to_byte('-');
+                    --msa->seq_lens[i];
+                    assert(msa->seq_lens[i] == 0);
+                    --emptyCount;
+                    break;
+                }
+            }
+        }
+    }
+    assert(emptyCount == 0);
+
+    //////////////////////////////////////////////////////////////////////////////////////
+    // todo: why is this hack necessary?  using it in order for trim to work properly   //
+    // after abpoa switched to weirdo 256-bit values  (nst_nt256_table)                //
+    for (int64_t i = 0; i < msa->seq_no; ++i) {
+        msa_canonicalise_row(msa->msa_seq[i], msa->column_no);
+    }
+
+    // Clean up
+    for (int64_t i = 0; i < seq_no; ++i) {
+        free(bseqs[i]);
+    }
+    free(bseqs);
+    free(empty_seqs);
+
+    return msa;
+}
+
+/*
+ * Makes the window msa consistent with the previous, overlapping window, by trimming the row_overlaps[i] bases
+ * the two share in each row i from the end of one or the start of the other. prev_column_scores are the column
+ * scores of prev_msa, as returned when it was trimmed with its own previous window, if any. The column scores of
+ * msa, updated for the trimming, are returned for trimming it with the next window. Empty columns left at the end
+ * of prev_msa are clipped off, while those left at the start of msa are counted in first_column rather than
+ * shifting its rows.
+ */
+static float *trim_window_overlap(Msa *prev_msa, float *prev_column_scores, Msa *msa, int64_t *row_overlaps,
+                                  int64_t *first_column) {
+    float *column_scores = make_column_scores(msa);
+
+    // trim with the previous alignment, the shared bases being at the start of the rows of msa, which are read
+    // right-to-left, and at the end of those of prev_msa
+    for (int64_t i = 0; i < msa->seq_no; ++i) {
+        int64_t overlap = msa->seq_lens[i] < row_overlaps[i] ? msa->seq_lens[i] : row_overlaps[i];
+        if (overlap > 0) {
+            trim(i, msa, column_scores, 1, i, prev_msa, prev_column_scores, 0, overlap);
+        }
+    }
+    prev_msa->column_no -= get_empty_end_columns(prev_msa, 0);
+    *first_column = get_empty_end_columns(msa, 1);
+
+    return column_scores;
+}
+
+/*
+ * Stitches the trimmed window msas into one msa of the sequences, leaving out the columns of each window before
+ * its first column, given by the matching element of first_columns.
+ */
+static Msa *concatenate_msa_windows(stList *msa_windows, stList *first_columns, char **seqs, int *seq_lens,
+                                    int64_t seq_no) {
+    int64_t num_windows = stList_length(msa_windows);
+    Msa *output_msa;
+    if (num_windows == 1) {
+        // if we have only one window, return it
+        assert((int64_t)stList_get(first_columns, 0) == 0);
+        output_msa = stList_removeFirst(msa_windows);
+        output_msa->seqs = seqs;
+        free(output_msa->seq_lens); // cleanup old memory
+        output_msa->seq_lens = seq_lens;
+    } else {
+        // otherwise, we stitch all the window msas into a new output msa
+        output_msa = st_malloc(sizeof(Msa));
+        assert(seq_no > 0);
+        output_msa->seq_no = seq_no;
+        output_msa->seqs = seqs;
+        output_msa->seq_lens = seq_lens;
+        output_msa->column_no = 0;
+        int64_t *window_columns = st_malloc(num_windows * sizeof(int64_t));
+        for (int64_t i = 0; i < num_windows; ++i) {
+            Msa* msa_i = (Msa*)stList_get(msa_windows, i);
+            int64_t first_column = (int64_t)stList_get(first_columns, i);
+            window_columns[i] = msa_i->column_no > first_column ? msa_i->column_no - first_column : 0;
+            output_msa->column_no += window_columns[i];
+        }
+        output_msa->msa_seq = st_malloc(sizeof(uint8_t *) * output_msa->seq_no);
+        for (int64_t i = 0; i < output_msa->seq_no; ++i) {
+            output_msa->msa_seq[i] = st_malloc(sizeof(uint8_t) * output_msa->column_no);
+            int64_t offset = 0;
+            for (int64_t j = 0; j < num_windows; ++j) {
+                Msa* msa_j = stList_get(msa_windows, j);
+                memcpy(output_msa->msa_seq[i] + offset,
+                       msa_j->msa_seq[i] + msa_j->column_no - window_columns[j], window_columns[j]);
+                offset += window_columns[j];
             }
+            assert(offset == output_msa->column_no);
         }
+        free(window_columns);
     }
-    // trim empty columns
-    int64_t empty_columns = 0;
-    for (bool still_empty = true; empty_columns < msa->column_no; ++empty_columns) {
-        for (int64_t i = 0; i < msa->seq_no && still_empty; ++i) {
-            still_empty = msa_to_base(msa->msa_seq[i][msa->column_no - 1 - empty_columns]) == '-';
+    return output_msa;
+}
+
+/*
+ * The length of the exact matches used to anchor the cuts between windows.
+ */
+#define POA_ANCHOR_LENGTH 12
+
+/*
+ * Finds the end of the occurrence of the anchor in seq closest to expected_end, looking no further than
+ * max_distance either side of it and keeping within [min_end, max_end], or returns -1.
+ */
+static int64_t find_anchor(char *anchor, char *seq, int64_t expected_end, int64_t max_distance,
+                           int64_t min_end, int64_t max_end) {
+    min_end = min_end > POA_ANCHOR_LENGTH ? min_end : POA_ANCHOR_LENGTH;
+    for (int64_t d = 0; d <= max_distance; d++) {
+        int64_t ends[2] = { expected_end - d, expected_end + d };
+        for (int64_t j = 0; j < (d == 0 ? 1 : 2); j++) {
+            if (ends[j] >= min_end && ends[j] <= max_end &&
+                strncasecmp(anchor, seq + ends[j] - POA_ANCHOR_LENGTH, POA_ANCHOR_LENGTH) == 0) {
+                return ends[j];
+            }
         }
-        if (!still_empty) {
+    }
+    return -1;
+}
+
+static bool is_anchor(char *s) {
+    for (int64_t i = 0; i < POA_ANCHOR_LENGTH; i++) {
+        if (nst_nt4_table[(unsigned char)s[i]] > 3) { // Ns and gaps do not make anchors
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Picks the cut points between the windows of each sequence in advance, so that the windows can be aligned
+ * concurrently, rather than each window starting where the alignment of the previous one ends. The longest
+ * sequence is cut every step - overlap_size / 4 bases, the cut in each other sequence being placed at the
+ * closest exact match to the bases before the cut in the longest sequence that is no more than overlap_size / 4
+ * bases from the same distance past its last cut. Where there is none that distance is used. The windows of a
+ * sequence are then extended by up to overlap_size / 2 bases about each cut, without the extensions about two
+ * cuts meeting, so that they can be trimmed by column score like the windows of the sequential alignment, and
+ * so hold at most step + overlap_size bases.
+ *
+ * Returns the list of windows, each an array of the starts of the rows followed by their ends, and fills in the
+ * number of bases each row of each window shares with the previous window.
+ */
+static stList *get_anchored_windows(char **seqs, int *seq_lens, int64_t seq_no, int64_t step, int64_t overlap_size,
+                                    stList *window_overlaps) {
+    int64_t longest = 0;
+    for (int64_t i = 1; i < seq_no; ++i) {
+        if (seq_lens[i] > seq_lens[longest]) {
+            longest = i;
+        }
+    }
+    int64_t drift = overlap_size / 4; // how far a cut may be moved to find an anchor
+    int64_t cut_step = step - drift;
+    assert(cut_step > 0);
+
+    // Pick the cuts, a window is made until every sequence is covered
+    stList *cuts = stList_construct3(0, free);
+    int64_t *cut = st_calloc(seq_no, sizeof(int64_t));
+    stList_append(cuts, cut);
+    while (1) {
+        int64_t *prev_cut = cut;
+        bool done = 1;
+        for (int64_t i = 0; i < seq_no; ++i) {
+            done = done && seq_lens[i] - prev_cut[i] <= step;
+        }
+        if (done) {
             break;
         }
+        cut = st_malloc(seq_no * sizeof(int64_t));
+        for (int64_t i = 0; i < seq_no; ++i) {
+            cut[i] = prev_cut[i] + cut_step < seq_lens[i] ? prev_cut[i] + cut_step : seq_lens[i];
+        }
+        char *anchor = cut[longest] - prev_cut[longest] >= POA_ANCHOR_LENGTH &&
+                       is_anchor(seqs[longest] + cut[longest] - POA_ANCHOR_LENGTH) ?
+                       seqs[longest] + cut[longest] - POA_ANCHOR_LENGTH : NULL;
+        for (int64_t i = 0; i < seq_no && anchor != NULL; ++i) {
+            if (i != longest) {
+                int64_t max_end = prev_cut[i] + step < seq_lens[i] ? prev_cut[i] + step : seq_lens[i];
+                int64_t anchor_end = find_anchor(anchor, seqs[i], prev_cut[i] + cut_step, drift,
+                                                 prev_cut[i] + POA_ANCHOR_LENGTH, max_end);
+                cut[i] = anchor_end != -1 ? anchor_end : cut[i];
+            }
+        }
+        stList_append(cuts, cut);
+    }
+    cut = st_malloc(seq_no * sizeof(int64_t));
+    for (int64_t i = 0; i < seq_no; ++i) {
+        cut[i] = seq_lens[i];
+    }
+    stList_append(cuts, cut);
+
+    // Get the extensions about each cut, the first and last cut having none
+    int64_t cut_no = stList_length(cuts);
+    int64_t *extensions = st_calloc(cut_no * seq_no, sizeof(int64_t));
+    for (int64_t k = 1; k < cut_no - 1; ++k) {
+        int64_t *prev_cut = stList_get(cuts, k - 1), *cut = stList_get(cuts, k), *next_cut = stList_get(cuts, k + 1);
+        for (int64_t i = 0; i < seq_no; ++i) {
+            int64_t e = overlap_size / 2;
+            e = (cut[i] - prev_cut[i]) / 2 < e ? (cut[i] - prev_cut[i]) / 2 : e;
+            e = (next_cut[i] - cut[i]) / 2 < e ? (next_cut[i] - cut[i]) / 2 : e;
+            extensions[k * seq_no + i] = e;
+        }
     }
-    msa->column_no -= empty_columns;
+
+    // Make the windows
+    stList *windows = stList_construct3(0, free);
+    for (int64_t k = 0; k < cut_no - 1; ++k) {
+        int64_t *cut = stList_get(cuts, k), *next_cut = stList_get(cuts, k + 1);
+        int64_t *window = st_malloc(2 * seq_no * sizeof(int64_t));
+        int64_t *overlaps = st_malloc(seq_no * sizeof(int64_t));
+        for (int64_t i = 0; i < seq_no; ++i) {
+            window[i] = cut[i] - extensions[k * seq_no + i];
+            window[seq_no + i] = next_cut[i] + extensions[(k + 1) * seq_no + i];
+            overlaps[i] = 2 * extensions[k * seq_no + i];
+        }
+        stList_append(windows, window);
+        stList_append(window_overlaps, overlaps);
+    }
+    free(extensions);
+    stList_destruct(cuts);
+    return windows;
 }
 
-Msa *msa_make_partial_order_alignment(char **seqs, int *seq_lens, int64_t seq_no, int64_t window_size,
-                                      int64_t max_prog_rows, double max_prog_length_diff, abpoa_para_t *poa_parameters) {
+/*
+ * The windows to align as tasks, see align_windows_as_tasks.
+ */
+typedef struct _WindowTasks {
+    char **seqs;
+    int64_t seq_no;
+    stList *windows;
+    int64_t max_prog_rows;
+    double max_prog_length_diff;
+    abpoa_para_t *poa_parameters;
+    Msa **window_msas; // The msa of each window
+} WindowTasks;
+
+/*
+ * Aligns each of the windows as a task, and waits for them.
+ */
+static void align_windows_as_tasks(void *extra_arg) {
+    WindowTasks *w = extra_arg;
+    for (int64_t k = 0; k < stList_length(w->windows); ++k) {
+#if defined(_OPENMP)
+#pragma omp task firstprivate(k)
+#endif
+        {
+            int64_t *window = stList_get(w->windows, k);
+            w->window_msas[k] = msa_align_window(w->seqs, w->seq_no, window, window + w->seq_no, w->max_prog_rows,
+                                                 w->max_prog_length_diff, w->poa_parameters);
+        }
+    }
+#if defined(_OPENMP)
+#pragma omp taskwait
+#endif
+}
+
+/*
+ * Aligns the sequences in anchored windows, see get_anchored_windows, aligning the windows as tasks, then
+ * trims and stitches them together in order.
+ */
+static Msa *msa_make_anchored_partial_order_alignment(char **seqs, int *seq_lens, int64_t seq_no, int64_t step,
+                                                      int64_t overlap_size, int64_t max_prog_rows,
+                                                      double max_prog_length_diff, abpoa_para_t *poa_parameters) {
+    stList *window_overlaps = stList_construct3(0, free);
+    stList *windows = get_anchored_windows(seqs, seq_lens, seq_no, step, overlap_size, window_overlaps);
+    int64_t num_windows = stList_length(windows);
+    Msa **window_msas = st_malloc(num_windows * sizeof(Msa *));
+    WindowTasks window_tasks = { seqs, seq_no, windows, max_prog_rows, max_prog_length_diff, poa_parameters,
+                                 window_msas };
+    bar_runTasks(align_windows_as_tasks, &window_tasks);
+
+    // Stitch the windows together, in order, as the trimming of each window depends on that of the previous
+    stList *msa_windows = stList_construct3(0, (void(*)(void *)) msa_destruct);
+    stList *first_columns = stList_construct();
+    float *prev_column_scores = make_column_scores(window_msas[0]);
+    for (int64_t k = 0; k < num_windows; ++k) {
+        int64_t first_column = 0;
+        if (k > 0) {
+            float *column_scores = trim_window_overlap(window_msas[k - 1], prev_column_scores, window_msas[k],
+                                                       stList_get(window_overlaps, k), &first_column);
+            free(prev_column_scores);
+            prev_column_scores = column_scores;
+        }
+        stList_append(msa_windows, window_msas[k]);
+        stList_append(first_columns, (void *)first_column);
+    }
+    Msa *output_msa = concatenate_msa_windows(msa_windows, first_columns, seqs, seq_lens, seq_no);
+
+    // Clean up
+    free(prev_column_scores);
+    stList_destruct(first_columns);
+    free(window_msas);
+    stList_destruct(windows);
+    stList_destruct(window_overlaps);
+    stList_destruct(msa_windows);
+
+    return output_msa;
+}
+
+/*
+ * Aligns the sequences, in overlapping windows of at most window_size bases of each sequence. If
+ * anchored_windows_min is positive and the longest sequence needs at least that many windows the windows are cut in
+ * advance, see msa_make_anchored_partial_order_alignment.
+ */
+static Msa *msa_make_sliding_window_alignment(char **seqs, int *seq_lens, int64_t seq_no, int64_t window_size,
+                                              int64_t max_prog_rows, double max_prog_length_diff,
+                                              int64_t anchored_windows_min, abpoa_para_t *poa_parameters) {
 
     assert(seq_no > 0);
 
@@ -489,28 +962,38 @@ Msa *msa_make_partial_order_alignment(char **seqs, int *seq_lens, int64_t seq_no
     if (window_overlap_size > 0) {
         --window_overlap_size; // don't want empty window when fully trimmed on each end
     }
+
+    // very long sequences are cut into windows in advance, so that the windows can be aligned in parallel
+    int64_t anchored_step = window_size - 2 * (window_overlap_size / 2);
+    int64_t max_seq_len = 0;
+    for (int64_t i = 0; i < seq_no; ++i) {
+        max_seq_len = seq_lens[i] > max_seq_len ? seq_lens[i] : max_seq_len;
+    }
+    if (anchored_windows_min > 0 && max_seq_len >= anchored_windows_min * anchored_step) {
+        return msa_make_anchored_partial_order_alignment(seqs, seq_lens, seq_no, anchored_step, window_overlap_size,
+                                                         max_prog_rows, max_prog_length_diff, poa_parameters);
+    }
+
     // keep track of what's left to align for the sliding window
     int64_t bases_remaining = 0;
     // keep track of current offsets
     int64_t* seq_offsets = (int64_t*)st_calloc(seq_no, sizeof(int64_t));
-    // keep track of empty chunks
-    bool* empty_seqs = (bool*)st_calloc(seq_no, sizeof(bool));
+    // keep track of the window ends
+    int64_t* seq_ends = (int64_t*)st_calloc(seq_no, sizeof(int64_t));
     // keep track of overlaps
     int64_t* row_overlaps = (int64_t*)st_calloc(seq_no, sizeof(int64_t));
-
-    // allocate the poa input buffer
-    uint8_t **bseqs = (uint8_t**)st_malloc(sizeof(uint8_t*) * seq_no);
     for (int64_t i = 0; i < seq_no; ++i) {
-        int64_t row_size = seq_lens[i] < window_size ? seq_lens[i] : window_size;
-        bseqs[i] = (uint8_t*)st_malloc(sizeof(uint8_t) * row_size);
         bases_remaining += seq_lens[i];
     }
      
     // collect our windowed outputs here, to be stiched at the end. 
     stList* msa_windows = stList_construct3(0, (void(*)(void *)) msa_destruct);
+    // and the first column of each that is kept after trimming
+    stList* first_columns = stList_construct();
     
-    // remember the previous window
+    // remember the previous window, and its column scores
     Msa* prev_msa = NULL;
+    float* prev_column_scores = NULL;
     
     int64_t prev_bases_remaining = bases_remaining;
     for (int64_t iteration = 0; bases_remaining > 0; ++iteration) {
@@ -533,163 +1016,32 @@ Msa *msa_make_partial_order_alignment(char **seqs, int *seq_lens, int64_t seq_no
             }
         }
 
-        // Make Msa object
-        Msa *msa = st_malloc(sizeof(Msa));
-        msa->seq_no = seq_no;
-        msa->seqs = NULL;
-        msa->seq_lens = st_malloc(sizeof(int) * msa->seq_no);
-        
-        // load up to window_size of each sequence into the input matrix for poa
-        for (int64_t i = 0; i < msa->seq_no; ++i) {
-            msa->seq_lens[i] = 0;
-            for (int64_t j = seq_offsets[i]; j < seq_lens[i] && msa->seq_lens[i] < window_size; ++j, ++msa->seq_lens[i]) {
-                // todo: support iupac characters?
-                bseqs[i][msa->seq_lens[i]] = msa_to_byte(seqs[i][j]);
-            }
+        // load up to window_size of each sequence
+        for (int64_t i = 0; i < seq_no; ++i) {
+            seq_ends[i] = seq_offsets[i] + window_size < seq_lens[i] ? seq_offsets[i] + window_size : seq_lens[i];
         }
+        Msa *msa = msa_align_window(seqs, seq_no, seq_offsets, seq_ends, max_prog_rows, max_prog_length_diff,
+                                    poa_parameters);
 
-        // poa can't handle empty sequences.  this is a hack to get around that
-        int emptyCount = 0;
-        for (int64_t i = 0; i < msa->seq_no; ++i) {
-            if (msa->seq_lens[i] == 0) {
-                empty_seqs[i] = true;
-                msa->seq_lens[i] = 1;
-                bseqs[i][0] = msa_to_byte('N');
-                ++emptyCount;
-            } else {
-                empty_seqs[i] = false;
-            }
-        }
-
-        // init abpoa
-        abpoa_t *ab = abpoa_init();
-        abpoa_para_t *abpt = copy_abpoa_params(poa_parameters);
-        if (msa->seq_no > max_prog_rows ||
-            // note: these are sorted by length excep in unit tests
-            (1. - (double)msa->seq_lens[msa->seq_no-1] / (double)msa->seq_lens[0] > max_prog_length_diff)) {
-            abpt->progressive_poa = 0;
-        }
-        
-#ifdef CACTUS_ABPOA_MSA_DUMP_DIR
-        // dump the input to file
-        char abpoa_input_path[1024], abpoa_matrix_path[1024], abpoa_command_path[1024], abpoa_output_path[1024];
-        sprintf(abpoa_input_path, "%s/ap_in_%ld.fa", CACTUS_ABPOA_MSA_DUMP_DIR, (int64_t)msa);
-        sprintf(abpoa_matrix_path, "%s.mat", abpoa_input_path);
-        sprintf(abpoa_command_path, "%s.cmd", abpoa_input_path);
-        sprintf(abpoa_output_path, "%s.out", abpoa_input_path);
-        char* abpoa_command_line = dump_abpoa_input(msa, abpt, bseqs,
-                                                    abpoa_input_path, abpoa_matrix_path, abpoa_command_path, abpoa_output_path);
-#endif
-
-#ifdef CACTUS_ABPOA_FROM_COMMAND_LINE
-        // run abpoa from the command line
-        abpoa_msa_from_command_line(abpoa_command_line, abpoa_output_path, &(msa->msa_seq), &(msa->column_no));
-
-        int test_cols = 0;
-        uint8_t** test_msa = NULL;
-        abpoa_msa(ab, abpt, msa->seq_no, NULL, msa->seq_lens, bseqs, NULL, NULL);
-        // abpoa's interface has changed a bit -- instead of passing in pointers to the results, they
-        // end up in the ab->abc struct -- we extract them here
-        test_msa = ab->abc->msa_base;
-        ab->abc->msa_base = NULL;
-        test_cols = ab->abc->msa_len;
-
-        // sanity check to make sure we get the same output
-        assert(msa->column_no == test_cols);        
-        for (int i = 0; i < msa->seq_no; ++i) {
-          for (int j = 0; j < test_cols; ++j) {
-              //todo: not sure why this doesn't work anymore !!!!
-              //assert(test_msa[i][j] == msa->msa_seq[i][j]);
-          }
-          free(test_msa[i]);
-        }
-        free(test_msa);
-#else
-        // perform abpoa-msa
-        abpoa_msa(ab, abpt, msa->seq_no, NULL, msa->seq_lens, bseqs, NULL, NULL);
-        // abpoa's interface has changed a bit -- instead of passing in pointers to the results, they
-        // end up in the ab->abc struct -- we extract them here
-        msa->msa_seq = ab->abc->msa_base;
-        ab->abc->msa_base = NULL;
-        msa->column_no = ab->abc->msa_len;
-#endif
-
-#ifdef CACTUS_ABPOA_MSA_DUMP_DIR
-        // we got this far without crashing, so delete the dumped file (they can really pile up otherwise)
-        remove(abpoa_input_path);
-        remove(abpoa_matrix_path);
-        remove(abpoa_command_path);
-        remove(abpoa_output_path);
-        free(abpoa_command_line);
-#endif
-
-        // free abpoa
-        abpoa_free(ab);
-        abpoa_free_para(abpt);
-
-        // mask out empty sequences that were phonied in as Ns above
-        for (int64_t i = 0; i < msa->seq_no && emptyCount > 0; ++i) {
-            if (empty_seqs[i] == true) {
-                for (int j = 0; j < msa->column_no; ++j) {
-                    if (msa_to_base(msa->msa_seq[i][j]) != '-') {
-                        assert(msa_to_base(msa->msa_seq[i][j]) == 'N');
-                        msa->msa_seq[i][j] = msa_to_byte('-');
-                        --msa->seq_lens[i];
-                        assert(msa->seq_lens[i] == 0);
-                        --emptyCount;
-                        break;
-                    }
-                }
-            }
-        }
-        assert(emptyCount == 0);
-
-        //if (prev_msa) {
-        //    fprintf(stderr, "PREV MSA\n");
-        //    msa_print(prev_msa, stderr);
-        //}
-        //fprintf(stderr, "CUR MSA\n");
-        //msa_print(msa, stderr);
         // remember how much we aligned this round
         for (int64_t i = 0; i < msa->seq_no; ++i) {
-            //////////////////////////////////////////////////////////////////////////////////////
-            // todo: why is this hack necessary?  using it in order for trim to work properly   //
-            // after abpoa switched to weirdo 256-bit values  (nst_nt256_table)                //
-            for (int64_t j = 0; j < msa->column_no; ++j) {
-                msa->msa_seq[i][j] = msa_to_byte(msa_to_base(msa->msa_seq[i][j]));
-            }
             bases_remaining -= msa->seq_lens[i];
             seq_offsets[i] += msa->seq_lens[i];
         }
 
-        // todo: there is obviously room for optimization here, as we compute full scores twice for each msa
-        //       in addition to flipping the prev_msa back and forth
-        //       (not sure if this is at all noticeable on top of abpoa running time though)
+        int64_t first_column = 0;
         if (prev_msa) {
-            // trim() presently assumes we're looking at reverse-complement sequence:
-            flip_msa_seq(msa);
-            float* prev_column_scores = make_column_scores(prev_msa);
-            float* column_scores = make_column_scores(msa);
-
-            // trim with the previous alignment
-            for (int64_t i = 0; i < msa->seq_no; ++i) {
-                int64_t overlap = msa->seq_lens[i] < row_overlaps[i] ? msa->seq_lens[i] : row_overlaps[i];
-                if (overlap > 0) {
-                    trim(i, msa, column_scores, i, prev_msa, prev_column_scores, overlap);
-                }
+            if (prev_column_scores == NULL) {
+                prev_column_scores = make_column_scores(prev_msa);
             }
-            // todo: can this be done as part of trim?
-            msa_fix_trimmed(msa);
-            msa_fix_trimmed(prev_msa);            
-            // flip our msa back to its original strand
-            flip_msa_seq(msa);
-
+            float* column_scores = trim_window_overlap(prev_msa, prev_column_scores, msa, row_overlaps, &first_column);
             free(prev_column_scores);
-            free(column_scores);
+            prev_column_scores = column_scores;
         }
 
         // add the msa to our list
         stList_append(msa_windows, msa);
+        stList_append(first_columns, (void *)first_column);
         
         // sanity check        
         assert(prev_bases_remaining > bases_remaining && bases_remaining >= 0);
@@ -700,67 +1052,576 @@ Msa *msa_make_partial_order_alignment(char **seqs, int *seq_lens, int64_t seq_no
         prev_bases_remaining = bases_remaining; 
     }
 
-    int64_t num_windows = stList_length(msa_windows);
-    Msa *output_msa;
-    if (num_windows == 1) {
-        // if we have only one window, return it
-        output_msa = stList_removeFirst(msa_windows);
-        output_msa->seqs = seqs;
-        free(output_msa->seq_lens); // cleanup old memory
-        output_msa->seq_lens = seq_lens;
-    } else {
-        // otherwise, we stitch all the window msas into a new output msa
-        output_msa = st_malloc(sizeof(Msa));
-        assert(seq_no > 0);
-        output_msa->seq_no = seq_no;
-        output_msa->seqs = seqs;
-        output_msa->seq_lens = seq_lens;
-        output_msa->column_no = 0;
-        for (int64_t i = 0; i < num_windows; ++i) {
-            Msa* msa_i = (Msa*)stList_get(msa_windows, i);
-            output_msa->column_no += msa_i->column_no;
-        }
-        output_msa->msa_seq = st_malloc(sizeof(uint8_t *) * output_msa->seq_no);
-        for (int64_t i = 0; i < output_msa->seq_no; ++i) {
-            output_msa->msa_seq[i] = st_malloc(sizeof(uint8_t) * output_msa->column_no);
-            int64_t offset = 0;
-            for (int64_t j = 0; j < num_windows; ++j) {
-                Msa* msa_j = stList_get(msa_windows, j);
-                uint8_t* window_row = msa_j->msa_seq[i];
-                for (int64_t k = 0; k < msa_j->column_no; ++k) {
-                    output_msa->msa_seq[i][offset++] = window_row[k];
-                }
-            }
-            assert(offset == output_msa->column_no);
-        }
-    } 
+    Msa *output_msa = concatenate_msa_windows(msa_windows, first_columns, seqs, seq_lens, seq_no);
 
     // Clean up
-    for (int64_t i = 0; i < seq_no; ++i) {
-        free(bseqs[i]);
-    }
-    free(bseqs);
+    free(prev_column_scores);
+    stList_destruct(first_columns);
     free(seq_offsets);
-    free(empty_seqs);
+    free(seq_ends);
     free(row_overlaps);
     stList_destruct(msa_windows);
 
     return output_msa;
 }
 
+/*
+ * A sequence to be aligned, used as the key when looking for sequences that are the same.
+ */
+typedef struct _distinctSeq {
+    char *seq;
+    int length;
+    int64_t row; // The row of the sequence in the msa of the distinct sequences
+} DistinctSeq;
+
+static uint64_t distinctSeq_hashKey(const void *key) {
+    const DistinctSeq *s = key;
+    uint64_t h = s->length;
+    for (int64_t i = 0; i < s->length; i++) {
+        h = h * 31 + msa_to_byte(s->seq[i]);
+    }
+    return h;
+}
+
+static int distinctSeq_equalsKey(const void *key1, const void *key2) {
+    const DistinctSeq *s1 = key1, *s2 = key2;
+    if (s1->length != s2->length) {
+        return 0;
+    }
+    for (int64_t i = 0; i < s1->length; i++) {
+        if (msa_to_byte(s1->seq[i]) != msa_to_byte(s2->seq[i])) { // the alphabet of the msa ignores case
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * The length of the k-mers and number of k-mer hashes in the sketches used to cluster the sequences.
+ */
+#define POA_SKETCH_K 15
+#define POA_SKETCH_SIZE 64
+
+static uint64_t kmer_hash(uint64_t kmer) {
+    // The finaliser of murmur3, so the smallest hashes are a random sample of the k-mers
+    kmer ^= kmer >> 33;
+    kmer *= 0xff51afd7ed558ccdULL;
+    kmer ^= kmer >> 33;
+    kmer *= 0xc4ceb9fe1a85ec53ULL;
+    kmer ^= kmer >> 33;
+    return kmer;
+}
+
+static int uint64_cmp(const void *a, const void *b) {
+    uint64_t i = *(uint64_t *)a, j = *(uint64_t *)b;
+    return i < j ? -1 : (i > j ? 1 : 0);
+}
+
+/*
+ * Gets the sketch of a sequence, the (up to) POA_SKETCH_SIZE smallest distinct hashes of its k-mers, in
+ * ascending order. K-mers containing anything but ACGT are ignored.
+ */
+static int64_t make_sketch(char *seq, int seq_len, uint64_t *sketch) {
+    uint64_t *hashes = st_malloc((seq_len > 0 ? seq_len : 1) * sizeof(uint64_t));
+    int64_t hash_no = 0, valid_bases = 0;
+    uint64_t kmer = 0, mask = (1ULL << (2 * POA_SKETCH_K)) - 1;
+    for (int64_t i = 0; i < seq_len; i++) {
+        uint8_t b = nst_nt4_table[(unsigned char)seq[i]];
+        if (b > 3) {
+            valid_bases = 0;
+            continue;
+        }
+        kmer = ((kmer << 2) | b) & mask;
+        if (++valid_bases >= POA_SKETCH_K) {
+            hashes[hash_no++] = kmer_hash(kmer);
+        }
+    }
+    qsort(hashes, hash_no, sizeof(uint64_t), uint64_cmp);
+    int64_t sketch_size = 0;
+    for (int64_t i = 0; i < hash_no && sketch_size < POA_SKETCH_SIZE; i++) {
+        if (sketch_size == 0 || sketch[sketch_size - 1] != hashes[i]) {
+            sketch[sketch_size++] = hashes[i];
+        }
+    }
+    free(hashes);
+    return sketch_size;
+}
+
+/*
+ * Estimates the Jaccard distance between the k-mers of two sequences from their sketches.
+ */
+static double sketch_distance(uint64_t *sketch1, int64_t size1, uint64_t *sketch2, int64_t size2) {
+    if (size1 == 0 || size2 == 0) {
+        return size1 == size2 ? 0.0 : 1.0;
+    }
+    // Merge the sketches, counting the hashes shared among the smallest of their union
+    int64_t i = 0, j = 0, union_size = 0, shared = 0;
+    while (union_size < POA_SKETCH_SIZE && (i < size1 || j < size2)) {
+        if (j == size2 || (i < size1 && sketch1[i] < sketch2[j])) {
+            i++;
+        } else if (i == size1 || sketch2[j] < sketch1[i]) {
+            j++;
+        } else {
+            i++;
+            j++;
+            shared++;
+        }
+        union_size++;
+    }
+    return 1.0 - (double)shared / union_size;
+}
+
+/*
+ * Splits the sequences into cluster_no clusters of at most max_cluster_rows sequences, by their sketch distance.
+ * The centres of the clusters are picked by farthest first traversal, starting from the first (longest) sequence,
+ * then each other sequence joins the closest centre whose cluster is not full. Fills in the cluster of each
+ * sequence and the centre of each cluster.
+ */
+static void cluster_seqs(char **seqs, int *seq_lens, int64_t seq_no, int64_t cluster_no, int64_t max_cluster_rows,
+                         int64_t *clusters, int64_t *centres) {
+    uint64_t *sketches = st_malloc(seq_no * POA_SKETCH_SIZE * sizeof(uint64_t));
+    int64_t *sketch_sizes = st_malloc(seq_no * sizeof(int64_t));
+    for (int64_t i = 0; i < seq_no; i++) {
+        sketch_sizes[i] = make_sketch(seqs[i], seq_lens[i], &sketches[i * POA_SKETCH_SIZE]);
+    }
+
+    // Pick the centres, keeping the distance of each sequence to each of them
+    double *distances = st_malloc(seq_no * cluster_no * sizeof(double));
+    double *closest = st_malloc(seq_no * sizeof(double));
+    for (int64_t i = 0; i < seq_no; i++) {
+        closest[i] = 2.0;
+        clusters[i] = -1;
+    }
+    int64_t centre = 0;
+    for (int64_t c = 0; c < cluster_no; c++) {
+        centres[c] = centre;
+        clusters[centre] = c;
+        int64_t next_centre = -1;
+        for (int64_t i = 0; i < seq_no; i++) {
+            double d = sketch_distance(&sketches[i * POA_SKETCH_SIZE], sketch_sizes[i],
+                                       &sketches[centre * POA_SKETCH_SIZE], sketch_sizes[centre]);
+            distances[i * cluster_no + c] = d;
+            closest[i] = d < closest[i] ? d : closest[i];
+            if (clusters[i] == -1 && (next_centre == -1 || closest[i] > closest[next_centre])) {
+                next_centre = i;
+            }
+        }
+        centre = next_centre;
+    }
+
+    // Assign the other sequences, in order, to the closest cluster with room
+    int64_t *cluster_sizes = st_calloc(cluster_no, sizeof(int64_t));
+    for (int64_t c = 0; c < cluster_no; c++) {
+        cluster_sizes[c] = 1;
+    }
+    for (int64_t i = 0; i < seq_no; i++) {
+        if (clusters[i] == -1) {
+            for (int64_t c = 0; c < cluster_no; c++) {
+                if (cluster_sizes[c] < max_cluster_rows &&
+                    (clusters[i] == -1 || distances[i * cluster_no + c] < distances[i * cluster_no + clusters[i]])) {
+                    clusters[i] = c;
+                }
+            }
+            assert(clusters[i] != -1);
+            cluster_sizes[clusters[i]]++;
+        }
+    }
+
+    free(sketches);
+    free(sketch_sizes);
+    free(distances);
+    free(closest);
+    free(cluster_sizes);
+}
+
+/*
+ * Merges the msas of the clusters into an msa of all the sequences, using the msa of the cluster centres,
+ * in which row c is the centre of cluster c. Each column of the msa of the centres is a column of the merged msa,
+ * holding the columns of the cluster msas that align a base of their centre to it. The columns of a cluster msa in
+ * which its centre has a gap are added just before the column of the next base of the centre.
+ */
+static Msa *merge_cluster_msas(Msa **cluster_msas, int64_t cluster_no, int64_t **cluster_rows, int64_t *centre_rows,
+                               Msa *centre_msa, char **seqs, int *seq_lens, int64_t seq_no) {
+    // For each cluster msa the column of the centre msa that each of its columns goes at or before
+    int64_t centre_column_no = centre_msa->column_no;
+    int64_t **centre_columns = st_malloc(cluster_no * sizeof(int64_t *));
+    int64_t *insertions = st_calloc(centre_column_no + 1, sizeof(int64_t)); // Columns added before each column
+    for (int64_t c = 0; c < cluster_no; c++) {
+        Msa *cluster_msa = cluster_msas[c];
+        uint8_t *centre_row = centre_msa->msa_seq[c], *row = cluster_msa->msa_seq[centre_rows[c]];
+        centre_columns[c] = st_malloc((cluster_msa->column_no + 1) * sizeof(int64_t));
+        int64_t k = 0; // The column of the centre msa of the next base of the centre
+        for (int64_t j = 0; j < cluster_msa->column_no; j++) {
+            centre_columns[c][j] = -1;
+            if (msa_to_base(row[j]) != '-') {
+                while (msa_to_base(centre_row[k]) == '-') {
+                    k++;
+                }
+                centre_columns[c][j] = k++;
+            }
+        }
+        // Fill in the columns of the gaps of the centre, from the next base of the centre
+        k = centre_column_no;
+        for (int64_t j = cluster_msa->column_no - 1; j >= 0; j--) {
+            if (centre_columns[c][j] == -1) {
+                centre_columns[c][j] = -1 - k; // Negative, as the column is added before column k
+                insertions[k]++;
+            } else {
+                k = centre_columns[c][j];
+            }
+        }
+    }
+
+    // Get the column of the merged msa at which the columns for each column of the centre msa start
+    int64_t *column_starts = st_malloc((centre_column_no + 1) * sizeof(int64_t));
+    int64_t column_no = 0;
+    for (int64_t p = 0; p <= centre_column_no; p++) {
+        column_starts[p] = column_no;
+        column_no += insertions[p] + (p < centre_column_no ? 1 : 0);
+    }
+
+    Msa *msa = st_malloc(sizeof(Msa));
+    msa->seq_no = seq_no;
+    msa->seqs = seqs;
+    msa->seq_lens = seq_lens;
+    msa->column_no = column_no;
+    msa->msa_seq = st_malloc(seq_no * sizeof(uint8_t *));
+    for (int64_t i = 0; i < seq_no; i++) {
+        msa->msa_seq[i] = st_malloc(column_no * sizeof(uint8_t));
+        memset(msa->msa_seq[i], msa_to_byte('-'), column_no * sizeof(uint8_t));
+    }
+
+    // Copy the columns of each cluster msa to their place in the merged msa, the columns added before a column
+    // of the centre msa being ordered by cluster
+    int64_t *offsets = st_calloc(centre_column_no + 1, sizeof(int64_t)); // Columns so far added before each column
+    for (int64_t c = 0; c < cluster_no; c++) {
+        Msa *cluster_msa = cluster_msas[c];
+        for (int64_t j = 0; j < cluster_msa->column_no; j++) {
+            int64_t k = centre_columns[c][j], merged_column;
+            if (k >= 0) {
+                merged_column = column_starts[k] + insertions[k];
+            } else {
+                k = -1 - k;
+                merged_column = column_starts[k] + offsets[k]++;
+            }
+            for (int64_t i = 0; i < cluster_msa->seq_no; i++) {
+                msa->msa_seq[cluster_rows[c][i]][merged_column] = cluster_msa->msa_seq[i][j];
+            }
+        }
+        free(centre_columns[c]);
+    }
+
+    free(centre_columns);
+    free(insertions);
+    free(column_starts);
+    free(offsets);
+
+    return msa;
+}
+
+static Msa *msa_align_distinct_seqs(char **seqs, int *seq_lens, int64_t seq_no, int64_t window_size,
+                                    int64_t max_prog_rows, double max_prog_length_diff, int64_t max_cluster_rows,
+                                    int64_t anchored_windows_min, abpoa_para_t *poa_parameters);
+
+/*
+ * Destroys an msa that does not own its sequences.
+ */
+static void msa_destruct_without_seqs(Msa *msa) {
+    free(msa->seqs);
+    msa->seqs = NULL;
+    msa_destruct(msa);
+}
+
+/*
+ * The clusters to align as tasks, see align_clusters_as_tasks.
+ */
+typedef struct _ClusterTasks {
+    int64_t cluster_no;
+    char ***cluster_seq_strings;
+    int **cluster_seq_lens;
+    int64_t *cluster_sizes;
+    char **centre_strings;
+    int *centre_lens;
+    int64_t window_size;
+    int64_t max_prog_rows;
+    double max_prog_length_diff;
+    int64_t max_cluster_rows;
+    int64_t anchored_windows_min;
+    abpoa_para_t *poa_parameters;
+    Msa **cluster_msas; // The msa of each cluster, then that of the centres
+} ClusterTasks;
+
+/*
+ * Aligns each of the clusters and their centres as a task, the alignment of the centres being the last of
+ * cluster_msas, and waits for them.
+ */
+static void align_clusters_as_tasks(void *extra_arg) {
+    ClusterTasks *t = extra_arg;
+    for (int64_t c = 0; c <= t->cluster_no; c++) {
+#if defined(_OPENMP)
+#pragma omp task firstprivate(c)
+#endif
+        {
+            if (c < t->cluster_no) {
+                t->cluster_msas[c] = msa_make_sliding_window_alignment(t->cluster_seq_strings[c],
+                                                                       t->cluster_seq_lens[c], t->cluster_sizes[c],
+                                                                       t->window_size, t->max_prog_rows,
+                                                                       t->max_prog_length_diff,
+                                                                       t->anchored_windows_min, t->poa_parameters);
+            } else {
+                t->cluster_msas[c] = msa_align_distinct_seqs(t->centre_strings, t->centre_lens, t->cluster_no,
+                                                             t->window_size, t->max_prog_rows,
+                                                             t->max_prog_length_diff, t->max_cluster_rows,
+                                                             t->anchored_windows_min, t->poa_parameters);
+            }
+        }
+    }
+#if defined(_OPENMP)
+#pragma omp taskwait
+#endif
+}
+
+/*
+ * Aligns the sequences in clusters of at most max_cluster_rows sequences, see cluster_seqs, then aligns the centres
+ * of the clusters, themselves in clusters if there are too many, and merges the msas of the clusters through it.
+ * The alignments of the clusters and of their centres are independent so are made as tasks. Twice as many
+ * clusters are made as are needed to hold the sequences, leaving room to put each sequence with similar ones.
+ */
+static Msa *msa_make_clustered_alignment(char **seqs, int *seq_lens, int64_t seq_no, int64_t window_size,
+                                         int64_t max_prog_rows, double max_prog_length_diff, int64_t max_cluster_rows,
+                                         int64_t anchored_windows_min, abpoa_para_t *poa_parameters) {
+    assert(max_cluster_rows > 1 && seq_no > max_cluster_rows);
+    int64_t cluster_no = (2 * seq_no + max_cluster_rows - 1) / max_cluster_rows;
+    cluster_no = cluster_no < seq_no - 1 ? cluster_no : seq_no - 1;
+    int64_t *clusters = st_malloc(seq_no * sizeof(int64_t));
+    int64_t *centres = st_malloc(cluster_no * sizeof(int64_t));
+    cluster_seqs(seqs, seq_lens, seq_no, cluster_no, max_cluster_rows, clusters, centres);
+
+    // Number the clusters in the order of their centres, so the centres are still sorted by length
+    int64_t *cluster_order = st_malloc(cluster_no * sizeof(int64_t));
+    for (int64_t i = 0, c = 0; i < seq_no; i++) {
+        if (centres[clusters[i]] == i) {
+            cluster_order[clusters[i]] = c++;
+        }
+    }
+    int64_t *cluster_sizes = st_calloc(cluster_no, sizeof(int64_t));
+    for (int64_t i = 0; i < seq_no; i++) {
+        clusters[i] = cluster_order[clusters[i]];
+        cluster_sizes[clusters[i]]++;
+    }
+    for (int64_t c = 0; c < cluster_no; c++) {
+        cluster_order[c] = centres[c];
+    }
+    for (int64_t c = 0; c < cluster_no; c++) {
+        centres[clusters[cluster_order[c]]] = cluster_order[c];
+    }
+
+    // Make the inputs for the alignment of each cluster and of the centres, each kept in the order of the sequences
+    char ***cluster_seq_strings = st_malloc(cluster_no * sizeof(char **));
+    int **cluster_seq_lens = st_malloc(cluster_no * sizeof(int *));
+    int64_t **cluster_rows = st_malloc(cluster_no * sizeof(int64_t *)); // For each row of each cluster its sequence
+    int64_t *centre_rows = st_malloc(cluster_no * sizeof(int64_t)); // The row of its centre in each cluster
+    char **centre_strings = st_malloc(cluster_no * sizeof(char *));
+    int *centre_lens = st_malloc(cluster_no * sizeof(int));
+    for (int64_t c = 0; c < cluster_no; c++) {
+        cluster_seq_strings[c] = st_malloc(cluster_sizes[c] * sizeof(char *));
+        cluster_seq_lens[c] = st_malloc(cluster_sizes[c] * sizeof(int));
+        cluster_rows[c] = st_malloc(cluster_sizes[c] * sizeof(int64_t));
+        cluster_sizes[c] = 0;
+        centre_strings[c] = seqs[centres[c]];
+        centre_lens[c] = seq_lens[centres[c]];
+    }
+    for (int64_t i = 0; i < seq_no; i++) {
+        int64_t c = clusters[i], j = cluster_sizes[c]++;
+        cluster_seq_strings[c][j] = seqs[i];
+        cluster_seq_lens[c][j] = seq_lens[i];
+        cluster_rows[c][j] = i;
+        if (centres[c] == i) {
+            centre_rows[c] = j;
+        }
+    }
+
+    // Align the clusters and the centres, the last being the alignment of the centres
+    Msa **cluster_msas = st_malloc((cluster_no + 1) * sizeof(Msa *));
+    ClusterTasks cluster_tasks = { cluster_no, cluster_seq_strings, cluster_seq_lens, cluster_sizes, centre_strings,
+                                   centre_lens, window_size, max_prog_rows, max_prog_length_diff, max_cluster_rows,
+                                   anchored_windows_min, poa_parameters, cluster_msas };
+    bar_runTasks(align_clusters_as_tasks, &cluster_tasks);
+
+    Msa *msa = merge_cluster_msas(cluster_msas, cluster_no, cluster_rows, centre_rows, cluster_msas[cluster_no],
+                                  seqs, seq_lens, seq_no);
+
+    // Clean up, the msas of the clusters do not own the sequences
+    for (int64_t c = 0; c <= cluster_no; c++) {
+        msa_destruct_without_seqs(cluster_msas[c]);
+        if (c < cluster_no) {
+            free(cluster_rows[c]);
+        }
+    }
+    free(cluster_msas);
+    free(cluster_seq_strings);
+    free(cluster_seq_lens);
+    free(cluster_rows);
+    free(centre_rows);
+    free(clusters);
+    free(centres);
+    free(cluster_order);
+    free(cluster_sizes);
+
+    return msa;
+}
+
+/*
+ * Aligns sequences that are all different, in clusters if there are more than max_cluster_rows of them.
+ */
+static Msa *msa_align_distinct_seqs(char **seqs, int *seq_lens, int64_t seq_no, int64_t window_size,
+                                    int64_t max_prog_rows, double max_prog_length_diff, int64_t max_cluster_rows,
+                                    int64_t anchored_windows_min, abpoa_para_t *poa_parameters) {
+    if (max_cluster_rows > 1 && seq_no > max_cluster_rows) {
+        return msa_make_clustered_alignment(seqs, seq_lens, seq_no, window_size, max_prog_rows, max_prog_length_diff,
+                                            max_cluster_rows, anchored_windows_min, poa_parameters);
+    }
+    return msa_make_sliding_window_alignment(seqs, seq_lens, seq_no, window_size, max_prog_rows,
+                                             max_prog_length_diff, anchored_windows_min, poa_parameters);
+}
+
+Msa *msa_make_partial_order_alignment(char **seqs, int *seq_lens, int64_t seq_no, int64_t window_size,
+                                      int64_t max_prog_rows, double max_prog_length_diff, int64_t max_cluster_rows,
+                                      int64_t anchored_windows_min, abpoa_para_t *poa_parameters) {
+    assert(seq_no > 0);
+
+    // Find the distinct sequences, as many of the adjacencies of an end are often the same, e.g. between
+    // haplotypes of a population, and the cost of poa grows with the number of rows
+    DistinctSeq *distinct_seqs = st_malloc(seq_no * sizeof(DistinctSeq));
+    int64_t *rows = st_malloc(seq_no * sizeof(int64_t)); // For each sequence the row of the distinct msa
+    stHash *distinct_seqs_hash = stHash_construct3(distinctSeq_hashKey, distinctSeq_equalsKey, NULL, NULL);
+    int64_t distinct_seq_no = 0;
+    for (int64_t i = 0; i < seq_no; i++) {
+        DistinctSeq *s = &distinct_seqs[i];
+        s->seq = seqs[i];
+        s->length = seq_lens[i];
+        DistinctSeq *t = stHash_search(distinct_seqs_hash, s);
+        if (t == NULL) {
+            s->row = distinct_seq_no++;
+            stHash_insert(distinct_seqs_hash, s, s);
+            t = s;
+        }
+        rows[i] = t->row;
+    }
+    stHash_destruct(distinct_seqs_hash);
+
+    if (distinct_seq_no == seq_no) {
+        free(distinct_seqs);
+        free(rows);
+        return msa_align_distinct_seqs(seqs, seq_lens, seq_no, window_size, max_prog_rows, max_prog_length_diff,
+                                       max_cluster_rows, anchored_windows_min, poa_parameters);
+    }
+
+    // Align the distinct sequences, which keep the order of their first occurrence, so are still sorted by length
+    char **distinct_seq_strings = st_malloc(distinct_seq_no * sizeof(char *));
+    int *distinct_seq_lens = st_malloc(distinct_seq_no * sizeof(int));
+    for (int64_t i = 0, j = 0; i < seq_no; i++) {
+        if (rows[i] == j) { // The first occurrence of the jth distinct sequence
+            distinct_seq_strings[j] = seqs[i];
+            distinct_seq_lens[j++] = seq_lens[i];
+        }
+    }
+    Msa *distinct_msa = msa_align_distinct_seqs(distinct_seq_strings, distinct_seq_lens, distinct_seq_no, window_size,
+                                                max_prog_rows, max_prog_length_diff, max_cluster_rows,
+                                                anchored_windows_min, poa_parameters);
+
+    // Expand the msa to a row for each sequence
+    Msa *msa = st_malloc(sizeof(Msa));
+    msa->seq_no = seq_no;
+    msa->seqs = seqs;
+    msa->seq_lens = seq_lens;
+    msa->column_no = distinct_msa->column_no;
+    msa->msa_seq = st_malloc(seq_no * sizeof(uint8_t *));
+    for (int64_t i = 0; i < seq_no; i++) {
+        assert(distinct_msa->seq_lens[rows[i]] == seq_lens[i]);
+        msa->msa_seq[i] = st_malloc(msa->column_no * sizeof(uint8_t));
+        memcpy(msa->msa_seq[i], distinct_msa->msa_seq[rows[i]], msa->column_no * sizeof(uint8_t));
+    }
+
+    // Clean up, the distinct msa does not own the sequences
+    msa_destruct_without_seqs(distinct_msa);
+    free(distinct_seqs);
+    free(rows);
+
+    return msa;
+}
+
+/*
+ * The ends to align as tasks, see align_ends_as_tasks.
+ */
+typedef struct _EndTasks {
+    int64_t end_no;
+    int64_t *end_lengths;
+    char ***end_strings;
+    int **end_string_lengths;
+    int64_t window_size;
+    int64_t max_prog_rows;
+    double max_prog_length_diff;
+    int64_t max_cluster_rows;
+    int64_t anchored_windows_min;
+    abpoa_para_t *poa_parameters;
+    Msa **msas; // The msa of each end
+    float **column_scores; // The column scores of the msa of each end
+} EndTasks;
+
+/*
+ * Aligns each end as a task, longest ends first so that the longest alignment does not start last, and waits
+ * for them. Each end is independent of the others and only reads its own strings, and the abpoa engine
+ * used is that of the thread running the task, so the tasks need no synchronisation.
+ */
+static void align_ends_as_tasks(void *extra_arg) {
+    EndTasks *t = extra_arg;
+    int64_t *total_lengths = st_calloc(t->end_no, sizeof(int64_t));
+    for (int64_t i = 0; i < t->end_no; i++) {
+        for (int64_t j = 0; j < t->end_lengths[i]; j++) {
+            total_lengths[i] += t->end_string_lengths[i][j];
+        }
+    }
+    stList *order = bar_getIndexesByDescendingLength(total_lengths, t->end_no);
+    for (int64_t k = 0; k < t->end_no; k++) {
+        int64_t i = (int64_t)stList_get(order, k);
+#if defined(_OPENMP)
+#pragma omp task firstprivate(i)
+#endif
+        {
+            t->msas[i] = msa_make_partial_order_alignment(t->end_strings[i], t->end_string_lengths[i],
+                                                          t->end_lengths[i], t->window_size, t->max_prog_rows,
+                                                          t->max_prog_length_diff, t->max_cluster_rows,
+                                                          t->anchored_windows_min, t->poa_parameters);
+            t->column_scores[i] = make_column_scores(t->msas[i]);
+        }
+    }
+#if defined(_OPENMP)
+#pragma omp taskwait
+#endif
+    free(total_lengths);
+    stList_destruct(order);
+}
+
 Msa **make_consistent_partial_order_alignments(int64_t end_no, int64_t *end_lengths, char ***end_strings,
         int **end_string_lengths, int64_t **right_end_indexes, int64_t **right_end_row_indexes, int64_t **overlaps,
-        int64_t window_size, int64_t max_prog_rows, double max_prog_length_diff, abpoa_para_t *poa_parameters) {
+        int64_t window_size, int64_t max_prog_rows, double max_prog_length_diff, int64_t max_cluster_rows,
+        int64_t anchored_windows_min, abpoa_para_t *poa_parameters, bool parallel) {
     // Calculate the initial, potentially inconsistent msas and column scores for each msa
-    float *column_scores[end_no];
+    float **column_scores = st_malloc(sizeof(float *) * end_no);
     Msa **msas = st_malloc(sizeof(Msa *) * end_no);
-//#if defined(_OPENMP)
-//#pragma omp parallel for schedule(dynamic)
-//#endif
-    for(int64_t i=0; i<end_no; i++) {
-        msas[i] = msa_make_partial_order_alignment(end_strings[i], end_string_lengths[i], end_lengths[i], window_size,
-                                                   max_prog_rows, max_prog_length_diff, poa_parameters);
-        column_scores[i] = make_column_scores(msas[i]);
+    if (parallel) {
+        EndTasks end_tasks = { end_no, end_lengths, end_strings, end_string_lengths, window_size, max_prog_rows,
+                               max_prog_length_diff, max_cluster_rows, anchored_windows_min, poa_parameters, msas,
+                               column_scores };
+        bar_runTasks(align_ends_as_tasks, &end_tasks);
+    } else {
+        for(int64_t i=0; i<end_no; i++) {
+            msas[i] = msa_make_partial_order_alignment(end_strings[i], end_string_lengths[i], end_lengths[i], window_size,
+                                                       max_prog_rows, max_prog_length_diff, max_cluster_rows,
+                                                       anchored_windows_min, poa_parameters);
+            column_scores[i] = make_column_scores(msas[i]);
+        }
     }
 
     // Make the msas consistent with one another
@@ -772,8 +1633,8 @@ Msa **make_consistent_partial_order_alignments(int64_t end_no, int64_t *end_leng
 
             // If it hasn't already been trimmed
             if(right_end_index > i || (right_end_index == i /* self loop */ && right_end_row_index > j)) {
-                trim(j, msa, column_scores[i],
-                        right_end_row_index, msas[right_end_index], column_scores[right_end_index], overlaps[i][j]);
+                trim(j, msa, column_scores[i], 0,
+                        right_end_row_index, msas[right_end_index], column_scores[right_end_index], 0, overlaps[i][j]);
             }
         }
     }
@@ -782,6 +1643,7 @@ Msa **make_consistent_partial_order_alignments(int64_t end_no, int64_t *end_leng
     for(int64_t i=0; i<end_no; i++) {
         free(column_scores[i]);
     }
+    free(column_scores);
 
     return msas;
 }
@@ -791,16 +1653,48 @@ Msa **make_consistent_partial_order_alignments(int64_t end_no, int64_t *end_leng
  */
 
 
-void alignmentBlock_destruct(AlignmentBlock *alignmentBlock) {
-    AlignmentBlock *a;
-    while(alignmentBlock != NULL) {
-        a = alignmentBlock;
-        alignmentBlock = alignmentBlock->next;
-        free(a);
+AlignmentBlocks *alignmentBlocks_construct(void) {
+    AlignmentBlocks *alignmentBlocks = st_calloc(1, sizeof(AlignmentBlocks));
+    alignmentBlocks->max_block_no = 16;
+    alignmentBlocks->max_row_no = 64;
+    alignmentBlocks->lengths = st_malloc(alignmentBlocks->max_block_no * sizeof(int64_t));
+    alignmentBlocks->row_starts = st_calloc(alignmentBlocks->max_block_no + 1, sizeof(int64_t));
+    alignmentBlocks->rows = st_malloc(alignmentBlocks->max_row_no * sizeof(AlignmentBlockRow));
+    return alignmentBlocks;
+}
+
+void alignmentBlocks_destruct(AlignmentBlocks *alignmentBlocks) {
+    free(alignmentBlocks->lengths);
+    free(alignmentBlocks->row_starts);
+    free(alignmentBlocks->rows);
+    free(alignmentBlocks);
+}
+
+AlignmentBlockRow *alignmentBlocks_add(AlignmentBlocks *alignmentBlocks, int64_t length, int64_t row_no) {
+    int64_t i = alignmentBlocks->block_no;
+    int64_t row_start = alignmentBlocks->row_starts[i];
+    if(i == alignmentBlocks->max_block_no) {
+        alignmentBlocks->max_block_no *= 2;
+        alignmentBlocks->lengths = st_realloc(alignmentBlocks->lengths, alignmentBlocks->max_block_no * sizeof(int64_t));
+        alignmentBlocks->row_starts = st_realloc(alignmentBlocks->row_starts,
+                                                 (alignmentBlocks->max_block_no + 1) * sizeof(int64_t));
+    }
+    if(row_start + row_no > alignmentBlocks->max_row_no) {
+        while(row_start + row_no > alignmentBlocks->max_row_no) {
+            alignmentBlocks->max_row_no *= 2;
+        }
+        alignmentBlocks->rows = st_realloc(alignmentBlocks->rows, alignmentBlocks->max_row_no * sizeof(AlignmentBlockRow));
     }
+    alignmentBlocks->lengths[i] = length;
+    alignmentBlocks->row_starts[i + 1] = row_start + row_no;
+    alignmentBlocks->block_no++;
+    return alignmentBlocks->rows + row_start;
 }
 
-char *get_adjacency_string(Cap *cap, int *length, bool return_string) {
+/**
+ * Gets a view of the string connecting two ends for the given cap.
+ */
+static SequenceView get_adjacency_view(Cap *cap) {
     assert(!cap_getSide(cap));
     Sequence *sequence = cap_getSequence(cap);
     assert(sequence != NULL);
@@ -809,31 +1703,39 @@ char *get_adjacency_string(Cap *cap, int *length, bool return_string) {
     assert(cap_getSide(cap2));
     if (cap_getStrand(cap)) {
         assert(cap_getCoordinate(cap2) > cap_getCoordinate(cap));
-        *length = cap_getCoordinate(cap2) - cap_getCoordinate(cap) - 1;
-        assert(*length >= 0);
-        return return_string ? sequence_getString(sequence, cap_getCoordinate(cap) + 1, *length, 1) : NULL;
+        return sequence_getView(sequence, cap_getCoordinate(cap) + 1, cap_getCoordinate(cap2) - cap_getCoordinate(cap) - 1, 1);
     } else {
         assert(cap_getCoordinate(cap) > cap_getCoordinate(cap2));
-        *length = cap_getCoordinate(cap) - cap_getCoordinate(cap2) - 1;
-        assert(*length >= 0);
-        return return_string ? sequence_getString(sequence, cap_getCoordinate(cap2) + 1, *length, 0) : NULL;
+        return sequence_getView(sequence, cap_getCoordinate(cap2) + 1, cap_getCoordinate(cap) - cap_getCoordinate(cap2) - 1, 0);
     }
 }
 
+char *get_adjacency_string(Cap *cap, int *length, bool return_string) {
+    SequenceView view = get_adjacency_view(cap);
+    *length = sequenceView_getLength(&view);
+    assert(*length >= 0);
+    return return_string ? sequenceView_getString(&view, 0, *length) : NULL;
+}
+
 /**
  * Used to find where a run of masked (hard or soft) of at least mask_filter bases starts
- * @param seq : The string
- * @param seq_length : The length of the string
+ * @param view : The view of the string
  * @param length : The maximum length we want to search in
  * @param reversed : If true, scan from the end of the string
  * @param mask_filter : Cut a string as soon as we hit more than this many hard or softmasked bases (cut is before first masked base)
  * @return length of the filtered string
  */
-static int get_unmasked_length(char* seq, int64_t seq_length, int64_t length, bool reversed, int64_t mask_filter) {
+static int get_unmasked_length(SequenceView *view, int64_t length, bool reversed, int64_t mask_filter) {
     if (mask_filter >= 0) {
+        // Scanning the reverse complement gives the bases from the end of the string, complemented, which
+        // doesn't change if they are masked
+        SequenceView view2 = *view;
+        view2.strand = reversed ? !view->strand : view->strand;
+        SequenceViewIt it;
+        sequenceView_getIt(&view2, &it);
         int64_t run_start = -1;
         for (int64_t i = 0; i < length; ++i) {
-            char base = reversed ? seq[seq_length - 1 - i] : seq[i];
+            char base = sequenceViewIt_getNext(&it);
             if (islower(base) || base == 'N') {
                 if (run_start == -1) {
                     // start masked run
@@ -860,9 +1762,9 @@ static int get_unmasked_length(char* seq, int64_t seq_length, int64_t length, bo
  * @return
  */
 char *get_adjacency_string_and_overlap(Cap *cap, int *length, int64_t *overlap, int64_t max_seq_length, int64_t mask_filter) {
-    // Get the complete adjacency string
-    int seq_length;
-    char *adjacency_string = get_adjacency_string(cap, &seq_length, 1);
+    // Get a view of the complete adjacency string, so that only the prefix is copied
+    SequenceView view = get_adjacency_view(cap);
+    int seq_length = sequenceView_getLength(&view);
     assert(seq_length >= 0);
 
     // Calculate the length of the prefix up to max_seq_length
@@ -872,15 +1774,11 @@ char *get_adjacency_string_and_overlap(Cap *cap, int *length, int64_t *overlap,
 
     if (mask_filter >= 0) {
         // apply the mask filter on the forward strand
-        *length = get_unmasked_length(adjacency_string, seq_length, *length, false, mask_filter);
-        length_backward = get_unmasked_length(adjacency_string, seq_length, *length, true, mask_filter);
+        *length = get_unmasked_length(&view, *length, false, mask_filter);
+        length_backward = get_unmasked_length(&view, *length, true, mask_filter);
     }
 
-    // Cleanup the string
-    adjacency_string[*length] = '\0'; // Terminate the string at the given length
-    char *c = stString_copy(adjacency_string);
-    free(adjacency_string);
-    adjacency_string = c;
+    char *adjacency_string = sequenceView_getString(&view, 0, *length);
 
     // Calculate the overlap with the reverse complement
     if (*length + length_backward > seq_length) { // There is overlap
@@ -895,116 +1793,88 @@ char *get_adjacency_string_and_overlap(Cap *cap, int *length, int64_t *overlap,
 
 /**
  * Gets the length and sequences present in the next maximal gapless alignment block.
- * @param msa The msa to scan
+ * @param bitmap The bitmap of the msa to scan
  * @param start The start of the gapless block
  * @param rows_in_block A boolean array of which sequences are present in the block
  * @param sequences_in_block The number of in the block
  * @return
  */
-int64_t get_next_maximal_block_dimensions(Msa *msa, int64_t start, bool *rows_in_block, int64_t *sequences_in_block) {
-    assert(start < msa->column_no);
+int64_t get_next_maximal_block_dimensions(MsaBitmap *bitmap, int64_t start, bool *rows_in_block, int64_t *sequences_in_block) {
+    assert(start < bitmap->column_no);
 
     // Calculate which sequences are in the block
-    *sequences_in_block = 0;
-    for(int64_t i=0; i<msa->seq_no; i++) {
-        rows_in_block[i] = msa_to_base(msa->msa_seq[i][start]) != '-';
-        if(rows_in_block[i]) {
-            *sequences_in_block += 1;
-        }
+    for(int64_t i=0; i<bitmap->row_no; i++) {
+        rows_in_block[i] = msa_bitmap_is_base(bitmap, i, start);
     }
+    *sequences_in_block = msa_bitmap_column_bases(bitmap, start);
 
     // Calculate the maximal block length by looking at successive columns of the MSA and
     // checking they have the same set of sequences present as in the first block
-    int64_t end = start;
-    while(++end < msa->column_no) {
-        for(int64_t i=0; i<msa->seq_no; i++) {
-            bool p = msa_to_base(msa->msa_seq[i][end]) != '-'; // Is not a gap
-            if(p != rows_in_block[i]) {
-                return end;
-            }
-        }
-    }
-    return end;
+    return msa_bitmap_next_different_column(bitmap, start);
 }
 
 /**
- * Make an alignment block for the given interval and sequences
+ * Adds an alignment block for the given interval and sequences
+ * @param alignment_blocks The alignment blocks to add the block to
  * @param seq_no The number of sequences in the MSA
- * @param start The start, inclusive, of the block
  * @param length The of the block
  * @param rows_in_block An array specifying which sequences are in the block
+ * @param sequences_in_block The number of sequences in the block
  * @param seq_indexes The start coordinates of the sequences in the block
- * @param row_indexes_to_caps The Caps corresponding to the sequences in the block
- * @return The new alignment block
+ * @param row_names The names of the sequences of the rows, as reported in the block
+ * @param row_strands The strands of the rows
+ * @param row_coordinates The coordinates of the caps of the rows
  */
-AlignmentBlock *make_alignment_block(int64_t seq_no, int64_t start, int64_t length, bool *rows_in_block,
-                                     int64_t *seq_indexes, Cap **row_indexes_to_caps) {
-    AlignmentBlock *pB = NULL, *block = NULL;
+static void add_alignment_block(AlignmentBlocks *alignment_blocks, int64_t seq_no, int64_t length,
+                                bool *rows_in_block, int64_t sequences_in_block, int64_t *seq_indexes,
+                                int64_t *row_names, bool *row_strands, int64_t *row_coordinates) {
+    assert(length > 0);
+    AlignmentBlockRow *b = alignmentBlocks_add(alignment_blocks, length, sequences_in_block);
     for(int64_t i=0; i<seq_no; i++) { // For each row
         if(rows_in_block[i]) { // If the row is in the block
-            // Make an alignment block
-            AlignmentBlock *b = st_calloc(1, sizeof(AlignmentBlock));
-            Cap *cap = row_indexes_to_caps[i];
-            assert(!cap_getSide(cap));
-            assert(cap_getSequence(cap) != NULL);
-            assert(length > 0);
-
-            b->strand = cap_getStrand(cap);
-            b->length = length;
-            // Calculate the sequence coordinate using Cactus coordinates
-            if(b->strand) {
-                b->subsequenceIdentifier = cap_getName(cap);
-                b->position = cap_getCoordinate(cap) + 1 + seq_indexes[i];
-                assert(b->position >= 0);
-                assert(b->position + length <= cap_getCoordinate(cap_getAdjacency(cap)));
-            }
-            else { // In the alignment block all the coordinates are reported with respect to the positive strand sequence
-                Cap *adjacentCap = cap_getAdjacency(cap);
-                assert(adjacentCap != NULL);
-                b->subsequenceIdentifier = cap_getName(adjacentCap);
-                b->position = cap_getCoordinate(cap) - seq_indexes[i] - length;
-                assert(b->position >= 0);
-                assert(b->position + length <= cap_getCoordinate(cap));
-                assert(b->position > cap_getCoordinate(adjacentCap));
-            }
-
-            // If this is not the first sequence in the block link to the previous sequence in the block
-            if (pB != NULL) {
-                pB->next = b;
-                pB = b;
-                assert(b->next == NULL);
-            } else { // Otherwise this is the first sequence in the block
-                block = b;
-                pB = b;
-            }
+            b->subsequenceIdentifier = row_names[i];
+            b->strand = row_strands[i];
+            // Calculate the sequence coordinate using Cactus coordinates. In the alignment block all the coordinates
+            // are reported with respect to the positive strand sequence
+            b->position = b->strand ? row_coordinates[i] + 1 + seq_indexes[i] : row_coordinates[i] - seq_indexes[i] - length;
+            assert(b->position >= 0);
+            b++;
         }
     }
-    assert(block != NULL);
-    return block;
 }
 
-void alignmentBlock_print(AlignmentBlock *ab, FILE *f) {
+void alignmentBlocks_print(AlignmentBlocks *alignmentBlocks, int64_t i, FILE *f) {
     fprintf(f, "Alignment block:\n");
-    while(ab != NULL) {
+    for(int64_t j=alignmentBlocks->row_starts[i]; j<alignmentBlocks->row_starts[i+1]; j++) {
+        AlignmentBlockRow *ab = &alignmentBlocks->rows[j];
         fprintf(f, "\tName: %" PRIi64 "\tPosition: %" PRIi64"\tStrand: %i\tLength: %" PRIi64 "\n",
-                ab->subsequenceIdentifier, ab->position, (int)ab->strand, ab->length);
-        ab = ab->next;
+                ab->subsequenceIdentifier, ab->position, (int)ab->strand, alignmentBlocks->lengths[i]);
     }
     fprintf(f, "\n");
 }
 
 /**
- * Converts an Msa into a list of AlignmentBlocks.
+ * Converts an Msa into AlignmentBlocks.
  * @param msa The msa to convert
  * @param row_indexes_to_caps The Caps for each sequence in the MSA
- * @param alignment_blocks The list to add the alignment blocks to
+ * @param alignment_blocks The alignment blocks to add the blocks of the msa to
  */
-void create_alignment_blocks(Msa *msa, Cap **row_indexes_to_caps, stList *alignment_blocks) {
+void create_alignment_blocks(Msa *msa, Cap **row_indexes_to_caps, AlignmentBlocks *alignment_blocks) {
     int64_t i=0; // The left most index of the current block
     bool rows_in_block[msa->seq_no]; // An array of bools used to indicate which sequences are present in a block
     int64_t seq_indexes[msa->seq_no]; // The start offsets of the current block
+    int64_t row_names[msa->seq_no]; // The sequence names of the rows, looked up once rather than for each block
+    bool row_strands[msa->seq_no]; // The strands of the rows
+    int64_t row_coordinates[msa->seq_no]; // The coordinates of the caps of the rows
     for(int64_t k=0; k<msa->seq_no; k++) { // Initialize to zero
         seq_indexes[k] = 0;
+        Cap *cap = row_indexes_to_caps[k];
+        assert(!cap_getSide(cap));
+        assert(cap_getSequence(cap) != NULL);
+        assert(cap_getAdjacency(cap) != NULL);
+        row_strands[k] = cap_getStrand(cap);
+        row_names[k] = row_strands[k] ? cap_getName(cap) : cap_getName(cap_getAdjacency(cap));
+        row_coordinates[k] = cap_getCoordinate(cap);
     }
     int64_t sequences_in_block; // The number of sequences in the block
 
@@ -1012,15 +1882,16 @@ void create_alignment_blocks(Msa *msa, Cap **row_indexes_to_caps, stList *alignm
     //msa_print(msa, stderr);
 
     // Walk through successive gapless blocks
+    MsaBitmap *bitmap = msa_bitmap_construct(msa);
     while(i < msa->column_no) {
-        int64_t j = get_next_maximal_block_dimensions(msa, i, rows_in_block, &sequences_in_block);
+        int64_t j = get_next_maximal_block_dimensions(bitmap, i, rows_in_block, &sequences_in_block);
         assert(j > i);
         assert(j <= msa->column_no);
 
         // Make the next alignment block
         if(sequences_in_block > 1) { // Only make a block if it contains two or more sequences
-            stList_append(alignment_blocks, make_alignment_block(msa->seq_no, i, j - i, rows_in_block,
-                                                                 seq_indexes, row_indexes_to_caps));
+            add_alignment_block(alignment_blocks, msa->seq_no, j - i, rows_in_block, sequences_in_block,
+                                seq_indexes, row_names, row_strands, row_coordinates);
         }
 
         // Update the offsets in the sequences in the block, regardless of if we actually
@@ -1034,6 +1905,14 @@ void create_alignment_blocks(Msa *msa, Cap **row_indexes_to_caps, stList *alignm
         i = j;
     }
     assert(i == msa->column_no);
+#ifndef NDEBUG
+    // The blocks of each row end within the adjacency of its cap
+    for(int64_t k=0; k<msa->seq_no; k++) {
+        Cap *cap = row_indexes_to_caps[k];
+        assert(llabs(cap_getCoordinate(cap_getAdjacency(cap)) - cap_getCoordinate(cap)) > seq_indexes[k]);
+    }
+#endif
+    msa_bitmap_destruct(bitmap);
 }
 
 
@@ -1098,8 +1977,10 @@ int64_t getMaxSequenceLength(End *end) {
     return max_length;
 }
 
-stList *make_flower_alignment_poa(Flower *flower, int64_t max_seq_length, int64_t window_size, int64_t mask_filter,
-                                  int64_t max_prog_rows, double max_prog_length_diff, abpoa_para_t * poa_parameters) {
+AlignmentBlocks *make_flower_alignment_poa(Flower *flower, int64_t max_seq_length, int64_t window_size,
+                                           int64_t mask_filter, int64_t max_prog_rows, double max_prog_length_diff,
+                                           int64_t max_cluster_rows, int64_t anchored_windows_min,
+                                           abpoa_para_t * poa_parameters, bool parallel) {
     End *dominantEnd = getDominantEnd(flower);
     int64_t seq_no = dominantEnd != NULL ? end_getInstanceNumber(dominantEnd) : -1;
     if(dominantEnd != NULL && getMaxSequenceLength(dominantEnd) < max_seq_length) {
@@ -1116,10 +1997,11 @@ stList *make_flower_alignment_poa(Flower *flower, int64_t max_seq_length, int64_
 
         get_end_sequences(dominantEnd, end_strings, end_string_lengths, overlaps, indices_to_caps, max_seq_length, mask_filter);
         Msa *msa = msa_make_partial_order_alignment(end_strings, end_string_lengths, seq_no, window_size,
-                                                    max_prog_rows, max_prog_length_diff, poa_parameters);
+                                                    max_prog_rows, max_prog_length_diff, max_cluster_rows,
+                                                    anchored_windows_min, poa_parameters);
 
         //Now convert to set of alignment blocks
-        stList *alignment_blocks = stList_construct3(0, (void (*)(void *))alignmentBlock_destruct);
+        AlignmentBlocks *alignment_blocks = alignmentBlocks_construct();
         create_alignment_blocks(msa, indices_to_caps, alignment_blocks);
 
         // Cleanup
@@ -1139,7 +2021,8 @@ stList *make_flower_alignment_poa(Flower *flower, int64_t max_seq_length, int64_
 
     // Data structures to translate between caps and sequences in above end arrays
     Cap **indices_to_caps[end_no]; // For each string the corresponding Cap
-    stHash *caps_to_indices = stHash_construct2(NULL, free); // A hash of caps to their end and row indices
+    // A hash of caps to their end and row indices, packed into one integer as end index * 2^32 + row index + 1
+    stHash *caps_to_indices = stHash_construct();
 
     // Fill out the end information for building the POA alignments arrays
     End *end;
@@ -1157,7 +2040,8 @@ stList *make_flower_alignment_poa(Flower *flower, int64_t max_seq_length, int64_
         get_end_sequences(end, end_strings[i], end_string_lengths[i], overlaps[i], indices_to_caps[i],
                           max_seq_length, mask_filter);
         for(int64_t j=0; j<end_lengths[i]; j++) {
-            stHash_insert(caps_to_indices, indices_to_caps[i][j], stIntTuple_construct2(i, j));
+            assert(j < INT32_MAX);
+            stHash_insert(caps_to_indices, indices_to_caps[i][j], (void *)((i << 32) + j + 1));
         }
         i++;
     }
@@ -1177,11 +2061,11 @@ stList *make_flower_alignment_poa(Flower *flower, int64_t max_seq_length, int64_
             cap2 = cap_getReverse(cap2);
             assert(!cap_getSide(cap));
             assert(!cap_getSide(cap2));
-            stIntTuple *k = stHash_search(caps_to_indices, cap2);
-            assert(k != NULL);
+            int64_t k = (int64_t)stHash_search(caps_to_indices, cap2) - 1;
+            assert(k >= 0);
 
-            right_end_indexes[i][j] = stIntTuple_get(k, 0);
-            right_end_row_indexes[i][j] = stIntTuple_get(k, 1);
+            right_end_indexes[i][j] = k >> 32;
+            right_end_row_indexes[i][j] = k & 0xFFFFFFFF;
         }
         i++;
     }
@@ -1190,7 +2074,8 @@ stList *make_flower_alignment_poa(Flower *flower, int64_t max_seq_length, int64_
     // Now make the consistent MSAs
     Msa **msas = make_consistent_partial_order_alignments(end_no, end_lengths, end_strings, end_string_lengths,
                                                           right_end_indexes, right_end_row_indexes, overlaps, window_size,
-                                                          max_prog_rows, max_prog_length_diff, poa_parameters);
+                                                          max_prog_rows, max_prog_length_diff, max_cluster_rows,
+                                                          anchored_windows_min, poa_parameters, parallel);
 
     // Temp debug output
     //for(int64_t i=0; i<end_no; i++) {
@@ -1198,7 +2083,7 @@ stList *make_flower_alignment_poa(Flower *flower, int64_t max_seq_length, int64_
     //}
 
     //Now convert to set of alignment blocks
-    stList *alignment_blocks = stList_construct3(0, (void (*)(void *))alignmentBlock_destruct);
+    AlignmentBlocks *alignment_blocks = alignmentBlocks_construct();
     for(int64_t i=0; i<end_no; i++) {
         create_alignment_blocks(msas[i], indices_to_caps[i], alignment_blocks);
     }
@@ -1215,8 +2100,8 @@ stList *make_flower_alignment_poa(Flower *flower, int64_t max_seq_length, int64_
     stHash_destruct(caps_to_indices);
 
     // Temp debug output
-    //for(int64_t i=0; i<stList_length(alignment_blocks); i++) {
-    //    alignmentBlock_print(stList_get(alignment_blocks, i), stderr);
+    //for(int64_t i=0; i<alignment_blocks->block_no; i++) {
+    //    alignmentBlocks_print(alignment_blocks, i, stderr);
     //}
 
     return alignment_blocks;
@@ -1227,54 +2112,60 @@ stList *make_flower_alignment_poa(Flower *flower, int64_t max_seq_length, int64_
  */
 
 /**
- * Iterator over the list of alignment blocks used to get stPinches in succession.
+ * Iterator over the alignment blocks used to get stPinches in succession, each pinch aligning two successive
+ * rows of a block.
  */
 typedef struct _alignmentBlockIterator {
-    stList *alignment_blocks; // The list of alignment blocks
-    int64_t i; // Index of the iterator into the alignment_blocks
-    AlignmentBlock *current_block; // The current block being considered
+    AlignmentBlocks *alignment_blocks; // The alignment blocks
+    int64_t i; // Index of the iterator into the blocks
+    int64_t j; // Index of the current row of the current block
 } AlignmentBlockIterator;
 
-AlignmentBlockIterator *alignmentBlockIterator_construct(stList *alignment_blocks) {
+AlignmentBlockIterator *alignmentBlockIterator_construct(AlignmentBlocks *alignment_blocks) {
     AlignmentBlockIterator *alignmentBlockIterator = st_calloc(1, sizeof(AlignmentBlockIterator));
     alignmentBlockIterator->alignment_blocks = alignment_blocks;
     return alignmentBlockIterator;
 }
 
 void alignmentBlockIterator_destruct(AlignmentBlockIterator *it) {
-    stList_length(it->alignment_blocks);
     free(it);
 }
 
 AlignmentBlockIterator *alignmentBlockIterator_start(AlignmentBlockIterator *it) {
     it->i = 0;
-    it->current_block = NULL;
+    it->j = 0;
     return it;
 }
 
 stPinch *alignmentBlockIterator_get_next(AlignmentBlockIterator *it, stPinch *pinchToFillOut) {
-    // If there is no current alignment block or the alignment block contains no further pinches
-    if(it->current_block == NULL || it->current_block->next == NULL) {
-        if(it->i >= stList_length(it->alignment_blocks)) { // We are done
-            return NULL;
-        }
-        it->current_block = stList_get(it->alignment_blocks, it->i++);
+    AlignmentBlocks *blocks = it->alignment_blocks;
+    // If the current alignment block contains no further pinches move to the next
+    if(it->i < blocks->block_no && it->j + 1 >= blocks->row_starts[it->i + 1]) {
+        it->i++;
+    }
+    if(it->i >= blocks->block_no) { // We are done
+        return NULL;
+    }
+    if(it->j < blocks->row_starts[it->i]) {
+        it->j = blocks->row_starts[it->i];
+        // All alignment blocks should contain at least two sequences
+        assert(blocks->row_starts[it->i + 1] - blocks->row_starts[it->i] >= 2);
     }
-    assert(it->current_block->next != NULL); // All alignment blocks should contain at least two sequences
 
-    AlignmentBlock *b = it->current_block;
+    AlignmentBlockRow *b = &blocks->rows[it->j];
+    int64_t length = blocks->lengths[it->i];
     assert(b->position >= 0);
-    assert(b->next->position >= 0);
-    assert(b->length > 0);
-    stPinch_fillOut(pinchToFillOut, b->subsequenceIdentifier, b->next->subsequenceIdentifier,
-                    b->position, b->next->position, b->length, b->strand == b->next->strand);
+    assert((b+1)->position >= 0);
+    assert(length > 0);
+    stPinch_fillOut(pinchToFillOut, b->subsequenceIdentifier, (b+1)->subsequenceIdentifier,
+                    b->position, (b+1)->position, length, b->strand == (b+1)->strand);
 
-    it->current_block = b->next; // Shift to the next sequence to ready the next pinch
+    it->j++; // Shift to the next sequence to ready the next pinch
 
     return pinchToFillOut;
 }
 
-stPinchIterator *stPinchIterator_constructFromAlignedBlocks(stList *alignment_blocks) {
+stPinchIterator *stPinchIterator_constructFromAlignedBlocks(AlignmentBlocks *alignment_blocks) {
     stPinchIterator *pinchIterator = st_calloc(1, sizeof(stPinchIterator));
     pinchIterator->alignmentArg = alignmentBlockIterator_construct(alignment_blocks);
     pinchIterator->getNextAlignment = (stPinch *(*)(void *, stPinch *)) alignmentBlockIterator_get_next;
@@ -0,0 +1,22 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#ifndef BAR_TASKS_H_
+#define BAR_TASKS_H_
+
+#include "sonLib.h"
+
+/*
+ * Calls spawnTasksFn(extraArg), which spawns OpenMP tasks and waits for them, within the team of the enclosing
+ * parallel region or, if there is none, of a new parallel region.
+ */
+void bar_runTasks(void (*spawnTasksFn)(void *extraArg), void *extraArg);
+
+/*
+ * Returns the indexes 0 to indexNumber-1, as a list, in descending order of lengths[i], so that the tasks for the
+ * longest items, e.g. the ends of a flower, are started first and the longest task does not start last.
+ */
+stList *bar_getIndexesByDescendingLength(int64_t *lengths, int64_t indexNumber);
+
+#endif /* BAR_TASKS_H_ */
@@ -16,50 +16,92 @@
 
 #include "sonLib.h"
 #include "cactus.h"
+#include "stPinchIterator.h"
 #include "pairwiseAligner.h"
 
+/*
+ * A pair of aligned positions. Both positions are held in the one struct, so that an alignment is a flat
+ * array of pairs rather than a set of linked pairs. An end alignment holds each pair twice, the second time
+ * with its positions swapped (its reverse), so that the pairs can be found from either position.
+ */
 typedef struct _AlignedPair {
-    int64_t subsequenceIdentifier;
-    int64_t position;
-    bool strand;
-    int64_t score;
-    struct _AlignedPair *reverse;
+    int64_t subsequenceIdentifier1;
+    int64_t position1;
+    int64_t score1;
+    int64_t subsequenceIdentifier2;
+    int64_t position2;
+    int64_t score2;
+    bool strand1;
+    bool strand2;
+    bool deleted; // Set when the pair has been pruned from an end alignment
 } AlignedPair;
 
 /*
- * Constructs the an aligned pair.
+ * A packed array of aligned pairs, sorted with alignedPairs_sort once all the pairs are added.
+ */
+typedef struct _AlignedPairs {
+    int64_t length;
+    int64_t maxLength;
+    AlignedPair *pairs;
+} AlignedPairs;
+
+AlignedPairs *alignedPairs_construct(void);
+
+void alignedPairs_destruct(AlignedPairs *alignedPairs);
+
+/*
+ * Appends the pair of positions, the first position scoring score1 and the second score2.
  */
-AlignedPair *alignedPair_construct(int64_t subsequenceIdentifier1, int64_t position1, bool strand1,
+void alignedPairs_add(AlignedPairs *alignedPairs, int64_t subsequenceIdentifier1, int64_t position1, bool strand1,
         int64_t subsequenceIdentifier2, int64_t position2, bool strand2, int64_t score1, int64_t score2);
 
 /*
- * Destruct the aligned pair.
+ * Sorts the pairs by alignedPair_cmpFn.
+ */
+void alignedPairs_sort(AlignedPairs *alignedPairs);
+
+/*
+ * Returns the index of the first of the sorted pairs whose first position is not before the given position,
+ * or the number of pairs if there is none.
+ */
+int64_t alignedPairs_getFirstIndex(AlignedPairs *alignedPairs, int64_t subsequenceIdentifier, int64_t position,
+        bool strand);
+
+/*
+ * Returns the reverse of the pair in the sorted pairs, or NULL if it is not present.
  */
-void alignedPair_destruct(AlignedPair *alignedPair);
+AlignedPair *alignedPairs_getReverse(AlignedPairs *alignedPairs, AlignedPair *alignedPair);
 
 /*
- * Compares two aligned pairs.
+ * Compares two aligned pairs, by their first positions then by their second positions.
  */
 int alignedPair_cmpFn(const AlignedPair *alignedPair1, const AlignedPair *alignedPair2);
 
 /*
- * Creates a global alignment (as a set of aligned pairs) of the sequences from the end,
- * the pairs returned are ordered according
+ * Constructs a pinch iterator over the pairs, each pair giving a pinch of length one.
+ */
+stPinchIterator *stPinchIterator_constructFromAlignedPairArray(AlignedPairs *alignedPairs);
+
+/*
+ * Creates a global alignment (as an array of aligned pairs, holding each pair and its reverse) of the
+ * sequences from the end, the pairs returned are ordered according
  * to the alignerPair comparison function.
  */
-stSortedSet *makeEndAlignment(StateMachine *sM, End *end, int64_t spanningTrees, int64_t maxSequenceLength,
+AlignedPairs *makeEndAlignment(StateMachine *sM, End *end, int64_t spanningTrees, int64_t maxSequenceLength,
                               bool useProgressiveMerging, float gapGamma,
                               PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters);
 
 /*
- * Writes an end alignment to the given file.
+ * Writes an end alignment, less any pairs deleted from it, to the given file, in a compact binary format in which
+ * each end alignment is a record that can be appended to the file.
  */
-void writeEndAlignmentToDisk(End *end, stSortedSet *endAlignment, FILE *fileHandle);
+void writeEndAlignmentToDisk(End *end, AlignedPairs *endAlignment, FILE *fileHandle);
 
 /*
- * Loads an end alignment from the given file.
+ * Loads the next end alignment from the given file, setting end to its end, or returns NULL, setting end to NULL,
+ * at the end of the file. The pairs are decoded straight into a sorted array.
  */
-stSortedSet *loadEndAlignmentFromDisk(Flower *flower, FILE *fileHandle, End **end);
+AlignedPairs *loadEndAlignmentFromDisk(Flower *flower, FILE *fileHandle, End **end);
 
 
 #endif /* ENDALIGNER_H_ */
@@ -15,6 +15,7 @@
 #define FLOWER_ALIGNER_H_
 
 #include "pairwiseAligner.h"
+#include "endAligner.h"
 
 /*
  * Constructs an alignment for the flower by constructing an alignment for each end
@@ -22,17 +23,21 @@
  * end alignment. Spanning trees controls the number of pairwise alignments used
  * to construct the alignment, maxSequenceLength is the maximum length of a sequence to consider in the end alignment.
  * Model parameters is the parameters of the pairwise alignment model.
+ * The alignment returned holds each aligned pair once (not its reverse), in sorted order.
  */
-stSortedSet *makeFlowerAlignment(StateMachine *sM, Flower *flower, int64_t spanningTrees,
+AlignedPairs *makeFlowerAlignment(StateMachine *sM, Flower *flower, int64_t spanningTrees,
         int64_t maxSequenceLength, bool useProgressiveMerging, float gapGamma,
         PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters, bool pruneOutStubAlignments);
 
 /*
- * As above, but including alignments from disk.
+ * As above, but including alignments from disk. The ends returned by getEndsToAlignSeparately for largeEndSize
+ * that are not loaded from disk are aligned in parallel, as OpenMP tasks, which within an enclosing parallel
+ * region go to its team.
  */
-stSortedSet *makeFlowerAlignment3(StateMachine *sM, Flower *flower, stList *listOfEndAlignmentFiles, int64_t spanningTrees,
+AlignedPairs *makeFlowerAlignment3(StateMachine *sM, Flower *flower, stList *listOfEndAlignmentFiles, int64_t spanningTrees,
         int64_t maxSequenceLength, bool useProgressiveMerging, float gapGamma,
-        PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters, bool pruneOutStubAlignments);
+        PairwiseAlignmentParameters *pairwiseAlignmentBandingParameters, bool pruneOutStubAlignments,
+        int64_t largeEndSize);
 
 /*
  * Returns an end, if exists, that has cap involved in every adjacency, else returns null.
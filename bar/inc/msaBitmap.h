@@ -0,0 +1,61 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#ifndef MSA_BITMAP_H_
+#define MSA_BITMAP_H_
+
+#include "sonLib.h"
+#include "poaBarAligner.h"
+
+/**
+ * Packed, column-major map of the non-gap cells of an msa. The rows with a base in a column are
+ * stored as a bit set in consecutive words, so a column is scanned a word of 64 rows at a time rather
+ * than by a pointer per row. The bitmap is built with SIMD (AVX2 or SSE2 where compiled for, with
+ * a scalar fallback) from the rows of the msa.
+ */
+typedef struct _MsaBitmap {
+    int64_t row_no; // number of rows of the msa
+    int64_t column_no; // number of columns of the msa
+    int64_t words_per_column; // number of 64 bit words holding the rows of a column
+    uint64_t *bits; // bit i%64 of word j*words_per_column + i/64 is set if row i has a base in column j
+} MsaBitmap;
+
+/**
+ * Builds the bitmap of the msa.
+ */
+MsaBitmap *msa_bitmap_construct(Msa *msa);
+
+void msa_bitmap_destruct(MsaBitmap *bitmap);
+
+/**
+ * Returns non-zero if the given row has a base in the column.
+ */
+static inline bool msa_bitmap_is_base(MsaBitmap *bitmap, int64_t row, int64_t column) {
+    return (bitmap->bits[column * bitmap->words_per_column + row / 64] >> (row % 64)) & 1;
+}
+
+/**
+ * Returns the number of rows with a base in the column.
+ */
+int64_t msa_bitmap_column_bases(MsaBitmap *bitmap, int64_t column);
+
+/**
+ * Fills in column_scores, one for each column, with the number of bases in the column less one, or
+ * zero for an empty column.
+ */
+void msa_bitmap_column_scores(MsaBitmap *bitmap, float *column_scores);
+
+/**
+ * Returns the first column after start whose rows with a base differ from those of start, or the number
+ * of columns if there is none.
+ */
+int64_t msa_bitmap_next_different_column(MsaBitmap *bitmap, int64_t start);
+
+/**
+ * Maps each of the length values of the row through msa_to_byte(msa_to_base(.)), so that it is in the
+ * alphabet of msa_to_byte.
+ */
+void msa_canonicalise_row(uint8_t *row, int64_t length);
+
+#endif /* MSA_BITMAP_H_ */
@@ -16,9 +16,54 @@
 #include "flowerAligner.h"
 
 /*
- * Overall coordination function to run the bar algorithm.
+ * The parameters of the bar algorithm, parsed from the cactus params.
  */
-void bar(stList *flowers, CactusParams *p, CactusDisk *cactusDisk, stList *listOfEndAlignmentFiles);
+typedef struct _barParameters BarParameters;
+
+/*
+ * Parses the bar parameters from the cactus params.
+ */
+BarParameters *barParameters_construct(CactusParams *params);
+
+/*
+ * Cleanup the bar parameters.
+ */
+void barParameters_destruct(BarParameters *barParameters);
+
+/*
+ * Frees the abpoa engine each thread keeps to align windows with, which otherwise lives as long as the thread.
+ * Called outside of a parallel region, once bar is finished, this frees the engines of all the threads of the
+ * parallel regions, else only that of the calling thread. A later alignment builds a new engine.
+ */
+void poa_engine_destruct(void);
+
+/*
+ * The number of the largest flowers, in an ordering of the flowers by descending size, whose ends are aligned
+ * in parallel. A few giant flowers otherwise leave the other threads idle at the end of bar.
+ */
+#define BAR_PARALLEL_END_FLOWERS 4
+
+/*
+ * Runs the bar algorithm on a single flower. Flowers that are not nested within one another
+ * can be aligned concurrently using the same parameters. If alignEndsInParallel is non-zero the poa alignments
+ * of the ends of the flower are computed as OpenMP tasks, which threads of an enclosing parallel region that are
+ * not otherwise busy help with.
+ */
+void bar_alignFlower(Flower *flower, BarParameters *barParameters, stList *listOfEndAlignmentFiles,
+                     bool alignEndsInParallel);
+
+/*
+ * Estimates the peak memory, in bytes, bar_alignFlower uses to align the flower, from the number and lengths of
+ * the adjacency strings of its ends and the poa window or pecan matrix size. Used by scheduleBarAndReference to
+ * keep the flowers aligned at once within the memoryBudget bar parameter.
+ */
+int64_t bar_estimateFlowerMemory(Flower *flower, BarParameters *barParameters, bool alignEndsInParallel);
+
+/*
+ * Gets the memoryBudget bar parameter, the bytes of estimated memory the flowers aligned at once are kept
+ * within, or a value below 1 if there is no budget.
+ */
+int64_t barParameters_getMemoryBudget(BarParameters *barParameters);
 
 /*
  * Construct a pairwise alignment parameters object parsing the cactus params specified parameters.
@@ -63,13 +108,19 @@ void msa_destruct(Msa *msa);
 void msa_print(Msa *msa, FILE *f);
 
 /**
- * Creates a partial order alignment
+ * Creates a partial order alignment. Strings that are the same (ignoring case) are only aligned once, each
+ * copy getting the same row.
  * @param seqs An array of DNA string
  * @param seq_lens An array giving the string lengths
  * @param seq_no The number of strings
  * @param window_size Sliding window size which limits length of poa sub-alignments.  Memory usage is quardatic in this. 
  * @param max_prog_rows Disable abpoas progressive alignment if there are more than this many rows (avoid quadratic dist mat blowup)
  * @param max_prog_length_diff Disable abpoa's progresive alignment if the 1 - shortest (last) sequence / longest (first) sequence is more than this 
+ * @param max_cluster_rows If more than one, and there are more than this many distinct strings, the strings are
+ * clustered by k-mer sketch distance, each cluster of at most this many strings aligned separately and the
+ * clusters merged through an alignment of their centres (-1 = disabled)
+ * @param anchored_windows_min If positive, strings needing at least this many sliding windows are cut into windows
+ * in advance, at exact matches shared by all the strings, and the windows aligned in parallel (-1 = disabled)
  * @param poa_parameters abpoa parameters
  * @return An msa of the strings.
  */
@@ -79,6 +130,8 @@ Msa *msa_make_partial_order_alignment(char **seqs,
                                       int64_t window_size,
                                       int64_t max_prog_rows,
                                       double max_prog_length_diff,
+                                      int64_t max_cluster_rows,
+                                      int64_t anchored_windows_min,
                                       abpoa_para_t *poa_parameters);
 
 /**
@@ -102,32 +155,56 @@ Msa *msa_make_partial_order_alignment(char **seqs,
  * @param window_size Sliding window size which limits length of poa sub-alignments.  Memory usage is quardatic in this. 
  * @param max_prog_rows Disable abpoas progressive alignment if there are more than this many rows (avoid quadratic dist mat blowup)
  * @param max_prog_length_diff Disable abpoa's progresive alignment if the 1 - shortest (last) sequence / longest (first) sequence is more than this 
+ * @param max_cluster_rows Align the strings of an end in clusters, see msa_make_partial_order_alignment
+ * @param anchored_windows_min Align the long strings of an end in anchored windows, see msa_make_partial_order_alignment
  * @param poa_parameters abpoa parameters
+ * @param parallel If non-zero the ends are aligned as OpenMP tasks, longest first, within the enclosing parallel
+ * region or, if there is none, a new one
  * @return A consistent Msa for each end
  */
 Msa **make_consistent_partial_order_alignments(int64_t end_no, int64_t *end_lengths, char ***end_strings,
         int **end_string_lengths, int64_t **right_end_indexes, int64_t **right_end_row_indexes, int64_t **overlaps,
-        int64_t window_size, int64_t max_prog_rows, double max_prog_length_diff, abpoa_para_t *poa_parameters);
+        int64_t window_size, int64_t max_prog_rows, double max_prog_length_diff, int64_t max_cluster_rows,
+        int64_t anchored_windows_min, abpoa_para_t *poa_parameters, bool parallel);
 
 /**
- * Represents a gapless alignment of a set of sequences.
+ * A sequence in a gapless alignment block.
  */
-typedef struct _AlignmentBlock {
+typedef struct _AlignmentBlockRow {
     int64_t subsequenceIdentifier; // The name of the sequence
     int64_t position; // The start position
     bool strand;
-    int64_t length;
-    struct _AlignmentBlock *next;
-} AlignmentBlock;
+} AlignmentBlockRow;
+
+/**
+ * Represents a set of gapless alignments of sequences, stored contiguously. Block i has length lengths[i] and
+ * aligns the sequences rows[row_starts[i]] to rows[row_starts[i+1]-1].
+ */
+typedef struct _AlignmentBlocks {
+    int64_t block_no; // The number of blocks
+    int64_t *lengths; // The length of each block
+    int64_t *row_starts; // The index of the first row of each block, and the number of rows after the last block
+    AlignmentBlockRow *rows; // The sequences of the blocks
+    int64_t max_block_no; // The number of blocks there is space for
+    int64_t max_row_no; // The number of rows there is space for
+} AlignmentBlocks;
 
-void alignmentBlock_destruct(AlignmentBlock *alignmentBlock);
+AlignmentBlocks *alignmentBlocks_construct(void);
+
+void alignmentBlocks_destruct(AlignmentBlocks *alignmentBlocks);
 
 /**
- * Prints a human readable version of the alignment block.
- * @param ab
+ * Adds a block of the given length with row_no rows, returning the rows to fill in.
+ */
+AlignmentBlockRow *alignmentBlocks_add(AlignmentBlocks *alignmentBlocks, int64_t length, int64_t row_no);
+
+/**
+ * Prints a human readable version of the ith alignment block.
+ * @param alignmentBlocks
+ * @param i
  * @param f file-handle to print to.
  */
-void alignmentBlock_print(AlignmentBlock *ab, FILE *f);
+void alignmentBlocks_print(AlignmentBlocks *alignmentBlocks, int64_t i, FILE *f);
 
 /**
  * Get the string connecting two ends for the given cap. If return_string is 0 then does not return the string,
@@ -144,21 +221,27 @@ char *get_adjacency_string(Cap *cap, int *length, bool return_string);
  * @param mask_filter Trim input sequences if encountering this many consecutive soft of hard masked bases (0 = disabled)
  * @param max_prog_rows Disable abpoa's progressive alignment if there are more than this many rows (avoid quadratic dist mat blowup)
  * @param max_prog_length_diff Disable abpoa's progresive alignment if the 1 - shortest (last) sequence / longest (first) sequence is more than this
+ * @param max_cluster_rows Align the strings of an end in clusters, see msa_make_partial_order_alignment
+ * @param anchored_windows_min Align the long strings of an end in anchored windows, see msa_make_partial_order_alignment
  * @param poa_parameters abpoa parameters
- */
-stList *make_flower_alignment_poa(Flower *flower,
-                                  int64_t max_seq_length,
-                                  int64_t window_size,
-                                  int64_t mask_filter,
-                                  int64_t max_prog_rows,
-                                  double max_prog_length_diff,
-                                  abpoa_para_t * poa_parameters);
+ * @param parallel If non-zero the ends are aligned in parallel, see make_consistent_partial_order_alignments
+ */
+AlignmentBlocks *make_flower_alignment_poa(Flower *flower,
+                                           int64_t max_seq_length,
+                                           int64_t window_size,
+                                           int64_t mask_filter,
+                                           int64_t max_prog_rows,
+                                           double max_prog_length_diff,
+                                           int64_t max_cluster_rows,
+                                           int64_t anchored_windows_min,
+                                           abpoa_para_t * poa_parameters,
+                                           bool parallel);
 
 /**
- * Create a pinch iterator for a list of alignment blocks.
- * @param alignment_blocks A list of AlignmentBlock instances
+ * Create a pinch iterator for a set of alignment blocks.
+ * @param alignment_blocks The alignment blocks, which must outlive the iterator
  * @return A pinch iterator for all the alignments in alignment_blocks
  */
-stPinchIterator *stPinchIterator_constructFromAlignedBlocks(stList *alignment_blocks);
+stPinchIterator *stPinchIterator_constructFromAlignedBlocks(AlignmentBlocks *alignment_blocks);
 
 #endif
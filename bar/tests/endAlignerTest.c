@@ -10,56 +10,58 @@
 #include "pairwiseAligner.h"
 
 void test_alignedPair_cmpFn(CuTest *testCase) {
-    stList *list = stList_construct3(0, (void (*)(void *))alignedPair_destruct);
-
-    //(int (*)(const void *, const void *))alignedPair_cmpFn,
+    AlignedPairs *alignedPairs = alignedPairs_construct();
 
     Name seq1 = 5;
     Name seq2 = 10;
 
-    AlignedPair *aP1 = alignedPair_construct(seq1, 2, 1,
-                        seq1, 7, 1, 90, 90);
-    AlignedPair *aP2 = alignedPair_construct(seq1, 2, 1,
-            seq2, 4, 0, 10, 10);
-    AlignedPair *aP3 = alignedPair_construct(seq1, 2, 1,
-                seq2, 4, 1, 75, 72);
-    AlignedPair *aP4 = alignedPair_construct(seq1, 3, 1,
-                        seq2, 4, 0, 10, 1);
-    AlignedPair *aP5 = alignedPair_construct(seq1, 4, 1,
-                            seq2, 4, 1, 90, 100);
-
-    AlignedPair *ordering[5] = { aP2, aP1, aP4, aP5, aP3 };
+    int64_t pairs[5][8] = { { seq1, 2, 1, seq2, 4, 0, 10, 10 }, //aP2
+                            { seq1, 2, 1, seq1, 7, 1, 90, 90 }, //aP1
+                            { seq1, 3, 1, seq2, 4, 0, 10, 1 }, //aP4
+                            { seq1, 4, 1, seq2, 4, 1, 90, 100 }, //aP5
+                            { seq1, 2, 1, seq2, 4, 1, 75, 72 } }; //aP3
     for(int64_t i=0; i<5; i++) {
-        AlignedPair *aP = ordering[i];
-        st_logInfo("I got %" PRIi64 " %" PRIi64 "\n", aP, aP->reverse);
-        stList_append(list, aP);
-        stList_append(list, aP->reverse);
+        int64_t *p = pairs[i];
+        alignedPairs_add(alignedPairs, p[0], p[1], p[2], p[3], p[4], p[5], p[6], p[7]);
+        alignedPairs_add(alignedPairs, p[3], p[4], p[5], p[0], p[1], p[2], p[7], p[6]);
     }
 
-    stList_sort(list, (int (*)(const void *, const void *))alignedPair_cmpFn);
+    alignedPairs_sort(alignedPairs);
 
-    AlignedPair *correctOrdering[10] = { aP1, aP2, aP3, aP4, aP5, aP1->reverse, aP2->reverse, aP4->reverse, aP3->reverse, aP5->reverse };
+    //The pairs are aP1, aP2, aP3, aP4, aP5, then the reverses of aP1, aP2, aP4, aP3 and aP5, given by their scores
+    int64_t correctScores[10][2] = { { 90, 90 }, { 10, 10 }, { 75, 72 }, { 10, 1 }, { 90, 100 },
+                                     { 90, 90 }, { 10, 10 }, { 1, 10 }, { 72, 75 }, { 100, 90 } };
+    CuAssertIntEquals(testCase, 10, alignedPairs->length);
     for(int64_t i=0; i<10; i++) {
-        st_logInfo("Checking %" PRIi64 " %" PRIi64 "\n", correctOrdering[i], stList_get(list, i));
-        CuAssertTrue(testCase, correctOrdering[i] == stList_get(list, i));
+        AlignedPair *aP = &alignedPairs->pairs[i];
+        st_logInfo("Checking %" PRIi64 " %" PRIi64 "\n", aP->score1, aP->score2);
+        CuAssertIntEquals(testCase, correctScores[i][0], aP->score1);
+        CuAssertIntEquals(testCase, correctScores[i][1], aP->score2);
+        CuAssertTrue(testCase, i < 5 ? aP->subsequenceIdentifier1 == seq1 : aP->subsequenceIdentifier2 == seq1);
+        //Each pair can be found from its reverse
+        AlignedPair *reverse = alignedPairs_getReverse(alignedPairs, aP);
+        CuAssertTrue(testCase, reverse != NULL);
+        CuAssertTrue(testCase, alignedPairs_getReverse(alignedPairs, reverse) == aP);
     }
+    CuAssertIntEquals(testCase, 0, alignedPairs_getFirstIndex(alignedPairs, seq1, 2, 1));
+    CuAssertIntEquals(testCase, 3, alignedPairs_getFirstIndex(alignedPairs, seq1, 3, 0));
+    CuAssertIntEquals(testCase, 5, alignedPairs_getFirstIndex(alignedPairs, seq1, 5, 0));
 
-
-    stList_destruct(list);
+    alignedPairs_destruct(alignedPairs);
 }
 
 int64_t isInAdjacencySequence(AlignedPair *alignedPair, AdjacencySequence *adjacencySequence) {
-    if (alignedPair->subsequenceIdentifier == adjacencySequence->subsequenceIdentifier) {
-        if (alignedPair->strand == adjacencySequence->strand) {
-            if (alignedPair->strand) {
-                if (alignedPair->position >= adjacencySequence->start
-                        && alignedPair->position < adjacencySequence->start
+    if (alignedPair->subsequenceIdentifier1 == adjacencySequence->subsequenceIdentifier) {
+        if (alignedPair->strand1 == adjacencySequence->strand) {
+            if (alignedPair->strand1) {
+                if (alignedPair->position1 >= adjacencySequence->start
+                        && alignedPair->position1 < adjacencySequence->start
                                 + adjacencySequence->length) {
                     return 1;
                 }
             } else {
-                if (alignedPair->position <= adjacencySequence->start
-                        && alignedPair->position > adjacencySequence->start
+                if (alignedPair->position1 <= adjacencySequence->start
+                        && alignedPair->position1 > adjacencySequence->start
                                 - adjacencySequence->length) {
                     return 1;
                 }
@@ -99,51 +101,82 @@ static void testMakeEndAlignments(CuTest *testCase) {
     int64_t maxLength = 4;
     for (int64_t endIndex = 0; endIndex < 3; endIndex++) {
         End *end = ends[endIndex];
-        stSortedSet *endAlignment = makeEndAlignment(stateMachine, end, 5, maxLength, end_getInstanceNumber(end) > 50, 0.5, pairwiseParameters);
+        AlignedPairs *endAlignment = makeEndAlignment(stateMachine, end, 5, maxLength, end_getInstanceNumber(end) > 50, 0.5, pairwiseParameters);
 
-        stSortedSetIterator *iterator = stSortedSet_getIterator(endAlignment);
-        AlignedPair *alignedPair;
         //Check pairs are part of valid sequences from end
-
-        while ((alignedPair = stSortedSet_getNext(iterator)) != NULL) {
-            CuAssertTrue(testCase, alignedPair->score > 0); //Check score is valid.
-            CuAssertTrue(testCase, alignedPair->score <= PAIR_ALIGNMENT_PROB_1);
-            CuAssertTrue(testCase, stSortedSet_search(endAlignment, alignedPair->reverse) != NULL); //Check other end is in.
+        for (int64_t i = 0; i < endAlignment->length; i++) {
+            AlignedPair *alignedPair = &endAlignment->pairs[i];
+            CuAssertTrue(testCase, alignedPair->score1 > 0); //Check score is valid.
+            CuAssertTrue(testCase, alignedPair->score1 <= PAIR_ALIGNMENT_PROB_1);
+            CuAssertTrue(testCase, i == 0 || alignedPair_cmpFn(&endAlignment->pairs[i-1], alignedPair) < 0); //Check the pairs are sorted.
+            CuAssertTrue(testCase, alignedPairs_getReverse(endAlignment, alignedPair) != NULL); //Check other end is in.
             //Check coordinates are in sequence..
             CuAssertTrue(testCase, isInAdjacency(alignedPair, end, maxLength));
         }
-        stSortedSet_destructIterator(iterator);
-        stSortedSet_destruct(endAlignment);
+        alignedPairs_destruct(endAlignment);
     }
     teardown(testCase);
 }
 
+static bool alignedPairs_equal(AlignedPairs *alignedPairs1, AlignedPairs *alignedPairs2) {
+    if (alignedPairs1->length != alignedPairs2->length) {
+        return 0;
+    }
+    for (int64_t i = 0; i < alignedPairs1->length; i++) {
+        AlignedPair *aP1 = &alignedPairs1->pairs[i], *aP2 = &alignedPairs2->pairs[i];
+        if (alignedPair_cmpFn(aP1, aP2) != 0 || aP1->score1 != aP2->score1 || aP1->score2 != aP2->score2) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
 static void testReadAndWriteEndAlignments(CuTest *testCase) {
     setup(testCase);
     End *ends[3] = { end1, end2, end3 };
     int64_t maxLength = 4;
     for (int64_t endIndex = 0; endIndex < 3; endIndex++) {
         End *end = ends[endIndex];
-        stSortedSet *endAlignment = makeEndAlignment(stateMachine, end, 5, maxLength, end_getInstanceNumber(end) > 50, 0.5, pairwiseParameters);
+        AlignedPairs *endAlignment = makeEndAlignment(stateMachine, end, 5, maxLength, end_getInstanceNumber(end) > 50, 0.5, pairwiseParameters);
         char *temporaryEndAlignmentFile = "temporaryEndAlignmentFile.end";
-        FILE *fileHandle = fopen(temporaryEndAlignmentFile, "w");
+        FILE *fileHandle = fopen(temporaryEndAlignmentFile, "wb");
         writeEndAlignmentToDisk(end, endAlignment, fileHandle);
         writeEndAlignmentToDisk(end, endAlignment, fileHandle); //Write twice to show we can serialise.
         fclose(fileHandle);
-        fileHandle = fopen(temporaryEndAlignmentFile, "r");
+        fileHandle = fopen(temporaryEndAlignmentFile, "rb");
         End *end2;
-        stSortedSet *endAlignment2 = loadEndAlignmentFromDisk(flower, fileHandle, &end2);
+        AlignedPairs *endAlignment2 = loadEndAlignmentFromDisk(flower, fileHandle, &end2);
         CuAssertPtrEquals(testCase, end, end2);
-        stSortedSet *endAlignment3 = loadEndAlignmentFromDisk(flower, fileHandle, &end2);
+        AlignedPairs *endAlignment3 = loadEndAlignmentFromDisk(flower, fileHandle, &end2);
         CuAssertPtrEquals(testCase, end, end2);
         CuAssertTrue(testCase, loadEndAlignmentFromDisk(flower, fileHandle, &end2) == NULL);
         CuAssertTrue(testCase, end2 == NULL);
         fclose(fileHandle);
-        CuAssertTrue(testCase, stSortedSet_equals(endAlignment, endAlignment2));
-        CuAssertTrue(testCase, stSortedSet_equals(endAlignment, endAlignment3));
-        stSortedSet_destruct(endAlignment);
-        stSortedSet_destruct(endAlignment2);
-        stSortedSet_destruct(endAlignment3);
+        CuAssertTrue(testCase, alignedPairs_equal(endAlignment, endAlignment2));
+        CuAssertTrue(testCase, alignedPairs_equal(endAlignment, endAlignment3));
+        //Pairs deleted from an end alignment are not written.
+        for (int64_t i = 0; i < endAlignment2->length; i++) {
+            endAlignment2->pairs[i].deleted = i % 3 == 0;
+        }
+        fileHandle = fopen(temporaryEndAlignmentFile, "wb");
+        writeEndAlignmentToDisk(end, endAlignment2, fileHandle);
+        fclose(fileHandle);
+        fileHandle = fopen(temporaryEndAlignmentFile, "rb");
+        AlignedPairs *endAlignment4 = loadEndAlignmentFromDisk(flower, fileHandle, &end2);
+        CuAssertPtrEquals(testCase, end, end2);
+        fclose(fileHandle);
+        int64_t j = 0;
+        for (int64_t i = 0; i < endAlignment2->length; i++) {
+            if (!endAlignment2->pairs[i].deleted) {
+                endAlignment2->pairs[j++] = endAlignment2->pairs[i];
+            }
+        }
+        endAlignment2->length = j;
+        CuAssertTrue(testCase, alignedPairs_equal(endAlignment2, endAlignment4));
+        alignedPairs_destruct(endAlignment4);
+        alignedPairs_destruct(endAlignment);
+        alignedPairs_destruct(endAlignment2);
+        alignedPairs_destruct(endAlignment3);
         stFile_rmtree(temporaryEndAlignmentFile);
     }
     teardown(testCase);
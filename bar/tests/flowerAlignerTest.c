@@ -10,7 +10,7 @@
 #include "adjacencySequences.h"
 #include "pairwiseAligner.h"
 
-stList *getInducedAlignment(stSortedSet *endAlignment, AdjacencySequence *adjacencySequence);
+stList *getInducedAlignment(AlignedPairs *endAlignment, AdjacencySequence *adjacencySequence);
 
 static int getRandomPosition(AdjacencySequence *adjacencySequence) {
     if(adjacencySequence->strand) {
@@ -23,16 +23,14 @@ static int getRandomPosition(AdjacencySequence *adjacencySequence) {
 
 int64_t isInAdjacencySequence(AlignedPair *alignedPair, AdjacencySequence *adjacencySequence);
 
-stList *getinducedAlignment2(stSortedSet *endAlignment, AdjacencySequence *adjacencySequence) {
+stList *getinducedAlignment2(AlignedPairs *endAlignment, AdjacencySequence *adjacencySequence) {
     stList *inducedAlignment = stList_construct();
-    stSortedSetIterator *it = stSortedSet_getIterator(endAlignment);
-    AlignedPair *alignedPair;
-    while((alignedPair = stSortedSet_getNext(it)) != NULL) {
+    for(int64_t i=0; i<endAlignment->length; i++) {
+        AlignedPair *alignedPair = &endAlignment->pairs[i];
         if(isInAdjacencySequence(alignedPair, adjacencySequence)) {
             stList_append(inducedAlignment, alignedPair);
         }
     }
-    stSortedSet_destructIterator(it);
     stList_sort(inducedAlignment, (int (*)(const void *, const void *))alignedPair_cmpFn);
     if(!adjacencySequence->strand) {
         stList_reverse(inducedAlignment);
@@ -44,8 +42,7 @@ void test_getInducedAlignment(CuTest *testCase) {
     for(int64_t test=0; test<100; test++) {
         setup(testCase);
 
-        stSortedSet *sortedAlignment = stSortedSet_construct3((int (*)(const void *, const void *))alignedPair_cmpFn,
-                       (void (*)(void *))alignedPair_destruct);
+        AlignedPairs *sortedAlignment = alignedPairs_construct();
 
 
         stList *adjacencySequences = stList_construct3(0, (void (*)(void *))adjacencySequence_destruct);
@@ -61,14 +58,15 @@ void test_getInducedAlignment(CuTest *testCase) {
             AdjacencySequence *aS1 = st_randomChoice(adjacencySequences);
             AdjacencySequence *aS2 = st_randomChoice(adjacencySequences);
             if(aS1 != aS2) {
-                AlignedPair *alignedPair =
-                        alignedPair_construct(aS1->subsequenceIdentifier, getRandomPosition(aS1), aS1->strand,
-                                              aS2->subsequenceIdentifier, getRandomPosition(aS2), aS2->strand,
-                                              st_randomInt(0, PAIR_ALIGNMENT_PROB_1), st_randomInt(0, PAIR_ALIGNMENT_PROB_1));
-                stSortedSet_insert(sortedAlignment, alignedPair);
-                stSortedSet_insert(sortedAlignment, alignedPair->reverse);
+                int64_t position1 = getRandomPosition(aS1), position2 = getRandomPosition(aS2);
+                int64_t score1 = st_randomInt(0, PAIR_ALIGNMENT_PROB_1), score2 = st_randomInt(0, PAIR_ALIGNMENT_PROB_1);
+                alignedPairs_add(sortedAlignment, aS1->subsequenceIdentifier, position1, aS1->strand,
+                                 aS2->subsequenceIdentifier, position2, aS2->strand, score1, score2);
+                alignedPairs_add(sortedAlignment, aS2->subsequenceIdentifier, position2, aS2->strand,
+                                 aS1->subsequenceIdentifier, position1, aS1->strand, score2, score1);
             }
         }
+        alignedPairs_sort(sortedAlignment);
 
         for(int64_t i=0; i<stList_length(adjacencySequences); i++) {
             AdjacencySequence *adjacencySequence = stList_get(adjacencySequences, i);
@@ -90,7 +88,8 @@ void test_getInducedAlignment(CuTest *testCase) {
 
             CuAssertTrue(testCase, stList_length(inducedAlignment) == stList_length(inducedAlignment2));
             for(int64_t j=0; j<stList_length(inducedAlignment); j++) {
-                CuAssertTrue(testCase, stList_get(inducedAlignment, j) == stList_get(inducedAlignment2, j));
+                // Pairs may be repeated, so compare them rather than their addresses
+                CuAssertTrue(testCase, alignedPair_cmpFn(stList_get(inducedAlignment, j), stList_get(inducedAlignment2, j)) == 0);
             }
 
             stList_destruct(inducedAlignment);
@@ -98,7 +97,7 @@ void test_getInducedAlignment(CuTest *testCase) {
         }
 
         //cleanup
-        stSortedSet_destruct(sortedAlignment);
+        alignedPairs_destruct(sortedAlignment);
         teardown(testCase);
     }
 }
@@ -110,18 +109,51 @@ void test_flowerAlignerRandom(CuTest *testCase) {
     setup(testCase);
     int64_t maxLength = 5;
     StateMachine *sM = stateMachine5_construct(fiveState);
-    stSortedSet *flowerAlignment = makeFlowerAlignment(sM, flower, 5, maxLength, 1, 0.5, pairwiseParameters, st_random() > 0.5);
+    AlignedPairs *flowerAlignment = makeFlowerAlignment(sM, flower, 5, maxLength, 1, 0.5, pairwiseParameters, st_random() > 0.5);
     stateMachine_destruct(sM);
     //Check the aligned pairs are all good..
-    stSortedSetIterator *iterator = stSortedSet_getIterator(flowerAlignment);
-    AlignedPair *alignedPair;
-    while((alignedPair = stSortedSet_getNext(iterator)) != NULL) {
-        CuAssertTrue(testCase, alignedPair->score > 0); //Check score is valid
-        CuAssertTrue(testCase, alignedPair->score <= PAIR_ALIGNMENT_PROB_1);
-        CuAssertTrue(testCase, stSortedSet_search(flowerAlignment, alignedPair->reverse) != NULL); //Check other end is in.
+    for(int64_t i=0; i<flowerAlignment->length; i++) {
+        AlignedPair *alignedPair = &flowerAlignment->pairs[i];
+        CuAssertTrue(testCase, alignedPair->score1 > 0); //Check score is valid
+        CuAssertTrue(testCase, alignedPair->score1 <= PAIR_ALIGNMENT_PROB_1);
+        CuAssertTrue(testCase, i == 0 || alignedPair_cmpFn(&flowerAlignment->pairs[i-1], alignedPair) < 0); //Check the pairs are sorted.
+        CuAssertTrue(testCase, alignedPairs_getReverse(flowerAlignment, alignedPair) == NULL); //Check each pair is held once.
     }
-    stSortedSet_destructIterator(iterator);
-    stSortedSet_destruct(flowerAlignment);
+    alignedPairs_destruct(flowerAlignment);
+
+    teardown(testCase);
+}
+
+/*
+ * Aligns the ends of the flower as tasks, with a large end size of zero so that every end is aligned separately,
+ * from within a parallel region, as when flowers are aligned by the tasks of the flower scheduler. The alignment
+ * must be the same as that made aligning the ends serially.
+ */
+void test_flowerAlignerParallelLargeEnds(CuTest *testCase) {
+    setup(testCase);
+    StateMachine *sM = stateMachine5_construct(fiveState);
+    stSortedSet *largeEnds = getEndsToAlignSeparately(flower, 5, 0);
+    CuAssertTrue(testCase, stSortedSet_size(largeEnds) > 1);
+    stSortedSet_destruct(largeEnds);
+    AlignedPairs *flowerAlignment = makeFlowerAlignment3(sM, flower, NULL, 5, 5, 1, 0.5, pairwiseParameters, 0,
+                                                         INT64_MAX);
+    AlignedPairs *flowerAlignment2;
+#if defined(_OPENMP)
+#pragma omp parallel
+#pragma omp single
+#endif
+    flowerAlignment2 = makeFlowerAlignment3(sM, flower, NULL, 5, 5, 1, 0.5, pairwiseParameters, 0, 0);
+    stateMachine_destruct(sM);
+
+    CuAssertIntEquals(testCase, flowerAlignment->length, flowerAlignment2->length);
+    for(int64_t i=0; i<flowerAlignment->length; i++) {
+        AlignedPair *aP = &flowerAlignment->pairs[i], *aP2 = &flowerAlignment2->pairs[i];
+        CuAssertTrue(testCase, alignedPair_cmpFn(aP, aP2) == 0);
+        CuAssertIntEquals(testCase, aP->score1, aP2->score1);
+        CuAssertIntEquals(testCase, aP->score2, aP2->score2);
+    }
+    alignedPairs_destruct(flowerAlignment);
+    alignedPairs_destruct(flowerAlignment2);
 
     teardown(testCase);
 }
@@ -130,5 +162,6 @@ CuSuite* flowerAlignerTestSuite(void) {
     CuSuite* suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, test_getInducedAlignment);
     SUITE_ADD_TEST(suite, test_flowerAlignerRandom);
+    SUITE_ADD_TEST(suite, test_flowerAlignerParallelLargeEnds);
     return suite;
 }
@@ -7,6 +7,7 @@
 #include "flowersShared.h"
 #include "randomSequences.h"
 #include "poaBarAligner.h"
+#include "msaBitmap.h"
 #include "stCaf.h"
 #include <stdio.h>
 #include <ctype.h>
@@ -65,7 +66,8 @@ void test_make_partial_order_alignment(CuTest *testCase) {
             }
 
             // generate the alignment
-            Msa *msa = msa_make_partial_order_alignment(seqs, seq_lens, seq_no, poa_window_size, 1000, 0.02, abpt);
+            Msa *msa = msa_make_partial_order_alignment(seqs, seq_lens, seq_no, poa_window_size, 1000, 0.02, -1, -1,
+                                                        abpt);
 
             // print the msa
 #ifdef stderr_logging
@@ -87,6 +89,268 @@ void test_make_partial_order_alignment(CuTest *testCase) {
     abpoa_free_para(abpt);
 }
 
+static char **copy_seqs(char **seqs, int *seq_lens, int64_t seq_no, int **seq_lens_copy) {
+    char **seqs_copy = st_malloc(sizeof(char *) * seq_no);
+    *seq_lens_copy = st_malloc(sizeof(int) * seq_no);
+    for(int64_t i=0; i<seq_no; i++) {
+        seqs_copy[i] = stString_copy(seqs[i]);
+        (*seq_lens_copy)[i] = seq_lens[i];
+    }
+    return seqs_copy;
+}
+
+/**
+ * Gets for each base of each row the index of the base of row 0 it is aligned to, or -1.
+ */
+static int64_t **get_aligned_to_first_row(Msa *msa) {
+    int64_t **aligned = st_malloc(sizeof(int64_t *) * msa->seq_no);
+    for(int64_t i=0; i<msa->seq_no; i++) {
+        aligned[i] = st_malloc(sizeof(int64_t) * msa->seq_lens[i]);
+    }
+    int64_t offsets[msa->seq_no];
+    memset(offsets, 0, sizeof(offsets));
+    for(int64_t j=0; j<msa->column_no; j++) {
+        int64_t first_row_base = msa_to_base(msa->msa_seq[0][j]) != '-' ? offsets[0] : -1;
+        for(int64_t i=0; i<msa->seq_no; i++) {
+            if(msa_to_base(msa->msa_seq[i][j]) != '-') {
+                aligned[i][offsets[i]++] = first_row_base;
+            }
+        }
+    }
+    return aligned;
+}
+
+/**
+ * Align strings long enough to be cut into anchored windows of exact matches (POA_ANCHOR_LENGTH is 12 bases, so the
+ * windows of 100 bases find them between the closely related strings), which are aligned as tasks. The msa must be
+ * valid, the same when made within a parallel region, where the tasks go to the enclosing team, and mostly agree
+ * with the msa made in a single sliding window.
+ */
+void test_make_anchored_partial_order_alignment(CuTest *testCase) {
+    abpoa_para_t *abpt = abpoa_init_para();
+    abpt->wb = 10;
+    abpt->wf = 0.01;
+    abpoa_post_set_para(abpt);
+    for(int64_t test=0; test<10; test++) {
+        char *parent_string = getRandomACGTSequence(st_randomInt(1000, 1500));
+        int64_t seq_no = st_randomInt(2, 10);
+        char **seqs = st_malloc(sizeof(char *) * seq_no);
+        int *seq_lens = st_malloc(sizeof(int) * seq_no);
+        for(int64_t i=0; i<seq_no; i++) {
+            seqs[i] = evolveSequence(parent_string);
+            seq_lens[i] = strlen(seqs[i]);
+        }
+
+        // Windows of 100 bases step by 52 bases, so strings of 1000 bases need at least 8 windows and are cut into
+        // anchored windows
+        int *seq_lens2, *seq_lens3;
+        char **seqs2 = copy_seqs(seqs, seq_lens, seq_no, &seq_lens2);
+        char **seqs3 = copy_seqs(seqs, seq_lens, seq_no, &seq_lens3);
+        Msa *msa = msa_make_partial_order_alignment(seqs, seq_lens, seq_no, 100, 1000, 0.02, -1, 8, abpt);
+        Msa *msa2;
+#if defined(_OPENMP)
+#pragma omp parallel
+#pragma omp single
+#endif
+        msa2 = msa_make_partial_order_alignment(seqs2, seq_lens2, seq_no, 100, 1000, 0.02, -1, 8, abpt);
+        // A window bigger than the strings aligns them with the sliding window
+        Msa *msa3 = msa_make_partial_order_alignment(seqs3, seq_lens3, seq_no, 2000, 1000, 0.02, -1, -1, abpt);
+
+        int64_t lengths[seq_no];
+        validate_msa(testCase, msa, lengths);
+        for(int64_t i=0; i<seq_no; i++) {
+            CuAssertTrue(testCase, lengths[i] == msa->seq_lens[i]);
+        }
+
+        // The windows are the same however the tasks are run
+        CuAssertIntEquals(testCase, msa->column_no, msa2->column_no);
+        for(int64_t i=0; i<seq_no; i++) {
+            CuAssertTrue(testCase, memcmp(msa->msa_seq[i], msa2->msa_seq[i], msa->column_no) == 0);
+        }
+
+        // Most bases are aligned to the first string as in the sliding window alignment
+        int64_t **aligned = get_aligned_to_first_row(msa), **aligned3 = get_aligned_to_first_row(msa3);
+        int64_t agreeing = 0, total = 0;
+        for(int64_t i=1; i<seq_no; i++) {
+            for(int64_t j=0; j<msa->seq_lens[i]; j++) {
+                agreeing += aligned[i][j] == aligned3[i][j] ? 1 : 0;
+                total++;
+            }
+        }
+        CuAssertTrue(testCase, agreeing >= 0.8 * total);
+
+        // clean up
+        for(int64_t i=0; i<seq_no; i++) {
+            free(aligned[i]);
+            free(aligned3[i]);
+        }
+        free(aligned);
+        free(aligned3);
+        msa_destruct(msa);
+        msa_destruct(msa2);
+        msa_destruct(msa3);
+        free(parent_string);
+    }
+    abpoa_free_para(abpt);
+}
+
+/**
+ * Align windows of different sizes, one after another, with the engine the thread keeps, and check each msa is the
+ * same as that made by a freshly initialised engine.
+ */
+void test_poa_engine_reuse(CuTest *testCase) {
+    abpoa_para_t *abpt = abpoa_init_para();
+    abpt->wb = 10;
+    abpt->wf = 0.01;
+    abpoa_post_set_para(abpt);
+    poa_engine_destruct();
+    for(int64_t test=0; test<20; test++) {
+        char *parent_string = getRandomACGTSequence(st_randomInt(1, 300));
+        int64_t seq_no = st_randomInt(2, 20);
+        char **seqs = st_malloc(sizeof(char *) * seq_no);
+        int *seq_lens = st_malloc(sizeof(int) * seq_no);
+        for(int64_t i=0; i<seq_no; i++) {
+            seqs[i] = evolveSequence(parent_string);
+            seq_lens[i] = strlen(seqs[i]);
+        }
+        // Small then large windows, so the matrices of the engine are reused after being grown
+        int64_t window_size = test % 2 == 0 ? st_randomInt(5, 30) : st_randomInt(100, 400);
+        int *seq_lens2;
+        char **seqs2 = copy_seqs(seqs, seq_lens, seq_no, &seq_lens2);
+        Msa *msa = msa_make_partial_order_alignment(seqs, seq_lens, seq_no, window_size, 1000, 0.02, -1, -1, abpt);
+        poa_engine_destruct();
+        Msa *msa2 = msa_make_partial_order_alignment(seqs2, seq_lens2, seq_no, window_size, 1000, 0.02, -1, -1, abpt);
+
+        CuAssertIntEquals(testCase, msa2->column_no, msa->column_no);
+        for(int64_t i=0; i<seq_no; i++) {
+            CuAssertTrue(testCase, memcmp(msa->msa_seq[i], msa2->msa_seq[i], msa->column_no) == 0);
+        }
+
+        // The engine that made msa2 is reused to make the msa of the next test, with another window size
+        msa_destruct(msa);
+        msa_destruct(msa2);
+        free(parent_string);
+    }
+    poa_engine_destruct();
+    abpoa_free_para(abpt);
+}
+
+/**
+ * Repeatedly generate random sets of strings from a few parents and align them in small clusters, check that the
+ * msa is valid
+ */
+void test_make_clustered_partial_order_alignment(CuTest *testCase) {
+    abpoa_para_t *abpt = abpoa_init_para();
+    abpt->wb = 10;
+    abpt->wf = 0.01;
+    abpoa_post_set_para(abpt);
+    for(int64_t test=0; test<100; test++) {
+        int64_t parent_no = st_randomInt(1, 4);
+        char *parent_strings[parent_no];
+        for(int64_t i=0; i<parent_no; i++) {
+            parent_strings[i] = getRandomACGTSequence(st_randomInt(1, 100));
+        }
+
+        int64_t seq_no = st_randomInt(1, 50);
+        char **seqs = st_malloc(sizeof(char *) * seq_no);
+        int *seq_lens = st_malloc(sizeof(int) * seq_no);
+        for(int64_t i=0; i<seq_no; i++) {
+            seqs[i] = evolveSequence(parent_strings[st_randomInt(0, parent_no)]);
+            seq_lens[i] = strlen(seqs[i]);
+        }
+
+        int64_t window_size = st_randomInt(5, 120), max_cluster_rows = st_randomInt(2, 10);
+        int *seq_lens2;
+        char **seqs2 = copy_seqs(seqs, seq_lens, seq_no, &seq_lens2);
+        Msa *msa = msa_make_partial_order_alignment(seqs, seq_lens, seq_no, window_size, 1000, 0.02,
+                                                    max_cluster_rows, -1, abpt);
+
+        int64_t lengths[seq_no];
+        validate_msa(testCase, msa, lengths);
+        for(int64_t i=0; i<seq_no; i++) {
+            CuAssertTrue(testCase, lengths[i] == seq_lens[i]);
+        }
+
+        // Within a parallel region the clusters are aligned by the tasks of the enclosing team, to the same msa
+        Msa *msa2;
+#if defined(_OPENMP)
+#pragma omp parallel
+#pragma omp single
+#endif
+        msa2 = msa_make_partial_order_alignment(seqs2, seq_lens2, seq_no, window_size, 1000, 0.02, max_cluster_rows,
+                                                -1, abpt);
+        CuAssertIntEquals(testCase, msa->column_no, msa2->column_no);
+        for(int64_t i=0; i<seq_no; i++) {
+            CuAssertTrue(testCase, memcmp(msa->msa_seq[i], msa2->msa_seq[i], msa->column_no) == 0);
+        }
+
+        // clean up
+        msa_destruct(msa);
+        msa_destruct(msa2);
+        for(int64_t i=0; i<parent_no; i++) {
+            free(parent_strings[i]);
+        }
+    }
+    abpoa_free_para(abpt);
+}
+
+/**
+ * Generate random sets of strings that repeat one another, check that the msa is valid and that copies of the
+ * same string get the same row
+ */
+void test_make_partial_order_alignment_duplicates(CuTest *testCase) {
+    abpoa_para_t *abpt = abpoa_init_para();
+    abpt->wb = 10;
+    abpt->wf = 0.01;
+    abpoa_post_set_para(abpt);
+    for(int64_t test=0; test<100; test++) {
+        char *parent_string = getRandomACGTSequence(st_randomInt(1, 100));
+        int64_t distinct_seq_no = st_randomInt(1, 5);
+        char *distinct_seqs[distinct_seq_no];
+        for(int64_t i=0; i<distinct_seq_no; i++) {
+            distinct_seqs[i] = evolveSequence(parent_string);
+        }
+
+        // each string is a copy of one of the distinct strings, possibly in lower case
+        int64_t seq_no = st_randomInt(1, 20);
+        char **seqs = st_malloc(sizeof(char *) * seq_no);
+        int *seq_lens = st_malloc(sizeof(int) * seq_no);
+        int64_t copy_of[seq_no];
+        for(int64_t i=0; i<seq_no; i++) {
+            copy_of[i] = st_randomInt(0, distinct_seq_no);
+            seqs[i] = stString_copy(distinct_seqs[copy_of[i]]);
+            if(st_random() > 0.5) {
+                for(int64_t j=0; seqs[i][j] != '\0'; j++) {
+                    seqs[i][j] = tolower(seqs[i][j]);
+                }
+            }
+            seq_lens[i] = strlen(seqs[i]);
+        }
+
+        Msa *msa = msa_make_partial_order_alignment(seqs, seq_lens, seq_no, st_randomInt(5, 120), 1000, 0.02, -1, -1,
+                                                    abpt);
+
+        int64_t lengths[seq_no];
+        validate_msa(testCase, msa, lengths);
+        for(int64_t i=0; i<seq_no; i++) {
+            CuAssertTrue(testCase, lengths[i] == seq_lens[i]);
+            for(int64_t j=0; j<i; j++) {
+                if(copy_of[i] == copy_of[j]) {
+                    CuAssertTrue(testCase, memcmp(msa->msa_seq[i], msa->msa_seq[j], msa->column_no) == 0);
+                }
+            }
+        }
+
+        // clean up
+        msa_destruct(msa);
+        for(int64_t i=0; i<distinct_seq_no; i++) {
+            free(distinct_seqs[i]);
+        }
+        free(parent_string);
+    }
+    abpoa_free_para(abpt);
+}
+
 /**
  * Repeatedly generate random sets of two ends connected by set of strings, check that the resulting msa is valid
  */
@@ -146,7 +410,7 @@ void test_make_consistent_partial_order_alignments_two_ends(CuTest *testCase) {
         // generate the alignments
         Msa **msas = make_consistent_partial_order_alignments(end_no, end_lengths, end_strings, end_string_lengths,
                                                               right_end_indexes, right_end_row_indexes, overlaps,
-                                                              1000000, 100, 0.02, abpt);
+                                                              1000000, 100, 0.02, -1, -1, abpt, test % 2);
 
         // print the msas
 #ifdef stderr_logging
@@ -213,14 +477,17 @@ void test_make_flower_alignment_poa(CuTest *testCase) {
     }
     flower_destructEndIterator(endIterator);
 
-    stList *alignment_blocks = make_flower_alignment_poa(flower, 2, 1000000, 5, 1000, 0.02, abpt);
+    AlignmentBlocks *alignment_blocks = make_flower_alignment_poa(flower, 2, 1000000, 5, 1000, 0.02, -1, -1, abpt, 0);
 
-    for(int64_t i=0; i<stList_length(alignment_blocks); i++) {
-        AlignmentBlock *b = stList_get(alignment_blocks, i);
+    for(int64_t i=0; i<alignment_blocks->block_no; i++) {
+        // Each block aligns at least two sequences
+        CuAssertTrue(testCase, alignment_blocks->row_starts[i+1] - alignment_blocks->row_starts[i] >= 2);
+        CuAssertTrue(testCase, alignment_blocks->lengths[i] > 0);
 #ifdef stderr_logging
-        alignmentBlock_print(b, stderr);
+        alignmentBlocks_print(alignment_blocks, i, stderr);
 #endif
     }
+    alignmentBlocks_destruct(alignment_blocks);
 
     abpoa_free_para(abpt);
     teardown(testCase);
@@ -234,13 +501,12 @@ void test_alignment_block_iterator(CuTest *testCase) {
     abpt->wf = 0.01;
     abpoa_post_set_para(abpt);
 
-    stList *alignment_blocks = make_flower_alignment_poa(flower, 10000, 1000000, 5, 50, 0.05, abpt);
+    AlignmentBlocks *alignment_blocks = make_flower_alignment_poa(flower, 10000, 1000000, 5, 50, 0.05, -1, -1, abpt, 1);
 
     abpoa_free_para(abpt);
 #ifdef stderr_logging
-    for(int64_t i=0; i<stList_length(alignment_blocks); i++) {
-        AlignmentBlock *b = stList_get(alignment_blocks, i);
-        alignmentBlock_print(b, stderr);
+    for(int64_t i=0; i<alignment_blocks->block_no; i++) {
+        alignmentBlocks_print(alignment_blocks, i, stderr);
     }
 #endif
 
@@ -259,16 +525,85 @@ void test_alignment_block_iterator(CuTest *testCase) {
     }
 #endif
 
+    // There is a pinch between each pair of successive rows of each block
+    int64_t expected_pinches = 0;
+    for(int64_t i=0; i<alignment_blocks->block_no; i++) {
+        expected_pinches += alignment_blocks->row_starts[i+1] - alignment_blocks->row_starts[i] - 1;
+    }
+    stPinchIterator_reset(it);
+    int64_t pinches = 0;
+    while((pinch = stPinchIterator_getNext(it, &pinchToFillOut)) != NULL) {
+        CuAssertTrue(testCase, pinch->length > 0);
+        pinches++;
+    }
+    CuAssertIntEquals(testCase, expected_pinches, pinches);
+
     stPinchIterator_destruct(it);
+    alignmentBlocks_destruct(alignment_blocks);
 
     teardown(testCase);
 }
 
+/**
+ * Test the bitmap of random msas, with rows and columns either side of the word sizes, against scanning the msa
+ */
+void test_msa_bitmap(CuTest *testCase) {
+    for (int64_t test = 0; test < 100; test++) {
+        Msa *msa = st_calloc(1, sizeof(Msa));
+        msa->seq_no = st_randomInt(1, 200);
+        msa->column_no = st_randomInt(1, 300);
+        msa->msa_seq = st_malloc(msa->seq_no * sizeof(uint8_t *));
+        for (int64_t i = 0; i < msa->seq_no; i++) {
+            msa->msa_seq[i] = st_malloc(msa->column_no * sizeof(uint8_t));
+            for (int64_t j = 0; j < msa->column_no; j++) {
+                msa->msa_seq[i][j] = st_random() < 0.3 ? msa_to_byte('-') : st_randomInt(0, 256);
+            }
+        }
+
+        MsaBitmap *bitmap = msa_bitmap_construct(msa);
+        for (int64_t j = 0; j < msa->column_no; j++) {
+            int64_t bases = 0;
+            for (int64_t i = 0; i < msa->seq_no; i++) {
+                bool is_base = msa_to_base(msa->msa_seq[i][j]) != '-';
+                CuAssertIntEquals(testCase, is_base, msa_bitmap_is_base(bitmap, i, j));
+                bases += is_base ? 1 : 0;
+            }
+            CuAssertIntEquals(testCase, bases, msa_bitmap_column_bases(bitmap, j));
+
+            int64_t end = j;
+            bool same = 1;
+            while (same && ++end < msa->column_no) {
+                for (int64_t i = 0; i < msa->seq_no; i++) {
+                    same = same && msa_bitmap_is_base(bitmap, i, j) == msa_bitmap_is_base(bitmap, i, end);
+                }
+            }
+            CuAssertIntEquals(testCase, end, msa_bitmap_next_different_column(bitmap, j));
+        }
+        msa_bitmap_destruct(bitmap);
+
+        for (int64_t i = 0; i < msa->seq_no; i++) {
+            uint8_t *row = st_malloc(msa->column_no * sizeof(uint8_t));
+            memcpy(row, msa->msa_seq[i], msa->column_no * sizeof(uint8_t));
+            msa_canonicalise_row(row, msa->column_no);
+            for (int64_t j = 0; j < msa->column_no; j++) {
+                CuAssertIntEquals(testCase, msa_to_byte(msa_to_base(msa->msa_seq[i][j])), row[j]);
+            }
+            free(row);
+        }
+        msa_destruct(msa);
+    }
+}
+
 CuSuite* poaBarAlignerTestSuite(void) {
     CuSuite* suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, test_make_partial_order_alignment);
+    SUITE_ADD_TEST(suite, test_make_partial_order_alignment_duplicates);
+    SUITE_ADD_TEST(suite, test_make_anchored_partial_order_alignment);
+    SUITE_ADD_TEST(suite, test_poa_engine_reuse);
+    SUITE_ADD_TEST(suite, test_make_clustered_partial_order_alignment);
     SUITE_ADD_TEST(suite, test_make_consistent_partial_order_alignments_two_ends);
     SUITE_ADD_TEST(suite, test_make_flower_alignment_poa);
     SUITE_ADD_TEST(suite, test_alignment_block_iterator);
+    SUITE_ADD_TEST(suite, test_msa_bitmap);
     return suite;
 }
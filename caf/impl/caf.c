@@ -6,6 +6,12 @@
 #include "stGiantComponent.h"
 #include "stCafPhylogeny.h"
 
+/*
+ * The most memory, in bytes, used to hold alignments while sorting them by score, larger files of alignments
+ * are sorted on disk.
+ */
+#define SORT_ALIGNMENTS_MEMORY 1073741824
+
 static bool blockFilterFn(stPinchBlock *pinchBlock, void *extraArg) {
     FilterArgs *f = extraArg;
     if (!stCaf_containsRequiredSpecies(pinchBlock, f->flower, f->minimumIngroupDegree,
@@ -351,28 +357,46 @@ void caf(Flower *flower, CactusParams *params, char *alignmentsFile, char *secon
         stList *alignmentsList = NULL;
         assert(alignmentsFile != NULL);
 
-        if (sortAlignments) {
+        if (sortAlignments && secondaryAlignmentsFile != NULL && sortSecondaryAlignments) {
+            // The primary and secondary alignments are sorted together and parsed once, each iterator getting
+            // the pinches of its own alignments
             tempFile1 = getTempFile();
-            //stCaf_sortCigarsFileByScoreInDescendingOrder(alignmentsFile, tempFile1);
-            pinchIterator = stPinchIterator_constructFromFile(tempFile1);
+            stList *alignmentsFiles = stList_construct();
+            stList_append(alignmentsFiles, alignmentsFile);
+            stList_append(alignmentsFiles, secondaryAlignmentsFile);
+            stCaf_sortCigarsFilesByScoreInDescendingOrder(alignmentsFiles, tempFile1, SORT_ALIGNMENTS_MEMORY);
+            stList_destruct(alignmentsFiles);
+            stList *pinchIterators = stPinchIterator_constructFromSortedFile(tempFile1, 2);
+            pinchIterator = stList_get(pinchIterators, 0);
+            secondaryPinchIterator = stList_get(pinchIterators, 1);
+            stList_destruct(pinchIterators);
         } else {
-            pinchIterator = stPinchIterator_constructFromFile(alignmentsFile);
-        }
-
-        if(secondaryAlignmentsFile != NULL) {
-            if (sortSecondaryAlignments) {
-                tempFile2 = getTempFile();
-                //stCaf_sortCigarsFileByScoreInDescendingOrder(secondaryAlignmentsFile, tempFile2);
-                secondaryPinchIterator = stPinchIterator_constructFromFile(tempFile2);
+            if (sortAlignments) {
+                tempFile1 = getTempFile();
+                stCaf_sortCigarsFileByScoreInDescendingOrder(alignmentsFile, tempFile1, SORT_ALIGNMENTS_MEMORY);
+                pinchIterator = stPinchIterator_constructFromFile(tempFile1);
             } else {
-                secondaryPinchIterator = stPinchIterator_constructFromFile(secondaryAlignmentsFile);
+                pinchIterator = stPinchIterator_constructFromFile(alignmentsFile);
+            }
+            if (secondaryAlignmentsFile != NULL) {
+                if (sortSecondaryAlignments) {
+                    tempFile2 = getTempFile();
+                    stCaf_sortCigarsFileByScoreInDescendingOrder(secondaryAlignmentsFile, tempFile2, SORT_ALIGNMENTS_MEMORY);
+                    secondaryPinchIterator = stPinchIterator_constructFromFile(tempFile2);
+                } else {
+                    secondaryPinchIterator = stPinchIterator_constructFromFile(secondaryAlignmentsFile);
+                }
             }
         }
 
+        PerfReport *perfReport = perfReport_getGlobal();
         for (int64_t annealingRound = 0; annealingRound < annealingRoundsLength; annealingRound++) {
             int64_t minimumChainLength = annealingRounds[annealingRound];
             int64_t alignmentTrim = annealingRound < alignmentTrimLength ? alignmentTrims[annealingRound] : 0;
             st_logInfo("Starting annealing round with a minimum chain length of %" PRIi64 " and an alignment trim of %" PRIi64 "\n", minimumChainLength, alignmentTrim);
+            char *stageName = stString_print("caf_annealing_round_%" PRIi64, annealingRound);
+            perfReport_startStage(perfReport, stageName);
+            free(stageName);
 
             stPinchIterator_setTrim(pinchIterator, alignmentTrim);
             if(secondaryPinchIterator != NULL) {
@@ -436,7 +460,12 @@ void caf(Flower *flower, CactusParams *params, char *alignmentsFile, char *secon
                 }
             }
 
+            perfReport_endStage(perfReport);
+
             //Do the melting rounds
+            stageName = stString_print("caf_melting_round_%" PRIi64, annealingRound);
+            perfReport_startStage(perfReport, stageName);
+            free(stageName);
             for (int64_t meltingRound = 0; meltingRound < meltingRoundsLength; meltingRound++) {
                 int64_t minimumChainLengthForMeltingRound = meltingRounds[meltingRound];
                 st_logInfo("Starting melting round with a minimum chain length of %" PRIi64 " \n", minimumChainLengthForMeltingRound);
@@ -448,8 +477,10 @@ void caf(Flower *flower, CactusParams *params, char *alignmentsFile, char *secon
             stCaf_melt(flower, threadSet, NULL, NULL, 0, minimumChainLength, breakChainsAtReverseTandems, maximumMedianSequenceLengthBetweenLinkedEnds);
             //This does the filtering of blocks that do not have the required species/tree-coverage/degree.
             stCaf_melt(flower, threadSet, blockFilterFn, fa, blockTrim, 0, 0, INT64_MAX);
+            perfReport_endStage(perfReport);
         }
 
+        perfReport_startStage(perfReport, "caf_finish");
         if (removeRecoverableChains) {
             stCaf_meltRecoverableChains(flower, threadSet, breakChainsAtReverseTandems, maximumMedianSequenceLengthBetweenLinkedEnds, recoverableChainsFilter, maxRecoverableChainsIterations, maxRecoverableChainLength);
         }
@@ -469,6 +500,7 @@ void caf(Flower *flower, CactusParams *params, char *alignmentsFile, char *secon
 
         //Finish up
         stCaf_finish(flower, threadSet, minLengthForChromosome, proportionOfUnalignedBasesForNewChromosome);
+        perfReport_endStage(perfReport);
         st_logDebug("Ran the cactus core script\n");
 
         //Cleanup
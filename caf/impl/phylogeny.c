@@ -86,10 +86,15 @@ stHash *stCaf_getThreadStrings(Flower *flower, stPinchThreadSet *threadSet) {
         Sequence *sequence = cap_getSequence(cap);
         assert(sequence != NULL);
         assert(stPinchThread_getLength(thread)-2 >= 0);
-        char *string = sequence_getString(sequence, stPinchThread_getStart(thread)+1, stPinchThread_getLength(thread)-2, 1); //Gets the sequence excluding the empty positions representing the caps.
-        char *paddedString = stString_print_r("N%sN", string); //Add in positions to represent the flanking bases
+        //Gets the sequence excluding the empty positions representing the caps, copied between Ns that represent the flanking bases
+        int64_t length = stPinchThread_getLength(thread) - 2;
+        SequenceView view = sequence_getView(sequence, stPinchThread_getStart(thread) + 1, length, 1);
+        char *paddedString = st_malloc((length + 3) * sizeof(char));
+        paddedString[0] = 'N';
+        sequenceView_copy(&view, 0, length, paddedString + 1);
+        paddedString[length + 1] = 'N';
+        paddedString[length + 2] = '\0';
         stHash_insert(threadStrings, thread, paddedString);
-        free(string);
     }
     gThreadStrings = threadStrings;
     return threadStrings;
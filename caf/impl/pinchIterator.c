@@ -6,6 +6,7 @@
  */
 
 #include <stdlib.h>
+#include <string.h>
 #include "sonLib.h"
 #include "stPinchGraphs.h"
 #include "stPinchIterator.h"
@@ -116,27 +117,155 @@ static stPinch *pairwiseAlignmentToPinch_getNext(PairwiseAlignmentToPinch *pA, s
     return NULL;
 }
 
-static PairwiseAlignmentToPinch *pairwiseAlignmentToPinch_resetForFile(PairwiseAlignmentToPinch *pA) {
-    fseek(pA->alignmentArg, 0, SEEK_SET);
-    pA->paf = NULL;
-    return pA;
+/*
+ * The pinches of a file of alignments, parsed once and held as an array so that they can be iterated over
+ * in each annealing round without parsing the file again.
+ */
+typedef struct _pinchRecord {
+    int64_t name1, name2;
+    int64_t start1, start2;
+    int64_t length; // Negative if the pinch is between opposite strands
+} PinchRecord;
+
+typedef struct _pinchArray {
+    PinchRecord *pinches;
+    int64_t length;
+    int64_t maxLength;
+    int64_t next; // Index of the next pinch to return
+} PinchArray;
+
+static PinchArray *pinchArray_construct(void) {
+    PinchArray *pinchArray = st_calloc(1, sizeof(PinchArray));
+    pinchArray->maxLength = 1024;
+    pinchArray->pinches = st_malloc(pinchArray->maxLength * sizeof(PinchRecord));
+    return pinchArray;
+}
+
+static void pinchArray_add(PinchArray *pinchArray, stPinch *pinch) {
+    if (pinchArray->length == pinchArray->maxLength) {
+        pinchArray->maxLength *= 2;
+        pinchArray->pinches = st_realloc(pinchArray->pinches, pinchArray->maxLength * sizeof(PinchRecord));
+    }
+    PinchRecord *record = &(pinchArray->pinches[pinchArray->length++]);
+    record->name1 = pinch->name1;
+    record->name2 = pinch->name2;
+    record->start1 = pinch->start1;
+    record->start2 = pinch->start2;
+    record->length = pinch->strand ? pinch->length : -pinch->length;
 }
 
-static void pairwiseAlignmentToPinch_destructForFile(PairwiseAlignmentToPinch *pA) {
-    fclose(pA->alignmentArg);
+/*
+ * Reads the alignments of a file whose lines are each prefixed by the source of the alignment and a tab,
+ * recording the source of the alignment last read.
+ */
+typedef struct _sourcedPafReader {
+    FILE *fileHandle;
+    int64_t source;
+} SourcedPafReader;
+
+static Paf *sourcedPafReader_read(SourcedPafReader *reader) {
+    char *line;
+    while ((line = stFile_getLineFromFile(reader->fileHandle)) != NULL && line[0] == '\0') { // Skip empty lines
+        free(line);
+    }
+    if (line == NULL) {
+        return NULL;
+    }
+    char *tab = strchr(line, '\t');
+    if (tab == NULL) {
+        st_errAbort("Missing the source of the alignment: %s", line);
+    }
+    reader->source = strtoll(line, NULL, 10);
+    Paf *paf = paf_parse(tab + 1, 0);
+    free(line);
+    return paf;
+}
+
+/*
+ * Parses the alignments of the file into pinchArrays, one per source if the lines of the file are prefixed by
+ * their sources, else into its single array.
+ */
+static void pinchArrays_constructFromFile(const char *alignmentFile, bool hasSources, stList *pinchArrays) {
+    FILE *fileHandle = fopen(alignmentFile, "r");
+    if (fileHandle == NULL) {
+        st_errAbort("Could not open the alignments file: %s", alignmentFile);
+    }
+    SourcedPafReader reader = { fileHandle, 0 };
+    PairwiseAlignmentToPinch *pA = hasSources ?
+            pairwiseAlignmentToPinch_construct(&reader, (Paf *(*)(void *)) sourcedPafReader_read, 1) :
+            pairwiseAlignmentToPinch_construct(fileHandle, (Paf *(*)(void *)) paf_read2, 1);
+    stPinch pinch;
+    while (pairwiseAlignmentToPinch_getNext(pA, &pinch) != NULL) {
+        // The source is that of the alignment the pinch is from, as the alignments are read as they are needed
+        if (reader.source < 0 || reader.source >= stList_length(pinchArrays)) {
+            st_errAbort("Alignment source %" PRIi64 " is out of range in the alignments file: %s", reader.source,
+                        alignmentFile);
+        }
+        pinchArray_add(stList_get(pinchArrays, reader.source), &pinch);
+    }
     free(pA);
+    fclose(fileHandle);
+    for (int64_t i = 0; i < stList_length(pinchArrays); i++) {
+        PinchArray *pinchArray = stList_get(pinchArrays, i);
+        pinchArray->maxLength = pinchArray->length > 0 ? pinchArray->length : 1;
+        pinchArray->pinches = st_realloc(pinchArray->pinches, pinchArray->maxLength * sizeof(PinchRecord));
+        st_logDebug("Read %" PRIi64 " pinches of source %" PRIi64 " from the alignments file: %s\n", pinchArray->length,
+                    i, alignmentFile);
+    }
 }
 
-stPinchIterator *stPinchIterator_constructFromFile(const char *alignmentFile) {
+static stPinch *pinchArray_getNext(PinchArray *pinchArray, stPinch *pinchToFillOut) {
+    if (pinchArray->next == pinchArray->length) {
+        return NULL;
+    }
+    PinchRecord *record = &(pinchArray->pinches[pinchArray->next++]);
+    stPinch_fillOut(pinchToFillOut, record->name1, record->name2, record->start1, record->start2,
+                    record->length > 0 ? record->length : -record->length, record->length > 0);
+    return pinchToFillOut;
+}
+
+static PinchArray *pinchArray_reset(PinchArray *pinchArray) {
+    pinchArray->next = 0;
+    return pinchArray;
+}
+
+static void pinchArray_destruct(PinchArray *pinchArray) {
+    free(pinchArray->pinches);
+    free(pinchArray);
+}
+
+static stPinchIterator *stPinchIterator_constructFromPinchArray(PinchArray *pinchArray) {
     stPinchIterator *pinchIterator = st_calloc(1, sizeof(stPinchIterator));
-    pinchIterator->alignmentArg = pairwiseAlignmentToPinch_construct(fopen(alignmentFile, "r"),
-            (Paf *(*)(void *)) paf_read2, 1);
-    pinchIterator->getNextAlignment = (stPinch *(*)(void *, stPinch *)) pairwiseAlignmentToPinch_getNext;
-    pinchIterator->destructAlignmentArg = (void(*)(void *)) pairwiseAlignmentToPinch_destructForFile;
-    pinchIterator->startAlignmentStack = (void *(*)(void *)) pairwiseAlignmentToPinch_resetForFile;
+    pinchIterator->alignmentArg = pinchArray;
+    pinchIterator->getNextAlignment = (stPinch *(*)(void *, stPinch *)) pinchArray_getNext;
+    pinchIterator->destructAlignmentArg = (void(*)(void *)) pinchArray_destruct;
+    pinchIterator->startAlignmentStack = (void *(*)(void *)) pinchArray_reset;
+    return pinchIterator;
+}
+
+stPinchIterator *stPinchIterator_constructFromFile(const char *alignmentFile) {
+    stList *pinchArrays = stList_construct();
+    stList_append(pinchArrays, pinchArray_construct());
+    pinchArrays_constructFromFile(alignmentFile, 0, pinchArrays);
+    stPinchIterator *pinchIterator = stPinchIterator_constructFromPinchArray(stList_get(pinchArrays, 0));
+    stList_destruct(pinchArrays);
     return pinchIterator;
 }
 
+stList *stPinchIterator_constructFromSortedFile(const char *alignmentFile, int64_t sourceNumber) {
+    stList *pinchArrays = stList_construct();
+    for (int64_t i = 0; i < sourceNumber; i++) {
+        stList_append(pinchArrays, pinchArray_construct());
+    }
+    pinchArrays_constructFromFile(alignmentFile, 1, pinchArrays);
+    stList *pinchIterators = stList_construct();
+    for (int64_t i = 0; i < sourceNumber; i++) {
+        stList_append(pinchIterators, stPinchIterator_constructFromPinchArray(stList_get(pinchArrays, i)));
+    }
+    stList_destruct(pinchArrays);
+    return pinchIterators;
+}
+
 stSortedSetIterator *startAlignmentStackForAlignedPairs(stSortedSetIterator *it) {
     while (stSortedSet_getPrevious(it) != NULL) {
         ;
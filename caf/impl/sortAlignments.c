@@ -0,0 +1,221 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include <stdlib.h>
+#include <string.h>
+#include "sonLib.h"
+#include "paf.h"
+#include "stCaf.h"
+
+///////////////////////////////////////////////////////////////////////////
+// External memory sort of files of alignments by score.
+//
+// The files are read in turn in runs of at most a given number of bytes, each of which is
+// sorted in memory and written to a temporary file, prefixed by the scores of its
+// alignments. The runs are then merged. Ties are broken by the order in the input
+// files, so the sort is stable.
+///////////////////////////////////////////////////////////////////////////
+
+typedef struct _scoredAlignment {
+    int64_t score;
+    int64_t index; // Position in the run, used to break ties
+    int64_t source; // Index of the file the alignment is from
+    char *line;
+} ScoredAlignment;
+
+static int scoredAlignment_cmp(const void *a, const void *b) {
+    const ScoredAlignment *i = a, *j = b;
+    if (i->score != j->score) {
+        return i->score > j->score ? -1 : 1; // Descending order of score
+    }
+    return i->index < j->index ? -1 : (i->index > j->index ? 1 : 0);
+}
+
+static int64_t getScore(char *line) {
+    char *lineCopy = stString_copy(line); // Parsing modifies the string
+    Paf *paf = paf_parse(lineCopy, 0);
+    int64_t score = paf->score;
+    paf_destruct(paf);
+    free(lineCopy);
+    return score;
+}
+
+/*
+ * Reads the next run of alignments, up to maxRunSize bytes, from the input files, starting with the file at index
+ * *source and moving on to the next file when it is exhausted. Returns the number of alignments read.
+ */
+static int64_t readRun(stList *fileHandles, int64_t *source, ScoredAlignment **run, int64_t *maxRunLength,
+                       int64_t maxRunSize) {
+    int64_t runLength = 0, runSize = 0;
+    char *line;
+    while (runSize < maxRunSize && *source < stList_length(fileHandles)) {
+        if ((line = stFile_getLineFromFile(stList_get(fileHandles, *source))) == NULL) {
+            (*source)++;
+            continue;
+        }
+        if (line[0] == '\0') { // Skip empty lines
+            free(line);
+            continue;
+        }
+        if (runLength == *maxRunLength) {
+            *maxRunLength *= 2;
+            *run = st_realloc(*run, *maxRunLength * sizeof(ScoredAlignment));
+        }
+        (*run)[runLength].score = getScore(line);
+        (*run)[runLength].index = runLength;
+        (*run)[runLength].source = *source;
+        (*run)[runLength].line = line;
+        runSize += strlen(line) + sizeof(ScoredAlignment);
+        runLength++;
+    }
+    return runLength;
+}
+
+/*
+ * A sorted run being merged, with its next alignment.
+ */
+typedef struct _mergeRun {
+    int64_t index; // Order of the run in the input, used to break ties
+    char *fileName;
+    FILE *fileHandle;
+    ScoredAlignment next;
+} MergeRun;
+
+static int mergeRun_cmp(const void *a, const void *b) {
+    const MergeRun *i = a, *j = b;
+    if (i->next.score != j->next.score) {
+        return i->next.score > j->next.score ? -1 : 1;
+    }
+    return i->index < j->index ? -1 : (i->index > j->index ? 1 : 0);
+}
+
+/*
+ * Reads the next alignment of the run, returning zero if the run is exhausted.
+ */
+static bool mergeRun_readNext(MergeRun *mergeRun) {
+    free(mergeRun->next.line);
+    mergeRun->next.line = stFile_getLineFromFile(mergeRun->fileHandle);
+    if (mergeRun->next.line == NULL) {
+        return 0;
+    }
+    char *tab = strchr(mergeRun->next.line, '\t');
+    assert(tab != NULL);
+    *tab = '\0';
+    mergeRun->next.score = strtoll(mergeRun->next.line, NULL, 10);
+    memmove(mergeRun->next.line, tab + 1, strlen(tab + 1) + 1);
+    return 1;
+}
+
+static void mergeRuns(stList *runFiles, FILE *outputFileHandle) {
+    stSortedSet *mergeRuns = stSortedSet_construct3(mergeRun_cmp, NULL);
+    for (int64_t i = 0; i < stList_length(runFiles); i++) {
+        MergeRun *mergeRun = st_calloc(1, sizeof(MergeRun));
+        mergeRun->index = i;
+        mergeRun->fileName = stList_get(runFiles, i);
+        mergeRun->fileHandle = fopen(mergeRun->fileName, "r");
+        if (mergeRun->fileHandle == NULL) {
+            st_errAbort("Could not open the sorted alignments run file: %s", mergeRun->fileName);
+        }
+        if (mergeRun_readNext(mergeRun)) {
+            stSortedSet_insert(mergeRuns, mergeRun);
+        } else {
+            fclose(mergeRun->fileHandle);
+            free(mergeRun);
+        }
+    }
+    while (stSortedSet_size(mergeRuns) > 0) {
+        MergeRun *mergeRun = stSortedSet_getFirst(mergeRuns);
+        stSortedSet_remove(mergeRuns, mergeRun);
+        fprintf(outputFileHandle, "%s\n", mergeRun->next.line);
+        if (mergeRun_readNext(mergeRun)) {
+            stSortedSet_insert(mergeRuns, mergeRun);
+        } else {
+            fclose(mergeRun->fileHandle);
+            free(mergeRun);
+        }
+    }
+    stSortedSet_destruct(mergeRuns);
+}
+
+/*
+ * Writes an alignment of a run, prefixed by its source if writeSources is non-zero.
+ */
+static void writeAlignment(ScoredAlignment *alignment, bool writeSources, FILE *fileHandle) {
+    if (writeSources) {
+        fprintf(fileHandle, "%" PRIi64 "\t%s\n", alignment->source, alignment->line);
+    } else {
+        fprintf(fileHandle, "%s\n", alignment->line);
+    }
+}
+
+static void sortFilesByScore(stList *alignmentsFiles, const char *sortedAlignmentsFile, int64_t maxBytesInMemory,
+                             bool writeSources) {
+    stList *inputFileHandles = stList_construct();
+    for (int64_t i = 0; i < stList_length(alignmentsFiles); i++) {
+        FILE *inputFileHandle = fopen(stList_get(alignmentsFiles, i), "r");
+        if (inputFileHandle == NULL) {
+            st_errAbort("Could not open the alignments file to sort: %s", (char *)stList_get(alignmentsFiles, i));
+        }
+        stList_append(inputFileHandles, inputFileHandle);
+    }
+    FILE *outputFileHandle = fopen(sortedAlignmentsFile, "w");
+    if (outputFileHandle == NULL) {
+        st_errAbort("Could not open the file for the sorted alignments: %s", sortedAlignmentsFile);
+    }
+
+    int64_t maxRunLength = 1024, runLength, source = 0;
+    ScoredAlignment *run = st_malloc(maxRunLength * sizeof(ScoredAlignment));
+    stList *runFiles = stList_construct3(0, free);
+    while ((runLength = readRun(inputFileHandles, &source, &run, &maxRunLength, maxBytesInMemory)) > 0) {
+        qsort(run, runLength, sizeof(ScoredAlignment), scoredAlignment_cmp);
+        if (stList_length(runFiles) == 0 && source == stList_length(inputFileHandles)) {
+            // The alignments fit in memory, so are written straight out
+            for (int64_t i = 0; i < runLength; i++) {
+                writeAlignment(&run[i], writeSources, outputFileHandle);
+                free(run[i].line);
+            }
+            break;
+        }
+        char *runFile = getTempFile();
+        FILE *runFileHandle = fopen(runFile, "w");
+        if (runFileHandle == NULL) {
+            st_errAbort("Could not open the sorted alignments run file: %s", runFile);
+        }
+        for (int64_t i = 0; i < runLength; i++) {
+            fprintf(runFileHandle, "%" PRIi64 "\t", run[i].score);
+            writeAlignment(&run[i], writeSources, runFileHandle);
+            free(run[i].line);
+        }
+        fclose(runFileHandle);
+        stList_append(runFiles, runFile);
+    }
+    free(run);
+    for (int64_t i = 0; i < stList_length(inputFileHandles); i++) {
+        fclose(stList_get(inputFileHandles, i));
+    }
+    stList_destruct(inputFileHandles);
+
+    if (stList_length(runFiles) > 0) {
+        st_logDebug("Merging %" PRIi64 " sorted runs of alignments into: %s\n", stList_length(runFiles), sortedAlignmentsFile);
+        mergeRuns(runFiles, outputFileHandle);
+        for (int64_t i = 0; i < stList_length(runFiles); i++) {
+            remove(stList_get(runFiles, i));
+        }
+    }
+    stList_destruct(runFiles);
+    fclose(outputFileHandle);
+}
+
+void stCaf_sortCigarsFileByScoreInDescendingOrder(const char *alignmentsFile, const char *sortedAlignmentsFile,
+                                                  int64_t maxBytesInMemory) {
+    stList *alignmentsFiles = stList_construct();
+    stList_append(alignmentsFiles, (void *)alignmentsFile);
+    sortFilesByScore(alignmentsFiles, sortedAlignmentsFile, maxBytesInMemory, 0);
+    stList_destruct(alignmentsFiles);
+}
+
+void stCaf_sortCigarsFilesByScoreInDescendingOrder(stList *alignmentsFiles, const char *sortedAlignmentsFile,
+                                                   int64_t maxBytesInMemory) {
+    sortFilesByScore(alignmentsFiles, sortedAlignmentsFile, maxBytesInMemory, 1);
+}
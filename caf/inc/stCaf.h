@@ -55,6 +55,23 @@ void stCaf_annealBetweenAdjacencyComponents(stPinchThreadSet *threadSet, stPinch
  */
 void stCaf_joinTrivialBoundaries(stPinchThreadSet *threadSet);
 
+/*
+ * Writes the PAF alignments in alignmentsFile to sortedAlignmentsFile in descending order of score, alignments
+ * with equal scores being kept in the order of the input. Holds at most about maxBytesInMemory bytes of alignments
+ * in memory, larger files being sorted in runs that are merged from temporary files.
+ */
+void stCaf_sortCigarsFileByScoreInDescendingOrder(const char *alignmentsFile, const char *sortedAlignmentsFile,
+                                                  int64_t maxBytesInMemory);
+
+/*
+ * As stCaf_sortCigarsFileByScoreInDescendingOrder, but sorts the alignments of all the files in alignmentsFiles
+ * together, alignments with equal scores being kept in the order of the files and then of the input. Each line of
+ * sortedAlignmentsFile is prefixed by the index in alignmentsFiles of the file its alignment is from and a tab, see
+ * stPinchIterator_constructFromSortedFile.
+ */
+void stCaf_sortCigarsFilesByScoreInDescendingOrder(stList *alignmentsFiles, const char *sortedAlignmentsFile,
+                                                   int64_t maxBytesInMemory);
+
 ///////////////////////////////////////////////////////////////////////////
 // Melting fuctions -- removing alignments from the pinch graph
 ///////////////////////////////////////////////////////////////////////////
@@ -38,10 +38,19 @@ void stPinchIterator_destruct(
         stPinchIterator *stPinchIterator);
 
 /*
- * Get a pairwise alignment iterator from a file.
+ * Get a pairwise alignment iterator from a file. The file is parsed once, when the iterator is constructed,
+ * into an array of pinches that is iterated over after each reset, so the file is not needed afterwards.
  */
 stPinchIterator *stPinchIterator_constructFromFile(const char *alignmentFile);
 
+/*
+ * Gets an iterator for each of the sourceNumber sources of a file of alignments sorted by
+ * stCaf_sortCigarsFilesByScoreInDescendingOrder, returned in a list in the order of the sources. The file is
+ * parsed once, each pinch going to the iterator of the source of its alignment, so the iterators share the one
+ * sort of the file and each iterates over the pinches of its source in descending order of score.
+ */
+stList *stPinchIterator_constructFromSortedFile(const char *alignmentFile, int64_t sourceNumber);
+
 /*
  * Constructs iterator from aligned pairs.
  */
@@ -7,6 +7,7 @@
 #include "CuTest.h"
 #include "sonLib.h"
 #include "stPinchIterator.h"
+#include "stCaf.h"
 #include "pairwiseAlignment.h"
 #include "paf.h"
 #include <math.h>
@@ -104,17 +105,119 @@ static void testPinchIteratorFromFile(CuTest *testCase) {
         fclose(fileHandle);
         //Get an iterator
         stPinchIterator *pinchIterator = stPinchIterator_constructFromFile(tempFile);
+        //The alignments are read when the iterator is constructed, so the file is no longer needed
+        stFile_rmtree(tempFile);
         //Now test it
         testIterator(testCase, pinchIterator, pairwiseAlignments);
         //Cleanup
         stPinchIterator_destruct(pinchIterator);
+        stList_destruct(pairwiseAlignments);
+    }
+}
+
+static void testSortCigarsFileByScoreInDescendingOrder(CuTest *testCase) {
+    for (int64_t test = 0; test < 100; test++) {
+        stList *pairwiseAlignments = getRandomPairwiseAlignments();
+        for (int64_t i = 0; i < stList_length(pairwiseAlignments); i++) {
+            ((Paf *)stList_get(pairwiseAlignments, i))->score = st_randomInt(0, 4);
+        }
+        char *tempFile = "tempFileForSortTest.paf", *sortedTempFile = "tempFileForSortTest.sorted.paf";
+        FILE *fileHandle = fopen(tempFile, "w");
+        assert(fileHandle != NULL);
+        write_pafs(fileHandle, pairwiseAlignments);
+        fclose(fileHandle);
+        // A small memory limit forces the alignments to be sorted in runs that are merged
+        stCaf_sortCigarsFileByScoreInDescendingOrder(tempFile, sortedTempFile, st_random() > 0.5 ? 1000 : 1000000);
         stFile_rmtree(tempFile);
+
+        // Check the alignments are all present, sorted by score with ties in the input order
+        fileHandle = fopen(sortedTempFile, "r");
+        assert(fileHandle != NULL);
+        Paf *paf, *pPaf = NULL;
+        int64_t alignmentNumber = 0;
+        while ((paf = paf_read(fileHandle, 0)) != NULL) {
+            if (pPaf != NULL) {
+                CuAssertTrue(testCase, pPaf->score >= paf->score);
+                if (pPaf->score == paf->score) {
+                    CuAssertTrue(testCase, atoi(pPaf->query_name) < atoi(paf->query_name));
+                }
+                paf_destruct(pPaf);
+            }
+            pPaf = paf;
+            alignmentNumber++;
+        }
+        if (pPaf != NULL) {
+            paf_destruct(pPaf);
+        }
+        fclose(fileHandle);
+        stFile_rmtree(sortedTempFile);
+        CuAssertIntEquals(testCase, stList_length(pairwiseAlignments), alignmentNumber);
         stList_destruct(pairwiseAlignments);
     }
 }
 
+static void writeRandomScoredAlignments(stList *pairwiseAlignments, char *file) {
+    for (int64_t i = 0; i < stList_length(pairwiseAlignments); i++) {
+        ((Paf *)stList_get(pairwiseAlignments, i))->score = st_randomInt(0, 4);
+    }
+    FILE *fileHandle = fopen(file, "w");
+    assert(fileHandle != NULL);
+    write_pafs(fileHandle, pairwiseAlignments);
+    fclose(fileHandle);
+}
+
+static void testPinchIteratorFromSortedFile(CuTest *testCase) {
+    for (int64_t test = 0; test < 100; test++) {
+        char *tempFiles[2] = { "tempFileForSortTest.1.paf", "tempFileForSortTest.2.paf" };
+        char *sortedTempFile = "tempFileForSortTest.sorted.paf";
+        stList *alignmentsFiles = stList_construct();
+        stList *pairwiseAlignments[2];
+        for (int64_t i = 0; i < 2; i++) {
+            pairwiseAlignments[i] = getRandomPairwiseAlignments();
+            writeRandomScoredAlignments(pairwiseAlignments[i], tempFiles[i]);
+            stList_append(alignmentsFiles, tempFiles[i]);
+        }
+        int64_t maxBytesInMemory = st_random() > 0.5 ? 1000 : 1000000;
+        stCaf_sortCigarsFilesByScoreInDescendingOrder(alignmentsFiles, sortedTempFile, maxBytesInMemory);
+        stList *pinchIterators = stPinchIterator_constructFromSortedFile(sortedTempFile, 2);
+        stFile_rmtree(sortedTempFile);
+        CuAssertIntEquals(testCase, 2, stList_length(pinchIterators));
+
+        // Each iterator gives the pinches of its file, as if the file had been sorted on its own
+        for (int64_t i = 0; i < 2; i++) {
+            stCaf_sortCigarsFileByScoreInDescendingOrder(tempFiles[i], sortedTempFile, maxBytesInMemory);
+            stPinchIterator *pinchIterator = stPinchIterator_constructFromFile(sortedTempFile);
+            stFile_rmtree(sortedTempFile);
+            stPinchIterator *pinchIterator2 = stList_get(pinchIterators, i);
+            stPinch pinch, pinch2;
+            stPinch *p, *p2;
+            do {
+                p = stPinchIterator_getNext(pinchIterator, &pinch);
+                p2 = stPinchIterator_getNext(pinchIterator2, &pinch2);
+                CuAssertTrue(testCase, (p == NULL) == (p2 == NULL));
+                if (p != NULL) {
+                    CuAssertIntEquals(testCase, pinch.name1, pinch2.name1);
+                    CuAssertIntEquals(testCase, pinch.name2, pinch2.name2);
+                    CuAssertIntEquals(testCase, pinch.start1, pinch2.start1);
+                    CuAssertIntEquals(testCase, pinch.start2, pinch2.start2);
+                    CuAssertIntEquals(testCase, pinch.length, pinch2.length);
+                    CuAssertIntEquals(testCase, pinch.strand, pinch2.strand);
+                }
+            } while (p != NULL);
+            stPinchIterator_destruct(pinchIterator);
+            stPinchIterator_destruct(pinchIterator2);
+            stFile_rmtree(tempFiles[i]);
+            stList_destruct(pairwiseAlignments[i]);
+        }
+        stList_destruct(pinchIterators);
+        stList_destruct(alignmentsFiles);
+    }
+}
+
 CuSuite* pinchIteratorTestSuite(void) {
     CuSuite* suite = CuSuiteNew();
     SUITE_ADD_TEST(suite, testPinchIteratorFromFile);
+    SUITE_ADD_TEST(suite, testSortCigarsFileByScoreInDescendingOrder);
+    SUITE_ADD_TEST(suite, testPinchIteratorFromSortedFile);
     return suite;
 }
@@ -15,6 +15,7 @@
 #include "blockMLString.h"
 #include "hal.h"
 #include "convertAlignmentCoordinates.h"
+#include "scheduleFlowers.h"
 
 // OpenMP
 #if defined(_OPENMP)
@@ -38,7 +39,7 @@ void usage() {
     fprintf(stderr, "-G --outputReferenceFile : The file to write the sequences of the reference in (used in the progressive recursion).\n");
     fprintf(stderr, "-s --sequences [Required unless --seqFile given] : eventName fastaFile/Directory]xN: The sequences\n");
     fprintf(stderr, "-e --seqFile [Required unless --sequences and --speciesTree give] : seqfile containing tree and sequences\n"); 
-    fprintf(stderr, "-a --alignments : [Required] The alignments file\n");
+    fprintf(stderr, "-a --alignments : [Required unless --resumeFrom given] The alignments file\n");
     fprintf(stderr, "-S --secondaryAlignments : The secondary alignments file\n");
     fprintf(stderr, "-c --constraintAlignments : The constraint alignments file\n");
     fprintf(stderr, "-g --speciesTree : [Required unless --seqFile given] The species tree, which will form the skeleton of the event tree\n");
@@ -46,6 +47,11 @@ void usage() {
     fprintf(stderr, "-r --referenceEvent : [Required] The name of the reference event\n");
     fprintf(stderr, "-t --runChecks : Run cactus checks after each stage, used for debugging\n");
     fprintf(stderr, "-T --threads : (int > 0) Use up to this many threads [default: all available]\n");
+    fprintf(stderr, "-k --snapshotPrefix : Write a snapshot of the cactus disk to PREFIX.caf, PREFIX.bar and PREFIX.reference after each of these stages\n");
+    fprintf(stderr, "-R --resumeFrom : Load a snapshot written using --snapshotPrefix and skip the stages it already completed\n");
+    fprintf(stderr, "-P --perfReport : Write a JSON report of the time and memory used by each stage and of the time taken by each flower to this file\n");
+    fprintf(stderr, "-C --flowerTimings : Write the time taken by each flower, with the features used to estimate its cost, to this file\n");
+    fprintf(stderr, "-M --flowerCostModel : Fit the model estimating the cost of each flower, used to process the most expensive flowers first, to a file written with --flowerTimings\n");
     fprintf(stderr, "-h --help : Print this help message\n");
 }
 
@@ -85,62 +91,58 @@ static void parse_seqfile(const char *seqFilePath, char **outSequencesAndEvents,
     free(buf);
 }
 
-static char *convertAlignments(char *alignmentsFile, Flower *flower) {
-    char *tempFile = getTempFile();
-    convertAlignmentCoordinates(alignmentsFile, tempFile, flower);
-    return tempFile;
-}
+/*
+ * Snapshots of the cactus disk, taken after the expensive stages so that a failed run can be
+ * resumed. A snapshot records the last stage completed and the root flower, followed by the cactus disk.
+ */
+typedef enum _snapshotStage {
+    SNAPSHOT_NONE = 0,
+    SNAPSHOT_CAF = 1,
+    SNAPSHOT_BAR = 2,
+    SNAPSHOT_REFERENCE = 3
+} SnapshotStage;
 
-static RecordHolder *getMergedRecordHolders(stHash *recordHolders, Flower *flower) {
-    stList *children = stList_construct();
-    getChildFlowers(flower, children);
-    RecordHolder *rh = recordHolder_construct();
-    for(int64_t i=0; i<stList_length(children); i++) {
-        RecordHolder *rh2 = stHash_search(recordHolders, stList_get(children, i));
-        assert(rh2 != NULL);
-        recordHolder_transferAll(rh, rh2);
-    }
-    stList_destruct(children);
-    return rh;
-}
+static const char *snapshotStageNames[] = { "none", "caf", "bar", "reference" };
 
-static void callBottomUp(Flower *flower, RecordHolder *rh, void *extraArg) {
-    bottomUpNoDb(flower, rh, (Name)extraArg, 0, generateJukesCantorMatrix);
+static void writeSnapshot(const char *snapshotPrefix, SnapshotStage stage, Flower *flower) {
+    if (snapshotPrefix == NULL) {
+        return;
+    }
+    char *snapshotFile = stString_print("%s.%s", snapshotPrefix, snapshotStageNames[stage]);
+    FILE *fileHandle = fopen(snapshotFile, "wb");
+    if (fileHandle == NULL) {
+        st_errAbort("Unable to open snapshot file \"%s\" for writing\n", snapshotFile);
+    }
+    int64_t header[2] = { stage, flower_getName(flower) };
+    if (fwrite(header, sizeof(int64_t), 2, fileHandle) != 2) {
+        st_errAbort("Failed to write snapshot file \"%s\"\n", snapshotFile);
+    }
+    cactusDisk_write(flower_getCactusDisk(flower), fileHandle);
+    fclose(fileHandle);
+    st_logInfo("Wrote %s snapshot to %s\n", snapshotStageNames[stage], snapshotFile);
+    free(snapshotFile);
 }
 
-static void callHalFn(Flower *flower, RecordHolder *rh, void *extraArg) {
-    makeHalFormatNoDb(flower, rh, (Name)extraArg, NULL);
+static CactusDisk *readSnapshot(const char *snapshotFile, SnapshotStage *stage, Name *flowerName) {
+    FILE *fileHandle = fopen(snapshotFile, "rb");
+    if (fileHandle == NULL) {
+        st_errAbort("Unable to open snapshot file \"%s\"\n", snapshotFile);
+    }
+    int64_t header[2];
+    if (fread(header, sizeof(int64_t), 2, fileHandle) != 2 || header[0] <= SNAPSHOT_NONE || header[0] > SNAPSHOT_REFERENCE) {
+        st_errAbort("Unable to parse snapshot file \"%s\"\n", snapshotFile);
+    }
+    *stage = header[0];
+    *flowerName = header[1];
+    CactusDisk *cactusDisk = cactusDisk_read(fileHandle);
+    fclose(fileHandle);
+    return cactusDisk;
 }
 
-static RecordHolder *doBottomUpTraversal(stList *flowerLayers,
-                                         void (*bottomUpFn)(Flower *, RecordHolder *, void *), void *extraArgs) {
-    // Bottom-up reference coordinates phase
-    stHash *recordHolders = stHash_construct();
-    for(int64_t i=stList_length(flowerLayers)-1; i>0 ; i--) {
-        stList *flowers = stList_get(flowerLayers, i);
-
-        // List to keep the RecordHolder for each flower
-        stList *recordHoldersForFlowers = stList_construct3(stList_length(flowers), NULL);
-
-#if defined(_OPENMP)
-#pragma omp parallel for schedule(dynamic)
-#endif
-        for (int64_t j = 0; j < stList_length(flowers); j++) {
-            stList_set(recordHoldersForFlowers, j, getMergedRecordHolders(recordHolders, stList_get(flowers, j)));
-            bottomUpFn(stList_get(flowers, j), stList_get(recordHoldersForFlowers, j), extraArgs);
-        }
-
-        // Make new map of flowers in the layer to RecordHolders
-        stHash_destruct(recordHolders);
-        recordHolders = stHash_construct();
-        for (int64_t j = 0; j < stList_length(flowers); j++) {
-            stHash_insert(recordHolders, stList_get(flowers, j), stList_get(recordHoldersForFlowers, j));
-        }
-        stList_destruct(recordHoldersForFlowers);
-    }
-    RecordHolder *rh = getMergedRecordHolders(recordHolders, stList_get(stList_get(flowerLayers, 0), 0));
-    stHash_destruct(recordHolders);
-    return rh;
+static char *convertAlignments(char *alignmentsFile, Flower *flower) {
+    char *tempFile = getTempFile();
+    convertAlignmentCoordinates(alignmentsFile, tempFile, flower);
+    return tempFile;
 }
 
 // check if a reference fasta was provided with the --sequences option
@@ -159,38 +161,14 @@ static bool refSequenceProvided(char *sequenceFilesAndEvents, char *referenceEve
     return found_ref;
 }
 
-// compute the total base lengths of each flower in parallel
-stHash *compute_flower_length_hash(stList *flowers) {
-    // compute lengths in parallel
-    stList *flower_lengths = stList_construct2(stList_length(flowers));
-#pragma omp parallel for schedule(dynamic)
-    for (int64_t i = 0; i < stList_length(flowers); ++i) {
-        stList_set(flower_lengths, i, (void*)flower_getTotalBaseLength((Flower*)stList_get(flowers, i)));
-    }
-    // add the lengths to the hash
-    stHash *flower_to_length = stHash_construct();
-    for (int64_t i = 0; i < stList_length(flowers); ++i) {
-        stHash_insert(flower_to_length, stList_get(flowers, i), stList_get(flower_lengths, i));
-    }
-    stList_destruct(flower_lengths);
-    return flower_to_length;
-}
-
-int flower_lengthCmpFn(const void *a, const void *b, void *flower_to_length_hash) {
-    // Sort by hashed length value of the flowers
-    int64_t i = (int64_t)stHash_search((stHash*)flower_to_length_hash, (void*)a);
-    int64_t j = (int64_t)stHash_search((stHash*)flower_to_length_hash, (void*)b);
-    return i < j ? 1 : (i > j ? -1 : 0); // Sort in descending order
-}
-
-int flower_sizeCmpFn(const void *a, const void *b) {
-    // Sort by number of caps the flowers contains
-    int64_t i = flower_getCapNumber((Flower *)a), j = flower_getCapNumber((Flower *)b);
-    return i < j ? 1 : (i > j ? -1 : 0); // Sort in descending order
-}
+/*
+ * The number of slowest flowers listed for each flower stage of the performance report.
+ */
+#define PERF_REPORT_TOP_FLOWERS 20
 
 int main(int argc, char *argv[]) {
-    time_t startTime = time(NULL);
+    double startTime = perfReport_getWallTime();
+    PerfReport *perfReport = perfReport_construct(PERF_REPORT_TOP_FLOWERS);
 
     /*
      * Arguments/options
@@ -208,6 +186,11 @@ int main(int argc, char *argv[]) {
     char *speciesTree = NULL;
     char *outgroupEvents = NULL;
     char *referenceEventString = NULL;
+    char *snapshotPrefix = NULL;
+    char *resumeFrom = NULL;
+    char *perfReportFile = NULL;
+    char *flowerTimingsFile = NULL;
+    char *flowerCostModelFile = NULL;
     bool runChecks = 0;
 
     ///////////////////////////////////////////////////////////////////////////
@@ -239,11 +222,16 @@ int main(int argc, char *argv[]) {
                 { "referenceEvent", required_argument, 0, 'r' },
                 { "runChecks", no_argument, 0, 't' },
                 { "threads", required_argument, 0, 'T' }, 
+                { "snapshotPrefix", required_argument, 0, 'k' },
+                { "resumeFrom", required_argument, 0, 'R' },
+                { "perfReport", required_argument, 0, 'P' },
+                { "flowerTimings", required_argument, 0, 'C' },
+                { "flowerCostModel", required_argument, 0, 'M' },
                 { 0, 0, 0, 0 } };
 
         int option_index = 0;
 
-        int64_t key = getopt_long(argc, argv, "l:p:s:a:S:e:c:g:o:hr:F:G:tT:", long_options, &option_index);
+        int64_t key = getopt_long(argc, argv, "l:p:s:a:S:e:c:g:o:hr:F:G:tT:k:R:P:C:M:", long_options, &option_index);
 
         if (key == -1) {
             break;
@@ -300,6 +288,21 @@ int main(int argc, char *argv[]) {
                 omp_set_num_threads(num_threads);
                 break;
             }
+            case 'k':
+                snapshotPrefix = optarg;
+                break;
+            case 'R':
+                resumeFrom = optarg;
+                break;
+            case 'P':
+                perfReportFile = optarg;
+                break;
+            case 'C':
+                flowerTimingsFile = optarg;
+                break;
+            case 'M':
+                flowerCostModelFile = optarg;
+                break;
             case 'h':
                 usage();
                 return 0;
@@ -322,7 +325,7 @@ int main(int argc, char *argv[]) {
     if (sequenceFilesAndEvents == NULL && seqFile == NULL) {
         st_errAbort("must supply --sequences (-s) OR --seqFile (-e)");
     }
-    if (alignmentsFile == NULL) {
+    if (alignmentsFile == NULL && resumeFrom == NULL) {
         st_errAbort("must supply --alignments (-a)");
     }
     if (speciesTree == NULL && seqFile == NULL) {
@@ -356,35 +359,69 @@ int main(int argc, char *argv[]) {
     st_logInfo("Species tree: %s\n", speciesTree);
     st_logInfo("Outgroup events: %s\n", outgroupEvents);
     st_logInfo("Reference event: %s\n", referenceEventString);
+    st_logInfo("Snapshot prefix: %s\n", snapshotPrefix);
+    st_logInfo("Resume from snapshot: %s\n", resumeFrom);
+    st_logInfo("Performance report file: %s\n", perfReportFile);
+    st_logInfo("Flower timings file: %s\n", flowerTimingsFile);
+    st_logInfo("Flower cost model file: %s\n", flowerCostModelFile);
+
+    // Only time the individual flowers if the report or timings are to be written
+    if (perfReportFile != NULL || flowerTimingsFile != NULL) {
+        perfReport_setGlobal(perfReport);
+        perfReport_setRecordAdjacencyCells(perfReport, flowerTimingsFile != NULL);
+    }
+
+    // The flowers are processed in descending order of their estimated cost, by default their size
+    FlowerCostModel *flowerCostModel = flowerCostModel_construct();
+    if (flowerCostModelFile != NULL) {
+        flowerCostModel_fitFromFile(flowerCostModel, flowerCostModelFile);
+    }
 
     //////////////////////////////////////////////
     //Parse stuff
     //////////////////////////////////////////////
 
+    perfReport_startStage(perfReport, "setup");
+
     // Load the params file
     CactusParams *params = cactusParams_load(paramsFile);
-    st_logInfo("Loaded the parameters files, %" PRIi64 " seconds have elapsed\n", time(NULL) - startTime);
-
-    // Load the cactus disk
-    CactusDisk *cactusDisk = cactusDisk_construct();
-
-    st_logInfo("Set up the cactus disk, %" PRIi64 " seconds have elapsed\n", time(NULL) - startTime);
 
     // Load the seqfile
     if (seqFile) {
         parse_seqfile(seqFile, &sequenceFilesAndEvents, &speciesTree);
     }
 
-    //////////////////////////////////////////////
-    //Call cactus setup
-    //////////////////////////////////////////////
+    CactusDisk *cactusDisk;
+    Flower *flower;
+    SnapshotStage resumeStage = SNAPSHOT_NONE;
+    if (resumeFrom != NULL) {
+        //////////////////////////////////////////////
+        //Load the cactus disk from a snapshot
+        //////////////////////////////////////////////
+
+        Name flowerName;
+        cactusDisk = readSnapshot(resumeFrom, &resumeStage, &flowerName);
+        flower = cactusDisk_getFlower(cactusDisk, flowerName);
+        if (flower == NULL) {
+            st_errAbort("Root flower not found in snapshot %s\n", resumeFrom);
+        }
+        st_logInfo("Loaded the cactus disk from the %s snapshot\n", snapshotStageNames[resumeStage]);
+    } else {
+        // Load the cactus disk
+        cactusDisk = cactusDisk_construct();
 
-    Flower *flower = cactus_setup_first_flower(cactusDisk, params, speciesTree, outgroupEvents, sequenceFilesAndEvents);
-    st_logInfo("Established the first Flower in the hierarchy, %" PRIi64 " seconds have elapsed\n", time(NULL) - startTime);
+        //////////////////////////////////////////////
+        //Call cactus setup
+        //////////////////////////////////////////////
+
+        flower = cactus_setup_first_flower(cactusDisk, params, speciesTree, outgroupEvents, sequenceFilesAndEvents);
+    }
+    perfReport_endStage(perfReport);
 
     if(runChecks) {
+        perfReport_startStage(perfReport, "setup_checks");
         flower_checkRecursive(flower);
-        st_logInfo("Checked the first flower in the hierarchy, %" PRIi64 " seconds have elapsed\n", time(NULL) - startTime);
+        perfReport_endStage(perfReport);
     }
 
     // Get the Name of the reference event - do this early so we don't fail late in the process
@@ -398,165 +435,200 @@ int main(int argc, char *argv[]) {
     // Check if we got the reference sequence as input
     bool skipReferencePhase = refSequenceProvided(sequenceFilesAndEvents, referenceEventString);
 
-    //////////////////////////////////////////////
-    //Convert alignment coordinates
-    //////////////////////////////////////////////
+    if (resumeStage < SNAPSHOT_CAF) {
+        //////////////////////////////////////////////
+        //Convert alignment coordinates
+        //////////////////////////////////////////////
 
-    alignmentsFile = convertAlignments(alignmentsFile, flower);
-    if(secondaryAlignmentsFile != NULL) {
-        secondaryAlignmentsFile = convertAlignments(secondaryAlignmentsFile, flower);
-    }
-    if(constraintAlignmentsFile != NULL) {
-        constraintAlignmentsFile = convertAlignments(constraintAlignmentsFile, flower);
-    }
-    st_logInfo("Converted alignment coordinates, %" PRIi64 " seconds have elapsed\n", time(NULL) - startTime);
+        perfReport_startStage(perfReport, "coordinate_conversion");
+        alignmentsFile = convertAlignments(alignmentsFile, flower);
+        if(secondaryAlignmentsFile != NULL) {
+            secondaryAlignmentsFile = convertAlignments(secondaryAlignmentsFile, flower);
+        }
+        if(constraintAlignmentsFile != NULL) {
+            constraintAlignmentsFile = convertAlignments(constraintAlignmentsFile, flower);
+        }
+        perfReport_endStage(perfReport);
 
-    //////////////////////////////////////////////
-    //Strip the unique IDs
-    //////////////////////////////////////////////
+        //////////////////////////////////////////////
+        //Strip the unique IDs
+        //////////////////////////////////////////////
 
-    stripUniqueIdsFromLeafSequences(flower);
-    st_logInfo("Stripped any unique IDs, %" PRIi64 " seconds have elapsed\n", time(NULL) - startTime);
+        perfReport_startStage(perfReport, "strip_unique_ids");
+        stripUniqueIdsFromLeafSequences(flower);
+        perfReport_endStage(perfReport);
 
-    //////////////////////////////////////////////
-    //Call cactus caf
-    //////////////////////////////////////////////
+        //////////////////////////////////////////////
+        //Call cactus caf
+        //////////////////////////////////////////////
 
-    assert(!flower_builtBlocks(flower));
-    caf(flower, params, alignmentsFile, secondaryAlignmentsFile, constraintAlignmentsFile, referenceEvent);
-    assert(flower_builtBlocks(flower));
-    st_logInfo("Ran cactus caf, %" PRIi64 " seconds have elapsed\n", time(NULL) - startTime);
+        assert(!flower_builtBlocks(flower));
+        perfReport_startStage(perfReport, "caf");
+        caf(flower, params, alignmentsFile, secondaryAlignmentsFile, constraintAlignmentsFile, referenceEvent);
+        perfReport_endStage(perfReport);
+        assert(flower_builtBlocks(flower));
 
-    if(runChecks) {
-        flower_checkRecursive(flower);
-        st_logInfo("Checked the flowers in the hierarchy created by CAF, %" PRIi64 " seconds have elapsed\n", time(NULL) - startTime);
+        if(runChecks) {
+            perfReport_startStage(perfReport, "caf_checks");
+            flower_checkRecursive(flower);
+            perfReport_endStage(perfReport);
+        }
+
+        if (snapshotPrefix != NULL) {
+            perfReport_startStage(perfReport, "caf_snapshot");
+            writeSnapshot(snapshotPrefix, SNAPSHOT_CAF, flower);
+            perfReport_endStage(perfReport);
+        }
+    } else {
+        // The converted alignments are not needed, so there is nothing to cleanup
+        alignmentsFile = secondaryAlignmentsFile = constraintAlignmentsFile = NULL;
+        st_logInfo("Skipped cactus caf, resuming from snapshot\n");
     }
 
     //////////////////////////////////////////////
-    //Call cactus bar
+    //Call cactus bar and cactus reference
     //////////////////////////////////////////////
 
-    if (cactusParams_get_int(params, 2, "bar", "runBar")) {
-        stList *leafFlowers = stList_construct();
+    // Get the flowers to run bar on
+    stList *leafFlowers = stList_construct();
+    BarParameters *barParameters = NULL;
+    if (resumeStage >= SNAPSHOT_BAR) {
+        st_logInfo("Skipped cactus bar, resuming from snapshot\n");
+    } else if (cactusParams_get_int(params, 2, "bar", "runBar")) {
+        perfReport_startStage(perfReport, "bar_setup");
         extendFlowers(flower, leafFlowers, 1); // Get nested flowers to complete
-        // Sort by descending order of size, so that we start processing the
-        // largest flower as quickly as possible
-        stHash *flower_to_length = compute_flower_length_hash(leafFlowers);
-        stList_sort2(leafFlowers, flower_lengthCmpFn, flower_to_length); 
-        stHash_destruct(flower_to_length);
-        st_logInfo("Ran extended flowers ready for bar, %" PRIi64 " seconds have elapsed\n", time(NULL) - startTime);
-
-        bar(leafFlowers, params, cactusDisk, NULL);
-        int64_t usePoa = cactusParams_get_int(params, 2, "bar", "partialOrderAlignment");
-        st_logInfo("Ran cactus bar (use poa:%i), %" PRIi64 " seconds have elapsed\n", (int)usePoa, time(NULL) - startTime);
+        // Sort by descending order of estimated cost, so that we start processing the
+        // most expensive flower as quickly as possible
+        flowerCostModel_sortFlowers(flowerCostModel, "bar", leafFlowers);
+        barParameters = barParameters_construct(params);
+        perfReport_endStage(perfReport);
+    }
+
+    // Get the parameters for the reference
+    ReferenceParameters *referenceParameters = NULL;
+    if (resumeStage >= SNAPSHOT_REFERENCE) {
+        st_logInfo("Skipped reference phase, resuming from snapshot\n");
+    } else if (skipReferencePhase) {
+        st_logInfo("Skipped reference phase because input sequence was provided for %s\n", referenceEventString);
+    } else {
+        referenceParameters = referenceParameters_construct(params);
+    }
 
+    // Bar and the reference are run as one pass over the flower hierarchy, so that bar on some flowers overlaps
+    // building the reference for others, unless we need the state of the flowers between them
+    bool separateBarAndReference = runChecks || snapshotPrefix != NULL;
+    if (stList_length(leafFlowers) > 0 && (separateBarAndReference || referenceParameters == NULL)) {
+        perfReport_startStage(perfReport, "bar");
+        scheduleBarAndReference(flower, leafFlowers, barParameters, NULL, NULL, referenceEventName, flowerCostModel);
+        perfReport_endStage(perfReport);
         stList_destruct(leafFlowers);
-
+        leafFlowers = stList_construct();
+    }
+    if (resumeStage < SNAPSHOT_BAR && stList_length(leafFlowers) == 0) {
         if(runChecks) {
+            perfReport_startStage(perfReport, "bar_checks");
             flower_checkRecursive(flower);
-            st_logInfo("Checked the flowers in the hierarchy created by BAR, %" PRIi64 " seconds have elapsed\n", time(NULL) - startTime);
+            perfReport_endStage(perfReport);
+        }
+        if (snapshotPrefix != NULL) {
+            perfReport_startStage(perfReport, "bar_snapshot");
+            writeSnapshot(snapshotPrefix, SNAPSHOT_BAR, flower);
+            perfReport_endStage(perfReport);
         }
     }
+    if (referenceParameters != NULL) {
+        // Top-down this constructs the reference sequence, then bottom-up the reference sequences are built. As the
+        // phases overlap the time of each is reported as a sub-stage summed over its tasks (see perfReport_addTaskTime)
+        perfReport_startStage(perfReport, stList_length(leafFlowers) > 0 ? "bar_and_reference" : "reference");
+        scheduleBarAndReference(flower, leafFlowers, barParameters, referenceParameters, referenceEventString,
+                                referenceEventName, flowerCostModel);
+        perfReport_endStage(perfReport);
+        referenceParameters_destruct(referenceParameters);
+    }
+    if (barParameters != NULL) {
+        int64_t usePoa = cactusParams_get_int(params, 2, "bar", "partialOrderAlignment");
+        st_logInfo("Ran cactus bar (use poa:%i)\n", (int)usePoa);
+        barParameters_destruct(barParameters);
+        poa_engine_destruct();
+    }
+    stList_destruct(leafFlowers);
 
-    //////////////////////////////////////////////
-    //Call cactus reference
-    //////////////////////////////////////////////
-
-    // Get the flowers in the tree so that level 0 contains just the root flower,
-    // level 1 contains the flowers that are children of the root flower, etc.
-    stList *flowerLayers = getFlowerHierarchyInLayers(flower);
-    for(int64_t i=0; i<stList_length(flowerLayers); i++) {
-        // Sort by descending order of size, so that we start processing the
-        // largest flower as quickly as possible
-        stList_sort(stList_get(flowerLayers, i), flower_sizeCmpFn); 
-    }
-    st_logInfo("There are %" PRIi64 " layers in the flowers hierarchy\n", stList_length(flowerLayers));
-
-    RecordHolder *rh = NULL;
-    if (!skipReferencePhase) {
-        // Top-down this constructs the reference sequence
-        for(int64_t i=0; i<stList_length(flowerLayers); i++) {
-            stList *flowerLayer = stList_get(flowerLayers, i);
-            st_logInfo("In the %" PRIi64 " layer there are %" PRIi64 " flowers in the flowers hierarchy\n", i,
-                       stList_length(flowerLayer));
-            cactus_make_reference(flowerLayer, referenceEventString, cactusDisk, params);
-        }
-        st_logInfo("Ran cactus make reference, %" PRIi64 " seconds have elapsed\n", time(NULL) - startTime);
-
-        // Bottom-up reference coordinates phase
-        RecordHolder *rh = doBottomUpTraversal(flowerLayers, callBottomUp, (void *)referenceEventName);
-        bottomUpNoDb(flower, rh, referenceEventName, 1, generateJukesCantorMatrix);
-        assert(recordHolder_size(rh) == 0);
-        recordHolder_destruct(rh);
-        st_logInfo("Ran cactus make reference bottom up coordinates, %" PRIi64 " seconds have elapsed\n", time(NULL) - startTime);
-
-        // Top-down reference coordinates phase
-        for(int64_t i=0; i<stList_length(flowerLayers); i++) {
-            stList *flowers = stList_get(flowerLayers, i);
-#if defined(_OPENMP)
-#pragma omp parallel for schedule(dynamic)
-#endif
-            for(int64_t j=0; j<stList_length(flowers); j++) {
-                topDown(stList_get(flowers, j), referenceEventName);
-            }
-        }
-        st_logInfo("Ran cactus make reference top down coordinates, %" PRIi64 " seconds have elapsed\n", time(NULL) - startTime);
-    } else {
-        st_logInfo("Skipped reference phase because input sequence was provided for %s\n", referenceEventString);
+    if (resumeStage < SNAPSHOT_REFERENCE && snapshotPrefix != NULL) {
+        perfReport_startStage(perfReport, "reference_snapshot");
+        writeSnapshot(snapshotPrefix, SNAPSHOT_REFERENCE, flower);
+        perfReport_endStage(perfReport);
     }
     
     if(runChecks) {
+        perfReport_startStage(perfReport, "reference_checks");
         flower_checkRecursive(flower);
-        st_logInfo("Ran cactus check, %" PRIi64 " seconds have elapsed\n", time(NULL) - startTime);
+        perfReport_endStage(perfReport);
     }
 
     //////////////////////////////////////////////
-    //Make c2h files, then build hal
+    //Set the reference coordinates top-down, make c2h files, then build hal
     //////////////////////////////////////////////
 
-    rh = doBottomUpTraversal(flowerLayers, callHalFn, (void *)referenceEventName);
+    perfReport_startStage(perfReport, "c2h");
     FILE *fileHandle = fopen(outputFile, "w");
-    makeHalFormatNoDb(flower, rh, referenceEventName, fileHandle);
+    scheduleTopDownAndHal(flower, referenceEventName, !skipReferencePhase, fileHandle, flowerCostModel);
     fclose(fileHandle);
-    assert(recordHolder_size(rh) == 0);
-    recordHolder_destruct(rh);
-    st_logInfo("Ran cactus to hal stage, %" PRIi64 " seconds have elapsed\n", time(NULL) - startTime);
+    perfReport_endStage(perfReport);
 
     //////////////////////////////////////////////
     //Get reference sequences
     //////////////////////////////////////////////
 
     if(outputHalFastaFile != NULL) {
+        perfReport_startStage(perfReport, "hal_fasta");
         fileHandle = fopen(outputHalFastaFile, "w");
         printFastaSequences(flower, fileHandle, referenceEventName);
         fclose(fileHandle);
-        st_logInfo("Dumped sequences for hal file, %" PRIi64 " seconds have elapsed\n", time(NULL) - startTime);
+        perfReport_endStage(perfReport);
     }
 
     if(outputReferenceFile != NULL) {
+        perfReport_startStage(perfReport, "reference_fasta");
         fileHandle = fopen(outputReferenceFile, "w");
         getReferenceSequences(fileHandle, flower, referenceEventString);
         fclose(fileHandle);
-        st_logInfo("Dumped reference sequences, %" PRIi64 " seconds have elapsed\n", time(NULL) - startTime);
+        perfReport_endStage(perfReport);
     }
 
     //////////////////////////////////////////////
     //Cleanup
     //////////////////////////////////////////////
 
-    st_system("rm %s", alignmentsFile);
+    if(alignmentsFile != NULL) {
+        st_system("rm %s", alignmentsFile);
+    }
     if(secondaryAlignmentsFile != NULL) {
         st_system("rm %s", secondaryAlignmentsFile);
     }
     if(constraintAlignmentsFile != NULL) {
         st_system("rm %s", constraintAlignmentsFile);
     }
-    st_logInfo("Cactus consolidated is done!, %" PRIi64 " seconds have elapsed\n", time(NULL) - startTime);
+    if (perfReportFile != NULL) {
+        fileHandle = fopen(perfReportFile, "w");
+        if (fileHandle == NULL) {
+            st_errAbort("Unable to open performance report file \"%s\" for writing\n", perfReportFile);
+        }
+        perfReport_writeJson(perfReport, fileHandle);
+        fclose(fileHandle);
+    }
+    if (flowerTimingsFile != NULL) {
+        fileHandle = fopen(flowerTimingsFile, "w");
+        if (fileHandle == NULL) {
+            st_errAbort("Unable to open flower timings file \"%s\" for writing\n", flowerTimingsFile);
+        }
+        perfReport_writeFlowerTimings(perfReport, fileHandle);
+        fclose(fileHandle);
+    }
+    st_logInfo("Cactus consolidated is done!, %f seconds have elapsed\n", perfReport_getWallTime() - startTime);
 
     return 0; // Exit without cleaning
 
     // Cleanup the memory
-    stList_destruct(flowerLayers);
     cactusParams_destruct(params);
     cactusDisk_destruct(cactusDisk);
     if (seqFile) {
@@ -564,7 +636,10 @@ int main(int argc, char *argv[]) {
         free(sequenceFilesAndEvents);
     }
 
-    st_logInfo("Cactus consolidated cleanup is done!, %" PRIi64 " seconds have elapsed\n", time(NULL) - startTime);
+    flowerCostModel_destruct(flowerCostModel);
+    perfReport_destruct(perfReport);
+
+    st_logInfo("Cactus consolidated cleanup is done!, %f seconds have elapsed\n", perfReport_getWallTime() - startTime);
 
     //while(1);
     //assert(0);
@@ -4,11 +4,18 @@
  * Released under the MIT license, see LICENSE.txt
  */
 
+#define _GNU_SOURCE // For memrchr
+#include <string.h>
 #include "cactus.h"
 #include "sonLib.h"
 #include "paf.h"
 #include "bioioC.h"
 
+// OpenMP
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
 void stripUniqueIdsFromLeafSequences(Flower *flower) {
     Flower_SequenceIterator *flowerIt = flower_getSequenceIterator(flower);
     Sequence *sequence;
@@ -60,8 +67,7 @@ static stHash *makeSequenceHeaderToCapHash(Flower *flower) {
     return sequenceHeaderToCapsHash;
 }
 
-static void convertCoordinates(Paf *paf, FILE *outputCigarFileHandle,
-                               stHash *sequenceHeaderToCapHash) {
+static void convertCoordinates(Paf *paf, stHash *sequenceHeaderToCapHash) {
     Cap *cap1 = stHash_search(sequenceHeaderToCapHash, paf->query_name);
     Cap *cap2 = stHash_search(sequenceHeaderToCapHash, paf->target_name);
     if (cap1 == NULL) {
@@ -95,6 +101,38 @@ static void convertCoordinates(Paf *paf, FILE *outputCigarFileHandle,
     }
 }
 
+/*
+ * The input is read in blocks of about this many bytes, the lines of each block being converted in parallel.
+ */
+#define CONVERSION_BLOCK_SIZE 67108864
+
+/*
+ * Reads the next block of whole lines from the file into the buffer, after the remainder of the last block,
+ * which is carried over. Returns the length of the whole lines in the buffer, setting remainder to the number of
+ * bytes of the following, partial, line.
+ */
+static int64_t readLines(FILE *fileHandle, char **buffer, int64_t *bufferSize, int64_t *remainder) {
+    int64_t length = *remainder;
+    while (1) {
+        if (length == *bufferSize) { // A line longer than the buffer
+            *bufferSize *= 2;
+            *buffer = st_realloc(*buffer, *bufferSize + 1);
+        }
+        int64_t i = fread(*buffer + length, sizeof(char), *bufferSize - length, fileHandle);
+        length += i;
+        char *lineEnd = length > 0 ? memrchr(*buffer, '\n', length) : NULL;
+        if (lineEnd != NULL) {
+            *remainder = length - (lineEnd - *buffer + 1);
+            return lineEnd - *buffer + 1;
+        }
+        if (i == 0) { // End of file, the last line may not be terminated
+            (*buffer)[length] = '\n';
+            *remainder = 0;
+            return length > 0 ? length + 1 : 0;
+        }
+    }
+}
+
 void convertAlignmentCoordinates(char *inputAlignmentFile, char *outputAlignmentFile, Flower *flower) {
     stHash *sequenceHeaderToCapHash = makeSequenceHeaderToCapHash(flower);
     st_logDebug("Set up the flower disk and built hash\n");
@@ -103,16 +141,49 @@ void convertAlignmentCoordinates(char *inputAlignmentFile, char *outputAlignment
     FILE *outputAlignmentFileHandle = fopen(outputAlignmentFile, "w");
     st_logDebug("Opened files for writing\n");
 
-    Paf *paf;
-    while ((paf = paf_read(inputAlignmentFileHandle, 0)) != NULL) {
-        convertCoordinates(paf, outputAlignmentFileHandle, sequenceHeaderToCapHash);
-        paf_check(paf);
-        paf_write(paf, outputAlignmentFileHandle);
-        paf_destruct(paf);
+    int64_t bufferSize = CONVERSION_BLOCK_SIZE, remainder = 0, length, alignmentNumber = 0;
+    char *buffer = st_malloc(bufferSize + 1); // Space to terminate the final line
+    stList *lines = stList_construct();
+    while ((length = readLines(inputAlignmentFileHandle, &buffer, &bufferSize, &remainder)) > 0) {
+        // Split the block into lines, skipping any empty ones
+        for (char *line = buffer, *lineEnd; line < buffer + length; line = lineEnd + 1) {
+            lineEnd = memchr(line, '\n', buffer + length - line);
+            *lineEnd = '\0';
+            if (lineEnd > line) {
+                stList_append(lines, line);
+            }
+        }
+
+        // Convert the alignments in parallel, the hash and flower are only read
+        char **convertedLines = st_malloc(stList_length(lines) * sizeof(char *));
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic, 1024)
+#endif
+        for (int64_t i = 0; i < stList_length(lines); i++) {
+            Paf *paf = paf_parse(stList_get(lines, i), 0);
+            convertCoordinates(paf, sequenceHeaderToCapHash);
+            paf_check(paf);
+            convertedLines[i] = paf_print(paf);
+            paf_destruct(paf);
+        }
+
+        // Write them out in the original order
+        for (int64_t i = 0; i < stList_length(lines); i++) {
+            fprintf(outputAlignmentFileHandle, "%s\n", convertedLines[i]);
+            free(convertedLines[i]);
+        }
+        alignmentNumber += stList_length(lines);
+        free(convertedLines);
+        stList_setLength(lines, 0);
+
+        // Move the partial line to the start of the buffer
+        memmove(buffer, buffer + length, remainder);
     }
-    st_logDebug("Finished converting alignments\n");
+    st_logDebug("Finished converting %" PRIi64 " alignments\n", alignmentNumber);
 
     //Cleanup
+    stList_destruct(lines);
+    free(buffer);
     fclose(inputAlignmentFileHandle);
     fclose(outputAlignmentFileHandle);
     stHash_destruct(sequenceHeaderToCapHash);
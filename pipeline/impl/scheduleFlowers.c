@@ -0,0 +1,381 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#include "scheduleFlowers.h"
+#include "traverseFlowers.h"
+#include "addReferenceCoordinates.h"
+#include "blockMLString.h"
+#include "hal.h"
+
+// OpenMP
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+
+/*
+ * A flower in the hierarchy, together with the number of flowers each of its tasks is still waiting on.
+ */
+typedef struct _flowerNode FlowerNode;
+
+struct _flowerNode {
+    Flower *flower;
+    FlowerNode *parent;
+    stList *children;
+    bool runBar; // If bar is run on the flower
+    bool alignEndsInParallel; // If bar aligns the ends of the flower in parallel
+    int64_t barMemory; // The estimated memory bar uses to align the flower, when bar is run within a memory budget
+    int64_t pendingTopDown; // Number of tasks the top-down task (reference construction) waits on
+    int64_t pendingBottomUp; // Number of tasks the bottom-up task (reference sequences or hal) waits on
+    RecordHolder *rh; // The records computed by the bottom-up task
+};
+
+typedef struct _flowerScheduler {
+    BarParameters *barParameters;
+    ReferenceParameters *referenceParameters;
+    char *referenceEventString;
+    Name referenceEventName;
+    bool setReferenceCoordinates;
+    FILE *fileHandle;
+    FlowerCostModel *costModel;
+    const char *costStageName; // The stage whose estimated costs order the children of a flower
+    int64_t memoryBudget; // If positive, the estimated memory of the bar tasks running at once is kept within this
+    stList *barNodes; // The nodes bar is run on, in the order given
+    int64_t firstUnstartedBarNode; // The bar nodes before this have been started, those after it have not
+    int64_t barMemoryInUse; // The estimated memory of the bar tasks running
+    int64_t barTasksRunning;
+} FlowerScheduler;
+
+static FlowerNode *flowerNode_construct(Flower *flower, FlowerNode *parent) {
+    FlowerNode *node = st_calloc(1, sizeof(FlowerNode));
+    node->flower = flower;
+    node->parent = parent;
+    node->children = stList_construct();
+    return node;
+}
+
+static void flowerNode_destruct(FlowerNode *node) {
+    stList *stack = stList_construct();
+    stList_append(stack, node);
+    while (stList_length(stack) > 0) {
+        node = stList_pop(stack);
+        stList_appendAll(stack, node->children);
+        stList_destruct(node->children);
+        assert(node->rh == NULL);
+        free(node);
+    }
+    stList_destruct(stack);
+}
+
+/*
+ * Adds the nodes for the hierarchy below the given node, setting the number of dependencies of each task.
+ * Bar flowers have no children until bar has run on them.
+ */
+static void addChildNodes(FlowerScheduler *s, FlowerNode *node, stSet *barFlowers) {
+    stList *stack = stList_construct();
+    stList_append(stack, node);
+    while (stList_length(stack) > 0) {
+        node = stList_pop(stack);
+        stList *children = stList_construct();
+        getChildFlowers(node->flower, children);
+        flowerCostModel_sortFlowers(s->costModel, s->costStageName, children);
+        for (int64_t i = 0; i < stList_length(children); i++) {
+            FlowerNode *child = flowerNode_construct(stList_get(children, i), node);
+            child->runBar = barFlowers != NULL && stSet_search(barFlowers, child->flower) != NULL;
+            // The reference of the child waits for the reference of its parent and for its own alignment, while the
+            // reference of the parent waits for the alignment of the child, as the two modify the same groups
+            child->pendingTopDown = child->runBar ? 2 : 1;
+            node->pendingTopDown += child->runBar ? 1 : 0;
+            stList_append(node->children, child);
+            stList_append(stack, child);
+        }
+        // The bottom-up task waits on those of its children and on the top-down task for the flower
+        node->pendingBottomUp = stList_length(children) + 1;
+        stList_destruct(children);
+    }
+    stList_destruct(stack);
+}
+
+/*
+ * Removes a dependency of a task, returning non-zero if the task is now ready to run.
+ */
+static bool releaseDependency(int64_t *pending) {
+    int64_t i;
+#if defined(_OPENMP)
+#pragma omp critical(scheduleFlowers)
+#endif
+    {
+        i = --(*pending);
+    }
+    assert(i >= 0);
+    return i == 0;
+}
+
+/*
+ * Runs the task, adding its time to the sub-stage stageName of the current stage of the performance report.
+ */
+static void runTask(FlowerScheduler *s, FlowerNode *node, void (*taskFn)(FlowerScheduler *, FlowerNode *),
+                    const char *stageName) {
+    double wallStart = perfReport_getWallTime(), cpuStart = perfReport_getThreadCpuTime();
+    taskFn(s, node);
+    perfReport_addTaskTime(perfReport_getGlobal(), stageName, perfReport_getWallTime() - wallStart,
+                           perfReport_getThreadCpuTime() - cpuStart);
+}
+
+static void spawnTask(FlowerScheduler *s, FlowerNode *node, void (*taskFn)(FlowerScheduler *, FlowerNode *),
+                      const char *stageName) {
+#if defined(_OPENMP)
+#pragma omp task firstprivate(s, node, taskFn, stageName)
+#endif
+    runTask(s, node, taskFn, stageName);
+}
+
+static RecordHolder *getMergedRecordHolders(FlowerNode *node) {
+    RecordHolder *rh = recordHolder_construct();
+    for (int64_t i = 0; i < stList_length(node->children); i++) {
+        FlowerNode *child = stList_get(node->children, i);
+        assert(child->rh != NULL);
+        recordHolder_transferAll(rh, child->rh);
+        recordHolder_destruct(child->rh);
+        child->rh = NULL;
+    }
+    return rh;
+}
+
+////////////////////////////////////
+////////////////////////////////////
+//Bar and reference construction
+////////////////////////////////////
+////////////////////////////////////
+
+static void referenceBottomUpTask(FlowerScheduler *s, FlowerNode *node) {
+    RecordHolder *rh = getMergedRecordHolders(node);
+    if (node->parent != NULL) {
+        bottomUpNoDb(node->flower, rh, s->referenceEventName, 0, generateJukesCantorMatrix);
+        node->rh = rh;
+        if (releaseDependency(&node->parent->pendingBottomUp)) {
+            spawnTask(s, node->parent, referenceBottomUpTask, "reference_bottom_up_coordinates");
+        }
+    } else { // The root flower, which creates the reference sequences
+        bottomUpNoDb(node->flower, rh, s->referenceEventName, 1, generateJukesCantorMatrix);
+        assert(recordHolder_size(rh) == 0);
+        recordHolder_destruct(rh);
+    }
+}
+
+static void referenceTopDownTask(FlowerScheduler *s, FlowerNode *node) {
+    cactus_make_reference_for_flower(node->flower, s->referenceEventString, s->referenceParameters);
+    for (int64_t i = 0; i < stList_length(node->children); i++) {
+        FlowerNode *child = stList_get(node->children, i);
+        if (releaseDependency(&child->pendingTopDown)) {
+            spawnTask(s, child, referenceTopDownTask, "reference_top_down");
+        }
+    }
+    if (releaseDependency(&node->pendingBottomUp)) {
+        spawnTask(s, node, referenceBottomUpTask, "reference_bottom_up_coordinates");
+    }
+}
+
+static void barTask(FlowerScheduler *s, FlowerNode *node);
+
+/*
+ * Spawns the next bar tasks, in order, while their estimated memory fits in what is left of the memory budget. The
+ * first flower that does not fit waits, rather than being passed over for smaller ones, until enough of the
+ * running bar tasks finish, so the largest flowers are not left until last. A flower larger than the whole budget
+ * is aligned once no other bar task is running.
+ */
+static void spawnAdmittedBarTasks(FlowerScheduler *s) {
+    stList *admittedNodes = stList_construct();
+#if defined(_OPENMP)
+#pragma omp critical(scheduleFlowers)
+#endif
+    {
+        while (s->firstUnstartedBarNode < stList_length(s->barNodes)) {
+            FlowerNode *node = stList_get(s->barNodes, s->firstUnstartedBarNode);
+            if (s->barTasksRunning > 0 && s->barMemoryInUse + node->barMemory > s->memoryBudget) {
+                break;
+            }
+            s->barMemoryInUse += node->barMemory;
+            s->barTasksRunning++;
+            s->firstUnstartedBarNode++;
+            stList_append(admittedNodes, node);
+        }
+    }
+    for (int64_t i = 0; i < stList_length(admittedNodes); i++) {
+        spawnTask(s, stList_get(admittedNodes, i), barTask, "bar");
+    }
+    stList_destruct(admittedNodes);
+}
+
+static void barTask(FlowerScheduler *s, FlowerNode *node) {
+    bar_alignFlower(node->flower, s->barParameters, NULL, node->alignEndsInParallel);
+    if (s->memoryBudget > 0) {
+        // Release the memory of the flower and start the bar tasks that now fit
+#if defined(_OPENMP)
+#pragma omp critical(scheduleFlowers)
+#endif
+        {
+            s->barMemoryInUse -= node->barMemory;
+            s->barTasksRunning--;
+        }
+        spawnAdmittedBarTasks(s);
+    }
+    if (s->referenceParameters != NULL) {
+        // Bar has created the hierarchy below the flower
+        addChildNodes(s, node, NULL);
+        if (releaseDependency(&node->pendingTopDown)) {
+            spawnTask(s, node, referenceTopDownTask, "reference_top_down");
+        }
+        assert(node->parent != NULL);
+        if (releaseDependency(&node->parent->pendingTopDown)) {
+            spawnTask(s, node->parent, referenceTopDownTask, "reference_top_down");
+        }
+    }
+}
+
+void scheduleBarAndReference(Flower *rootFlower, stList *barFlowers, BarParameters *barParameters,
+                             ReferenceParameters *referenceParameters, char *referenceEventString,
+                             Name referenceEventName, FlowerCostModel *costModel) {
+    FlowerScheduler s = { barParameters, referenceParameters, referenceEventString, referenceEventName, 0, NULL,
+                          costModel, "reference",
+                          barParameters != NULL ? barParameters_getMemoryBudget(barParameters) : -1, NULL, 0, 0, 0 };
+
+    // Build the hierarchy down to the flowers bar is run on
+    stSet *barFlowersSet = stList_getSet(barFlowers);
+    FlowerNode *root = flowerNode_construct(rootFlower, NULL);
+    addChildNodes(&s, root, barFlowersSet);
+    stSet_destruct(barFlowersSet);
+
+    // Get the nodes for the bar flowers, in the order given
+    stHash *flowersToNodes = stHash_construct();
+    stList *stack = stList_construct();
+    stList_append(stack, root);
+    while (stList_length(stack) > 0) {
+        FlowerNode *node = stList_pop(stack);
+        stHash_insert(flowersToNodes, node->flower, node);
+        stList_appendAll(stack, node->children);
+    }
+    stList_destruct(stack);
+    stList *barNodes = stList_construct();
+    for (int64_t i = 0; i < stList_length(barFlowers); i++) {
+        FlowerNode *node = stHash_search(flowersToNodes, stList_get(barFlowers, i));
+        assert(node != NULL && node->runBar);
+        stList_append(barNodes, node);
+    }
+
+    // The ends of the most expensive flowers are aligned in parallel, as otherwise they are left running alone at
+    // the end
+    stList *largestBarFlowers = stList_copy(barFlowers, NULL);
+    flowerCostModel_sortFlowers(costModel, "bar", largestBarFlowers);
+    for (int64_t i = 0; i < stList_length(largestBarFlowers) && i < BAR_PARALLEL_END_FLOWERS; i++) {
+        ((FlowerNode *)stHash_search(flowersToNodes, stList_get(largestBarFlowers, i)))->alignEndsInParallel = 1;
+    }
+    stList_destruct(largestBarFlowers);
+    stHash_destruct(flowersToNodes);
+
+    // With a memory budget the bar tasks are spawned as the estimated memory of the running bar tasks allows
+    s.barNodes = barNodes;
+    if (s.memoryBudget > 0) {
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic, 64)
+#endif
+        for (int64_t i = 0; i < stList_length(barNodes); i++) {
+            FlowerNode *node = stList_get(barNodes, i);
+            node->barMemory = bar_estimateFlowerMemory(node->flower, barParameters, node->alignEndsInParallel);
+        }
+    }
+
+#if defined(_OPENMP)
+#pragma omp parallel
+#pragma omp single
+#endif
+    {
+        if (s.memoryBudget > 0) {
+            spawnAdmittedBarTasks(&s);
+        } else {
+            for (int64_t i = 0; i < stList_length(barNodes); i++) {
+                spawnTask(&s, stList_get(barNodes, i), barTask, "bar");
+            }
+        }
+        if (referenceParameters != NULL && root->pendingTopDown == 0) {
+            spawnTask(&s, root, referenceTopDownTask, "reference_top_down");
+        }
+    }
+
+    stList_destruct(barNodes);
+    flowerNode_destruct(root);
+}
+
+////////////////////////////////////
+////////////////////////////////////
+//Reference coordinates and hal
+////////////////////////////////////
+////////////////////////////////////
+
+static void halTask(FlowerScheduler *s, FlowerNode *node) {
+    RecordHolder *rh = getMergedRecordHolders(node);
+    if (node->parent != NULL) {
+        makeHalFormatNoDb(node->flower, rh, s->referenceEventName, NULL);
+        node->rh = rh;
+        if (releaseDependency(&node->parent->pendingBottomUp)) {
+            spawnTask(s, node->parent, halTask, "hal");
+        }
+    } else { // The root flower, which writes out the hal
+        makeHalFormatNoDb(node->flower, rh, s->referenceEventName, s->fileHandle);
+        assert(recordHolder_size(rh) == 0);
+        recordHolder_destruct(rh);
+    }
+}
+
+static void referenceCoordinatesTopDownTask(FlowerScheduler *s, FlowerNode *node) {
+    topDown(node->flower, s->referenceEventName);
+    for (int64_t i = 0; i < stList_length(node->children); i++) {
+        spawnTask(s, stList_get(node->children, i), referenceCoordinatesTopDownTask,
+                  "reference_top_down_coordinates");
+    }
+    if (releaseDependency(&node->pendingBottomUp)) {
+        spawnTask(s, node, halTask, "hal");
+    }
+}
+
+void scheduleTopDownAndHal(Flower *rootFlower, Name referenceEventName, bool setReferenceCoordinates,
+                           FILE *fileHandle, FlowerCostModel *costModel) {
+    FlowerScheduler s = { NULL, NULL, NULL, referenceEventName, setReferenceCoordinates, fileHandle, costModel, "hal",
+                          -1, NULL, 0, 0, 0 };
+
+    FlowerNode *root = flowerNode_construct(rootFlower, NULL);
+    addChildNodes(&s, root, NULL);
+
+    // Without the top-down pass the hal tasks only wait on the hal tasks of their children
+    stList *leaves = stList_construct();
+    stList *stack = stList_construct();
+    stList_append(stack, root);
+    while (stList_length(stack) > 0) {
+        FlowerNode *node = stList_pop(stack);
+        if (!setReferenceCoordinates) {
+            node->pendingBottomUp--;
+            if (node->pendingBottomUp == 0) {
+                stList_append(leaves, node);
+            }
+        }
+        stList_appendAll(stack, node->children);
+    }
+    stList_destruct(stack);
+
+#if defined(_OPENMP)
+#pragma omp parallel
+#pragma omp single
+#endif
+    {
+        if (setReferenceCoordinates) {
+            spawnTask(&s, root, referenceCoordinatesTopDownTask, "reference_top_down_coordinates");
+        } else {
+            for (int64_t i = 0; i < stList_length(leaves); i++) {
+                spawnTask(&s, stList_get(leaves, i), halTask, "hal");
+            }
+        }
+    }
+
+    stList_destruct(leaves);
+    flowerNode_destruct(root);
+}
@@ -0,0 +1,44 @@
+/*
+ * Released under the MIT license, see LICENSE.txt
+ */
+
+#ifndef SCHEDULE_FLOWERS_H_
+#define SCHEDULE_FLOWERS_H_
+
+#include "sonLib.h"
+#include "cactus.h"
+#include "poaBarAligner.h"
+#include "cactusReference.h"
+
+/*
+ * Runs bar on each of the barFlowers and, if referenceParameters is not NULL, builds the reference top-down
+ * and then the reference sequences bottom-up over the hierarchy rooted at rootFlower.
+ *
+ * Rather than processing the hierarchy layer by layer, each flower is processed as soon as the
+ * flowers it depends on are complete: the reference of a flower is built once the reference of its parent
+ * is built and bar has finished for the flower and any of its children it runs on, and the bottom-up
+ * reference sequences of a flower are computed once those of all its children are. Bar therefore overlaps
+ * with building the reference in other parts of the hierarchy. Ready children are started in descending order
+ * of their reference cost estimated by costModel, and the ends of the BAR_PARALLEL_END_FLOWERS bar flowers with
+ * the highest estimated bar cost are aligned in parallel. If the memoryBudget bar parameter is positive, the bar
+ * tasks are started in the given order only as long as the memory bar_estimateFlowerMemory estimates for the
+ * flowers being aligned stays within it, the next being started as running bar tasks finish. barParameters may
+ * be NULL if barFlowers is empty, as when bar has already been run. The times of the tasks of each phase ("bar",
+ * "reference_top_down" and "reference_bottom_up_coordinates") are added to the current stage of the global
+ * performance report as sub-stages.
+ */
+void scheduleBarAndReference(Flower *rootFlower, stList *barFlowers, BarParameters *barParameters,
+                             ReferenceParameters *referenceParameters, char *referenceEventString,
+                             Name referenceEventName, FlowerCostModel *costModel);
+
+/*
+ * If setReferenceCoordinates is non-zero sets the reference coordinates top-down, then builds the hal
+ * records bottom-up over the hierarchy rooted at rootFlower, writing the hal for the root flower to fileHandle.
+ * As with scheduleBarAndReference each flower is processed as soon as the flowers it depends on are complete.
+ * Ready children are started in descending order of their hal cost estimated by costModel. The phases are
+ * reported as the sub-stages "reference_top_down_coordinates" and "hal".
+ */
+void scheduleTopDownAndHal(Flower *rootFlower, Name referenceEventName, bool setReferenceCoordinates,
+                           FILE *fileHandle, FlowerCostModel *costModel);
+
+#endif /* SCHEDULE_FLOWERS_H_ */
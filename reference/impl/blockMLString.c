@@ -179,11 +179,13 @@ double *getBaseProbsString(Segment *segment) {
      * Gets an array of base probs, as described in getMaxLikelihoodString, representing
      * the input string.
      */
-    char *string = segment_getString(segment);
+    SequenceView view = segment_getView(segment);
+    SequenceViewIt it;
+    sequenceView_getIt(&view, &it);
     int64_t length = segment_getLength(segment);
     double *baseProbs = st_calloc(length * 4, sizeof(double)); //Gets the initial array initialised to 0.0 values
     for (int64_t i = 0; i < length; i++) {
-        switch (toupper(string[i])) {
+        switch (toupper(sequenceViewIt_getNext(&it))) {
         case 'A':
             assert(baseProbs[i * 4] == 0.0);
             baseProbs[i * 4] = 1.0;
@@ -205,7 +207,6 @@ double *getBaseProbsString(Segment *segment) {
             break;
         }
     }
-    free(string);
     return baseProbs;
 }
 
@@ -287,13 +288,15 @@ void maskAncestralRepeatBases(Block *block, stList *segments, char *mlString) {
     for(int64_t i=0; i<j; i++) {
         Segment *segment = stList_get(segments, i);
         assert(segment_getSequence(segment) != NULL);
-        char *string = segment_getString(segment);
+        SequenceView view = segment_getView(segment);
+        SequenceViewIt it;
+        sequenceView_getIt(&view, &it);
         for (int64_t k = 0; k < l; k++) {
-            char uC = toupper(string[k]);
-            upperCounts[k] += uC == string[k] ? 1 : 0;
+            char c = sequenceViewIt_getNext(&it);
+            char uC = toupper(c);
+            upperCounts[k] += uC == c ? 1 : 0;
             nCounts[k] += (uC != 'A' && uC != 'C' && uC != 'G' && uC != 'T' ? 1 : 0);
         }
-        free(string);
     }
 
     //Convert any upper case character to lower case if the majority of bases
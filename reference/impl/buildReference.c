@@ -1169,40 +1169,52 @@ void buildReferenceTopDown(Flower *flower, const char *referenceEventHeader, int
 ////////////////////////////////////
 ////////////////////////////////////
 
-void cactus_make_reference(stList *flowers, char *referenceEventString,
-                           CactusDisk *cactusDisk, CactusParams *params) {
-    ///////////////////////////////////////////////////////////////////////////
-    // Build the reference
-    ///////////////////////////////////////////////////////////////////////////
-
-    int64_t permutations = cactusParams_get_int(params, 2, "reference", "permutations");
-    double theta = cactusParams_get_float(params, 2, "reference", "theta");
-    double phi = cactusParams_get_float(params, 2, "reference", "phi");
+/*
+ * The parameters for building the reference, parsed once from the cactus params.
+ */
+struct _referenceParameters {
+    int64_t permutations;
+    double theta;
+    double phi;
+    int64_t maxWalkForCalculatingZ;
+    bool ignoreUnalignedGaps;
+    double wiggle;
+    int64_t numberOfNsForScaffoldGap;
+    int64_t minNumberOfSequencesToSupportAdjacency;
+    bool makeScaffolds;
+    stList *(*matchingAlgorithm)(stList *edges, int64_t nodeNumber);
+    double (*temperatureFn)(double);
+};
+
+ReferenceParameters *referenceParameters_construct(CactusParams *params) {
+    ReferenceParameters *referenceParameters = st_malloc(sizeof(ReferenceParameters));
+    referenceParameters->permutations = cactusParams_get_int(params, 2, "reference", "permutations");
+    referenceParameters->theta = cactusParams_get_float(params, 2, "reference", "theta");
+    referenceParameters->phi = cactusParams_get_float(params, 2, "reference", "phi");
     bool useSimulatedAnnealing = cactusParams_get_int(params, 2, "reference", "useSimulatedAnnealing");
-    int64_t maxWalkForCalculatingZ = cactusParams_get_int(params, 2, "reference", "maxWalkForCalculatingZ");
-    bool ignoreUnalignedGaps = cactusParams_get_int(params, 2, "reference", "ignoreUnalignedGaps");
-    double wiggle = cactusParams_get_float(params, 2, "reference", "wiggle");
-    int64_t numberOfNsForScaffoldGap = cactusParams_get_int(params, 2, "reference", "numberOfNs");
-    int64_t minNumberOfSequencesToSupportAdjacency = cactusParams_get_int(params, 2, "reference", "minNumberOfSequencesToSupportAdjacency");
-    bool makeScaffolds = cactusParams_get_int(params, 2, "reference", "makeScaffolds");
-
-    stList *(*matchingAlgorithm)(stList *edges, int64_t nodeNumber) = chooseMatching_greedy;
+    referenceParameters->maxWalkForCalculatingZ = cactusParams_get_int(params, 2, "reference", "maxWalkForCalculatingZ");
+    referenceParameters->ignoreUnalignedGaps = cactusParams_get_int(params, 2, "reference", "ignoreUnalignedGaps");
+    referenceParameters->wiggle = cactusParams_get_float(params, 2, "reference", "wiggle");
+    referenceParameters->numberOfNsForScaffoldGap = cactusParams_get_int(params, 2, "reference", "numberOfNs");
+    referenceParameters->minNumberOfSequencesToSupportAdjacency = cactusParams_get_int(params, 2, "reference", "minNumberOfSequencesToSupportAdjacency");
+    referenceParameters->makeScaffolds = cactusParams_get_int(params, 2, "reference", "makeScaffolds");
+
+    referenceParameters->matchingAlgorithm = chooseMatching_greedy;
     char *matchAlgorithmString = cactusParams_get_string(params, 2, "reference", "matchingAlgorithm");
     if (strcmp("greedy", matchAlgorithmString) == 0) {
-        matchingAlgorithm = chooseMatching_greedy;
+        referenceParameters->matchingAlgorithm = chooseMatching_greedy;
     } else if (strcmp("maxCardinality", matchAlgorithmString) == 0) {
-        matchingAlgorithm = chooseMatching_maximumCardinalityMatching;
+        referenceParameters->matchingAlgorithm = chooseMatching_maximumCardinalityMatching;
     } else if (strcmp("maxWeight", matchAlgorithmString) == 0) {
-        matchingAlgorithm = chooseMatching_maximumWeightMatching;
+        referenceParameters->matchingAlgorithm = chooseMatching_maximumWeightMatching;
     } else if (strcmp("blossom5", matchAlgorithmString) == 0) {
-        matchingAlgorithm = chooseMatching_blossom5;
+        referenceParameters->matchingAlgorithm = chooseMatching_blossom5;
     } else {
         stThrowNew(REFERENCE_BUILDING_EXCEPTION, "Input error: unrecognized matching algorithm: %s", matchAlgorithmString);
     }
     free(matchAlgorithmString);
 
-    /*st_logDebug("The reference event string: %s\n", referenceEventString);
-    st_logDebug("The theta parameter has been set to %lf\n", theta);
+    /*st_logDebug("The theta parameter has been set to %lf\n", theta);
     st_logDebug("The ignore unaligned gaps parameter is %i\n", ignoreUnalignedGaps);
     st_logDebug("The number of permutations is %" PRIi64 "\n", permutations);
     st_logDebug("Simulated annealing is %" PRIi64 "\n", useSimulatedAnnealing);
@@ -1214,15 +1226,41 @@ void cactus_make_reference(stList *flowers, char *referenceEventString,
             minNumberOfSequencesToSupportAdjacency);
     st_logDebug("Make scaffolds is: %i\n", makeScaffolds);*/
 
-    double (*temperatureFn)(double) = useSimulatedAnnealing ? exponentiallyDecreasingTemperatureFn : constantTemperatureFn;
+    referenceParameters->temperatureFn = useSimulatedAnnealing ? exponentiallyDecreasingTemperatureFn : constantTemperatureFn;
+
+    return referenceParameters;
+}
+
+void referenceParameters_destruct(ReferenceParameters *referenceParameters) {
+    free(referenceParameters);
+}
+
+void cactus_make_reference_for_flower(Flower *flower, char *referenceEventString, ReferenceParameters *referenceParameters) {
+    st_logDebug("Processing flower %" PRIi64 "\n", flower_getName(flower));
+    PerfReport *perfReport = perfReport_getGlobal();
+    PerfFlowerTimer flowerTimer;
+    perfReport_startFlower(perfReport, flower, &flowerTimer);
+    buildReferenceTopDown(flower, referenceEventString, referenceParameters->permutations,
+                          referenceParameters->matchingAlgorithm, referenceParameters->temperatureFn,
+                          referenceParameters->theta, referenceParameters->phi,
+                          referenceParameters->maxWalkForCalculatingZ, referenceParameters->ignoreUnalignedGaps,
+                          referenceParameters->wiggle, referenceParameters->numberOfNsForScaffoldGap,
+                          referenceParameters->minNumberOfSequencesToSupportAdjacency, referenceParameters->makeScaffolds);
+    perfReport_endFlower(perfReport, "reference", &flowerTimer);
+}
+
+void cactus_make_reference(stList *flowers, char *referenceEventString,
+                           CactusDisk *cactusDisk, CactusParams *params) {
+    ///////////////////////////////////////////////////////////////////////////
+    // Build the reference
+    ///////////////////////////////////////////////////////////////////////////
+
+    ReferenceParameters *referenceParameters = referenceParameters_construct(params);
 
 #pragma omp parallel for schedule(dynamic, 1)
     for(int64_t i=0; i<stList_length(flowers); i++) {
-        Flower *flower = stList_get(flowers, i);
-        st_logDebug("Processing flower %" PRIi64 "\n", flower_getName(flower));
-        buildReferenceTopDown(flower, referenceEventString, permutations, matchingAlgorithm, temperatureFn, theta,
-                              phi, maxWalkForCalculatingZ, ignoreUnalignedGaps, wiggle, numberOfNsForScaffoldGap,
-                              minNumberOfSequencesToSupportAdjacency, makeScaffolds);
+        cactus_make_reference_for_flower(stList_get(flowers, i), referenceEventString, referenceParameters);
     }
-}
 
+    referenceParameters_destruct(referenceParameters);
+}
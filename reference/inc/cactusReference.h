@@ -26,6 +26,28 @@ extern const char *REFERENCE_BUILDING_EXCEPTION;
  */
 void cactus_make_reference(stList *flowers, char *referenceEventString, CactusDisk *cactusDisk, CactusParams *params);
 
+/*
+ * The parameters used to build the reference, parsed from the cactus params.
+ */
+typedef struct _referenceParameters ReferenceParameters;
+
+/*
+ * Parses the reference parameters from the cactus params.
+ */
+ReferenceParameters *referenceParameters_construct(CactusParams *params);
+
+/*
+ * Cleanup the reference parameters.
+ */
+void referenceParameters_destruct(ReferenceParameters *referenceParameters);
+
+/*
+ * Builds the reference for a single flower. The reference must already have been built for
+ * the parent of the flower. Flowers whose parents have references can be processed concurrently, provided
+ * the parent flowers are not concurrently modified.
+ */
+void cactus_make_reference_for_flower(Flower *flower, char *referenceEventString, ReferenceParameters *referenceParameters);
+
 /*
  * Construct a reference for the flower, top down.
  */
@@ -4,6 +4,13 @@
 #include <stdio.h>
 #include <ctype.h>
 
+// OpenMP
+#if defined(_OPENMP)
+#include <omp.h>
+#endif
+#include <unistd.h>
+#include <sys/mman.h>
+
 void checkBranchLengthsAreDefined(stTree *tree) {
     if (isinf(stTree_getBranchLength(tree))) {
         st_errAbort("Got a non defined branch length in the input tree: %s.\n", stTree_getNewickTreeString(tree));
@@ -58,29 +65,268 @@ bool getCompleteStatus(const char *fileName) {
     return 0;
 }
 
-typedef struct _processSequenceVars {
-    bool isComplete;
+/*
+ * The location of a sequence in a FASTA file, as in a faidx index.
+ */
+typedef struct _fastaRecord {
+    int64_t headerOffset; // Offset in the file of the '>' starting the header line
+    int64_t offset; // Offset in the file of the first base
+    int64_t length; // Number of bases
+    int64_t lineBases; // Bases per line
+    int64_t lineBytes; // Bytes per line, including the line terminator
+    bool lastLine; // Set once a line shorter than the others is seen
+    bool regular; // If all lines but the last have lineBases bases and lineBytes bytes, so the bases can be located by offset
+} FastaRecord;
+
+static void fastaRecord_addLine(FastaRecord *record, int64_t bases, int64_t bytes) {
+    if (bases == 0) { // Blank lines are fine before or after the bases
+        record->lastLine = record->length > 0;
+        return;
+    }
+    if (record->lastLine || (record->lineBases > 0 && bases > record->lineBases)) {
+        record->regular = 0;
+    } else if (record->lineBases == 0) {
+        record->lineBases = bases;
+        record->lineBytes = bytes;
+    } else if (bases < record->lineBases || bytes < record->lineBytes) { // Bytes is less for a final line without a terminator
+        record->lastLine = 1;
+    } else if (bytes != record->lineBytes) {
+        record->regular = 0;
+    }
+    record->length += bases;
+}
+
+/*
+ * Indexes the sequences in a FASTA file, returning a list of FastaRecords, in the order the sequences appear in the file.
+ */
+static stList *indexFastaFile(const char *fileName) {
+    FILE *fileHandle = fopen(fileName, "r");
+    if (fileHandle == NULL) {
+        st_errAbort("Could not open the file %s", fileName);
+    }
+    stList *records = stList_construct3(0, free);
+    FastaRecord *record = NULL;
+    int64_t bufferSize = 1048576, bases = 0, bytes = 0, position = 0;
+    bool lineStart = 1, inHeader = 0, sawSpace = 0;
+    char *buffer = st_malloc(bufferSize);
+    size_t n;
+    while ((n = fread(buffer, sizeof(char), bufferSize, fileHandle)) > 0) {
+        for (size_t i = 0; i < n; i++, position++) {
+            char c = buffer[i];
+            if (lineStart && c == '>') {
+                record = st_calloc(1, sizeof(FastaRecord));
+                record->headerOffset = position;
+                record->regular = 1;
+                stList_append(records, record);
+                inHeader = 1;
+            }
+            lineStart = c == '\n';
+            if (inHeader || record == NULL) {
+                inHeader = inHeader && c != '\n';
+                continue;
+            }
+            bytes++;
+            if (c == '\n') {
+                fastaRecord_addLine(record, bases, bytes);
+                bases = 0;
+                bytes = 0;
+                sawSpace = 0;
+            } else if (isspace((unsigned char) c)) {
+                sawSpace = 1;
+            } else {
+                if (sawSpace) { // Whitespace before or between the bases of a line
+                    record->regular = 0;
+                }
+                if (record->length == 0 && bases == 0) {
+                    record->offset = position;
+                }
+                bases++;
+            }
+        }
+    }
+    if (record != NULL && bytes > 0) {
+        fastaRecord_addLine(record, bases, bytes);
+    }
+    free(buffer);
+    fclose(fileHandle);
+    return records;
+}
+
+/*
+ * Checks the record locates exactly the given sequence in the mapped file.
+ */
+static bool fastaRecord_matches(FastaRecord *record, const char *mapping, const char *string, int64_t length) {
+    if (!record->regular || record->length != length || length == 0) {
+        return 0;
+    }
+    for (int64_t i = 0; i < length; i += record->lineBases) {
+        int64_t j = length - i < record->lineBases ? length - i : record->lineBases;
+        if (memcmp(mapping + record->offset + (i / record->lineBases) * record->lineBytes, string + i, j) != 0) {
+            return 0;
+        }
+    }
+    return 1;
+}
+
+/*
+ * Releases the pages of the mapped file that hold the record, which were read when checking it, so that
+ * they are only read again if the sequence is used.
+ */
+static void fastaRecord_releasePages(FastaRecord *record, const char *mapping) {
+    int64_t pageSize = sysconf(_SC_PAGESIZE);
+    int64_t start = ((record->offset + pageSize - 1) / pageSize) * pageSize;
+    int64_t end = ((record->offset + ((record->length - 1) / record->lineBases + 1) * record->lineBytes) / pageSize) * pageSize;
+    if (start < end) {
+        madvise((void *)(mapping + start), end - start, MADV_DONTNEED);
+    }
+}
+
+/*
+ * A FASTA file to read the sequences of an event from.
+ */
+typedef struct _fastaFile {
+    char *fileName;
     Event *event;
-    int64_t totalSequenceNumber;
-    Flower *flower;
-    CactusDisk *cactusDisk;
-} ProcessSequenceVars;
+    bool isComplete; // If the sequences should be attached
+    stList *records; // The index of the file
+    const char *mapping; // The file, memory mapped
+    int64_t fileLength;
+} FastaFile;
+
+static void fastaFile_destruct(FastaFile *file) {
+    free(file->fileName);
+    if (file->records != NULL) {
+        stList_destruct(file->records);
+    }
+    free(file);
+}
+
+/*
+ * A sequence read from a FASTA file, ready to be added to the flower.
+ */
+typedef struct _parsedSequence {
+    char *header;
+    int64_t length;
+    FastaRecord *record; // If not NULL the record of the sequence, which is left in the mapped file
+    PackedString *string; // Otherwise the packed string of the sequence
+} ParsedSequence;
+
+/*
+ * A range of whole records of a FASTA file, parsed independently of the rest of the file.
+ */
+typedef struct _fastaChunk {
+    FastaFile *file;
+    int64_t start; // Offset in the file of the start of the chunk
+    int64_t end; // Offset in the file after the end of the chunk
+    int64_t firstRecord; // Index of the first record of the chunk
+    stList *sequences; // The ParsedSequences of the chunk, in order
+} FastaChunk;
+
+static void fastaChunk_destruct(FastaChunk *chunk) {
+    if (chunk->sequences != NULL) {
+        stList_destruct(chunk->sequences);
+    }
+    free(chunk);
+}
+
+/*
+ * Chunks are cut at the first record starting after this many bytes.
+ */
+#define FASTA_CHUNK_SIZE 16777216
+
+static FastaChunk *fastaChunk_construct(FastaFile *file, int64_t start, int64_t firstRecord) {
+    FastaChunk *chunk = st_calloc(1, sizeof(FastaChunk));
+    chunk->file = file;
+    chunk->start = start;
+    chunk->end = file->fileLength;
+    chunk->firstRecord = firstRecord;
+    return chunk;
+}
+
+/*
+ * Splits the file into chunks at record boundaries, appending them to chunks in order.
+ */
+static void fastaFile_getChunks(FastaFile *file, stList *chunks) {
+    if (file->fileLength == 0) {
+        return;
+    }
+    FastaChunk *chunk = fastaChunk_construct(file, 0, 0); // The first chunk includes anything before the first record
+    stList_append(chunks, chunk);
+    for (int64_t i = 1; i < stList_length(file->records); i++) {
+        FastaRecord *record = stList_get(file->records, i);
+        if (record->headerOffset - chunk->start >= FASTA_CHUNK_SIZE) {
+            chunk->end = record->headerOffset;
+            chunk = fastaChunk_construct(file, record->headerOffset, i);
+            stList_append(chunks, chunk);
+        }
+    }
+}
+
+static void parsedSequence_destruct(ParsedSequence *parsedSequence) {
+    free(parsedSequence->header);
+    if (parsedSequence->string != NULL) {
+        packedString_destruct(parsedSequence->string);
+    }
+    free(parsedSequence);
+}
 
 void processSequence(void* destination, const char *fastaHeader, const char *string, int64_t length) {
     /*
-     * Processes a sequence by adding it to the flower disk.
+     * Processes a sequence by checking if it can be left in the mapped file, and otherwise packing it.
      */
-    //Now put the details in a flower.
-    ProcessSequenceVars *p = destination;
-    Sequence *sequence = sequence_construct(2, length, string, fastaHeader, p->event, p->cactusDisk);
-    flower_addSequence(p->flower, sequence);
+    FastaChunk *chunk = destination;
+    FastaFile *file = chunk->file;
+    int64_t i = chunk->firstRecord + stList_length(chunk->sequences);
+    FastaRecord *record = i < stList_length(file->records) ? stList_get(file->records, i) : NULL;
+    ParsedSequence *parsedSequence = st_calloc(1, sizeof(ParsedSequence));
+    parsedSequence->header = stString_copy(fastaHeader);
+    parsedSequence->length = length;
+    if (record != NULL && fastaRecord_matches(record, file->mapping, string, length)) {
+        // Leave the sequence in the mapped file, it will be read when it is used
+        parsedSequence->record = record;
+        fastaRecord_releasePages(record, file->mapping);
+    } else {
+        parsedSequence->string = packedString_construct(string);
+    }
+    stList_append(chunk->sequences, parsedSequence);
+}
+
+/*
+ * Parses the sequences in the chunk. Each sequence whose lines are regular enough to be located by offset
+ * is left in the mapped file, to be read only if it is used. Other sequences are packed.
+ */
+static void fastaChunk_parse(FastaChunk *chunk) {
+    chunk->sequences = stList_construct3(0, (void (*)(void *))parsedSequence_destruct);
+    FILE *fileHandle = fmemopen((void *)(chunk->file->mapping + chunk->start), chunk->end - chunk->start, "r");
+    if (fileHandle == NULL) {
+        st_errAbort("Could not read the file %s", chunk->file->fileName);
+    }
+    fastaReadToFunction(fileHandle, chunk, processSequence);
+    fclose(fileHandle);
+}
 
-    End *end1 = end_construct2(0, p->isComplete, p->flower);
-    End *end2 = end_construct2(1, p->isComplete, p->flower);
+/*
+ * Adds a parsed sequence to the flower, taking ownership of its string.
+ */
+static void addSequence(Flower *flower, FastaFile *file, ParsedSequence *parsedSequence) {
+    CactusDisk *cactusDisk = flower_getCactusDisk(flower);
+    Name stringName;
+    if (parsedSequence->record != NULL) {
+        FastaRecord *record = parsedSequence->record;
+        stringName = cactusDisk_addMappedString(cactusDisk, file->mapping + record->offset, parsedSequence->length,
+                                                record->lineBases, record->lineBytes);
+    } else {
+        stringName = cactusDisk_addPackedString(cactusDisk, parsedSequence->string);
+        parsedSequence->string = NULL;
+    }
+    Sequence *sequence = sequence_construct4(2, parsedSequence->length, stringName, parsedSequence->header, file->event, cactusDisk);
+    flower_addSequence(flower, sequence);
+
+    End *end1 = end_construct2(0, file->isComplete, flower);
+    End *end2 = end_construct2(1, file->isComplete, flower);
     Cap *cap1 = cap_construct2(end1, 1, 1, sequence);
-    Cap *cap2 = cap_construct2(end2, length + 2, 1, sequence);
+    Cap *cap2 = cap_construct2(end2, parsedSequence->length + 2, 1, sequence);
     cap_makeAdjacent(cap1, cap2);
-    p->totalSequenceNumber++;
 }
 
 static int64_t assignSequences(CactusDisk *cactusDisk, Flower *flower, EventTree *eventTree, char *sequenceFilesAndEvents) {
@@ -90,12 +336,9 @@ static int64_t assignSequences(CactusDisk *cactusDisk, Flower *flower, EventTree
         st_errAbort("Sequences weren't provided in a proper "
                     "'event seq' space-separated format");
     }
-    ProcessSequenceVars p; // Struct to pass around storing variables for
-    // making sequences
-    p.totalSequenceNumber = 0;
-    p.flower = flower;
-    p.cactusDisk = cactusDisk;
 
+    // Get the files, in order
+    stList *files = stList_construct3(0, (void (*)(void *))fastaFile_destruct);
     for (int64_t i = 0; i < stList_length(sequenceFilesAndEventsList); i += 2) {
         char *eventName = stList_get(sequenceFilesAndEventsList, i);
         char *fileName = stList_get(sequenceFilesAndEventsList, i+1);
@@ -106,36 +349,75 @@ static int64_t assignSequences(CactusDisk *cactusDisk, Flower *flower, EventTree
             st_errAbort("File does not exist: %s\n", fileName);
         }
 
-        // Set the global "event" variable, which is needed for the
-        // function provided to fastaReadToFunction.
-        p.event = eventTree_getEventByHeader(eventTree, eventName);
-        if (p.event == NULL) {
+        Event *event = eventTree_getEventByHeader(eventTree, eventName);
+        if (event == NULL) {
             st_errAbort("No such event: %s", eventName);
         }
+        stList *fileNames = stList_construct3(0, free);
         if (stFile_isDir(fileName)) {
             st_logInfo("Processing directory: %s\n", fileName);
             stList *filesInDir = stFile_getFileNamesInDirectory(fileName);
             for (int64_t j = 0; j < stList_length(filesInDir); j++) {
                 char *absChildFileName = stFile_pathJoin(fileName, stList_get(filesInDir, j));
                 assert(stFile_exists(absChildFileName));
-                p.isComplete = getCompleteStatus(absChildFileName); //decide if the sequences in the file should be free or attached.
-                FILE *fileHandle = fopen(absChildFileName, "r");
-                fastaReadToFunction(fileHandle, &p, processSequence);
-                fclose(fileHandle);
-                free(absChildFileName);
+                stList_append(fileNames, absChildFileName);
             }
             stList_destruct(filesInDir);
         } else {
             st_logInfo("Processing file: %s\n", fileName);
-            p.isComplete = getCompleteStatus(fileName); //decide if the sequences in the file should be free or attached.
-            FILE *fileHandle = fopen(fileName, "r");
-            fastaReadToFunction(fileHandle, &p, processSequence);
-            fclose(fileHandle);
+            stList_append(fileNames, stString_copy(fileName));
+        }
+        for (int64_t j = 0; j < stList_length(fileNames); j++) {
+            FastaFile *file = st_calloc(1, sizeof(FastaFile));
+            file->fileName = stString_copy(stList_get(fileNames, j));
+            file->event = event;
+            file->isComplete = getCompleteStatus(file->fileName); //decide if the sequences in the file should be free or attached.
+            stList_append(files, file);
         }
+        stList_destruct(fileNames);
     }
     stList_destruct(sequenceFilesAndEventsList);
 
-    return p.totalSequenceNumber;
+    // Index and map the files in parallel
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+    for (int64_t i = 0; i < stList_length(files); i++) {
+        FastaFile *file = stList_get(files, i);
+        file->records = indexFastaFile(file->fileName);
+        file->mapping = cactusDisk_mapFile(cactusDisk, file->fileName, &(file->fileLength));
+    }
+
+    // Parse the chunks of the files in parallel, so large files are split between threads
+    stList *chunks = stList_construct3(0, (void (*)(void *))fastaChunk_destruct);
+    for (int64_t i = 0; i < stList_length(files); i++) {
+        fastaFile_getChunks(stList_get(files, i), chunks);
+    }
+#if defined(_OPENMP)
+#pragma omp parallel for schedule(dynamic, 1)
+#endif
+    for (int64_t i = 0; i < stList_length(chunks); i++) {
+        fastaChunk_parse(stList_get(chunks, i));
+    }
+
+    // Add the sequences to the flower in the order they appear in the files, so the names of the objects
+    // are the same as if the files were read one after another
+    int64_t totalSequenceNumber = 0, mappedSequenceNumber = 0;
+    for (int64_t i = 0; i < stList_length(chunks); i++) {
+        FastaChunk *chunk = stList_get(chunks, i);
+        for (int64_t j = 0; j < stList_length(chunk->sequences); j++) {
+            ParsedSequence *parsedSequence = stList_get(chunk->sequences, j);
+            mappedSequenceNumber += parsedSequence->record != NULL ? 1 : 0;
+            addSequence(flower, chunk->file, parsedSequence);
+            totalSequenceNumber++;
+        }
+    }
+    st_logInfo("Left %" PRIi64 " of %" PRIi64 " sequences in their memory mapped files\n", mappedSequenceNumber,
+               totalSequenceNumber);
+
+    stList_destruct(chunks);
+    stList_destruct(files);
+    return totalSequenceNumber;
 }
 
 static int64_t constructEvents(Event *parentEvent, stTree *tree, EventTree *eventTree) {
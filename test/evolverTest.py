@@ -1030,6 +1030,71 @@ class TestCase(unittest.TestCase):
         # check the output
         self._check_maf_accuracy(self._out_hal("local"), delta=(0.0025,0.0075), dataset='primates')
 
+    def _run_consolidated_resumed_from_bar(self, config_path, paf_path):
+        """ Run cactus_consolidated directly on the primates star, writing snapshots, then resume it from the snapshot
+        written after bar, which only builds the reference
+        """
+        seq_file_path = os.path.join(self.tempDir, 'primates.consolidated.txt')
+        self._write_primates_seqfile(seq_file_path)
+        fa_dir = os.path.join(self.tempDir, 'consolidated')
+        os.makedirs(fa_dir)
+        with open(seq_file_path, 'r') as seq_file:
+            genomes = [line.strip().split() for line in seq_file if line.strip()]
+        with open(seq_file_path, 'w') as seq_file:
+            seq_file.write('({})Anc0;\n'.format(','.join([genome for genome, url in genomes])))
+            for genome, url in genomes:
+                subprocess.check_call(['wget', '-O', os.path.join(fa_dir, genome + '.fa'), url])
+                seq_file.write('{}\t{}\n'.format(genome, os.path.join(fa_dir, genome + '.fa')))
+
+        # split out the secondary alignments as cactus does
+        primary_paf_path = os.path.join(self.tempDir, 'Anc0_primary.paf')
+        subprocess.check_call("grep -v 'tp:A:S' {} > {} || true".format(paf_path, primary_paf_path), shell=True)
+
+        snapshot_prefix = os.path.join(self.tempDir, 'Anc0.snapshot')
+        cmd = ['cactus_consolidated', '--seqFile', seq_file_path, '--params', config_path, '--referenceEvent', 'Anc0',
+               '--logLevel', 'INFO']
+        subprocess.check_call(cmd + ['--alignments', primary_paf_path, '--snapshotPrefix', snapshot_prefix,
+                                     '--outputFile', os.path.join(self.tempDir, 'Anc0.c2h')])
+        self.assertTrue(os.path.isfile(snapshot_prefix + '.bar'))
+        resumed_c2h_path = os.path.join(self.tempDir, 'Anc0.resumed.c2h')
+        subprocess.check_call(cmd + ['--resumeFrom', snapshot_prefix + '.bar', '--outputFile', resumed_c2h_path])
+        self.assertTrue(os.path.getsize(resumed_c2h_path) > 0)
+
+    def testEvolverMemoryBudgetLocal(self):
+        """ Check that cactus with --binariesMode local gives as accurate an alignment when bar aligns the flowers
+        within a tiny memory budget, so each flower is aligned on its own. Then check that cactus_consolidated
+        with the same config can resume from a snapshot taken after bar, which skips bar.
+        """
+        # use the same logic cactus does to get default config
+        config_path = 'src/cactus/cactus_progressive_config.xml'
+
+        xml_root = ET.parse(config_path).getroot()
+        bar_elem = xml_root.find("bar")
+        bar_elem.attrib["memoryBudget"] = "1"
+        decomp_elem = xml_root.find("multi_cactus").find("decomposition")
+        # force cactus to accept multifurcation in tree
+        decomp_elem.attrib["allow_multifurcations"] = "1"
+        # keep the alignments given to cactus_consolidated, to run it again directly
+        paf_dir = os.path.join(self.tempDir, 'pafs')
+        os.makedirs(paf_dir)
+        xml_root.find("caf").attrib["writeInputAlignmentsTo"] = paf_dir
+
+        budget_config_path = os.path.join(self.tempDir, "config.budget.xml")
+        with open(budget_config_path, 'w') as budget_config_file:
+            xmlString = ET.tostring(xml_root, encoding='unicode')
+            xmlString = minidom.parseString(xmlString).toprettyxml()
+            budget_config_file.write(xmlString)
+
+        # run cactus directly, the old school way
+        name = "local"
+        self._run_evolver_primates_star(name, configFile = budget_config_path)
+
+        # check the output
+        self._check_maf_accuracy(self._out_hal("local"), delta=(0.0025,0.0075), dataset='primates')
+
+        # resuming from the bar snapshot runs the reference without the bar parameters
+        self._run_consolidated_resumed_from_bar(budget_config_path, os.path.join(paf_dir, 'Anc0.paf'))
+
     def testEvolverRefmapLocal(self):
         """ Use the new minimap pangenome pipeline to create an alignment of the primates, then compare with the baseline
         """